@@ -0,0 +1,433 @@
+/*
+ * lan.c – The agent's side of War3's LAN discovery traffic (see lan.h).
+ *
+ * Datagrams are received at an offset into their buffer so the header
+ * of the outgoing packet can be written in front of the payload without
+ * copying: captured broadcasts leave room for the reflector header,
+ * reflected packets leave room for the IPv4 + UDP headers that replace
+ * the reflector header when the payload is injected.
+ */
+
+#define _GNU_SOURCE                  /* recvmmsg / sendmmsg */
+
+#include "lan.h"
+#include "../common/reflect.h"
+#include "../common/w3filter.h"
+#include "../common/w3gs.h"
+#include "tunnel.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LAN_BUF_SIZE    2048
+#define IP_UDP_HDR      28           /* IPv4 header (no options) + UDP */
+#define UPLINK_OFFSET   (IP_UDP_HDR - REFLECT_HDR_SIZE)
+#define LAN_MAX_OUT     (LAN_BATCH * LAN_MAX_PEERS)
+#define LAN_ECHOES      (LAN_BATCH * 2)
+
+typedef struct {
+    uint8_t            data[LAN_BUF_SIZE];
+    int                len;          /* bytes at data + offset */
+    struct sockaddr_in from;
+} Datagram;
+
+typedef struct {
+    const uint8_t     *data;
+    int                len;
+    struct sockaddr_in to;
+} OutPacket;
+
+/* A packet we injected, expected back on the capture socket. */
+typedef struct {
+    uint32_t hash;
+    int      len;
+    uint32_t src_addr;               /* network order, 0 = any */
+    uint16_t src_port;               /* network order */
+    uint32_t at_ms;
+} Echo;
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+static int      s_capture = -1;
+static int      s_uplink  = -1;
+static int      s_inject  = -1;
+static int      s_raw;               /* s_inject is a raw IPv4 socket */
+static uint16_t s_inject_port;       /* plain inject socket's port, net order */
+static int      s_lan_port;
+
+static struct sockaddr_in s_reflector;   /* sin_port 0 = none */
+static uint32_t           s_token;
+static struct in_addr     s_local;       /* our address towards the lobby */
+static struct in_addr     s_peers[LAN_MAX_PEERS];
+static int                s_peer_count;
+
+static W3Filter  s_filter;
+static Echo      s_echoes[LAN_ECHOES];
+static int       s_next_echo;
+static LanStats  s_stats;
+
+static Datagram        s_in[LAN_BATCH];
+static OutPacket       s_out[LAN_MAX_OUT];
+static int             s_out_count;
+static struct mmsghdr  s_rmsg[LAN_BATCH];
+static struct iovec    s_riov[LAN_BATCH];
+static struct mmsghdr  s_smsg[LAN_MAX_OUT];
+static struct iovec    s_siov[LAN_MAX_OUT];
+
+/* ------------------------------------------------------------------ */
+/*  Batched socket I/O                                                */
+/* ------------------------------------------------------------------ */
+
+/* Read up to LAN_BATCH datagrams into s_in at `offset`.  Returns the count. */
+static int RecvBatch(int fd, int offset)
+{
+    for (int i = 0; i < LAN_BATCH; i++) {
+        s_riov[i].iov_base = s_in[i].data + offset;
+        s_riov[i].iov_len  = LAN_BUF_SIZE - offset;
+        memset(&s_rmsg[i].msg_hdr, 0, sizeof(s_rmsg[i].msg_hdr));
+        s_rmsg[i].msg_hdr.msg_iov     = &s_riov[i];
+        s_rmsg[i].msg_hdr.msg_iovlen  = 1;
+        s_rmsg[i].msg_hdr.msg_name    = &s_in[i].from;
+        s_rmsg[i].msg_hdr.msg_namelen = sizeof(s_in[i].from);
+    }
+
+    int n = recvmmsg(fd, s_rmsg, LAN_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) return 0;
+    for (int i = 0; i < n; i++) {
+        s_in[i].len = (int)s_rmsg[i].msg_len;
+    }
+    return n;
+}
+
+static void Queue(const uint8_t *data, int len, const struct sockaddr_in *to)
+{
+    if (s_out_count == LAN_MAX_OUT) return;
+    OutPacket *o = &s_out[s_out_count++];
+    o->data = data;
+    o->len  = len;
+    o->to   = *to;
+}
+
+/* Send everything queued on `fd`.  Returns the number of datagrams sent. */
+static int SendBatch(int fd)
+{
+    int done = 0, sent = 0;
+
+    for (int i = 0; i < s_out_count; i++) {
+        s_siov[i].iov_base = (void *)s_out[i].data;
+        s_siov[i].iov_len  = (size_t)s_out[i].len;
+        memset(&s_smsg[i].msg_hdr, 0, sizeof(s_smsg[i].msg_hdr));
+        s_smsg[i].msg_hdr.msg_iov     = &s_siov[i];
+        s_smsg[i].msg_hdr.msg_iovlen  = 1;
+        s_smsg[i].msg_hdr.msg_name    = &s_out[i].to;
+        s_smsg[i].msg_hdr.msg_namelen = sizeof(s_out[i].to);
+    }
+
+    while (done < s_out_count) {
+        int n = sendmmsg(fd, s_smsg + done, (unsigned)(s_out_count - done), 0);
+        if (n > 0) {
+            done += n;
+            sent += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+
+        /* Skip a datagram the kernel refuses (e.g. no route) rather
+         * than dropping the rest of the batch; stop when it is full. */
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        done++;
+    }
+
+    s_out_count = 0;
+    return sent;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Injection                                                         */
+/* ------------------------------------------------------------------ */
+
+static void RememberEcho(const uint8_t *payload, int len, uint32_t src_addr,
+                         uint16_t src_port, uint32_t now_ms)
+{
+    Echo *e = &s_echoes[s_next_echo];
+    s_next_echo = (s_next_echo + 1) % LAN_ECHOES;
+    e->hash     = W3Filter_Hash(payload, len);
+    e->len      = len;
+    e->src_addr = src_addr;
+    e->src_port = src_port;
+    e->at_ms    = now_ms;
+}
+
+static int IsEcho(const Datagram *d, const uint8_t *payload, uint32_t now_ms)
+{
+    uint32_t hash = 0;
+    int      hashed = 0;
+
+    for (int i = 0; i < LAN_ECHOES; i++) {
+        const Echo *e = &s_echoes[i];
+        if (e->len != d->len || now_ms - e->at_ms > LAN_ECHO_MS ||
+            e->src_port != d->from.sin_port ||
+            (e->src_addr != 0 && e->src_addr != d->from.sin_addr.s_addr))
+            continue;
+        if (!hashed) {
+            hash   = W3Filter_Hash(payload, d->len);
+            hashed = 1;
+        }
+        if (e->hash == hash) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Turn a reflected datagram (received at UPLINK_OFFSET) into a local
+ * broadcast from origin:6112 and queue it.
+ */
+static void QueueInjection(Datagram *d, uint32_t now_ms)
+{
+    uint8_t *ip      = d->data;
+    uint8_t *payload = d->data + IP_UDP_HDR;
+    int      len     = d->len - REFLECT_HDR_SIZE;
+    uint32_t origin;
+    memcpy(&origin, d->data + UPLINK_OFFSET + 4, 4);
+
+    /* A game we reach through the relay: War3 is told it is hosted at
+     * the tunnel's listener on this machine (game port: last 2 bytes). */
+    int tunnel_port = Tunnel_GamePort(origin);
+    if (tunnel_port > 0 && W3GS_PacketId(payload, len) == W3GS_GAMEINFO) {
+        payload[len - 2] = (uint8_t)tunnel_port;
+        payload[len - 1] = (uint8_t)(tunnel_port >> 8);
+        origin = s_local.s_addr;
+    }
+
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family      = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    to.sin_port        = htons((uint16_t)s_lan_port);
+
+    if (!s_raw) {
+        RememberEcho(payload, len, 0, s_inject_port, now_ms);
+        Queue(payload, len, &to);
+        return;
+    }
+
+    /* IPv4 header; the kernel fills in the id and checksum. */
+    int total = IP_UDP_HDR + len;
+    memset(ip, 0, IP_UDP_HDR);
+    ip[0]  = 0x45;
+    ip[2]  = (uint8_t)(total >> 8);
+    ip[3]  = (uint8_t)total;
+    ip[8]  = 64;                     /* TTL */
+    ip[9]  = IPPROTO_UDP;
+    memcpy(ip + 12, &origin, 4);
+    memcpy(ip + 16, &to.sin_addr, 4);
+
+    /* UDP header; checksum 0 = none. */
+    uint8_t *udp = ip + 20;
+    int      ulen = 8 + len;
+    udp[0] = (uint8_t)(LAN_WAR3_PORT >> 8);
+    udp[1] = (uint8_t)LAN_WAR3_PORT;
+    udp[2] = (uint8_t)(s_lan_port >> 8);
+    udp[3] = (uint8_t)s_lan_port;
+    udp[4] = (uint8_t)(ulen >> 8);
+    udp[5] = (uint8_t)ulen;
+
+    RememberEcho(payload, len, origin, htons(LAN_WAR3_PORT), now_ms);
+    Queue(ip, total, &to);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int Lan_Open(int lan_port)
+{
+    Lan_Close();
+    s_lan_port = lan_port;
+    W3Filter_Init(&s_filter);
+
+    int on = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+
+    s_capture = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(s_capture, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    addr.sin_port        = htons((uint16_t)lan_port);
+    if (s_capture < 0 ||
+        bind(s_capture, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("[lan] cannot bind 255.255.255.255:%d: %s\n",
+               lan_port, strerror(errno));
+        Lan_Close();
+        return -1;
+    }
+
+    s_uplink = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s_uplink < 0) {
+        Lan_Close();
+        return -1;
+    }
+
+    s_inject = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+    s_raw    = s_inject >= 0;
+    if (!s_raw) {
+        printf("[lan] no raw socket (%s): injected games will appear to "
+               "come from this machine\n", strerror(errno));
+        s_inject = socket(AF_INET, SOCK_DGRAM, 0);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port        = 0;
+        socklen_t alen = sizeof(addr);
+        if (s_inject < 0 ||
+            bind(s_inject, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            getsockname(s_inject, (struct sockaddr *)&addr, &alen) != 0) {
+            Lan_Close();
+            return -1;
+        }
+        s_inject_port = addr.sin_port;
+    }
+    setsockopt(s_inject, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+
+    printf("[lan] capturing broadcasts on udp port %d, injecting via %s\n",
+           lan_port, s_raw ? "raw socket" : "udp socket");
+    return 0;
+}
+
+void Lan_Close(void)
+{
+    if (s_capture >= 0) close(s_capture);
+    if (s_uplink >= 0)  close(s_uplink);
+    if (s_inject >= 0)  close(s_inject);
+    s_capture = s_uplink = s_inject = -1;
+}
+
+int Lan_CaptureFd(void)
+{
+    return s_capture;
+}
+
+int Lan_UplinkFd(void)
+{
+    return s_uplink;
+}
+
+void Lan_SetReflector(struct in_addr addr, int port, uint32_t token)
+{
+    memset(&s_reflector, 0, sizeof(s_reflector));
+    s_reflector.sin_family = AF_INET;
+    s_reflector.sin_addr   = addr;
+    s_reflector.sin_port   = htons((uint16_t)port);
+    s_token = token;
+}
+
+void Lan_SetLocalAddr(struct in_addr addr)
+{
+    s_local = addr;
+}
+
+void Lan_SetPeers(const struct in_addr *addrs, int count)
+{
+    if (count > LAN_MAX_PEERS) count = LAN_MAX_PEERS;
+    memcpy(s_peers, addrs, sizeof(*addrs) * (size_t)count);
+    s_peer_count = count;
+
+    /* New peers should not wait out the repeat window. */
+    W3Filter_ForgetRecent(&s_filter);
+}
+
+void Lan_Register(void)
+{
+    if (s_reflector.sin_port == 0 || s_token == 0) return;
+
+    uint8_t hdr[REFLECT_HDR_SIZE] = {
+        REFLECT_MAGIC0, REFLECT_MAGIC1, REFLECT_MAGIC2, REFLECT_MAGIC3,
+        (uint8_t)(s_token >> 24), (uint8_t)(s_token >> 16),
+        (uint8_t)(s_token >> 8),  (uint8_t)s_token
+    };
+    sendto(s_uplink, hdr, sizeof(hdr), 0,
+           (struct sockaddr *)&s_reflector, sizeof(s_reflector));
+}
+
+void Lan_OnCapture(uint32_t now_ms)
+{
+    int n = RecvBatch(s_capture, REFLECT_HDR_SIZE);
+    int reflect = s_reflector.sin_port != 0 && s_token != 0;
+
+    for (int i = 0; i < n; i++) {
+        Datagram *d       = &s_in[i];
+        uint8_t  *payload = d->data + REFLECT_HDR_SIZE;
+        s_stats.captured++;
+
+        if (IsEcho(d, payload, now_ms)) {
+            s_stats.echoes++;
+            continue;
+        }
+        if (!W3Filter_Check(&s_filter, payload, d->len, now_ms)) {
+            s_stats.filtered++;
+            continue;
+        }
+
+        if (reflect) {
+            if (d->len > REFLECT_MAX_PAYLOAD ||
+                !W3Filter_Allow(&s_filter, s_reflector.sin_addr.s_addr,
+                                s_reflector.sin_port, now_ms))
+                continue;
+            d->data[0] = REFLECT_MAGIC0;
+            d->data[1] = REFLECT_MAGIC1;
+            d->data[2] = REFLECT_MAGIC2;
+            d->data[3] = REFLECT_MAGIC3;
+            d->data[4] = (uint8_t)(s_token >> 24);
+            d->data[5] = (uint8_t)(s_token >> 16);
+            d->data[6] = (uint8_t)(s_token >> 8);
+            d->data[7] = (uint8_t)s_token;
+            Queue(d->data, REFLECT_HDR_SIZE + d->len, &s_reflector);
+            continue;
+        }
+
+        /* No reflector: straight to each peer's War3. */
+        for (int p = 0; p < s_peer_count; p++) {
+            struct sockaddr_in to;
+            memset(&to, 0, sizeof(to));
+            to.sin_family = AF_INET;
+            to.sin_addr   = s_peers[p];
+            to.sin_port   = htons(LAN_WAR3_PORT);
+            if (W3Filter_Allow(&s_filter, to.sin_addr.s_addr, to.sin_port,
+                               now_ms))
+                Queue(payload, d->len, &to);
+        }
+    }
+
+    s_stats.sent += (uint64_t)SendBatch(s_uplink);
+}
+
+void Lan_OnUplink(uint32_t now_ms)
+{
+    int n = RecvBatch(s_uplink, UPLINK_OFFSET);
+
+    for (int i = 0; i < n; i++) {
+        Datagram *d = &s_in[i];
+        if (s_reflector.sin_port == 0 ||
+            d->from.sin_addr.s_addr != s_reflector.sin_addr.s_addr ||
+            d->from.sin_port != s_reflector.sin_port ||
+            d->len <= REFLECT_HDR_SIZE ||
+            !REFLECT_IS_MAGIC(d->data + UPLINK_OFFSET))
+            continue;
+
+        s_stats.received++;
+        QueueInjection(d, now_ms);
+    }
+
+    s_stats.injected += (uint64_t)SendBatch(s_inject);
+}
+
+const LanStats *Lan_Stats(void)
+{
+    return &s_stats;
+}
@@ -0,0 +1,79 @@
+/*
+ * lan.h – The agent's side of War3's LAN discovery traffic.
+ *
+ * Three sockets:
+ *
+ *   capture  UDP bound to 255.255.255.255:<lan port> with SO_REUSEADDR.
+ *            Shares the port with War3 but, being bound to the broadcast
+ *            address, only receives broadcasts; War3's unicast traffic
+ *            is never taken from it.
+ *   uplink   UDP on an ephemeral port.  Captured broadcasts go out here:
+ *            once to the lobby's reflector ("W3RF" + token), or, when
+ *            the server has no reflector, once per room peer.  Reflected
+ *            packets ("W3RF" + origin) come back on it.
+ *   inject   Raw IPv4 socket.  Reflected packets are re-broadcast on the
+ *            local machine as origin:6112 -> 255.255.255.255:<lan port>,
+ *            so War3 connects to the real host.  Without CAP_NET_RAW a
+ *            plain UDP socket is used and War3 sees this machine as the
+ *            origin (games are listed but cannot be joined).
+ *
+ * GAMEINFO from a peer reached through the relay (tunnel.h) is injected
+ * as hosted on this machine, at the tunnel's listener port.
+ *
+ * The local broadcast of an injected packet also reaches the capture
+ * socket; packets injected in the last LAN_ECHO_MS are recognised by
+ * hash and not sent back out.  Captured broadcasts go through the same
+ * filter as the hook's (common/w3filter.h).
+ *
+ * All I/O is batched with recvmmsg / sendmmsg.
+ */
+
+#ifndef LAN_H
+#define LAN_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define LAN_WAR3_PORT   6112
+#define LAN_BATCH       32
+#define LAN_MAX_PEERS   16
+#define LAN_ECHO_MS     2000
+
+typedef struct {
+    uint64_t captured;            /* broadcasts read from the capture socket */
+    uint64_t echoes;              /* ... of which were our own injections */
+    uint64_t filtered;            /* ... dropped by w3filter */
+    uint64_t sent;                /* datagrams sent on the uplink */
+    uint64_t received;            /* reflected datagrams received */
+    uint64_t injected;            /* local broadcasts written */
+} LanStats;
+
+/* Open the sockets.  Returns 0 on success, -1 if the capture or uplink
+ * socket cannot be opened. */
+int Lan_Open(int lan_port);
+
+/* Close everything. */
+void Lan_Close(void);
+
+int Lan_CaptureFd(void);
+int Lan_UplinkFd(void);
+
+/* Use the lobby's reflector (port 0 disables it). */
+void Lan_SetReflector(struct in_addr addr, int port, uint32_t token);
+
+/* This machine's address, the origin of games reached via the relay. */
+void Lan_SetLocalAddr(struct in_addr addr);
+
+/* Room peers for servers without a reflector. */
+void Lan_SetPeers(const struct in_addr *addrs, int count);
+
+/* Register (or refresh) our endpoint with the reflector. */
+void Lan_Register(void);
+
+/* Poll callbacks. */
+void Lan_OnCapture(uint32_t now_ms);
+void Lan_OnUplink(uint32_t now_ms);
+
+const LanStats *Lan_Stats(void);
+
+#endif /* LAN_H */
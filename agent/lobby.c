@@ -0,0 +1,170 @@
+/*
+ * lobby.c – The agent's TCP connection to the lobby server (see lobby.h).
+ */
+
+#define _POSIX_C_SOURCE 200809L     /* getaddrinfo */
+
+#include "lobby.h"
+#include "../common/protocol.h"
+#include "../common/alloc.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+static int            s_fd = -1;
+static struct in_addr s_server;
+static uint8_t        s_buf[MAX_MSG_SIZE * 2];
+static uint32_t       s_len;
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int Lobby_Connect(const char *host, int port)
+{
+    Lobby_Close();
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons((uint16_t)port);
+
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        struct addrinfo hints, *res = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, NULL, &hints, &res) != 0 || !res) {
+            printf("[lobby] cannot resolve %s\n", host);
+            return -1;
+        }
+        addr.sin_addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+        freeaddrinfo(res);
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("[lobby] connect to %s:%d failed: %s\n",
+               host, port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    s_fd     = fd;
+    s_server = addr.sin_addr;
+    s_len    = 0;
+    return 0;
+}
+
+void Lobby_Close(void)
+{
+    if (s_fd >= 0) {
+        close(s_fd);
+        s_fd = -1;
+    }
+    s_len = 0;
+}
+
+int Lobby_Fd(void)
+{
+    return s_fd;
+}
+
+struct in_addr Lobby_ServerAddr(void)
+{
+    return s_server;
+}
+
+struct in_addr Lobby_LocalAddr(void)
+{
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    if (s_fd >= 0) getsockname(s_fd, (struct sockaddr *)&addr, &alen);
+    return addr.sin_addr;
+}
+
+int Lobby_Send(const cJSON *msg)
+{
+    if (s_fd < 0) return -1;
+
+    char *str = cJSON_PrintUnformatted(msg);
+    if (!str) return -1;
+    uint32_t len;
+    uint8_t *frame = Protocol_Frame(str, &len);
+    free(str);
+    if (!frame) return -1;
+
+    uint32_t off = 0;
+    while (off < len) {
+        ssize_t n = send(s_fd, frame + off, len - off, MSG_NOSIGNAL);
+        if (n > 0) {
+            off += (uint32_t)n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd p = { s_fd, POLLOUT, 0 };
+            if (poll(&p, 1, 1000) <= 0) break;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            break;
+        }
+    }
+    Alloc_Free(frame);
+    return off == len ? 0 : -1;
+}
+
+int Lobby_Read(void)
+{
+    if (s_fd < 0) return -1;
+
+    for (;;) {
+        if (s_len == sizeof(s_buf)) {
+            /* Full: the buffer holds at least one whole frame unless
+             * the header announces more than the protocol allows. */
+            uint32_t payload = ((uint32_t)s_buf[0] << 24) |
+                               ((uint32_t)s_buf[1] << 16) |
+                               ((uint32_t)s_buf[2] << 8)  | s_buf[3];
+            return payload > MAX_MSG_SIZE ? -1 : 0;
+        }
+        ssize_t n = recv(s_fd, s_buf + s_len, sizeof(s_buf) - s_len, 0);
+        if (n > 0) {
+            s_len += (uint32_t)n;
+            continue;
+        }
+        if (n == 0) return -1;
+        if (errno == EINTR) continue;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+}
+
+cJSON *Lobby_Next(void)
+{
+    for (;;) {
+        char *json = NULL;
+        uint32_t consumed = Protocol_Extract(s_buf, s_len, &json);
+        if (consumed == 0) return NULL;
+
+        memmove(s_buf, s_buf + consumed, s_len - consumed);
+        s_len -= consumed;
+
+        if (!json) continue;
+        cJSON *msg = cJSON_Parse(json);
+        Alloc_Free(json);
+        if (msg) return msg;
+    }
+}
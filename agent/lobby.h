@@ -0,0 +1,42 @@
+/*
+ * lobby.h – The agent's TCP connection to the lobby server.
+ *
+ * Same framing as every other client (common/protocol.h).  The socket
+ * is non-blocking after connect: the poll loop calls Lobby_Read when it
+ * is readable and then drains complete messages with Lobby_Next.
+ * Outgoing messages are small and rare, so Lobby_Send writes them with
+ * a short blocking loop.
+ */
+
+#ifndef LOBBY_H
+#define LOBBY_H
+
+#include "../third_party/cJSON/cJSON.h"
+
+#include <netinet/in.h>
+
+/* Resolve and connect.  Returns 0 on success, -1 on failure. */
+int Lobby_Connect(const char *host, int port);
+
+/* Close the connection. */
+void Lobby_Close(void);
+
+/* Socket to poll for input, -1 when closed. */
+int Lobby_Fd(void);
+
+/* The server's IPv4 address (valid after Lobby_Connect). */
+struct in_addr Lobby_ServerAddr(void);
+
+/* Our end of the connection: this machine's address towards the lobby. */
+struct in_addr Lobby_LocalAddr(void);
+
+/* Frame and send `msg` (not freed).  Returns 0 on success, -1 on error. */
+int Lobby_Send(const cJSON *msg);
+
+/* Read what is available.  Returns -1 once the server has closed. */
+int Lobby_Read(void);
+
+/* Next complete message (caller cJSON_Deletes it), or NULL. */
+cJSON *Lobby_Next(void);
+
+#endif /* LOBBY_H */
@@ -0,0 +1,312 @@
+/*
+ * main.c – war3-lan-agent: virtual LAN for War3 running under Wine.
+ *
+ * The injected hook DLL cannot be used under Wine, so this native
+ * process does its job from the outside: it logs into the lobby, joins
+ * (or creates) a room, and relays War3's LAN discovery broadcasts
+ * between this machine and the rest of the room (see lan.h).  Game
+ * traffic itself is plain TCP to the host; when that cannot get through
+ * (symmetric NAT), it goes through the lobby's relay (see tunnel.h).
+ *
+ * Usage:
+ *   war3-lan-agent [-p lan_port] [-r peer] <server> <port> <username>
+ *                  [room_id]
+ *
+ * Without room_id a room named after the user is created.  -p changes
+ * the port War3 broadcasts on and hosts games on (6112), e.g. to run
+ * two agents on one machine for testing.  -r asks the lobby for a relay
+ * to `peer`'s game as soon as both are in the room; relay tickets the
+ * lobby sends for other reasons are honoured either way.
+ *
+ * Single-threaded poll() loop over the lobby connection, the LAN
+ * sockets and the relay tunnels; a one-second tick sends heartbeats and
+ * keeps the reflector registration (and the NAT mapping in front of it)
+ * alive.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "lobby.h"
+#include "lan.h"
+#include "tunnel.h"
+#include "../common/message.h"
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AGENT_HEARTBEAT_S    20
+#define AGENT_REGISTER_S     15
+
+static volatile sig_atomic_t s_stop = 0;
+
+static char s_username[32];
+static int  s_room_id;                 /* 0 = create */
+static int  s_lan_port = LAN_WAR3_PORT;
+
+/* Room members from the last room_peers, for relay tickets. */
+static char           s_peer_names[LAN_MAX_PEERS][32];
+static struct in_addr s_peer_addrs[LAN_MAX_PEERS];
+static int            s_peer_count;
+
+static char s_relay_peer[32];          /* -r, "" = none */
+static int  s_relay_requested;
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                           */
+/* ------------------------------------------------------------------ */
+
+static void OnSignal(int sig)
+{
+    (void)sig;
+    s_stop = 1;
+}
+
+static uint32_t NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void SendSimple(const char *type)
+{
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(msg, "type", type);
+    Lobby_Send(msg);
+    cJSON_Delete(msg);
+}
+
+static void Usage(const char *argv0)
+{
+    printf("Usage: %s [-p lan_port] [-r peer] <server> <port> <username> "
+           "[room_id]\n", argv0);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Lobby messages                                                    */
+/* ------------------------------------------------------------------ */
+
+static void HandleLoginOk(const cJSON *root)
+{
+    const cJSON *port  = cJSON_GetObjectItem(root, "udp_port");
+    const cJSON *token = cJSON_GetObjectItem(root, "udp_token");
+    if (cJSON_IsNumber(port) && cJSON_IsNumber(token)) {
+        Lan_SetReflector(Lobby_ServerAddr(), port->valueint,
+                         (uint32_t)token->valuedouble);
+        Lan_Register();
+        printf("[agent] logged in, using the lobby reflector\n");
+        Lan_SetLocalAddr(Lobby_LocalAddr());
+    } else {
+        printf("[agent] logged in, server has no reflector: "
+               "sending to peers directly\n");
+    }
+
+    cJSON *msg = cJSON_CreateObject();
+    if (s_room_id > 0) {
+        cJSON_AddStringToObject(msg, "type", MSG_ROOM_JOIN);
+        cJSON_AddNumberToObject(msg, "room_id", s_room_id);
+    } else {
+        cJSON_AddStringToObject(msg, "type", MSG_ROOM_CREATE);
+        cJSON_AddStringToObject(msg, "name", s_username);
+        cJSON_AddNumberToObject(msg, "max_players", 12);
+    }
+    Lobby_Send(msg);
+    cJSON_Delete(msg);
+}
+
+static void HandleRoomPeers(const cJSON *root)
+{
+    int count = 0;
+
+    const cJSON *peers = cJSON_GetObjectItem(root, "peers");
+    const cJSON *p;
+    printf("[agent] room members:");
+    cJSON_ArrayForEach(p, peers) {
+        const cJSON *name = cJSON_GetObjectItem(p, "username");
+        const cJSON *ip   = cJSON_GetObjectItem(p, "ip");
+        if (!cJSON_IsString(name) || !cJSON_IsString(ip)) continue;
+        printf(" %s", name->valuestring);
+        if (strcmp(name->valuestring, s_username) == 0) continue;
+        if (count < LAN_MAX_PEERS &&
+            inet_pton(AF_INET, ip->valuestring, &s_peer_addrs[count]) == 1) {
+            snprintf(s_peer_names[count], sizeof(s_peer_names[count]),
+                     "%s", name->valuestring);
+            count++;
+        }
+    }
+    printf("\n");
+    s_peer_count = count;
+    Lan_SetPeers(s_peer_addrs, count);
+
+    for (int i = 0; i < count; i++) {
+        if (s_relay_peer[0] == '\0' || s_relay_requested ||
+            strcmp(s_peer_names[i], s_relay_peer) != 0)
+            continue;
+        cJSON *msg = cJSON_CreateObject();
+        cJSON_AddStringToObject(msg, "type", MSG_RELAY_OPEN);
+        cJSON_AddStringToObject(msg, "peer", s_relay_peer);
+        Lobby_Send(msg);
+        cJSON_Delete(msg);
+        s_relay_requested = 1;
+    }
+}
+
+static void HandleRelayTicket(const cJSON *root)
+{
+    const cJSON *peer   = cJSON_GetObjectItem(root, "peer");
+    const cJSON *port   = cJSON_GetObjectItem(root, "port");
+    const cJSON *ticket = cJSON_GetObjectItem(root, "ticket");
+    const cJSON *role   = cJSON_GetObjectItem(root, "role");
+    if (!cJSON_IsString(peer) || !cJSON_IsNumber(port) ||
+        !cJSON_IsNumber(ticket) || !cJSON_IsString(role))
+        return;
+
+    /* The game we rewrite is announced from the peer's room address. */
+    struct in_addr addr = { 0 };
+    for (int i = 0; i < s_peer_count; i++) {
+        if (strcmp(s_peer_names[i], peer->valuestring) == 0)
+            addr = s_peer_addrs[i];
+    }
+
+    int r = strcmp(role->valuestring, "accept") == 0 ? TUNNEL_ACCEPT
+                                                      : TUNNEL_CONNECT;
+    Tunnel_Open(r, peer->valuestring, addr, Lobby_ServerAddr(),
+                port->valueint, (uint32_t)ticket->valuedouble, s_lan_port);
+}
+
+static void HandleMessage(const cJSON *root)
+{
+    const cJSON *type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(type)) return;
+    const char *t = type->valuestring;
+
+    if (strcmp(t, MSG_LOGIN_OK) == 0) {
+        HandleLoginOk(root);
+    } else if (strcmp(t, MSG_LOGIN_FAIL) == 0 || strcmp(t, MSG_ERROR) == 0) {
+        const cJSON *reason = cJSON_GetObjectItem(root, "reason");
+        if (!cJSON_IsString(reason))
+            reason = cJSON_GetObjectItem(root, "message");
+        printf("[agent] %s: %s\n", t,
+               cJSON_IsString(reason) ? reason->valuestring : "?");
+        if (strcmp(t, MSG_LOGIN_FAIL) == 0) s_stop = 1;
+    } else if (strcmp(t, MSG_ROOM_CREATED) == 0 ||
+               strcmp(t, MSG_ROOM_JOINED) == 0) {
+        const cJSON *id = cJSON_GetObjectItem(root, "room_id");
+        printf("[agent] in room %d\n", cJSON_IsNumber(id) ? id->valueint : 0);
+    } else if (strcmp(t, MSG_ROOM_PEERS) == 0) {
+        HandleRoomPeers(root);
+    } else if (strcmp(t, MSG_RELAY_TICKET) == 0) {
+        HandleRelayTicket(root);
+    } else if (strcmp(t, MSG_CHAT_MSG) == 0) {
+        const cJSON *from = cJSON_GetObjectItem(root, "from");
+        const cJSON *text = cJSON_GetObjectItem(root, "message");
+        if (cJSON_IsString(from) && cJSON_IsString(text))
+            printf("[chat] %s: %s\n", from->valuestring, text->valuestring);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Entry point                                                       */
+/* ------------------------------------------------------------------ */
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "p:r:")) != -1) {
+        if (opt == 'p') {
+            s_lan_port = atoi(optarg);
+        } else if (opt == 'r') {
+            snprintf(s_relay_peer, sizeof(s_relay_peer), "%s", optarg);
+        } else {
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind < 3 || s_lan_port <= 0 || s_lan_port > 65535) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    const char *server = argv[optind];
+    int         port   = atoi(argv[optind + 1]);
+    strncpy(s_username, argv[optind + 2], sizeof(s_username) - 1);
+    if (argc - optind > 3) s_room_id = atoi(argv[optind + 3]);
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+
+    /* One line at a time even into a file or pipe (tests, journald). */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if (Lan_Open(s_lan_port) != 0) return 1;
+    if (Lobby_Connect(server, port) != 0) {
+        Lan_Close();
+        return 1;
+    }
+
+    cJSON *login = cJSON_CreateObject();
+    cJSON_AddStringToObject(login, "type", MSG_LOGIN);
+    cJSON_AddStringToObject(login, "username", s_username);
+    Lobby_Send(login);
+    cJSON_Delete(login);
+
+    time_t last_heartbeat = time(NULL);
+    time_t last_register  = last_heartbeat;
+
+    while (!s_stop) {
+        struct pollfd fds[3 + TUNNEL_POLL_FDS] = {
+            { Lobby_Fd(),      POLLIN, 0 },
+            { Lan_CaptureFd(), POLLIN, 0 },
+            { Lan_UplinkFd(),  POLLIN, 0 },
+        };
+        int ntunnel = Tunnel_PollFds(fds + 3);
+        if (poll(fds, (nfds_t)(3 + ntunnel), 1000) < 0) continue;   /* EINTR */
+
+        uint32_t now_ms = NowMs();
+        if (fds[1].revents & POLLIN) Lan_OnCapture(now_ms);
+        if (fds[2].revents & POLLIN) Lan_OnUplink(now_ms);
+        Tunnel_OnPoll(fds + 3, ntunnel);
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            int closed = Lobby_Read() < 0;
+            cJSON *msg;
+            while ((msg = Lobby_Next()) != NULL) {
+                HandleMessage(msg);
+                cJSON_Delete(msg);
+            }
+            if (closed) {
+                printf("[agent] disconnected from the lobby\n");
+                break;
+            }
+        }
+
+        time_t now = time(NULL);
+        if (now - last_heartbeat >= AGENT_HEARTBEAT_S) {
+            last_heartbeat = now;
+            SendSimple(MSG_HEARTBEAT);
+        }
+        if (now - last_register >= AGENT_REGISTER_S) {
+            last_register = now;
+            Lan_Register();
+        }
+        Tunnel_Tick();
+    }
+
+    const LanStats *st = Lan_Stats();
+    printf("[agent] captured %llu (%llu echoes, %llu filtered), "
+           "sent %llu, received %llu, injected %llu\n",
+           (unsigned long long)st->captured, (unsigned long long)st->echoes,
+           (unsigned long long)st->filtered, (unsigned long long)st->sent,
+           (unsigned long long)st->received, (unsigned long long)st->injected);
+
+    Tunnel_CloseAll();
+    Lobby_Close();
+    Lan_Close();
+    return 0;
+}
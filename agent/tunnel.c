@@ -0,0 +1,397 @@
+/*
+ * tunnel.c – The agent's end of the lobby's TCP game relay (see tunnel.h).
+ *
+ * War3's game port is on this machine and answers at once, so it is
+ * opened with a blocking connect().  The relay is dialled without
+ * blocking (TUNNEL_DIAL until the socket is writable, then the hello):
+ * the agent has one loop, and an unreachable relay must not stall LAN
+ * forwarding for a whole connect timeout.  Everything else is
+ * non-blocking too.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "tunnel.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define TUNNEL_FREE     0
+#define TUNNEL_LISTEN   1            /* connect role, waiting for War3 */
+#define TUNNEL_WAIT     2            /* accept role, waiting for bytes */
+#define TUNNEL_OPEN     3
+#define TUNNEL_DIAL     4            /* relay connect() in progress */
+
+typedef struct {
+    uint8_t data[TUNNEL_BUF];
+    int     len;                     /* bytes buffered */
+    int     off;                     /* ... of which already written */
+} Pipe;
+
+typedef struct {
+    int      state;
+    int      role;
+    char     peer[32];
+    uint32_t peer_addr;              /* network order */
+    uint32_t ticket;
+    struct sockaddr_in relay;
+    int      game_port;
+    time_t   opened;
+    time_t   dial_started;
+    int      dialled;                /* state once the relay is up */
+
+    int      listen_fd;
+    int      listen_port;
+    int      game_fd;
+    int      relay_fd;
+    Pipe     up;                     /* War3 -> relay */
+    Pipe     down;                   /* relay -> War3 */
+    uint64_t bytes_up;
+    uint64_t bytes_down;
+} Tunnel;
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+static Tunnel s_tunnels[TUNNEL_MAX];
+
+/* Tunnel behind each entry of the last Tunnel_PollFds. */
+static int s_poll_tunnel[TUNNEL_POLL_FDS];
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                           */
+/* ------------------------------------------------------------------ */
+
+static void SetNonBlocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static void CloseTunnel(Tunnel *t, const char *why)
+{
+    if (t->state == TUNNEL_OPEN || t->bytes_up + t->bytes_down > 0) {
+        printf("[tunnel] '%s' closed (%s): %llu bytes up, %llu down\n",
+               t->peer, why, (unsigned long long)t->bytes_up,
+               (unsigned long long)t->bytes_down);
+    } else {
+        printf("[tunnel] '%s' dropped (%s)\n", t->peer, why);
+    }
+
+    if (t->listen_fd >= 0) close(t->listen_fd);
+    if (t->game_fd >= 0)   close(t->game_fd);
+    if (t->relay_fd >= 0)  close(t->relay_fd);
+    t->listen_fd = t->game_fd = t->relay_fd = -1;
+    t->state = TUNNEL_FREE;
+}
+
+static void RelayError(const Tunnel *t, int err)
+{
+    printf("[tunnel] relay %s:%d: %s\n", inet_ntoa(t->relay.sin_addr),
+           ntohs(t->relay.sin_port), strerror(err));
+}
+
+/* The relay connection is up: send the hello and move on to `dialled`.
+ * Returns 0 or -1. */
+static int SendHello(Tunnel *t)
+{
+    uint8_t hello[8] = {
+        'W', '3', 'R', 'L',
+        (uint8_t)(t->ticket >> 24), (uint8_t)(t->ticket >> 16),
+        (uint8_t)(t->ticket >> 8),  (uint8_t)t->ticket
+    };
+
+    /* A fresh socket's send buffer always takes 8 bytes. */
+    if (send(t->relay_fd, hello, sizeof(hello), MSG_NOSIGNAL) !=
+        (ssize_t)sizeof(hello)) {
+        RelayError(t, errno);
+        return -1;
+    }
+    t->state = t->dialled;
+    return 0;
+}
+
+/*
+ * Start connecting the relay; the tunnel goes to `next` once the hello
+ * is sent, either right away or from Tunnel_OnPoll (TUNNEL_DIAL in the
+ * meantime).  Returns 0 or -1.
+ */
+static int DialRelay(Tunnel *t, int next)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    SetNonBlocking(fd);
+
+    t->relay_fd     = fd;
+    t->dialled      = next;
+    t->dial_started = time(NULL);
+    if (connect(fd, (struct sockaddr *)&t->relay, sizeof(t->relay)) == 0)
+        return SendHello(t);
+    if (errno == EINPROGRESS) {
+        t->state = TUNNEL_DIAL;
+        return 0;
+    }
+    RelayError(t, errno);
+    return -1;
+}
+
+/* Connect War3's game port on this machine.  Returns 0 or -1. */
+static int DialGame(Tunnel *t)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons((uint16_t)t->game_port);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("[tunnel] game port %d: %s\n", t->game_port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    SetNonBlocking(fd);
+    t->game_fd = fd;
+    return 0;
+}
+
+/* Read from `from` into `p` if it is empty.  Returns -1 on EOF/error. */
+static int Fill(int from, Pipe *p)
+{
+    if (p->len > 0) return 0;
+
+    ssize_t n = recv(from, p->data, sizeof(p->data), 0);
+    if (n == 0) return -1;
+    if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    p->len = (int)n;
+    p->off = 0;
+    return 0;
+}
+
+/* Write what `to` takes from `p`.  Returns -1 on error. */
+static int Drain(int to, Pipe *p, uint64_t *bytes)
+{
+    while (p->off < p->len) {
+        ssize_t n = send(to, p->data + p->off, (size_t)(p->len - p->off),
+                         MSG_NOSIGNAL);
+        if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+        p->off += (int)n;
+        *bytes += (uint64_t)n;
+    }
+    p->len = p->off = 0;
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int Tunnel_Open(int role, const char *peer, struct in_addr peer_addr,
+                struct in_addr relay, int relay_port, uint32_t ticket,
+                int game_port)
+{
+    Tunnel *t = NULL;
+    for (int i = 0; i < TUNNEL_MAX && t == NULL; i++) {
+        if (s_tunnels[i].state == TUNNEL_FREE) t = &s_tunnels[i];
+    }
+    if (t == NULL) {
+        printf("[tunnel] no free tunnel for '%s'\n", peer);
+        return -1;
+    }
+
+    memset(t, 0, sizeof(*t));
+    t->listen_fd = t->game_fd = t->relay_fd = -1;
+    t->role      = role;
+    t->peer_addr = peer_addr.s_addr;
+    t->ticket    = ticket;
+    t->game_port = game_port;
+    t->opened    = time(NULL);
+    strncpy(t->peer, peer, sizeof(t->peer) - 1);
+    t->relay.sin_family = AF_INET;
+    t->relay.sin_addr   = relay;
+    t->relay.sin_port   = htons((uint16_t)relay_port);
+
+    if (role == TUNNEL_ACCEPT) {
+        if (DialRelay(t, TUNNEL_WAIT) != 0) {
+            CloseTunnel(t, "relay unreachable");
+            return -1;
+        }
+        printf("[tunnel] relaying '%s' to game port %d\n", peer, game_port);
+        return 0;
+    }
+
+    /* Connect role: listen where War3 will be told the game is. */
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, 1) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &alen) != 0) {
+        printf("[tunnel] listener for '%s': %s\n", peer, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    SetNonBlocking(fd);
+    t->listen_fd   = fd;
+    t->listen_port = ntohs(addr.sin_port);
+    t->state       = TUNNEL_LISTEN;
+    printf("[tunnel] game of '%s' reachable on port %d via the relay\n",
+           peer, t->listen_port);
+    return t->listen_port;
+}
+
+int Tunnel_GamePort(uint32_t origin)
+{
+    for (int i = 0; i < TUNNEL_MAX; i++) {
+        const Tunnel *t = &s_tunnels[i];
+        if (t->state == TUNNEL_LISTEN && t->peer_addr == origin)
+            return t->listen_port;
+    }
+    return 0;
+}
+
+int Tunnel_PollFds(struct pollfd *fds)
+{
+    int n = 0;
+    for (int i = 0; i < TUNNEL_MAX; i++) {
+        const Tunnel *t = &s_tunnels[i];
+        switch (t->state) {
+        case TUNNEL_LISTEN:
+            fds[n] = (struct pollfd){ t->listen_fd, POLLIN, 0 };
+            s_poll_tunnel[n++] = i;
+            break;
+        case TUNNEL_WAIT:
+            fds[n] = (struct pollfd){ t->relay_fd, POLLIN, 0 };
+            s_poll_tunnel[n++] = i;
+            break;
+        case TUNNEL_DIAL:
+            fds[n] = (struct pollfd){ t->relay_fd, POLLOUT, 0 };
+            s_poll_tunnel[n++] = i;
+            break;
+        case TUNNEL_OPEN:
+            /* Read a side only once its buffer has gone out. */
+            fds[n] = (struct pollfd){ t->game_fd,
+                (short)((t->up.len == 0 ? POLLIN : 0) |
+                        (t->down.len > 0 ? POLLOUT : 0)), 0 };
+            s_poll_tunnel[n++] = i;
+            fds[n] = (struct pollfd){ t->relay_fd,
+                (short)((t->down.len == 0 ? POLLIN : 0) |
+                        (t->up.len > 0 ? POLLOUT : 0)), 0 };
+            s_poll_tunnel[n++] = i;
+            break;
+        }
+    }
+    return n;
+}
+
+void Tunnel_OnPoll(const struct pollfd *fds, int count)
+{
+    for (int k = 0; k < count; k++) {
+        Tunnel *t = &s_tunnels[s_poll_tunnel[k]];
+        short   ev = fds[k].revents;
+        if (ev == 0) continue;
+
+        if (t->state == TUNNEL_LISTEN && fds[k].fd == t->listen_fd) {
+            int fd = accept(t->listen_fd, NULL, NULL);
+            if (fd < 0) continue;
+            close(t->listen_fd);
+            t->listen_fd = -1;
+            SetNonBlocking(fd);
+            t->game_fd = fd;
+            if (DialRelay(t, TUNNEL_OPEN) != 0)
+                CloseTunnel(t, "relay unreachable");
+            continue;
+        }
+
+        if (t->state == TUNNEL_DIAL && fds[k].fd == t->relay_fd) {
+            int       err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(t->relay_fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+                err = errno;
+            if (err != 0) {
+                RelayError(t, err);
+                CloseTunnel(t, "relay unreachable");
+            } else if (SendHello(t) != 0) {
+                CloseTunnel(t, "relay unreachable");
+            }
+            continue;
+        }
+
+        if (t->state == TUNNEL_WAIT && fds[k].fd == t->relay_fd) {
+            /* The joiner's War3 is talking: only now wake our host. */
+            if (Fill(t->relay_fd, &t->down) != 0) {
+                CloseTunnel(t, "relay closed");
+                continue;
+            }
+            if (t->down.len == 0) continue;
+            if (DialGame(t) != 0) {
+                CloseTunnel(t, "game port unreachable");
+                continue;
+            }
+            t->state = TUNNEL_OPEN;
+            if (Drain(t->game_fd, &t->down, &t->bytes_down) != 0)
+                CloseTunnel(t, "game closed");
+            continue;
+        }
+
+        if (t->state != TUNNEL_OPEN) continue;
+
+        int from_game = fds[k].fd == t->game_fd;
+        int src = from_game ? t->game_fd  : t->relay_fd;
+        int dst = from_game ? t->relay_fd : t->game_fd;
+        Pipe     *in_pipe  = from_game ? &t->up   : &t->down;
+        Pipe     *out_pipe = from_game ? &t->down : &t->up;
+        uint64_t *in_bytes = from_game ? &t->bytes_up   : &t->bytes_down;
+        uint64_t *out_bytes = from_game ? &t->bytes_down : &t->bytes_up;
+
+        int rc = 0;
+        if (ev & POLLOUT) rc = Drain(src, out_pipe, out_bytes);
+        if (rc == 0 && (ev & (POLLHUP | POLLERR)) && in_pipe->len > 0) {
+            /* `src` is gone but its last bytes are still waiting on
+             * `dst`.  POLLHUP would now come back on every poll without
+             * anything to read: pass on what `dst` takes and end it. */
+            Drain(dst, in_pipe, in_bytes);
+            rc = -1;
+        } else if (rc == 0 && (ev & (POLLIN | POLLHUP | POLLERR))) {
+            rc = Fill(src, in_pipe);
+            if (rc == 0) rc = Drain(dst, in_pipe, in_bytes);
+        }
+        if (rc != 0) {
+            CloseTunnel(t, from_game ? "game closed" : "relay closed");
+        }
+    }
+}
+
+void Tunnel_Tick(void)
+{
+    time_t now = time(NULL);
+    for (int i = 0; i < TUNNEL_MAX; i++) {
+        Tunnel *t = &s_tunnels[i];
+        if ((t->state == TUNNEL_LISTEN || t->state == TUNNEL_WAIT) &&
+            now - t->opened > TUNNEL_IDLE_S)
+            CloseTunnel(t, "ticket unused");
+        else if (t->state == TUNNEL_DIAL &&
+                 now - t->dial_started > TUNNEL_DIAL_S)
+            CloseTunnel(t, "relay unreachable");
+    }
+}
+
+void Tunnel_CloseAll(void)
+{
+    for (int i = 0; i < TUNNEL_MAX; i++) {
+        if (s_tunnels[i].state != TUNNEL_FREE)
+            CloseTunnel(&s_tunnels[i], "agent exiting");
+    }
+}
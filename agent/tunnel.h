@@ -0,0 +1,71 @@
+/*
+ * tunnel.h – The agent's end of the lobby's TCP game relay.
+ *
+ * For peers that cannot reach each other's game port directly, the
+ * lobby hands both sides a relay_ticket (server/relay.h).  Each ticket
+ * carries one War3 TCP connection through the relay port:
+ *
+ *   connect  We asked for the relay, the peer hosts.  A listener on an
+ *            ephemeral port stands in for the host's game port (lan.c
+ *            points the peer's GAMEINFO at it); when War3 connects, the
+ *            relay is dialled, the hello sent and the two are joined.
+ *   accept   We host.  The relay is dialled and the hello sent at once;
+ *            War3's own game port is only connected when the first
+ *            bytes arrive, i.e. once the joiner's War3 is on the line.
+ *
+ *   hello = "W3RL" (4) | ticket (4, big-endian)
+ *
+ * Bytes are moved through one buffer per direction from the agent's
+ * poll loop.  A tunnel ends when either side closes; one whose ticket
+ * was never used is dropped after TUNNEL_IDLE_S.
+ */
+
+#ifndef TUNNEL_H
+#define TUNNEL_H
+
+#include <stdint.h>
+#include <poll.h>
+#include <netinet/in.h>
+
+#define TUNNEL_MAX       8
+#define TUNNEL_BUF       16384     /* bytes in flight per direction */
+#define TUNNEL_IDLE_S    30        /* the relay's ticket lifetime */
+#define TUNNEL_DIAL_S    10        /* to connect the relay */
+#define TUNNEL_POLL_FDS  (TUNNEL_MAX * 2)
+
+#define TUNNEL_CONNECT   1
+#define TUNNEL_ACCEPT    2
+
+/*
+ * Start a tunnel for a relay_ticket from `peer` (room address
+ * `peer_addr`).  `relay` is the lobby's address and `relay_port` the
+ * ticket's port; `game_port` is War3's port on this machine (accept
+ * role only).  Returns the listener's port (connect) or
+ * 0 (accept) on success, -1 on failure.
+ */
+int Tunnel_Open(int role, const char *peer, struct in_addr peer_addr,
+                struct in_addr relay, int relay_port, uint32_t ticket,
+                int game_port);
+
+/*
+ * Port of the connect-role listener standing in for the game hosted at
+ * `origin` (network order), or 0 if none is waiting for War3.
+ */
+int Tunnel_GamePort(uint32_t origin);
+
+/*
+ * Fill `fds` with the sockets to poll (at most TUNNEL_POLL_FDS).
+ * Returns the count; pass the same array to Tunnel_OnPoll after poll().
+ */
+int Tunnel_PollFds(struct pollfd *fds);
+
+/* Move bytes, accept War3's connection, close finished tunnels. */
+void Tunnel_OnPoll(const struct pollfd *fds, int count);
+
+/* Drop tunnels whose ticket went unused (call once a second). */
+void Tunnel_Tick(void);
+
+/* Close every tunnel. */
+void Tunnel_CloseAll(void);
+
+#endif /* TUNNEL_H */
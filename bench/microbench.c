@@ -0,0 +1,862 @@
+/*
+ * microbench.c – Microbenchmarks for the lobby server's hot paths.
+ *
+ * Runs the server code in-process, without the event loop
+ * (tests/harness.h): users are slots whose sockets are one end of a
+ * socketpair, so handlers queue and flush replies exactly as they do on
+ * TCP while nothing leaves the machine.  The setup logs every user in and fills the rooms through
+ * Handler_ProcessMessage, then each case is timed in batches of
+ * BENCH_BATCH operations; between batches (untimed) every send queue
+ * is flushed and the other end of each socketpair drained, so queues
+ * never back up.
+ *
+ * Cases:
+ *   protocol_frame / protocol_extract / protocol_peek
+ *                        one chat request framed / unframed
+ *   login .. whisper     Handler_ProcessMessage, one request per op
+ *                        (room_join+leave is two)
+ *   rooms_getlist        Rooms_GetList over every room
+ *   match_enqueue+tick   Match_Enqueue into one of up to 16 tagged
+ *                        queues of 4, then Match_Tick; every fourth op
+ *                        forms a group (consumed without a room)
+ *   broadcast_room_peers Handler_BroadcastRoomPeers on one room
+ *   presence_unsub+sub   Presence_Unsubscribe and Presence_Subscribe of
+ *                        one friend, on -p users x 100 friends each
+ *   presence_touch+tick  one of those users logs in or out (name index),
+ *                        then Presence_Touch + Presence_Tick notify its
+ *                        100 watchers
+ *   reflector_fanout     a member of room 0 sends one 64-byte datagram to
+ *                        the reflector over loopback UDP; every 16th op
+ *                        runs Reflector_Drain, which forwards the batch
+ *                        to the other members.  Also reported as
+ *                        datagrams per second on one core (the senders'
+ *                        sendto included)
+ *   tcp_loopback         one 64-byte message written on a loopback TCP
+ *                        connection and read at the other end
+ *   relay_forward        the same through a relay session (relay.h) on
+ *                        loopback; the difference to tcp_loopback is
+ *                        reported as the relay's overhead per message
+ *   w3filter_repeat      W3Filter_Check on a 118-byte GAMEINFO, one of
+ *                        4 re-broadcast every simulated millisecond, so
+ *                        nearly every op is dropped as a repeat
+ *   w3filter_new+allow   W3Filter_Check on one of 12 variants, more than
+ *                        the filter remembers, so each is forwarded,
+ *                        then W3Filter_Allow for 8 targets; the clock
+ *                        moves 250 ms per op, so buckets refill
+ *
+ * Reported per operation: wall time, heap allocation calls (alloc.h)
+ * and bytes copied – into OutFrames (OutFrame_BytesFramed, once per
+ * frame however many queues share it) plus the buffer Protocol_Frame /
+ * Protocol_Extract return.
+ *
+ * Usage:
+ *   war3-microbench [-u users] [-r rooms] [-m members] [-s chat_bytes]
+ *                   [-p presence_users] [-t seconds] [-f filter]
+ *
+ * The presence cases use their own population of -p users (default
+ * 10000) outside the lobby's slots; this binary links a build of the
+ * server whose presence tables hold 10000 x 100 subscriptions
+ * (PRESENCE_MAX_SUBS, set in CMakeLists.txt).
+ *
+ * `cmake --build <dir> --target bench` builds and runs it with the
+ * defaults.  Unix only (socketpair).
+ */
+
+#include "../tests/harness.h"
+#include "../server/handler.h"
+#include "../server/user.h"
+#include "../server/room.h"
+#include "../server/sendq.h"
+#include "../server/match.h"
+#include "../server/channel.h"
+#include "../server/presence.h"
+#include "../server/reflector.h"
+#include "../server/relay.h"
+#include "../server/profiler.h"
+#include "../server/jsonmem.h"
+#include "../server/clock.h"
+#include "../server/log.h"
+#include "../common/protocol.h"
+#include "../common/message.h"
+#include "../common/alloc.h"
+#include "../common/reflect.h"
+#include "../common/w3filter.h"
+#include "../common/w3gs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#define BENCH_BATCH      16         /* operations per timed batch */
+#define BENCH_WARMUP     64         /* untimed batches per case */
+#define BENCH_MSG_MAX    512
+#define BENCH_UDP_PAYLOAD 64        /* reflector_fanout datagram body */
+#define BENCH_TCP_MSG    64         /* tcp_loopback / relay_forward */
+#define BENCH_W3_LEN     118        /* w3filter cases: a typical GAMEINFO */
+#define BENCH_W3_VARIANTS 12
+#define BENCH_W3_TARGETS 8
+
+/* ------------------------------------------------------------------ */
+/*  State                                                             */
+/* ------------------------------------------------------------------ */
+
+static User s_users[MAX_USERS];
+static Room s_rooms[MAX_ROOMS];
+static int  s_peer[MAX_USERS];              /* our end of each socketpair */
+
+static int    s_nusers   = MAX_USERS;
+static int    s_nrooms   = 16;
+static int    s_members  = 8;
+static int    s_chat_len = 32;
+static double s_seconds  = 0.5;
+static const char *s_filter;
+
+static Room *s_room_ptr[MAX_ROOMS];         /* the rooms set up */
+static int   s_nspare;                      /* users not in a room */
+static User *s_spare[MAX_USERS];
+
+static uint64_t s_copied;                   /* set by the protocol cases */
+
+/* Requests prebuilt so the timed loop only runs the code under test. */
+static char     s_chat_req[BENCH_MSG_MAX];
+static uint8_t  s_chat_frame[BENCH_MSG_MAX + FRAME_HEADER_SIZE];
+static uint32_t s_chat_frame_len;
+static char     s_login_req[MAX_USERS][96];
+static char     s_join_req[MAX_ROOMS][64];
+static char     s_whisper_req[MAX_USERS][BENCH_MSG_MAX];
+
+/* Presence population: user w watches names (w + 1 + k * stride) % n
+ * for k < PRESENCE_MAX_WATCH, so every name has exactly that many
+ * watchers and they can be listed without a table. */
+static int    s_presence_n = 10000;
+static int    s_presence_stride;
+static User  *s_pusers;
+static char (*s_pnames)[MAX_USERNAME];
+static int    s_ptouched[BENCH_BATCH];   /* names changed this batch */
+static int    s_nptouched;
+
+/* Reflector case: each member of room 0 owns a UDP socket registered
+ * with the reflector, and a prebuilt datagram carrying its token. */
+static int      s_nudp;
+static int      s_udp[MAX_ROOM_PLAYERS];
+static uint8_t  s_udp_pkt[MAX_ROOM_PLAYERS][REFLECT_HDR_SIZE +
+                                            BENCH_UDP_PAYLOAD];
+static struct sockaddr_in s_reflector_addr;
+static uint64_t s_udp_in, s_udp_out;        /* set by reflector_fanout */
+
+/* Relay cases: both ends of a relay session and of a direct loopback
+ * connection, [0] writes and [1] reads. */
+static int    s_relay_fd[2]  = { -1, -1 };
+static int    s_direct_fd[2] = { -1, -1 };
+static double s_direct_ns;                  /* tcp_loopback's ns/op */
+
+/* W3Filter cases: announcements differing in their host counter. */
+static W3Filter s_w3filter;
+static uint8_t  s_w3_pkt[BENCH_W3_VARIANTS][BENCH_W3_LEN];
+static uint32_t s_w3_now_ms;
+
+static const char s_heartbeat_req[] = "{\"type\":\"heartbeat\",\"ts\":12345}";
+static const char s_list_req[]      = "{\"type\":\"room_list\"}";
+static const char s_leave_req[]     = "{\"type\":\"room_leave\"}";
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                           */
+/* ------------------------------------------------------------------ */
+
+static void Send(User *u, const char *json)
+{
+    Handler_ProcessMessage(json, (uint32_t)strlen(json), u,
+                           s_rooms, MAX_ROOMS);
+}
+
+/* Drain every user's queue, drop presence notes and UDP datagrams. */
+static void DrainAll(void)
+{
+    static char sink[64 * 1024];
+
+    for (int i = 0; i < s_nusers; i++) {
+        User *u = &s_users[i];
+        if (Harness_Drain(u, s_peer[i]) != 0) {
+            fprintf(stderr, "microbench: flush failed for fd %d\n", u->fd);
+            exit(1);
+        }
+        u->sendq.overflow = 0;
+    }
+
+    /* Presence notes go to users without sockets: drop them. */
+    for (int t = 0; t < s_nptouched; t++) {
+        for (int k = 0; k < PRESENCE_MAX_WATCH; k++) {
+            int w = s_ptouched[t] - 1 - k * s_presence_stride;
+            w = ((w % s_presence_n) + s_presence_n) % s_presence_n;
+            SendQ_Clear(&s_pusers[w].sendq);
+            s_pusers[w].sendq.overflow = 0;
+        }
+    }
+    s_nptouched = 0;
+
+    for (int m = 0; m < s_nudp; m++) {
+        while (recv(s_udp[m], sink, sizeof(sink), 0) > 0)
+            ;
+    }
+}
+
+static int SetNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Setup                                                             */
+/* ------------------------------------------------------------------ */
+
+static int Setup(void)
+{
+    Harness_Init(s_users, MAX_USERS, s_rooms, MAX_ROOMS);
+
+    for (int i = 0; i < s_nusers; i++) {
+        User *u = Harness_Connect(s_users, MAX_USERS, &s_peer[i]);
+        if (u == NULL) {
+            fprintf(stderr, "microbench: socketpair: %s\n", strerror(errno));
+            return -1;
+        }
+        u->rtt_ms = 20 + i % 80;
+        snprintf(u->ip, MAX_IP_STR, "10.0.%d.%d", i / 250, 1 + i % 250);
+
+        snprintf(s_login_req[i], sizeof(s_login_req[i]),
+                 "{\"type\":\"login\",\"username\":\"bench%03d\"}", i);
+        Send(u, s_login_req[i]);
+        if (u->username[0] == '\0') {
+            fprintf(stderr, "microbench: login %d failed\n", i);
+            return -1;
+        }
+    }
+
+    /* Rooms: user r * members creates room r, the next ones join. */
+    for (int r = 0; r < s_nrooms; r++) {
+        char req[BENCH_MSG_MAX];
+        User *creator = &s_users[r * s_members];
+
+        snprintf(req, sizeof(req), "{\"type\":\"room_create\","
+                 "\"name\":\"bench room %d\",\"max_players\":%d}",
+                 r, MAX_ROOM_PLAYERS);
+        Send(creator, req);
+        s_room_ptr[r] = Rooms_FindById(s_rooms, MAX_ROOMS, creator->room_id);
+        if (s_room_ptr[r] == NULL) {
+            fprintf(stderr, "microbench: room_create %d failed\n", r);
+            return -1;
+        }
+
+        snprintf(s_join_req[r], sizeof(s_join_req[r]),
+                 "{\"type\":\"room_join\",\"room_id\":%d}", s_room_ptr[r]->id);
+        for (int m = 1; m < s_members; m++)
+            Send(&s_users[r * s_members + m], s_join_req[r]);
+        if (s_room_ptr[r]->member_count != s_members) {
+            fprintf(stderr, "microbench: room %d has %d members\n",
+                    r, s_room_ptr[r]->member_count);
+            return -1;
+        }
+        DrainAll();
+    }
+    for (int i = s_nrooms * s_members; i < s_nusers; i++)
+        s_spare[s_nspare++] = &s_users[i];
+
+    /* Chat line of -s bytes, also used by the protocol cases. */
+    char line[MAX_CHAT_MSG];
+    memset(line, 'x', (size_t)s_chat_len);
+    line[s_chat_len] = '\0';
+    snprintf(s_chat_req, sizeof(s_chat_req),
+             "{\"type\":\"chat\",\"message\":\"%s\"}", line);
+
+    uint32_t len;
+    uint8_t *frame = Protocol_Frame(s_chat_req, &len);
+    memcpy(s_chat_frame, frame, len);
+    s_chat_frame_len = len;
+    Alloc_Free(frame);
+
+    for (int i = 0; i < s_nusers; i++) {
+        snprintf(s_whisper_req[i], sizeof(s_whisper_req[i]),
+                 "{\"type\":\"whisper\",\"to\":\"bench%03d\","
+                 "\"message\":\"%s\"}", (i + 1) % s_nusers, line);
+    }
+
+    W3Filter_Init(&s_w3filter);
+    for (int v = 0; v < BENCH_W3_VARIANTS; v++) {
+        uint8_t *pkt = s_w3_pkt[v];
+        memset(pkt, 'x', BENCH_W3_LEN);
+        pkt[0]  = W3GS_HEADER;
+        pkt[1]  = W3GS_GAMEINFO;
+        pkt[2]  = BENCH_W3_LEN;
+        pkt[3]  = 0;
+        pkt[12] = (uint8_t)v;                   /* host counter */
+    }
+
+    DrainAll();
+    return 0;
+}
+
+static int SetupPresence(void)
+{
+    int n = s_presence_n;
+    s_presence_stride = n / PRESENCE_MAX_WATCH;
+
+    /* Only the fields presence touches are ever written, so most of
+     * each slot's pages are never faulted in. */
+    s_pusers = (User *)calloc((size_t)n, sizeof(User));
+    s_pnames = calloc((size_t)n, sizeof(*s_pnames));
+    if (s_pusers == NULL || s_pnames == NULL) {
+        fprintf(stderr, "microbench: out of memory for %d presence users\n",
+                n);
+        return -1;
+    }
+
+    for (int w = 0; w < n; w++) {
+        User *u = &s_pusers[w];
+        u->fd          = -1;
+        u->room_id     = -1;
+        u->watch_head  = -1;
+        u->match_ticket = -1;
+        SendQ_Init(&u->sendq);
+        snprintf(s_pnames[w], MAX_USERNAME, "friend%05d", w);
+        memcpy(u->username, s_pnames[w], MAX_USERNAME);
+        if (w % 2 == 0) Users_IndexName(u);      /* half are online */
+    }
+
+    uint64_t t0 = Clock_NowNs();
+    for (int w = 0; w < n; w++) {
+        for (int k = 0; k < PRESENCE_MAX_WATCH; k++) {
+            int f = (w + 1 + k * s_presence_stride) % n;
+            if (Presence_Subscribe(&s_pusers[w], s_pnames[f]) != 0) {
+                fprintf(stderr, "microbench: presence tables full at "
+                        "user %d\n", w);
+                return -1;
+            }
+        }
+    }
+    printf("  (presence: %d users x %d friends subscribed in %.0f ms)\n",
+           n, PRESENCE_MAX_WATCH, (double)(Clock_NowNs() - t0) / 1e6);
+    return 0;
+}
+
+static int SetupReflector(void)
+{
+    if (Reflector_Open(0) < 0) return -1;
+
+    memset(&s_reflector_addr, 0, sizeof(s_reflector_addr));
+    s_reflector_addr.sin_family      = AF_INET;
+    s_reflector_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    s_reflector_addr.sin_port        = htons((uint16_t)Reflector_Port());
+
+    Room *room = s_room_ptr[0];
+    for (int m = 0; m < room->member_count; m++) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in local = s_reflector_addr;
+        local.sin_port = 0;
+        if (fd < 0 || bind(fd, (struct sockaddr *)&local,
+                           sizeof(local)) != 0 ||
+            SetNonBlocking(fd) != 0) {
+            fprintf(stderr, "microbench: udp socket: %s\n", strerror(errno));
+            return -1;
+        }
+        s_udp[s_nudp++] = fd;
+
+        uint32_t token = Reflector_IssueToken(room->members[m]);
+        uint8_t *pkt   = s_udp_pkt[m];
+        pkt[0] = REFLECT_MAGIC0;
+        pkt[1] = REFLECT_MAGIC1;
+        pkt[2] = REFLECT_MAGIC2;
+        pkt[3] = REFLECT_MAGIC3;
+        pkt[4] = (uint8_t)(token >> 24);
+        pkt[5] = (uint8_t)(token >> 16);
+        pkt[6] = (uint8_t)(token >> 8);
+        pkt[7] = (uint8_t)token;
+        memset(pkt + REFLECT_HDR_SIZE, 'x', BENCH_UDP_PAYLOAD);
+
+        /* A bare header registers the member's endpoint. */
+        sendto(fd, pkt, REFLECT_HDR_SIZE, 0,
+               (struct sockaddr *)&s_reflector_addr,
+               sizeof(s_reflector_addr));
+    }
+
+    Reflector_Drain(s_rooms, MAX_ROOMS, NULL, NULL);
+    for (int m = 0; m < room->member_count; m++) {
+        if (room->members[m]->udp_port == 0) {
+            fprintf(stderr, "microbench: member %d did not register "
+                    "with the reflector\n", m);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Nagle off and a read timeout, so a broken relay fails the run
+ * instead of hanging it. */
+static void TuneSocket(int fd)
+{
+    int on = 1;
+    struct timeval tv = { 2, 0 };
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static int Dial(int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons((uint16_t)port);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    TuneSocket(fd);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Write one message on fds[0] and read it back from fds[1]. */
+static int RoundTrip(const int fds[2])
+{
+    static char msg[BENCH_TCP_MSG];
+    if (write(fds[0], msg, sizeof(msg)) != (ssize_t)sizeof(msg)) return -1;
+
+    size_t got = 0;
+    while (got < sizeof(msg)) {
+        ssize_t n = read(fds[1], msg + got, sizeof(msg) - got);
+        if (n <= 0) return -1;
+        got += (size_t)n;
+    }
+    return 0;
+}
+
+static int SetupRelay(void)
+{
+    /* Direct connection: a listener on an ephemeral loopback port. */
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(lfd, 1) != 0 ||
+        getsockname(lfd, (struct sockaddr *)&addr, &alen) != 0 ||
+        (s_direct_fd[0] = Dial(ntohs(addr.sin_port))) < 0 ||
+        (s_direct_fd[1] = accept(lfd, NULL, NULL)) < 0) {
+        fprintf(stderr, "microbench: loopback tcp: %s\n", strerror(errno));
+        if (lfd >= 0) close(lfd);
+        return -1;
+    }
+    close(lfd);
+    TuneSocket(s_direct_fd[1]);
+
+    /* Relay session: a ticket pair and both hellos. */
+    uint32_t tickets[2];
+    if (Relay_Start(0) != 0 ||
+        Relay_Open("bench-a", "bench-b", &tickets[0], &tickets[1]) != 0) {
+        fprintf(stderr, "microbench: relay did not start\n");
+        return -1;
+    }
+    for (int k = 0; k < 2; k++) {
+        uint8_t hello[RELAY_HELLO_SIZE] = {
+            'W', '3', 'R', 'L',
+            (uint8_t)(tickets[k] >> 24), (uint8_t)(tickets[k] >> 16),
+            (uint8_t)(tickets[k] >> 8),  (uint8_t)tickets[k]
+        };
+        s_relay_fd[k] = Dial(Relay_Port());
+        if (s_relay_fd[k] < 0 ||
+            write(s_relay_fd[k], hello, sizeof(hello)) !=
+                (ssize_t)sizeof(hello)) {
+            fprintf(stderr, "microbench: relay connect: %s\n",
+                    strerror(errno));
+            return -1;
+        }
+    }
+    if (RoundTrip(s_relay_fd) != 0) {
+        fprintf(stderr, "microbench: relay session did not forward\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void Teardown(void)
+{
+    for (int k = 0; k < 2; k++) {
+        if (s_relay_fd[k] >= 0)  close(s_relay_fd[k]);
+        if (s_direct_fd[k] >= 0) close(s_direct_fd[k]);
+    }
+    Relay_Stop();
+
+    for (int m = 0; m < s_nudp; m++) close(s_udp[m]);
+    Reflector_Close();
+
+    if (s_pusers != NULL) {
+        for (int w = 0; w < s_presence_n; w++) {
+            Presence_UnsubscribeAll(&s_pusers[w]);
+            Users_UnindexName(&s_pusers[w]);
+            SendQ_Clear(&s_pusers[w].sendq);
+        }
+        Presence_Tick();
+        free(s_pusers);
+        free(s_pnames);
+    }
+
+    for (int i = 0; i < s_nusers; i++) {
+        SendQ_Clear(&s_users[i].sendq);
+        close(s_users[i].fd);
+        close(s_peer[i]);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Cases                                                             */
+/* ------------------------------------------------------------------ */
+
+static void Op_ProtocolFrame(uint32_t i)
+{
+    (void)i;
+    uint32_t len;
+    uint8_t *frame = Protocol_Frame(s_chat_req, &len);
+    s_copied += len;
+    Alloc_Free(frame);
+}
+
+static void Op_ProtocolExtract(uint32_t i)
+{
+    (void)i;
+    char *json = NULL;
+    uint32_t used = Protocol_Extract(s_chat_frame, s_chat_frame_len, &json);
+    s_copied += used - FRAME_HEADER_SIZE + 1;
+    Alloc_Free(json);
+}
+
+static void Op_ProtocolPeek(uint32_t i)
+{
+    (void)i;
+    const char *payload;
+    uint32_t    payload_len;
+    Protocol_Peek(s_chat_frame, s_chat_frame_len, &payload, &payload_len);
+}
+
+static void Op_Login(uint32_t i)
+{
+    int u = (int)(i % (uint32_t)s_nusers);
+    Send(&s_users[u], s_login_req[u]);
+}
+
+static void Op_Heartbeat(uint32_t i)
+{
+    Send(&s_users[i % (uint32_t)s_nusers], s_heartbeat_req);
+}
+
+static void Op_Chat(uint32_t i)
+{
+    Room *room = s_room_ptr[i % (uint32_t)s_nrooms];
+    Send(room->members[0], s_chat_req);
+}
+
+static void Op_RoomList(uint32_t i)
+{
+    Send(&s_users[i % (uint32_t)s_nusers], s_list_req);
+}
+
+static void Op_RoomJoinLeave(uint32_t i)
+{
+    User *u = s_spare[i % (uint32_t)s_nspare];
+    Send(u, s_join_req[i % (uint32_t)s_nrooms]);
+    Send(u, s_leave_req);
+}
+
+static void Op_Whisper(uint32_t i)
+{
+    int u = (int)(i % (uint32_t)s_nusers);
+    Send(&s_users[u], s_whisper_req[u]);
+}
+
+static void Op_RoomsGetList(uint32_t i)
+{
+    RoomInfo list[MAX_ROOMS];
+    Rooms_GetList(s_rooms, MAX_ROOMS, list, MAX_ROOMS, 20 + (int)(i % 80),
+                  Clock_Wall());
+}
+
+static void Op_PresenceResubscribe(uint32_t i)
+{
+    int w = (int)(i % (uint32_t)s_presence_n);
+    int k = (int)(i / (uint32_t)s_presence_n % PRESENCE_MAX_WATCH);
+    const char *name = s_pnames[(w + 1 + k * s_presence_stride) %
+                                s_presence_n];
+    Presence_Unsubscribe(&s_pusers[w], name);
+    Presence_Subscribe(&s_pusers[w], name);
+}
+
+static void Op_PresenceTouchTick(uint32_t i)
+{
+    /* Spread over the population so every op hits a cold topic. */
+    int   j = (int)((i * 7919u) % (uint32_t)s_presence_n);
+    User *u = &s_pusers[j];
+
+    if (Users_FindByName(u->username) == u) Users_UnindexName(u);
+    else                                    Users_IndexName(u);
+    Presence_Touch(u->username);
+    Presence_Tick();
+
+    if (s_nptouched < BENCH_BATCH) s_ptouched[s_nptouched++] = j;
+}
+
+/* Group size and number of tagged queues for match_enqueue+tick. */
+#define BENCH_MATCH_SIZE   4
+#define BENCH_MATCH_QUEUES 16
+
+static int MatchConsume(const MatchGroup *group, void *ctx)
+{
+    (void)group;
+    (void)ctx;
+    return 0;
+}
+
+static void Op_MatchEnqueueTick(uint32_t i)
+{
+    static const char *const tags[BENCH_MATCH_QUEUES] = {
+        "dota", "td", "lt", "ts", "ei", "ffa", "1v1", "2v2",
+        "3v3", "4v4", "rpg", "tag", "swat", "castle", "footman", "hero"
+    };
+    /* Enough queues that each stays well short of the user count, so
+     * a user has been matched before it comes round again. */
+    int queues = s_nusers / (2 * BENCH_MATCH_SIZE);
+    if (queues > BENCH_MATCH_QUEUES) queues = BENCH_MATCH_QUEUES;
+    if (queues < 1)                  queues = 1;
+
+    int u = (int)(i % (uint32_t)s_nusers);
+    Match_Enqueue(&s_users[u], BENCH_MATCH_SIZE, tags[u % queues],
+                  Clock_Wall());
+    Match_Tick(Clock_Wall(), MatchConsume, NULL, NULL);
+}
+
+static void Op_BroadcastRoomPeers(uint32_t i)
+{
+    Handler_BroadcastRoomPeers(s_room_ptr[i % (uint32_t)s_nrooms]);
+}
+
+static void Op_ReflectorFanout(uint32_t i)
+{
+    int m = (int)(i % (uint32_t)s_nudp);
+    if (sendto(s_udp[m], s_udp_pkt[m], sizeof(s_udp_pkt[m]), 0,
+               (struct sockaddr *)&s_reflector_addr,
+               sizeof(s_reflector_addr)) > 0) {
+        s_udp_in++;
+        s_udp_out += (uint64_t)(s_nudp - 1);
+    }
+    /* The runner's batches start at multiples of BENCH_BATCH. */
+    if (i % BENCH_BATCH == BENCH_BATCH - 1)
+        Reflector_Drain(s_rooms, MAX_ROOMS, NULL, NULL);
+}
+
+static void Op_TcpLoopback(uint32_t i)
+{
+    (void)i;
+    if (RoundTrip(s_direct_fd) != 0) {
+        fprintf(stderr, "microbench: loopback tcp failed\n");
+        exit(1);
+    }
+}
+
+static void Op_RelayForward(uint32_t i)
+{
+    (void)i;
+    if (RoundTrip(s_relay_fd) != 0) {
+        fprintf(stderr, "microbench: relay forwarding failed\n");
+        exit(1);
+    }
+}
+
+static void Op_W3FilterRepeat(uint32_t i)
+{
+    s_w3_now_ms++;
+    W3Filter_Check(&s_w3filter, s_w3_pkt[i % 4], BENCH_W3_LEN, s_w3_now_ms);
+}
+
+static void Op_W3FilterNewAllow(uint32_t i)
+{
+    s_w3_now_ms += 250;
+    if (!W3Filter_Check(&s_w3filter, s_w3_pkt[i % BENCH_W3_VARIANTS],
+                        BENCH_W3_LEN, s_w3_now_ms))
+        return;
+    for (int t = 0; t < BENCH_W3_TARGETS; t++) {
+        W3Filter_Allow(&s_w3filter, htonl(0x0A000001u + (uint32_t)t),
+                       htons(6112), s_w3_now_ms);
+    }
+}
+
+typedef struct {
+    const char *name;
+    void      (*op)(uint32_t i);
+    int         needs;               /* BENCH_NEEDS_* */
+} BenchCase;
+
+#define BENCH_NEEDS_ROOMS    1         /* -r > 0 */
+#define BENCH_NEEDS_SPARE    2         /* a user outside the full rooms */
+#define BENCH_NEEDS_PRESENCE 4         /* the -p population */
+#define BENCH_NEEDS_UDP      8         /* the reflector and its sockets */
+#define BENCH_NEEDS_RELAY    16        /* the relay and a session */
+
+static const BenchCase s_cases[] = {
+    { "protocol_frame",       Op_ProtocolFrame,      0 },
+    { "protocol_extract",     Op_ProtocolExtract,    0 },
+    { "protocol_peek",        Op_ProtocolPeek,       0 },
+    { "login",                Op_Login,              0 },
+    { "heartbeat",            Op_Heartbeat,          0 },
+    { "chat",                 Op_Chat,               BENCH_NEEDS_ROOMS },
+    { "room_list",            Op_RoomList,           0 },
+    { "room_join+leave",      Op_RoomJoinLeave,      BENCH_NEEDS_ROOMS |
+                                                     BENCH_NEEDS_SPARE },
+    { "whisper",              Op_Whisper,            0 },
+    { "rooms_getlist",        Op_RoomsGetList,       0 },
+    { "match_enqueue+tick",   Op_MatchEnqueueTick,   0 },
+    { "broadcast_room_peers", Op_BroadcastRoomPeers, BENCH_NEEDS_ROOMS },
+    { "presence_unsub+sub",   Op_PresenceResubscribe, BENCH_NEEDS_PRESENCE },
+    { "presence_touch+tick",  Op_PresenceTouchTick,  BENCH_NEEDS_PRESENCE },
+    { "reflector_fanout",     Op_ReflectorFanout,    BENCH_NEEDS_ROOMS |
+                                                     BENCH_NEEDS_UDP },
+    { "tcp_loopback",         Op_TcpLoopback,        BENCH_NEEDS_RELAY },
+    { "relay_forward",        Op_RelayForward,       BENCH_NEEDS_RELAY },
+    { "w3filter_repeat",      Op_W3FilterRepeat,     0 },
+    { "w3filter_new+allow",   Op_W3FilterNewAllow,   0 },
+};
+
+/* ------------------------------------------------------------------ */
+/*  Runner                                                            */
+/* ------------------------------------------------------------------ */
+
+/* Returns the case's ns/op. */
+static double RunCase(const BenchCase *c)
+{
+    uint32_t i = 0;
+
+    for (int b = 0; b < BENCH_WARMUP; b++) {
+        for (int k = 0; k < BENCH_BATCH; k++) c->op(i++);
+        DrainAll();
+    }
+
+    uint64_t ops = 0, ns = 0, allocs = 0, copied = 0;
+    uint64_t budget = (uint64_t)(s_seconds * 1e9);
+    s_udp_in  = 0;
+    s_udp_out = 0;
+    while (ns < budget) {
+        s_copied = 0;
+        uint64_t framed = OutFrame_BytesFramed();
+        uint64_t calls  = Alloc_ThreadCalls();
+        uint64_t t0     = Clock_NowNs();
+
+        for (int k = 0; k < BENCH_BATCH; k++) c->op(i++);
+
+        ns     += Clock_NowNs() - t0;
+        allocs += Alloc_ThreadCalls() - calls;
+        copied += OutFrame_BytesFramed() - framed + s_copied;
+        ops    += BENCH_BATCH;
+        DrainAll();
+    }
+
+    printf("  %-22s %10.1f %10.2f %12.1f %12llu\n", c->name,
+           (double)ns / (double)ops, (double)allocs / (double)ops,
+           (double)copied / (double)ops, (unsigned long long)ops);
+    if (s_udp_in > 0) {
+        printf("  (%.0f k datagrams/s in, %.0f k/s out on one core)\n",
+               (double)s_udp_in  / (double)ns * 1e6,
+               (double)s_udp_out / (double)ns * 1e6);
+    }
+    return (double)ns / (double)ops;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Main                                                              */
+/* ------------------------------------------------------------------ */
+
+static void Usage(void)
+{
+    fprintf(stderr,
+            "usage: war3-microbench [-u users] [-r rooms] [-m members]\n"
+            "                       [-s chat_bytes] [-p presence_users]\n"
+            "                       [-t seconds] [-f filter]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "u:r:m:s:p:t:f:")) != -1) {
+        switch (opt) {
+        case 'u': s_nusers   = atoi(optarg); break;
+        case 'r': s_nrooms   = atoi(optarg); break;
+        case 'm': s_members  = atoi(optarg); break;
+        case 's': s_chat_len = atoi(optarg); break;
+        case 'p': s_presence_n = atoi(optarg); break;
+        case 't': s_seconds  = atof(optarg); break;
+        case 'f': s_filter   = optarg;       break;
+        default:  Usage(); return 2;
+        }
+    }
+    if (optind != argc || s_nusers < 2 || s_nusers > MAX_USERS ||
+        s_nrooms < 0 || s_nrooms > MAX_ROOMS ||
+        s_members < 1 || s_members > MAX_ROOM_PLAYERS ||
+        s_nrooms * s_members > s_nusers ||
+        s_chat_len < 0 || s_chat_len >= MAX_CHAT_MSG || s_seconds <= 0 ||
+        s_presence_n < PRESENCE_MAX_WATCH + 1 ||
+        (long long)s_presence_n * PRESENCE_MAX_WATCH > PRESENCE_MAX_SUBS) {
+        Usage();
+        return 2;
+    }
+
+    Log_Init(LOG_LEVEL_WARN);
+    if (Setup() != 0) return 1;
+
+    printf("war3-microbench: %d users, %d rooms x %d members, "
+           "%d-byte chat, %.2f s per case\n\n",
+           s_nusers, s_nrooms, s_members, s_chat_len, s_seconds);
+    printf("  %-22s %10s %10s %12s %12s\n",
+           "case", "ns/op", "allocs/op", "copied B/op", "ops");
+
+    for (size_t c = 0; c < sizeof(s_cases) / sizeof(s_cases[0]); c++) {
+        const BenchCase *bc = &s_cases[c];
+        if (s_filter && strstr(bc->name, s_filter) == NULL) continue;
+        if ((bc->needs & BENCH_NEEDS_PRESENCE) && s_pusers == NULL &&
+            SetupPresence() != 0)
+            return 1;
+        if ((bc->needs & BENCH_NEEDS_UDP) && s_nrooms > 0 &&
+            s_members > 1 && s_nudp == 0 && SetupReflector() != 0)
+            return 1;
+        if (((bc->needs & BENCH_NEEDS_ROOMS) && s_nrooms == 0) ||
+            ((bc->needs & BENCH_NEEDS_UDP) && s_nudp == 0) ||
+            ((bc->needs & BENCH_NEEDS_SPARE) &&
+             (s_nspare == 0 || s_members >= MAX_ROOM_PLAYERS))) {
+            printf("  %-22s %10s\n", bc->name, "skipped");
+            continue;
+        }
+        if ((bc->needs & BENCH_NEEDS_RELAY) && s_relay_fd[0] < 0 &&
+            SetupRelay() != 0)
+            return 1;
+
+        double ns = RunCase(bc);
+        if (bc->op == Op_TcpLoopback) s_direct_ns = ns;
+        if (bc->op == Op_RelayForward && s_direct_ns > 0) {
+            printf("  (relay adds %.1f us per message over direct "
+                   "loopback)\n", (ns - s_direct_ns) / 1000.0);
+        }
+    }
+
+    Teardown();
+    Log_Shutdown();
+    return 0;
+}
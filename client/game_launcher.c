@@ -1,7 +1,8 @@
 /*
  * game_launcher.c – Launch War3 with DLL injection.
  *
- * 1. Writes war3hook.cfg next to the executable with peer IPs.
+ * 1. Writes war3hook.cfg next to the executable with peer IPs (and the
+ *    lobby's discovery reflector, when there is one).
  * 2. Locates war3hook.dll next to the executable.
  * 3. Creates war3.exe in a suspended state.
  * 4. Injects war3hook.dll via the injector module.
@@ -10,6 +11,7 @@
 
 #include "game_launcher.h"
 #include "injector.h"
+#include "../common/launch.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -31,12 +33,39 @@ static BOOL GetExeDirectory(char *buf, DWORD bufSize)
     return TRUE;
 }
 
+/* ------------------------------------------------------------------ */
+/*  GameLauncher_WriteConfig                                          */
+/* ------------------------------------------------------------------ */
+
+BOOL GameLauncher_WriteConfig(const char **peer_ips, int peer_count,
+                              const char *reflector, unsigned udp_token)
+{
+    char exeDir[MAX_PATH];
+    if (!GetExeDirectory(exeDir, MAX_PATH))
+        return FALSE;
+
+    char cfgPath[MAX_PATH];
+    snprintf(cfgPath, MAX_PATH, "%s%s", exeDir, CONFIG_FILENAME);
+
+    char text[4096];
+    int len = Launch_FormatConfig((const char *const *)peer_ips, peer_count,
+                                  reflector, udp_token, text, sizeof(text));
+    if (len < 0) return FALSE;
+
+    FILE *fp = fopen(cfgPath, "w");
+    if (!fp) return FALSE;
+    BOOL ok = fwrite(text, 1, (size_t)len, fp) == (size_t)len;
+    fclose(fp);
+    return ok;
+}
+
 /* ------------------------------------------------------------------ */
 /*  GameLauncher_Start                                                */
 /* ------------------------------------------------------------------ */
 
 BOOL GameLauncher_Start(const char **peer_ips, int peer_count,
-                        const char *war3_path)
+                        const char *war3_path,
+                        const char *reflector, unsigned udp_token)
 {
     if (!peer_ips || peer_count <= 0)
         return FALSE;
@@ -54,17 +83,8 @@ BOOL GameLauncher_Start(const char **peer_ips, int peer_count,
         return FALSE;
 
     /* ── Write config file ────────────────────────────────────────── */
-    char cfgPath[MAX_PATH];
-    snprintf(cfgPath, MAX_PATH, "%s%s", exeDir, CONFIG_FILENAME);
-
-    FILE *fp = fopen(cfgPath, "w");
-    if (!fp) return FALSE;
-
-    fprintf(fp, "# war3hook target IPs (one per line)\n");
-    for (int i = 0; i < peer_count; i++) {
-        fprintf(fp, "%s\n", peer_ips[i]);
-    }
-    fclose(fp);
+    if (!GameLauncher_WriteConfig(peer_ips, peer_count, reflector, udp_token))
+        return FALSE;
 
     /* ── Build war3 command line ──────────────────────────────────── */
     char war3Exe[MAX_PATH];
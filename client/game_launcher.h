@@ -7,17 +7,36 @@
 
 #include <windows.h>
 
+/*
+ * (Re)write war3hook.cfg next to the executable.  The hook reloads it
+ * within a few seconds, so this also updates a running game, e.g. once
+ * a peer's hole-punched endpoint is known.
+ *
+ *   peer_ips   – "IP" or "IP:PORT" strings for the other players
+ *   peer_count – number of entries in peer_ips
+ *   reflector  – "IP:PORT" of the lobby's discovery reflector, or NULL
+ *   udp_token  – reflector token from login_ok (ignored if no reflector)
+ *
+ * Returns TRUE on success.
+ */
+BOOL GameLauncher_WriteConfig(const char **peer_ips, int peer_count,
+                              const char *reflector, unsigned udp_token);
+
 /*
  * Write war3hook.cfg with peer IPs, then launch war3.exe with
  * war3hook.dll injected via CreateRemoteThread.
  *
- *   peer_ips   – array of IP strings for other players in the room
+ *   peer_ips   – array of "IP" / "IP:PORT" strings for the other players
  *   peer_count – number of entries in peer_ips
  *   war3_path  – full path to war3.exe (NULL = look next to this exe)
+ *   reflector  – "IP:PORT" of the lobby's discovery reflector, or NULL
+ *                to have the hook send each broadcast to every peer
+ *   udp_token  – reflector token from login_ok (ignored if no reflector)
  *
  * Returns TRUE on success.
  */
 BOOL GameLauncher_Start(const char **peer_ips, int peer_count,
-                        const char *war3_path);
+                        const char *war3_path,
+                        const char *reflector, unsigned udp_token);
 
 #endif /* GAME_LAUNCHER_H */
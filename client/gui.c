@@ -17,6 +17,7 @@
 #include "gui_style.h"
 #include "resource.h"
 #include "net_client.h"
+#include "prober.h"
 #include "../common/message.h"
 #include "../third_party/cJSON/cJSON.h"
 
@@ -30,6 +31,9 @@ static const wchar_t *CLASS_NAME = L"War3Platform";
 static const wchar_t *WINDOW_TITLE = L"War3 \x5BF9\x6218\x5E73\x53F0";
 /* L"War3 对战平台" encoded as escape sequences for portability */
 
+/* Round trip of the last timed heartbeat, -1 until one comes back */
+static int s_rtt_ms = -1;
+
 #define WINDOW_W  800
 #define WINDOW_H  600
 
@@ -152,6 +156,11 @@ void GUI_HandleNetworkMessage(const char *json_str)
     if (strcmp(type, MSG_LOGIN_OK) == 0 ||
         strcmp(type, MSG_LOGIN_FAIL) == 0) {
         LoginPage_HandleMessage(type, root);
+
+        /* Time a first heartbeat right away so the server has an RTT
+         * for ranking rooms before the regular interval comes round. */
+        if (strcmp(type, MSG_LOGIN_OK) == 0)
+            SendHeartbeat();
     }
     /* Lobby responses */
     else if (strcmp(type, MSG_ROOM_LIST_RES) == 0 ||
@@ -164,6 +173,11 @@ void GUI_HandleNetworkMessage(const char *json_str)
              strcmp(type, MSG_CHAT_MSG) == 0 ||
              strcmp(type, MSG_PLAYER_JOINED) == 0 ||
              strcmp(type, MSG_PLAYER_LEFT) == 0 ||
+             strcmp(type, MSG_PUNCH_START) == 0 ||
+             strcmp(type, MSG_HOST_HINT) == 0 ||
+             strcmp(type, MSG_MAP_UPLOAD) == 0 ||
+             strcmp(type, MSG_MAP_AVAILABLE) == 0 ||
+             strcmp(type, MSG_GAME_START) == 0 ||
              strcmp(type, MSG_ROOM_LEFT) == 0) {
         RoomPage_HandleMessage(type, root);
     }
@@ -187,7 +201,16 @@ void GUI_HandleNetworkMessage(const char *json_str)
             }
         }
     }
-    /* heartbeat_ack – silently ignore */
+    /* heartbeat_ack – time the round trip */
+    else if (strcmp(type, MSG_HEARTBEAT_ACK) == 0) {
+        cJSON *jts = cJSON_GetObjectItem(root, "ts");
+        if (jts && cJSON_IsNumber(jts)) {
+            BOOL first = (s_rtt_ms < 0);
+            s_rtt_ms = (int)(GetTickCount() - (DWORD)jts->valuedouble);
+            /* Report the first sample now rather than in 15 s. */
+            if (first) SendHeartbeat();
+        }
+    }
 
     cJSON_Delete(root);
 }
@@ -199,6 +222,7 @@ void GUI_HandleNetworkMessage(const char *json_str)
 void GUI_HandleDisconnect(void)
 {
     KillTimer(g_app.hwndMain, IDT_HEARTBEAT);
+    Prober_Stop();
     NetClient_Disconnect();
 
     MessageBoxW(g_app.hwndMain,
@@ -207,6 +231,7 @@ void GUI_HandleDisconnect(void)
                 L"\x63D0\x793A",  /* L"提示" */
                 MB_OK | MB_ICONWARNING);
 
+    s_rtt_ms = -1;
     g_app.user_id = 0;
     g_app.current_room_id = 0;
     g_app.current_room_name[0] = '\0';
@@ -221,8 +246,12 @@ static void SendHeartbeat(void)
 {
     if (!NetClient_IsConnected()) return;
 
+    /* "ts" comes back in heartbeat_ack; "rtt_ms" is the last result. */
     cJSON *msg = cJSON_CreateObject();
     cJSON_AddStringToObject(msg, "type", MSG_HEARTBEAT);
+    cJSON_AddNumberToObject(msg, "ts", (double)GetTickCount());
+    if (s_rtt_ms >= 0)
+        cJSON_AddNumberToObject(msg, "rtt_ms", s_rtt_ms);
     char *str = cJSON_PrintUnformatted(msg);
     if (str) {
         NetClient_Send(str);
@@ -270,11 +299,23 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg,
         GUI_HandleDisconnect();
         return 0;
 
+    case WM_MAPFETCH_DONE:
+        RoomPage_OnMapFetchDone((int)wParam, (BOOL)lParam);
+        return 0;
+
     case WM_TIMER:
         if (wParam == IDT_HEARTBEAT) {
             SendHeartbeat();
             return 0;
         }
+        if (wParam == IDT_PROBE) {
+            Prober_Tick();
+            return 0;
+        }
+        if (wParam == IDT_LAUNCH) {
+            RoomPage_OnLaunchTimer();
+            return 0;
+        }
         break;
 
     case WM_COMMAND:
@@ -295,6 +336,7 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg,
 
     case WM_DESTROY:
         KillTimer(hwnd, IDT_HEARTBEAT);
+        Prober_Stop();
         NetClient_Disconnect();
         Style_Cleanup();
         PostQuitMessage(0);
@@ -37,6 +37,13 @@ typedef struct {
     int       current_room_id;
     char      current_room_name[64];
     char      war3_path[MAX_PATH];
+
+    /* Discovery reflector credentials from login_ok (0 = none) */
+    unsigned  udp_token;
+    int       udp_port;
+
+    /* Our address as the server sees it (login_ok "public_ip") */
+    char      public_ip[46];
 } AppState;
 
 extern AppState g_app;
@@ -77,5 +84,9 @@ HWND RoomPage_Create(HWND hwndParent, HINSTANCE hInst);
 void RoomPage_OnSize(int cx, int cy);
 void RoomPage_HandleMessage(const char *type, void *json_root);
 void RoomPage_ClearAll(void);
+/* WM_MAPFETCH_DONE: a map upload / download finished (mapfetch.h). */
+void RoomPage_OnMapFetchDone(int kind, BOOL ok);
+/* IDT_LAUNCH: a coordinated launch (game_start) may be due. */
+void RoomPage_OnLaunchTimer(void);
 
 #endif /* GUI_H */
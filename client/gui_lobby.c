@@ -32,6 +32,7 @@ static HWND s_lblMaxPlayers   = NULL;
 static HWND s_editMaxPlayers  = NULL;
 static HWND s_btnCreate       = NULL;
 static HWND s_btnJoin         = NULL;
+static HWND s_btnQuickJoin    = NULL;
 
 /* ------------------------------------------------------------------ */
 /*  Forward declarations                                              */
@@ -41,6 +42,7 @@ static LRESULT CALLBACK LobbyPanelProc(HWND, UINT, WPARAM, LPARAM);
 static void OnRefreshClicked(void);
 static void OnCreateClicked(void);
 static void OnJoinClicked(void);
+static void OnQuickJoinClicked(void);
 
 /* ------------------------------------------------------------------ */
 /*  LobbyPage_Create                                                  */
@@ -101,7 +103,7 @@ HWND LobbyPage_Create(HWND hwndParent, HINSTANCE hInst)
 
     /* L"房间名" */
     col.pszText = L"\x623F\x95F4\x540D";
-    col.cx      = 320;
+    col.cx      = 220;
     SendMessageW(s_listRooms, LVM_INSERTCOLUMNW, 0, (LPARAM)&col);
 
     /* L"人数" */
@@ -115,6 +117,17 @@ HWND LobbyPage_Create(HWND hwndParent, HINSTANCE hInst)
     col.cx      = 80;
     SendMessageW(s_listRooms, LVM_INSERTCOLUMNW, 2, (LPARAM)&col);
 
+    /* L"延迟" – the server lists rooms fastest first */
+    col.pszText = L"\x5EF6\x8FDF";
+    col.cx      = 80;
+    SendMessageW(s_listRooms, LVM_INSERTCOLUMNW, 3, (LPARAM)&col);
+
+    /* L"游戏" – map of the game being hosted, if War3 is up */
+    col.pszText = L"\x6E38\x620F";
+    col.cx      = 180;
+    col.fmt     = LVCFMT_LEFT;
+    SendMessageW(s_listRooms, LVM_INSERTCOLUMNW, 4, (LPARAM)&col);
+
     /* ── Bottom controls ──────────────────────────────────────────── */
 
     /* L"刷新" */
@@ -164,6 +177,13 @@ HWND LobbyPage_Create(HWND hwndParent, HINSTANCE hInst)
         0, 0, 0, 0,
         s_hwndPanel, (HMENU)IDC_BTN_JOIN_ROOM, hInst, NULL);
 
+    /* L"快速加入" */
+    s_btnQuickJoin = CreateWindowExW(0, L"BUTTON",
+        L"\x5FEB\x901F\x52A0\x5165",
+        WS_CHILD | WS_VISIBLE | WS_TABSTOP,
+        0, 0, 0, 0,
+        s_hwndPanel, (HMENU)IDC_BTN_QUICK_JOIN, hInst, NULL);
+
     /* ── Apply theme fonts ─────────────────────────────────────────── */
     SendMessage(s_lblHeader,      WM_SETFONT, (WPARAM)g_theme.fontSubtitle, TRUE);
     SendMessage(s_listRooms,      WM_SETFONT, (WPARAM)g_theme.fontBody, TRUE);
@@ -174,11 +194,13 @@ HWND LobbyPage_Create(HWND hwndParent, HINSTANCE hInst)
     SendMessage(s_editMaxPlayers, WM_SETFONT, (WPARAM)g_theme.fontBody, TRUE);
     SendMessage(s_btnCreate,      WM_SETFONT, (WPARAM)g_theme.fontBtn, TRUE);
     SendMessage(s_btnJoin,        WM_SETFONT, (WPARAM)g_theme.fontBtn, TRUE);
+    SendMessage(s_btnQuickJoin,   WM_SETFONT, (WPARAM)g_theme.fontBtn, TRUE);
 
     /* Owner-draw buttons. */
     Style_SetButton(s_btnCreate,  BTN_STYLE_PRIMARY);
     Style_SetButton(s_btnJoin,    BTN_STYLE_SECONDARY);
     Style_SetButton(s_btnRefresh, BTN_STYLE_SECONDARY);
+    Style_SetButton(s_btnQuickJoin, BTN_STYLE_PRIMARY);
 
     return s_hwndPanel;
 }
@@ -227,12 +249,14 @@ void LobbyPage_OnSize(int cx, int cy)
     x += edit_max_w + 10;
     MoveWindow(s_btnCreate, x, row1_y, btn_create_w, btn_h, TRUE);
 
-    /* Row 2: refresh + join */
+    /* Row 2: refresh + join + quick join */
     int btn_w = 100;
     x = margin;
     MoveWindow(s_btnRefresh, x, row2_y, btn_w, btn_h, TRUE);
     x += btn_w + 10;
     MoveWindow(s_btnJoin, x, row2_y, btn_w, btn_h, TRUE);
+    x += btn_w + 10;
+    MoveWindow(s_btnQuickJoin, x, row2_y, btn_w, btn_h, TRUE);
 }
 
 /* ------------------------------------------------------------------ */
@@ -299,6 +323,42 @@ void LobbyPage_HandleMessage(const char *type, void *json_root)
             lvi.pszText  = wbuf;
             SendMessageW(s_listRooms, LVM_SETITEMW, 0, (LPARAM)&lvi);
 
+            cJSON *jlat = cJSON_GetObjectItem(room, "latency_ms");
+            if (jlat && cJSON_IsNumber(jlat))
+                wsprintfW(wbuf, L"%d ms", jlat->valueint);
+            else
+                lstrcpyW(wbuf, L"-");
+            lvi.iSubItem = 3;
+            lvi.pszText  = wbuf;
+            SendMessageW(s_listRooms, LVM_SETITEMW, 0, (LPARAM)&lvi);
+
+            /* "map.w3x (3/10)" from the host's live GAMEINFO */
+            cJSON *jgame = cJSON_GetObjectItem(room, "game");
+            if (jgame && cJSON_IsObject(jgame)) {
+                cJSON *jmap   = cJSON_GetObjectItem(jgame, "map");
+                cJSON *jslots = cJSON_GetObjectItem(jgame, "slots");
+                cJSON *jplay  = cJSON_GetObjectItem(jgame, "players");
+
+                const char *map = (jmap && cJSON_IsString(jmap))
+                                  ? jmap->valuestring : "";
+                const char *base = strrchr(map, '\\');
+                if (base) map = base + 1;
+
+                char game[160];
+                if (jplay && cJSON_IsNumber(jplay) &&
+                    jslots && cJSON_IsNumber(jslots))
+                    snprintf(game, sizeof(game), "%s (%d/%d)", map,
+                             jplay->valueint, jslots->valueint);
+                else
+                    snprintf(game, sizeof(game), "%s", map);
+
+                wchar_t wgame[160] = {0};
+                MultiByteToWideChar(CP_UTF8, 0, game, -1, wgame, 160);
+                lvi.iSubItem = 4;
+                lvi.pszText  = wgame;
+                SendMessageW(s_listRooms, LVM_SETITEMW, 0, (LPARAM)&lvi);
+            }
+
             idx++;
         }
     }
@@ -387,6 +447,38 @@ static void OnJoinClicked(void)
     cJSON_Delete(msg);
 }
 
+/*
+ * Quick join: the server picks the fullest room that still has a free
+ * slot (filtered by the room-name box if filled in) or creates one, and
+ * answers with room_joined / room_created directly.
+ */
+static void OnQuickJoinClicked(void)
+{
+    wchar_t wname[128] = {0};
+    GetWindowTextW(s_editRoomName, wname, 128);
+    char name[128] = {0};
+    WideCharToMultiByte(CP_UTF8, 0, wname, -1, name, sizeof(name),
+                        NULL, NULL);
+
+    wchar_t wmax[16] = {0};
+    GetWindowTextW(s_editMaxPlayers, wmax, 16);
+    int max_players = _wtoi(wmax);
+    if (max_players <= 0 || max_players > MAX_ROOM_PLAYERS)
+        max_players = 10;
+
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(msg, "type", MSG_QUICK_JOIN);
+    if (name[0] != '\0')
+        cJSON_AddStringToObject(msg, "filter", name);
+    cJSON_AddNumberToObject(msg, "max_players", max_players);
+    char *str = cJSON_PrintUnformatted(msg);
+    if (str) {
+        NetClient_Send(str);
+        free(str);
+    }
+    cJSON_Delete(msg);
+}
+
 /* ------------------------------------------------------------------ */
 /*  Panel window procedure                                            */
 /* ------------------------------------------------------------------ */
@@ -406,6 +498,9 @@ static LRESULT CALLBACK LobbyPanelProc(HWND hwnd, UINT msg,
         case IDC_BTN_JOIN_ROOM:
             if (HIWORD(wParam) == BN_CLICKED) { OnJoinClicked(); return 0; }
             break;
+        case IDC_BTN_QUICK_JOIN:
+            if (HIWORD(wParam) == BN_CLICKED) { OnQuickJoinClicked(); return 0; }
+            break;
         }
         break;
 
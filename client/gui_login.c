@@ -190,6 +190,21 @@ void LoginPage_HandleMessage(const char *type, void *json_root)
             strncpy(g_app.username, jname->valuestring,
                     sizeof(g_app.username) - 1);
 
+        /* Older servers have no reflector; the hook then falls back
+         * to sending each broadcast to every peer. */
+        cJSON *jtoken = cJSON_GetObjectItem(root, "udp_token");
+        cJSON *jport  = cJSON_GetObjectItem(root, "udp_port");
+        g_app.udp_token = (jtoken && cJSON_IsNumber(jtoken))
+                          ? (unsigned)jtoken->valuedouble : 0;
+        g_app.udp_port  = (jport && cJSON_IsNumber(jport))
+                          ? jport->valueint : 0;
+
+        cJSON *jpub = cJSON_GetObjectItem(root, "public_ip");
+        g_app.public_ip[0] = '\0';
+        if (jpub && cJSON_IsString(jpub))
+            strncpy(g_app.public_ip, jpub->valuestring,
+                    sizeof(g_app.public_ip) - 1);
+
         SetTimer(g_app.hwndMain, IDT_HEARTBEAT, HEARTBEAT_INTERVAL_MS, NULL);
 
         GUI_SwitchPage(PAGE_LOBBY);
@@ -275,6 +290,12 @@ static void OnLoginClicked(void)
     cJSON *msg = cJSON_CreateObject();
     cJSON_AddStringToObject(msg, "type", MSG_LOGIN);
     cJSON_AddStringToObject(msg, "username", user);
+
+    /* Peers behind the same NAT reach us on this address. */
+    char local_ip[46];
+    if (NetClient_GetLocalIp(local_ip, sizeof(local_ip)))
+        cJSON_AddStringToObject(msg, "local_ip", local_ip);
+
     char *json_str = cJSON_PrintUnformatted(msg);
     if (json_str) {
         NetClient_Send(json_str);
@@ -16,6 +16,9 @@
 #include "resource.h"
 #include "net_client.h"
 #include "game_launcher.h"
+#include "prober.h"
+#include "mapfetch.h"
+#include "../common/launch.h"
 #include "../common/message.h"
 #include "../third_party/cJSON/cJSON.h"
 
@@ -34,9 +37,18 @@ static HWND s_btnLeave        = NULL;
 
 /* Peer IP cache for game launcher. */
 #define MAX_PEERS 16
-static char  s_peer_ips[MAX_PEERS][48];
+static char  s_peer_names[MAX_PEERS][32];
+static char  s_peer_ips[MAX_PEERS][48];    /* "IP" or punched "IP:PORT" */
+static BOOL  s_peer_lan[MAX_PEERS];        /* reached on its LAN address */
 static int   s_peer_count = 0;
 
+/* Set once War3 is running; peer changes then rewrite war3hook.cfg. */
+static BOOL  s_game_running = FALSE;
+static char  s_reflector[64];
+
+/* Coordinated launch (game_start) waiting for IDT_LAUNCH. */
+static Launch s_launch;
+
 /* ------------------------------------------------------------------ */
 /*  Forward declarations                                              */
 /* ------------------------------------------------------------------ */
@@ -45,8 +57,13 @@ static LRESULT CALLBACK RoomPanelProc(HWND, UINT, WPARAM, LPARAM);
 static void OnSendClicked(void);
 static void OnStartGameClicked(void);
 static void OnLeaveClicked(void);
+static void LaunchGame(void);
+static uint64_t NowMs(void);
 static void AppendChatW(const wchar_t *line);
 static void AppendChatSystemW(const wchar_t *line);
+static void RewriteHookConfig(void);
+static void GetReflectorAddr(char *buf, int buf_len);
+static BOOL GetWar3Dir(char *buf, DWORD buf_len);
 
 /* ------------------------------------------------------------------ */
 /*  RoomPage_Create                                                   */
@@ -207,7 +224,13 @@ void RoomPage_ClearAll(void)
         SetWindowTextW(s_editChat, L"");
 
     s_peer_count = 0;
+    memset(s_peer_names, 0, sizeof(s_peer_names));
     memset(s_peer_ips, 0, sizeof(s_peer_ips));
+    memset(s_peer_lan, 0, sizeof(s_peer_lan));
+    s_game_running = FALSE;
+    s_reflector[0] = '\0';
+    KillTimer(g_app.hwndMain, IDT_LAUNCH);
+    Launch_Reset(&s_launch);
 
     /* Update room name label. */
     if (s_lblRoomName) {
@@ -238,6 +261,11 @@ void RoomPage_HandleMessage(const char *type, void *json_root)
         SendMessageW(s_listPlayers, LB_RESETCONTENT, 0, 0);
         s_peer_count = 0;
 
+        /* Probe each peer at the address chosen below (before any
+         * punched endpoint replaces it; probes use their own port). */
+        const char *probe_names[MAX_PEERS];
+        const char *probe_addrs[MAX_PEERS];
+
         cJSON *peers = cJSON_GetObjectItem(root, "peers");
         if (!peers || !cJSON_IsArray(peers)) return;
 
@@ -245,12 +273,22 @@ void RoomPage_HandleMessage(const char *type, void *json_root)
         cJSON_ArrayForEach(peer, peers) {
             cJSON *juser = cJSON_GetObjectItem(peer, "username");
             cJSON *jip   = cJSON_GetObjectItem(peer, "ip");
+            cJSON *jlan  = cJSON_GetObjectItem(peer, "local_ip");
 
             const char *uname = (juser && cJSON_IsString(juser))
                                 ? juser->valuestring : "???";
             const char *ip    = (jip && cJSON_IsString(jip))
                                 ? jip->valuestring : "";
 
+            /* Same public address: both sit behind one NAT, which often
+             * won't hairpin, so use the peer's LAN address instead. */
+            BOOL lan = FALSE;
+            if (jlan && cJSON_IsString(jlan) && g_app.public_ip[0] &&
+                strcmp(ip, g_app.public_ip) == 0) {
+                ip  = jlan->valuestring;
+                lan = TRUE;
+            }
+
             wchar_t wline[128] = {0};
             wchar_t wuser[64] = {0};
             MultiByteToWideChar(CP_UTF8, 0, uname, -1, wuser, 64);
@@ -259,11 +297,49 @@ void RoomPage_HandleMessage(const char *type, void *json_root)
 
             if (strcmp(uname, g_app.username) != 0 &&
                 s_peer_count < MAX_PEERS && strlen(ip) > 0) {
+                strncpy(s_peer_names[s_peer_count], uname,
+                        sizeof(s_peer_names[0]) - 1);
                 strncpy(s_peer_ips[s_peer_count], ip,
                         sizeof(s_peer_ips[0]) - 1);
+                s_peer_lan[s_peer_count] = lan;
+                probe_names[s_peer_count] = s_peer_names[s_peer_count];
+                probe_addrs[s_peer_count] = ip;
                 s_peer_count++;
             }
         }
+
+        if (!Prober_IsRunning()) {
+            char server[64];
+            GetReflectorAddr(server, sizeof(server));
+            Prober_Start(server, g_app.udp_token);
+        }
+        Prober_SetPeers(probe_names, probe_addrs, s_peer_count);
+
+        if (s_game_running) RewriteHookConfig();
+    }
+    /* ── punch_start: a peer's public UDP endpoint is known ───────── */
+    else if (strcmp(type, MSG_PUNCH_START) == 0) {
+        cJSON *juser = cJSON_GetObjectItem(root, "peer");
+        cJSON *jip   = cJSON_GetObjectItem(root, "public_ip");
+        cJSON *jport = cJSON_GetObjectItem(root, "public_port");
+        if (!juser || !cJSON_IsString(juser) ||
+            !jip   || !cJSON_IsString(jip)   ||
+            !jport || !cJSON_IsNumber(jport))
+            return;
+
+        /* The hook sends War3's broadcasts straight to this endpoint
+         * (as well as via the reflector); both sides doing so opens
+         * the NAT mappings.  The hook picks the change up on its next
+         * config check, which already staggers it past delay_ms. */
+        for (int i = 0; i < s_peer_count; i++) {
+            if (strcmp(s_peer_names[i], juser->valuestring) != 0 ||
+                s_peer_lan[i])
+                continue;
+            snprintf(s_peer_ips[i], sizeof(s_peer_ips[0]), "%s:%d",
+                     jip->valuestring, jport->valueint);
+            if (s_game_running) RewriteHookConfig();
+            break;
+        }
     }
     /* ── chat_msg ─────────────────────────────────────────────────── */
     else if (strcmp(type, MSG_CHAT_MSG) == 0) {
@@ -307,8 +383,156 @@ void RoomPage_HandleMessage(const char *type, void *json_root)
         MultiByteToWideChar(CP_UTF8, 0, line, -1, wline, 256);
         AppendChatSystemW(wline);
     }
+    /* ── host_hint: best-connected member to host ─────────────────── */
+    else if (strcmp(type, MSG_HOST_HINT) == 0) {
+        cJSON *jhost  = cJSON_GetObjectItem(root, "host");
+        cJSON *jworst = cJSON_GetObjectItem(root, "max_rtt_ms");
+        if (!jhost || !cJSON_IsString(jhost)) return;
+
+        /* "*** 推荐主机: X (最大延迟 N ms) ***" */
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "*** \xe6\x8e\xa8\xe8\x8d\x90\xe4\xb8\xbb\xe6\x9c\xba: %s "
+                 "(\xe6\x9c\x80\xe5\xa4\xa7\xe5\xbb\xb6\xe8\xbf\x9f %d ms) ***",
+                 jhost->valuestring,
+                 (jworst && cJSON_IsNumber(jworst)) ? jworst->valueint : 0);
+        wchar_t wline[256] = {0};
+        MultiByteToWideChar(CP_UTF8, 0, line, -1, wline, 256);
+        AppendChatSystemW(wline);
+    }
+    /* ── game_start: the host started; stage the server's peer set ── */
+    else if (strcmp(type, MSG_GAME_START) == 0) {
+        cJSON *jid    = cJSON_GetObjectItem(root, "launch_id");
+        cJSON *jdelay = cJSON_GetObjectItem(root, "delay_ms");
+        cJSON *peers  = cJSON_GetObjectItem(root, "peers");
+        if (!jid    || !cJSON_IsNumber(jid)    ||
+            !jdelay || !cJSON_IsNumber(jdelay) ||
+            !peers  || !cJSON_IsArray(peers))
+            return;
+
+        uint64_t now = NowMs();
+        if (Launch_Stage(&s_launch, (uint32_t)jid->valuedouble,
+                         (uint32_t)jdelay->valuedouble, now) != 0)
+            return;
+
+        /* The server's set replaces ours: the addresses every other
+         * member was given too, punched endpoints included. */
+        s_peer_count = 0;
+        cJSON *peer = NULL;
+        cJSON_ArrayForEach(peer, peers) {
+            cJSON *juser = cJSON_GetObjectItem(peer, "username");
+            cJSON *jaddr = cJSON_GetObjectItem(peer, "addr");
+            cJSON *jvia  = cJSON_GetObjectItem(peer, "via");
+            if (!juser || !cJSON_IsString(juser) ||
+                !jaddr || !cJSON_IsString(jaddr))
+                continue;
+            BOOL lan = jvia && cJSON_IsString(jvia) &&
+                       strcmp(jvia->valuestring, "lan") == 0;
+            if (Launch_AddPeer(&s_launch, juser->valuestring,
+                               jaddr->valuestring,
+                               lan ? LAUNCH_VIA_LAN : LAUNCH_VIA_PUBLIC) != 0)
+                break;
+            strncpy(s_peer_names[s_peer_count], juser->valuestring,
+                    sizeof(s_peer_names[0]) - 1);
+            strncpy(s_peer_ips[s_peer_count], jaddr->valuestring,
+                    sizeof(s_peer_ips[0]) - 1);
+            s_peer_lan[s_peer_count] = lan;
+            s_peer_count++;
+        }
+
+        /* Written now, the hook finds it on injection instead of on
+         * its next reload poll. */
+        GetReflectorAddr(s_reflector, sizeof(s_reflector));
+        RewriteHookConfig();
+
+        uint32_t wait = Launch_Remaining(&s_launch, now);
+        SetTimer(g_app.hwndMain, IDT_LAUNCH,
+                 wait > USER_TIMER_MINIMUM ? wait : USER_TIMER_MINIMUM, NULL);
+
+        /* "*** 游戏将在 N.N 秒后启动 ***" */
+        char line[128];
+        snprintf(line, sizeof(line),
+                 "*** \xe6\xb8\xb8\xe6\x88\x8f\xe5\xb0\x86\xe5\x9c\xa8"
+                 " %u.%u \xe7\xa7\x92\xe5\x90\x8e\xe5\x90\xaf\xe5\x8a\xa8 ***",
+                 wait / 1000, wait % 1000 / 100);
+        wchar_t wline[128] = {0};
+        MultiByteToWideChar(CP_UTF8, 0, line, -1, wline, 128);
+        AppendChatSystemW(wline);
+    }
+    /* ── map_upload: we host a map the lobby's store lacks ────────── */
+    else if (strcmp(type, MSG_MAP_UPLOAD) == 0) {
+        cJSON *jmap    = cJSON_GetObjectItem(root, "map");
+        cJSON *jport   = cJSON_GetObjectItem(root, "port");
+        cJSON *jticket = cJSON_GetObjectItem(root, "ticket");
+        if (!jmap    || !cJSON_IsString(jmap)  ||
+            !jport   || !cJSON_IsNumber(jport) ||
+            !jticket || !cJSON_IsNumber(jticket))
+            return;
+
+        char dir[MAX_PATH], file[MAX_PATH], server[46];
+        if (!GetWar3Dir(dir, MAX_PATH) ||
+            !MapFetch_LocalPath(dir, jmap->valuestring, file, MAX_PATH) ||
+            !NetClient_GetServerIp(server, sizeof(server)))
+            return;
+        /* Unanswered tickets expire; the lobby asks again later. */
+        MapFetch_Upload(server, jport->valueint,
+                        (uint32_t)jticket->valuedouble, file, g_app.hwndMain);
+    }
+    /* ── map_available: prefetch the room's map from the lobby ────── */
+    else if (strcmp(type, MSG_MAP_AVAILABLE) == 0) {
+        cJSON *jmap    = cJSON_GetObjectItem(root, "map");
+        cJSON *jsha1   = cJSON_GetObjectItem(root, "sha1");
+        cJSON *jsize   = cJSON_GetObjectItem(root, "size");
+        cJSON *jchunk  = cJSON_GetObjectItem(root, "chunk_size");
+        cJSON *jchunks = cJSON_GetObjectItem(root, "chunks");
+        cJSON *jport   = cJSON_GetObjectItem(root, "port");
+        if (!jmap    || !cJSON_IsString(jmap)    ||
+            !jsha1   || !cJSON_IsString(jsha1)   ||
+            !jsize   || !cJSON_IsNumber(jsize)   ||
+            !jchunk  || !cJSON_IsNumber(jchunk)  ||
+            !jchunks || !cJSON_IsNumber(jchunks) ||
+            !jport   || !cJSON_IsNumber(jport))
+            return;
+
+        char dir[MAX_PATH], file[MAX_PATH], server[46];
+        if (MapFetch_IsDownloading() ||
+            !GetWar3Dir(dir, MAX_PATH) ||
+            !MapFetch_LocalPath(dir, jmap->valuestring, file, MAX_PATH) ||
+            !NetClient_GetServerIp(server, sizeof(server)))
+            return;
+
+        /* Already have it: War3 matches maps by path and checksum, so
+         * a same-sized file at that path is taken to be the same map. */
+        WIN32_FILE_ATTRIBUTE_DATA fa;
+        if (GetFileAttributesExA(file, GetFileExInfoStandard, &fa) &&
+            fa.nFileSizeHigh == 0 &&
+            fa.nFileSizeLow == (DWORD)jsize->valuedouble)
+            return;
+
+        if (!MapFetch_Download(server, jport->valueint, jsha1->valuestring,
+                               (uint32_t)jsize->valuedouble,
+                               (uint32_t)jchunk->valuedouble,
+                               (uint32_t)jchunks->valuedouble,
+                               file, g_app.hwndMain))
+            return;
+
+        /* "*** 正在预取地图: X (N KB) ***" */
+        char line[384];
+        snprintf(line, sizeof(line),
+                 "*** \xe6\xad\xa3\xe5\x9c\xa8\xe9\xa2\x84\xe5\x8f\x96"
+                 "\xe5\x9c\xb0\xe5\x9b\xbe: %s (%u KB) ***",
+                 jmap->valuestring,
+                 (unsigned)(jsize->valuedouble / 1024));
+        wchar_t wline[384] = {0};
+        MultiByteToWideChar(CP_UTF8, 0, line, -1, wline, 384);
+        AppendChatSystemW(wline);
+    }
     /* ── room_left (self left the room) ───────────────────────────── */
     else if (strcmp(type, MSG_ROOM_LEFT) == 0) {
+        MapFetch_Cancel();
+        KillTimer(g_app.hwndMain, IDT_LAUNCH);
+        Launch_Reset(&s_launch);
+        Prober_Stop();
         g_app.current_room_id = 0;
         g_app.current_room_name[0] = '\0';
         GUI_SwitchPage(PAGE_LOBBY);
@@ -316,6 +540,102 @@ void RoomPage_HandleMessage(const char *type, void *json_root)
     }
 }
 
+/* ------------------------------------------------------------------ */
+/*  RoomPage_OnLaunchTimer                                            */
+/* ------------------------------------------------------------------ */
+
+void RoomPage_OnLaunchTimer(void)
+{
+    KillTimer(g_app.hwndMain, IDT_LAUNCH);
+
+    uint64_t now = NowMs();
+    if (Launch_Poll(&s_launch, now)) {
+        LaunchGame();
+        return;
+    }
+    /* Timers may fire a little early: wait out the rest. */
+    uint32_t wait = Launch_Remaining(&s_launch, now);
+    if (wait > 0)
+        SetTimer(g_app.hwndMain, IDT_LAUNCH,
+                 wait > USER_TIMER_MINIMUM ? wait : USER_TIMER_MINIMUM, NULL);
+}
+
+/* ------------------------------------------------------------------ */
+/*  RoomPage_OnMapFetchDone                                           */
+/* ------------------------------------------------------------------ */
+
+void RoomPage_OnMapFetchDone(int kind, BOOL ok)
+{
+    if (g_app.current_room_id == 0) return;
+
+    if (kind == MAPFETCH_DOWNLOAD) {
+        /* L"*** 地图已就绪 ***" / L"*** 地图预取失败，将在游戏内下载 ***" */
+        AppendChatSystemW(ok
+            ? L"*** \x5730\x56FE\x5DF2\x5C31\x7EEA ***"
+            : L"*** \x5730\x56FE\x9884\x53D6\x5931\x8D25\xFF0C"
+              L"\x5C06\x5728\x6E38\x620F\x5185\x4E0B\x8F7D ***");
+    } else if (ok) {
+        /* L"*** 已将地图上传到服务器 ***" */
+        AppendChatSystemW(L"*** \x5DF2\x5C06\x5730\x56FE\x4E0A\x4F20"
+                          L"\x5230\x670D\x52A1\x5668 ***");
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Hook config                                                       */
+/* ------------------------------------------------------------------ */
+
+/* "serverip:udp_port" of the lobby's UDP port, or "" without one. */
+static void GetReflectorAddr(char *buf, int buf_len)
+{
+    char server_ip[46];
+    buf[0] = '\0';
+    if (g_app.udp_token != 0 && g_app.udp_port > 0 &&
+        NetClient_GetServerIp(server_ip, sizeof(server_ip)))
+    {
+        snprintf(buf, buf_len, "%s:%d", server_ip, g_app.udp_port);
+    }
+}
+
+/* Monotonic milliseconds for the launch state machine. */
+static uint64_t NowMs(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000 +
+           (uint64_t)(now.QuadPart % freq.QuadPart) * 1000 / freq.QuadPart;
+}
+
+/* War3's directory with a trailing backslash: that of the configured
+ * war3.exe, else ours (the launcher's default is war3.exe beside us). */
+static BOOL GetWar3Dir(char *buf, DWORD buf_len)
+{
+    if (g_app.war3_path[0] != '\0') {
+        strncpy(buf, g_app.war3_path, buf_len - 1);
+        buf[buf_len - 1] = '\0';
+    } else {
+        DWORD len = GetModuleFileNameA(NULL, buf, buf_len);
+        if (len == 0 || len >= buf_len) return FALSE;
+    }
+    char *p = strrchr(buf, '\\');
+    if (!p) return FALSE;
+    *(p + 1) = '\0';
+    return TRUE;
+}
+
+/* Push the current peer list to the running game's hook. */
+static void RewriteHookConfig(void)
+{
+    const char *ips[MAX_PEERS];
+    for (int i = 0; i < s_peer_count; i++)
+        ips[i] = s_peer_ips[i];
+
+    GameLauncher_WriteConfig(ips, s_peer_count, s_reflector,
+                             g_app.udp_token);
+}
+
 /* ------------------------------------------------------------------ */
 /*  Chat helpers                                                      */
 /* ------------------------------------------------------------------ */
@@ -372,6 +692,21 @@ static void OnStartGameClicked(void)
         return;
     }
 
+    /* The server answers the whole room with game_start; we launch
+     * along with everyone else when it fires. */
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(msg, "type", MSG_START_GAME);
+    char *str = cJSON_PrintUnformatted(msg);
+    if (str) {
+        NetClient_Send(str);
+        free(str);
+    }
+    cJSON_Delete(msg);
+}
+
+/* Start War3 with the staged peer set (IDT_LAUNCH). */
+static void LaunchGame(void)
+{
     const char *ips[MAX_PEERS];
     for (int i = 0; i < s_peer_count; i++)
         ips[i] = s_peer_ips[i];
@@ -379,7 +714,8 @@ static void OnStartGameClicked(void)
     const char *war3 = (g_app.war3_path[0] != '\0')
                        ? g_app.war3_path : NULL;
 
-    if (!GameLauncher_Start(ips, s_peer_count, war3)) {
+    if (!GameLauncher_Start(ips, s_peer_count, war3,
+                            s_reflector, g_app.udp_token)) {
         MessageBoxW(g_app.hwndMain,
                     L"\x542F\x52A8\x6E38\x620F\x5931\x8D25\xFF0C"
                     L"\x8BF7\x68C0\x67E5 war3.exe \x548C "
@@ -387,6 +723,18 @@ static void OnStartGameClicked(void)
                     L"\x9519\x8BEF", MB_OK | MB_ICONERROR);
     } else {
         AppendChatW(L"*** \x6E38\x620F\x5DF2\x542F\x52A8\xFF01 ***");
+        s_game_running = TRUE;
+
+        /* Let friends watching our presence see we're in game. */
+        cJSON *msg = cJSON_CreateObject();
+        cJSON_AddStringToObject(msg, "type", MSG_GAME_STATUS);
+        cJSON_AddBoolToObject(msg, "in_game", 1);
+        char *str = cJSON_PrintUnformatted(msg);
+        if (str) {
+            NetClient_Send(str);
+            free(str);
+        }
+        cJSON_Delete(msg);
     }
 }
 
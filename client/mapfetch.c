@@ -0,0 +1,384 @@
+/*
+ * mapfetch.c – Map upload / prefetch against the lobby's map store
+ * (see mapfetch.h, wire format in server/mapstore.h).
+ */
+
+#include "mapfetch.h"
+#include "resource.h"
+
+#include <ws2tcpip.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAPFETCH_MAX_SIZE    (8 * 1024 * 1024)   /* as the store */
+#define MAPFETCH_MAX_CHUNKS  256
+
+typedef struct {
+    struct sockaddr_in addr;
+    uint32_t ticket;
+    char     file[MAX_PATH];
+    HWND     hwnd;
+} UploadJob;
+
+typedef struct {
+    struct sockaddr_in addr;
+    uint8_t  sha1[20];
+    uint32_t size;
+    uint32_t chunk_size;
+    uint32_t chunks;
+    char     dest[MAX_PATH];
+    char     part[MAX_PATH];
+    HANDLE   file;
+    HWND     hwnd;
+    volatile LONG next;                       /* next chunk to claim */
+    volatile LONG done[MAPFETCH_MAX_CHUNKS];  /* 1 = written */
+} DownloadJob;
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+static UploadJob     s_up;
+static DownloadJob   s_dl;
+static volatile LONG s_up_busy = 0;
+static volatile LONG s_dl_busy = 0;
+static volatile LONG s_cancel  = 0;
+
+/* ------------------------------------------------------------------ */
+/*  Socket helpers                                                    */
+/* ------------------------------------------------------------------ */
+
+static BOOL ParseServer(const char *ip, int port, struct sockaddr_in *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_port   = htons((u_short)port);
+    return port > 0 && port <= 65535 &&
+           inet_pton(AF_INET, ip, &out->sin_addr) == 1;
+}
+
+static SOCKET Connect(const struct sockaddr_in *addr)
+{
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET) return INVALID_SOCKET;
+
+    DWORD timeout = MAPFETCH_TIMEOUT_MS;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout,
+               sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout,
+               sizeof(timeout));
+
+    if (connect(s, (const struct sockaddr *)addr, sizeof(*addr)) ==
+        SOCKET_ERROR) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+static BOOL SendAll(SOCKET s, const uint8_t *buf, uint32_t len)
+{
+    while (len > 0) {
+        int n = send(s, (const char *)buf, (int)len, 0);
+        if (n <= 0) return FALSE;
+        buf += n;
+        len -= (uint32_t)n;
+    }
+    return TRUE;
+}
+
+static BOOL RecvAll(SOCKET s, uint8_t *buf, uint32_t len)
+{
+    while (len > 0) {
+        int n = recv(s, (char *)buf, (int)len, 0);
+        if (n <= 0) return FALSE;
+        buf += n;
+        len -= (uint32_t)n;
+    }
+    return TRUE;
+}
+
+static void PutU32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static uint32_t GetU32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  | p[3];
+}
+
+static BOOL ParseSha1(const char *hex, uint8_t out[20])
+{
+    if (strlen(hex) != 40) return FALSE;
+    for (int i = 0; i < 20; i++) {
+        unsigned v;
+        if (sscanf(hex + i * 2, "%2x", &v) != 1) return FALSE;
+        out[i] = (uint8_t)v;
+    }
+    return TRUE;
+}
+
+/* Create every missing directory on the way to `file`. */
+static void MakeParentDirs(const char *file)
+{
+    char dir[MAX_PATH];
+    strncpy(dir, file, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+
+    for (char *p = dir; *p; p++) {
+        if ((*p == '\\' || *p == '/') && p > dir && p[-1] != ':') {
+            char c = *p;
+            *p = '\0';
+            CreateDirectoryA(dir, NULL);
+            *p = c;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Upload                                                            */
+/* ------------------------------------------------------------------ */
+
+static BOOL DoUpload(const UploadJob *job)
+{
+    FILE *fp = fopen(job->file, "rb");
+    if (!fp) return FALSE;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size <= 0 || size > MAPFETCH_MAX_SIZE) {
+        fclose(fp);
+        return FALSE;
+    }
+
+    uint8_t *buf = (uint8_t *)malloc(12 + (size_t)size);
+    if (!buf) {
+        fclose(fp);
+        return FALSE;
+    }
+    memcpy(buf, "W3MU", 4);
+    PutU32(buf + 4, job->ticket);
+    PutU32(buf + 8, (uint32_t)size);
+    BOOL ok = fread(buf + 12, 1, (size_t)size, fp) == (size_t)size;
+    fclose(fp);
+
+    SOCKET s = ok ? Connect(&job->addr) : INVALID_SOCKET;
+    uint8_t reply[21];
+    ok = s != INVALID_SOCKET &&
+         SendAll(s, buf, 12 + (uint32_t)size) &&
+         RecvAll(s, reply, sizeof(reply)) &&
+         reply[0] == 0;
+    if (s != INVALID_SOCKET) closesocket(s);
+    free(buf);
+    return ok;
+}
+
+static DWORD WINAPI UploadThreadProc(LPVOID param)
+{
+    (void)param;
+    BOOL ok = DoUpload(&s_up);
+    PostMessageW(s_up.hwnd, WM_MAPFETCH_DONE, MAPFETCH_UPLOAD, ok);
+    InterlockedExchange(&s_up_busy, 0);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Download                                                          */
+/* ------------------------------------------------------------------ */
+
+static BOOL FetchChunk(SOCKET s, uint32_t index, uint8_t *buf)
+{
+    uint8_t req[28];
+    memcpy(req, "W3MG", 4);
+    memcpy(req + 4, s_dl.sha1, 20);
+    PutU32(req + 24, index);
+
+    uint32_t offset = index * s_dl.chunk_size;
+    uint32_t want   = s_dl.size - offset;
+    if (want > s_dl.chunk_size) want = s_dl.chunk_size;
+
+    uint8_t hdr[5];
+    if (!SendAll(s, req, sizeof(req)) || !RecvAll(s, hdr, sizeof(hdr)))
+        return FALSE;
+    if (hdr[0] != 0 || GetU32(hdr + 1) != want) return FALSE;
+    if (!RecvAll(s, buf, want)) return FALSE;
+
+    /* Positioned write: the workers share one handle. */
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = offset;
+    DWORD written = 0;
+    return WriteFile(s_dl.file, buf, want, &written, &ov) && written == want;
+}
+
+/* Claim chunks until none are left; a failed chunk is left for the
+ * next pass and ends this worker (its connection may be broken). */
+static DWORD WINAPI ChunkWorkerProc(LPVOID param)
+{
+    (void)param;
+    uint8_t *buf = (uint8_t *)malloc(s_dl.chunk_size);
+    SOCKET s = buf ? Connect(&s_dl.addr) : INVALID_SOCKET;
+
+    while (s != INVALID_SOCKET && !s_cancel) {
+        LONG index = InterlockedIncrement(&s_dl.next) - 1;
+        if ((uint32_t)index >= s_dl.chunks) break;
+        if (s_dl.done[index]) continue;
+        if (!FetchChunk(s, (uint32_t)index, buf)) break;
+        InterlockedExchange(&s_dl.done[index], 1);
+    }
+
+    if (s != INVALID_SOCKET) closesocket(s);
+    free(buf);
+    return 0;
+}
+
+static uint32_t MissingChunks(void)
+{
+    uint32_t missing = 0;
+    for (uint32_t i = 0; i < s_dl.chunks; i++)
+        if (!s_dl.done[i]) missing++;
+    return missing;
+}
+
+static BOOL DoDownload(void)
+{
+    MakeParentDirs(s_dl.part);
+    s_dl.file = CreateFileA(s_dl.part, GENERIC_WRITE, 0, NULL,
+                            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (s_dl.file == INVALID_HANDLE_VALUE) return FALSE;
+
+    uint32_t missing = s_dl.chunks;
+    for (int pass = 0; pass <= MAPFETCH_RETRIES && missing > 0 &&
+                       !s_cancel; pass++) {
+        if (pass > 0) Sleep(500 * pass);
+
+        HANDLE threads[MAPFETCH_CONNS];
+        int count = missing < MAPFETCH_CONNS ? (int)missing : MAPFETCH_CONNS;
+        int started = 0;
+
+        s_dl.next = 0;
+        for (int i = 0; i < count; i++) {
+            threads[started] = CreateThread(NULL, 0, ChunkWorkerProc,
+                                            NULL, 0, NULL);
+            if (threads[started]) started++;
+        }
+        if (started == 0) break;
+        WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+        for (int i = 0; i < started; i++) CloseHandle(threads[i]);
+
+        missing = MissingChunks();
+    }
+
+    CloseHandle(s_dl.file);
+    s_dl.file = INVALID_HANDLE_VALUE;
+
+    if (missing > 0 ||
+        !MoveFileExA(s_dl.part, s_dl.dest, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileA(s_dl.part);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static DWORD WINAPI DownloadThreadProc(LPVOID param)
+{
+    (void)param;
+    BOOL ok = DoDownload();
+    PostMessageW(s_dl.hwnd, WM_MAPFETCH_DONE, MAPFETCH_DOWNLOAD, ok);
+    InterlockedExchange(&s_dl_busy, 0);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+BOOL MapFetch_LocalPath(const char *war3_dir, const char *map_path,
+                        char *out, int out_len)
+{
+    if (!map_path[0] || map_path[0] == '\\' || map_path[0] == '/' ||
+        strchr(map_path, ':') || strstr(map_path, ".."))
+        return FALSE;
+
+    int n = snprintf(out, out_len, "%s%s", war3_dir, map_path);
+    if (n <= 0 || n >= out_len) return FALSE;
+    for (char *p = out; *p; p++)
+        if (*p == '/') *p = '\\';
+    return TRUE;
+}
+
+BOOL MapFetch_Upload(const char *server_ip, int port, uint32_t ticket,
+                     const char *file, HWND hwnd)
+{
+    if (InterlockedCompareExchange(&s_up_busy, 1, 0) != 0) return FALSE;
+
+    if (!ParseServer(server_ip, port, &s_up.addr)) {
+        InterlockedExchange(&s_up_busy, 0);
+        return FALSE;
+    }
+    s_up.ticket = ticket;
+    s_up.hwnd   = hwnd;
+    strncpy(s_up.file, file, sizeof(s_up.file) - 1);
+    s_up.file[sizeof(s_up.file) - 1] = '\0';
+    s_cancel = 0;
+
+    HANDLE t = CreateThread(NULL, 0, UploadThreadProc, NULL, 0, NULL);
+    if (!t) {
+        InterlockedExchange(&s_up_busy, 0);
+        return FALSE;
+    }
+    CloseHandle(t);
+    return TRUE;
+}
+
+BOOL MapFetch_Download(const char *server_ip, int port, const char *sha1,
+                       uint32_t size, uint32_t chunk_size, uint32_t chunks,
+                       const char *dest, HWND hwnd)
+{
+    if (size == 0 || size > MAPFETCH_MAX_SIZE || chunk_size == 0 ||
+        chunks == 0 || chunks > MAPFETCH_MAX_CHUNKS ||
+        (uint64_t)chunks * chunk_size < size)
+        return FALSE;
+    if (InterlockedCompareExchange(&s_dl_busy, 1, 0) != 0) return FALSE;
+
+    if (!ParseServer(server_ip, port, &s_dl.addr) ||
+        !ParseSha1(sha1, s_dl.sha1) ||
+        snprintf(s_dl.part, sizeof(s_dl.part), "%s.part", dest) >=
+            (int)sizeof(s_dl.part)) {
+        InterlockedExchange(&s_dl_busy, 0);
+        return FALSE;
+    }
+    s_dl.size       = size;
+    s_dl.chunk_size = chunk_size;
+    s_dl.chunks     = chunks;
+    s_dl.hwnd       = hwnd;
+    s_dl.file       = INVALID_HANDLE_VALUE;
+    strncpy(s_dl.dest, dest, sizeof(s_dl.dest) - 1);
+    s_dl.dest[sizeof(s_dl.dest) - 1] = '\0';
+    for (uint32_t i = 0; i < chunks; i++) s_dl.done[i] = 0;
+    s_cancel = 0;
+
+    HANDLE t = CreateThread(NULL, 0, DownloadThreadProc, NULL, 0, NULL);
+    if (!t) {
+        InterlockedExchange(&s_dl_busy, 0);
+        return FALSE;
+    }
+    CloseHandle(t);
+    return TRUE;
+}
+
+void MapFetch_Cancel(void)
+{
+    InterlockedExchange(&s_cancel, 1);
+}
+
+BOOL MapFetch_IsDownloading(void)
+{
+    return s_dl_busy != 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * mapfetch.h – Map upload / prefetch against the lobby's map store.
+ *
+ * The lobby keeps a copy of each room's map (server/mapstore.h) so that
+ * joiners have it before the game starts instead of pulling it from the
+ * host through War3's slow in-game download:
+ *
+ *   map_upload     the host sends its map file once (MapFetch_Upload)
+ *   map_available  a member without the map fetches it in chunks over
+ *                  MAPFETCH_CONNS parallel connections
+ *                  (MapFetch_Download)
+ *
+ * Transfers run on background threads with blocking sockets; completion
+ * is posted to the given window as WM_MAPFETCH_DONE with
+ * wParam = MAPFETCH_UPLOAD / MAPFETCH_DOWNLOAD and lParam = TRUE on
+ * success.  One transfer of each kind runs at a time.
+ */
+
+#ifndef MAPFETCH_H
+#define MAPFETCH_H
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdint.h>
+
+#define MAPFETCH_CONNS       4       /* parallel chunk connections */
+#define MAPFETCH_RETRIES     3       /* passes over failed chunks */
+#define MAPFETCH_TIMEOUT_MS  15000   /* per send / recv */
+
+#define MAPFETCH_UPLOAD      0
+#define MAPFETCH_DOWNLOAD    1
+
+/*
+ * Resolve a GAMEINFO map path ("Maps\Download\x.w3x") under the War3
+ * directory.  Rejects absolute paths and "..".  Returns FALSE if the
+ * path is unusable.
+ */
+BOOL MapFetch_LocalPath(const char *war3_dir, const char *map_path,
+                        char *out, int out_len);
+
+/* Upload `file` to the store at server_ip:port with the given ticket. */
+BOOL MapFetch_Upload(const char *server_ip, int port, uint32_t ticket,
+                     const char *file, HWND hwnd);
+
+/*
+ * Fetch map `sha1` (hex) of `size` bytes, served in `chunks` pieces of
+ * `chunk_size`, into `dest`.  Data goes to "<dest>.part", renamed once
+ * every chunk has arrived.
+ */
+BOOL MapFetch_Download(const char *server_ip, int port, const char *sha1,
+                       uint32_t size, uint32_t chunk_size, uint32_t chunks,
+                       const char *dest, HWND hwnd);
+
+/* Ask running transfers to stop (their completion is still posted). */
+void MapFetch_Cancel(void);
+
+/* TRUE while a download is running. */
+BOOL MapFetch_IsDownloading(void);
+
+#endif /* MAPFETCH_H */
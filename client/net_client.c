@@ -9,6 +9,7 @@
 #include "net_client.h"
 #include "resource.h"
 #include "../common/protocol.h"
+#include "../common/alloc.h"
 
 #include <ws2tcpip.h>
 #include <stdio.h>
@@ -64,7 +65,7 @@ static DWORD WINAPI RecvThreadProc(LPVOID param)
              * The GUI is responsible for calling free(). */
             if (json) {
                 char *copy = _strdup(json);
-                free(json);
+                Alloc_Free(json);
                 if (copy) {
                     if (!PostMessage(g_hwnd, WM_NETWORK_MSG, 0, (LPARAM)copy)) {
                         free(copy);
@@ -206,7 +207,7 @@ BOOL NetClient_Send(const char *json_str)
         sent += (uint32_t)n;
     }
 
-    free(frame);
+    Alloc_Free(frame);
     LeaveCriticalSection(&g_cs);
     return ok;
 }
@@ -215,3 +216,37 @@ BOOL NetClient_IsConnected(void)
 {
     return g_running && (g_sock != INVALID_SOCKET);
 }
+
+BOOL NetClient_GetServerIp(char *buf, int buf_len)
+{
+    if (!buf || buf_len <= 0 || !g_cs_init) return FALSE;
+
+    EnterCriticalSection(&g_cs);
+    BOOL ok = FALSE;
+    if (g_sock != INVALID_SOCKET) {
+        struct sockaddr_in addr;
+        int len = sizeof(addr);
+        if (getpeername(g_sock, (struct sockaddr *)&addr, &len) == 0 &&
+            inet_ntop(AF_INET, &addr.sin_addr, buf, buf_len) != NULL)
+            ok = TRUE;
+    }
+    LeaveCriticalSection(&g_cs);
+    return ok;
+}
+
+BOOL NetClient_GetLocalIp(char *buf, int buf_len)
+{
+    if (!buf || buf_len <= 0 || !g_cs_init) return FALSE;
+
+    EnterCriticalSection(&g_cs);
+    BOOL ok = FALSE;
+    if (g_sock != INVALID_SOCKET) {
+        struct sockaddr_in addr;
+        int len = sizeof(addr);
+        if (getsockname(g_sock, (struct sockaddr *)&addr, &len) == 0 &&
+            inet_ntop(AF_INET, &addr.sin_addr, buf, buf_len) != NULL)
+            ok = TRUE;
+    }
+    LeaveCriticalSection(&g_cs);
+    return ok;
+}
@@ -27,4 +27,13 @@ BOOL NetClient_Send(const char *json_str);
 /* Returns TRUE if currently connected. */
 BOOL NetClient_IsConnected(void);
 
+/* Numeric IPv4 address of the connected server (the resolved form of
+ * whatever was passed to NetClient_Connect).  Returns FALSE if not
+ * connected. */
+BOOL NetClient_GetServerIp(char *buf, int buf_len);
+
+/* Local IPv4 address of the connection to the server, i.e. this
+ * machine's address on its LAN.  Returns FALSE if not connected. */
+BOOL NetClient_GetLocalIp(char *buf, int buf_len);
+
 #endif /* NET_CLIENT_H */
@@ -0,0 +1,238 @@
+/*
+ * prober.c – Latency probing between room members (see prober.h).
+ */
+
+#include "prober.h"
+#include "gui.h"
+#include "resource.h"
+#include "net_client.h"
+#include "../common/probe.h"
+#include "../common/message.h"
+#include "../third_party/cJSON/cJSON.h"
+
+#include <ws2tcpip.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROBER_MAX_PEERS 16
+
+typedef struct {
+    char               name[32];
+    struct sockaddr_in addr;
+    ProbeTarget        probe;
+} ProbePeer;
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+static SOCKET      s_sock = INVALID_SOCKET;
+static ProbePeer   s_peers[PROBER_MAX_PEERS];
+static int         s_peer_count = 0;
+static struct sockaddr_in s_server;        /* sin_port 0 = none */
+static ProbeTarget s_server_probe;
+static uint32_t    s_server_token;
+static int         s_ticks = 0;
+
+static uint64_t NowUs(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+           (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
+
+/* Parse "IP" (port = PROBER_PORT) or "IP:PORT". */
+static BOOL ParseAddr(const char *s, struct sockaddr_in *out)
+{
+    char host[64];
+    int  port = PROBER_PORT;
+
+    strncpy(host, s, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    char *colon = strrchr(host, ':');
+    if (colon) {
+        *colon = '\0';
+        port = atoi(colon + 1);
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_port   = htons((u_short)port);
+    return port > 0 && port <= 65535 &&
+           inet_pton(AF_INET, host, &out->sin_addr) == 1;
+}
+
+static BOOL SameAddr(const struct sockaddr_in *a, const struct sockaddr_in *b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr &&
+           a->sin_port == b->sin_port;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+BOOL Prober_Start(const char *server, unsigned udp_token)
+{
+    Prober_Stop();
+
+    s_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s_sock == INVALID_SOCKET) return FALSE;
+
+    /* Peers probe us on the well-known port; if another client on this
+     * machine has it, we can still measure our side. */
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family      = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port        = htons(PROBER_PORT);
+    if (bind(s_sock, (struct sockaddr *)&local, sizeof(local)) != 0) {
+        local.sin_port = 0;
+        bind(s_sock, (struct sockaddr *)&local, sizeof(local));
+    }
+
+    u_long nb = 1;
+    ioctlsocket(s_sock, FIONBIO, &nb);
+
+    memset(&s_server, 0, sizeof(s_server));
+    if (server && server[0] != '\0' && !ParseAddr(server, &s_server))
+        memset(&s_server, 0, sizeof(s_server));
+    Probe_Reset(&s_server_probe);
+    s_server_token = (uint32_t)udp_token;
+
+    s_peer_count = 0;
+    s_ticks      = 0;
+    SetTimer(g_app.hwndMain, IDT_PROBE, PROBER_INTERVAL_MS, NULL);
+    return TRUE;
+}
+
+void Prober_Stop(void)
+{
+    KillTimer(g_app.hwndMain, IDT_PROBE);
+    if (s_sock != INVALID_SOCKET) {
+        closesocket(s_sock);
+        s_sock = INVALID_SOCKET;
+    }
+    s_peer_count = 0;
+}
+
+BOOL Prober_IsRunning(void)
+{
+    return s_sock != INVALID_SOCKET;
+}
+
+void Prober_SetPeers(const char **names, const char **addrs, int count)
+{
+    ProbePeer old[PROBER_MAX_PEERS];
+    int old_count = s_peer_count;
+    memcpy(old, s_peers, sizeof(ProbePeer) * old_count);
+
+    s_peer_count = 0;
+    for (int i = 0; i < count && s_peer_count < PROBER_MAX_PEERS; i++) {
+        ProbePeer *p = &s_peers[s_peer_count];
+        if (!ParseAddr(addrs[i], &p->addr)) continue;
+        strncpy(p->name, names[i], sizeof(p->name) - 1);
+        p->name[sizeof(p->name) - 1] = '\0';
+
+        Probe_Reset(&p->probe);
+        for (int k = 0; k < old_count; k++) {
+            if (strcmp(old[k].name, p->name) == 0 &&
+                SameAddr(&old[k].addr, &p->addr)) {
+                p->probe = old[k].probe;
+                break;
+            }
+        }
+        s_peer_count++;
+    }
+}
+
+static void SendReport(void)
+{
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(msg, "type", MSG_RTT_REPORT);
+    if (Probe_RttMs(&s_server_probe) >= 0)
+        cJSON_AddNumberToObject(msg, "server_rtt_ms",
+                                Probe_RttMs(&s_server_probe));
+
+    /* Peers that never answered are left out; the server estimates
+     * those pairs from both sides' RTT to itself. */
+    cJSON *peers = cJSON_AddArrayToObject(msg, "peers");
+    for (int i = 0; i < s_peer_count; i++) {
+        int rtt = Probe_RttMs(&s_peers[i].probe);
+        if (rtt < 0) continue;
+        cJSON *e = cJSON_CreateObject();
+        cJSON_AddStringToObject(e, "peer", s_peers[i].name);
+        cJSON_AddNumberToObject(e, "rtt_ms", rtt);
+        cJSON_AddNumberToObject(e, "loss_pct",
+                                Probe_LossPct(&s_peers[i].probe));
+        cJSON_AddItemToArray(peers, e);
+    }
+
+    char *str = cJSON_PrintUnformatted(msg);
+    if (str) {
+        NetClient_Send(str);
+        free(str);
+    }
+    cJSON_Delete(msg);
+}
+
+void Prober_Tick(void)
+{
+    if (s_sock == INVALID_SOCKET) return;
+
+    /* Drain what arrived since the last tick. */
+    uint8_t buf[64];
+    for (;;) {
+        struct sockaddr_in from;
+        int flen = sizeof(from);
+        int n = recvfrom(s_sock, (char *)buf, sizeof(buf), 0,
+                         (struct sockaddr *)&from, &flen);
+        if (n < 0) {
+            if (WSAGetLastError() == WSAECONNRESET) continue;
+            break;
+        }
+
+        uint64_t now  = NowUs();
+        int      kind = Probe_Classify(buf, n);
+        if (kind == PROBE_KIND_PING) {
+            Probe_MakePong(buf);
+            sendto(s_sock, (const char *)buf, n, 0,
+                   (struct sockaddr *)&from, sizeof(from));
+        } else if (kind == PROBE_KIND_PONG) {
+            if (s_server.sin_port != 0 && SameAddr(&from, &s_server)) {
+                Probe_HandlePong(&s_server_probe, buf, n, now);
+                continue;
+            }
+            /* Match on the address only: a peer's reply may come back
+             * from a different port than the one we pinged. */
+            for (int i = 0; i < s_peer_count; i++) {
+                if (s_peers[i].addr.sin_addr.s_addr == from.sin_addr.s_addr &&
+                    Probe_HandlePong(&s_peers[i].probe, buf, n, now) >= 0)
+                    break;
+            }
+        }
+    }
+
+    /* One ping to everyone. */
+    uint64_t now = NowUs();
+    for (int i = 0; i < s_peer_count; i++) {
+        Probe_Expire(&s_peers[i].probe, now);
+        int len = Probe_BuildPing(&s_peers[i].probe, now, buf);
+        sendto(s_sock, (const char *)buf, len, 0,
+               (struct sockaddr *)&s_peers[i].addr, sizeof(s_peers[i].addr));
+    }
+    if (s_server.sin_port != 0) {
+        Probe_Expire(&s_server_probe, now);
+        Probe_BuildPing(&s_server_probe, now, buf);
+        int len = Probe_AddToken(buf, s_server_token);
+        sendto(s_sock, (const char *)buf, len, 0,
+               (struct sockaddr *)&s_server, sizeof(s_server));
+    }
+
+    if (++s_ticks % PROBER_REPORT_TICKS == 0 && NetClient_IsConnected())
+        SendReport();
+}
@@ -0,0 +1,41 @@
+/*
+ * prober.h – Latency probing between room members.
+ *
+ * While the player is in a room, a UDP socket on PROBER_PORT pings every
+ * other member (and the lobby's reflector port) once per tick using the
+ * engine in common/probe.h, answers their pings, and every few ticks
+ * sends the figures to the server in rtt_report.  The server combines
+ * the reports into the room's RTT matrix and replies with host_hint.
+ *
+ * Everything runs on the GUI thread from a WM_TIMER (IDT_PROBE).
+ */
+
+#ifndef PROBER_H
+#define PROBER_H
+
+#include <winsock2.h>
+#include <windows.h>
+
+#define PROBER_PORT          6113    /* next to War3's 6112 */
+#define PROBER_INTERVAL_MS   1000
+#define PROBER_REPORT_TICKS  5       /* rtt_report every N ticks */
+
+/* Open the probe socket and start the timer.  `server` is the lobby's
+ * "IP:PORT" UDP endpoint, or NULL / "" if it has none; its pings carry
+ * `udp_token` from login_ok. */
+BOOL Prober_Start(const char *server, unsigned udp_token);
+
+/* Stop the timer and close the socket. */
+void Prober_Stop(void);
+
+/* TRUE between Prober_Start and Prober_Stop. */
+BOOL Prober_IsRunning(void);
+
+/* Replace the probed peers.  `addrs` are IPv4 strings; history is kept
+ * for peers that stay at the same address. */
+void Prober_SetPeers(const char **names, const char **addrs, int count);
+
+/* Timer callback: answer pings, read pongs, send pings and reports. */
+void Prober_Tick(void);
+
+#endif /* PROBER_H */
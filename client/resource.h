@@ -26,6 +26,7 @@
 #define IDC_BTN_REFRESH         1104
 #define IDC_EDIT_ROOM_NAME      1105
 #define IDC_EDIT_MAX_PLAYERS    1106
+#define IDC_BTN_QUICK_JOIN      1107
 
 /* ------------------------------------------------------------------ */
 /*  Room page controls                                                */
@@ -43,11 +44,14 @@
 /* ------------------------------------------------------------------ */
 #define IDT_HEARTBEAT           2001
 #define HEARTBEAT_INTERVAL_MS   15000
+#define IDT_PROBE               2002
+#define IDT_LAUNCH              2003
 
 /* ------------------------------------------------------------------ */
 /*  Custom window messages                                            */
 /* ------------------------------------------------------------------ */
 #define WM_NETWORK_MSG          (WM_USER + 1)
 #define WM_NET_DISCONNECTED     (WM_USER + 2)
+#define WM_MAPFETCH_DONE        (WM_USER + 3)   /* see mapfetch.h */
 
 #endif /* RESOURCE_H */
@@ -0,0 +1,158 @@
+/*
+ * alloc.c – Accounted heap allocation (see alloc.h).
+ */
+
+#include "alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#   include <windows.h>
+#   define THREAD_LOCAL      __declspec(thread)
+#   define LOAD64(p)         (*(volatile uint64_t *)(p))
+#   define ADD64(p, v)       ((uint64_t)InterlockedExchangeAdd64(           \
+                                 (volatile LONG64 *)(p), (LONG64)(v)) + (v))
+#   define CAS64(p, e, v)    (InterlockedCompareExchange64(                 \
+                                 (volatile LONG64 *)(p), (LONG64)(v),       \
+                                 (LONG64)*(e)) == (LONG64)*(e))
+#else
+#   define THREAD_LOCAL      _Thread_local
+#   define LOAD64(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+#   define ADD64(p, v)       __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#   define CAS64(p, e, v)    __atomic_compare_exchange_n((p), (e), (v), 1,  \
+                                 __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#endif
+
+#define ALLOC_MAGIC  0x57334131u      /* "W3A1" */
+
+/* Sits in front of every block; 16 bytes keeps the caller's pointer as
+ * aligned as malloc's. */
+typedef struct {
+    uint64_t size;
+    uint32_t site;
+    uint32_t magic;
+} Header;
+
+static AllocStats s_stats[ALLOC_SITE_COUNT];
+
+static THREAD_LOCAL uint64_t t_calls;
+
+static const char *const s_site_names[ALLOC_SITE_COUNT] = {
+    [ALLOC_PROTOCOL] = "protocol",
+    [ALLOC_JSON]     = "json",
+    [ALLOC_SENDQ]    = "sendq",
+    [ALLOC_LOBBY]    = "lobby",
+    [ALLOC_RELAY]    = "relay",
+    [ALLOC_MAPSTORE] = "mapstore",
+    [ALLOC_MONITOR]  = "monitor",
+    [ALLOC_SIM]      = "sim",
+};
+
+/* ------------------------------------------------------------------ */
+/*  Accounting                                                        */
+/* ------------------------------------------------------------------ */
+
+static void Charge(AllocSite site, uint64_t size)
+{
+    AllocStats *st = &s_stats[site];
+
+    t_calls++;
+    ADD64(&st->calls, 1);
+    ADD64(&st->bytes, size);
+
+    uint64_t live = ADD64(&st->live_bytes, size);
+    uint64_t peak = LOAD64(&st->peak_bytes);
+    while (live > peak) {
+        if (CAS64(&st->peak_bytes, &peak, live)) break;
+        peak = LOAD64(&st->peak_bytes);
+    }
+}
+
+static void Credit(const Header *h)
+{
+    AllocStats *st = &s_stats[h->site];
+    ADD64(&st->frees, 1);
+    ADD64(&st->live_bytes, (uint64_t)0 - h->size);
+}
+
+static Header *HeaderOf(void *ptr)
+{
+    Header *h = (Header *)ptr - 1;
+    /* Not ours: freed twice, or from plain malloc. */
+    if (h->magic != ALLOC_MAGIC) abort();
+    return h;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+void *Alloc_Malloc(AllocSite site, size_t size)
+{
+    Header *h = (Header *)malloc(sizeof(Header) + size);
+    if (h == NULL) return NULL;
+
+    h->size  = size;
+    h->site  = (uint32_t)site;
+    h->magic = ALLOC_MAGIC;
+    Charge(site, size);
+    return h + 1;
+}
+
+void *Alloc_Calloc(AllocSite site, size_t count, size_t size)
+{
+    if (size != 0 && count > ((size_t)-1 - sizeof(Header)) / size)
+        return NULL;
+
+    void *p = Alloc_Malloc(site, count * size);
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+void *Alloc_Realloc(AllocSite site, void *ptr, size_t size)
+{
+    if (ptr == NULL) return Alloc_Malloc(site, size);
+
+    Header *old = HeaderOf(ptr);
+    Header  was = *old;
+
+    Header *h = (Header *)realloc(old, sizeof(Header) + size);
+    if (h == NULL) return NULL;
+
+    Credit(&was);
+    h->size = size;
+    h->site = (uint32_t)site;
+    Charge(site, size);
+    return h + 1;
+}
+
+void Alloc_Free(void *ptr)
+{
+    if (ptr == NULL) return;
+
+    Header *h = HeaderOf(ptr);
+    Credit(h);
+    h->magic = 0;
+    free(h);
+}
+
+void Alloc_GetStats(AllocSite site, AllocStats *out)
+{
+    const AllocStats *st = &s_stats[site];
+    out->calls      = LOAD64(&st->calls);
+    out->bytes      = LOAD64(&st->bytes);
+    out->frees      = LOAD64(&st->frees);
+    out->live_bytes = LOAD64(&st->live_bytes);
+    out->peak_bytes = LOAD64(&st->peak_bytes);
+}
+
+const char *Alloc_SiteName(AllocSite site)
+{
+    return s_site_names[site];
+}
+
+uint64_t Alloc_ThreadCalls(void)
+{
+    return t_calls;
+}
@@ -0,0 +1,62 @@
+/*
+ * alloc.h – Accounted heap allocation.
+ *
+ * Server and common code allocate through these wrappers instead of
+ * malloc/free so every heap block is charged to a subsystem (AllocSite).
+ * Per site we keep allocation calls and bytes (totals), plus bytes
+ * currently live and their high-water mark; the server exports them as
+ * metrics.  Each calling thread also counts its own allocation calls,
+ * which is how the lobby checks that a message was handled without
+ * touching the heap.
+ *
+ * Blocks carry a small header recording their size and site, so memory
+ * from Alloc_* must be released with Alloc_Free (and only that); this
+ * includes the buffers returned by Protocol_Frame / Protocol_Extract.
+ *
+ * Thread-safe: counters are relaxed atomics.
+ */
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    ALLOC_PROTOCOL,                    /* Protocol_Frame / Protocol_Extract */
+    ALLOC_JSON,                        /* cJSON trees and printed strings */
+    ALLOC_SENDQ,                       /* outbound frames */
+    ALLOC_LOBBY,                       /* channel member tables */
+    ALLOC_RELAY,                       /* relay sessions and buffers */
+    ALLOC_MAPSTORE,                    /* map chunk cache */
+    ALLOC_MONITOR,                     /* metrics and admin replies */
+    ALLOC_SIM,                         /* simulated network (sim.h) */
+    ALLOC_SITE_COUNT
+} AllocSite;
+
+typedef struct {
+    uint64_t calls;                    /* malloc / calloc / realloc */
+    uint64_t bytes;                    /* requested by those calls */
+    uint64_t frees;
+    uint64_t live_bytes;               /* allocated and not yet freed */
+    uint64_t peak_bytes;               /* highest live_bytes seen */
+} AllocStats;
+
+/* As malloc / calloc / realloc, charged to `site`.  NULL on failure. */
+void *Alloc_Malloc(AllocSite site, size_t size);
+void *Alloc_Calloc(AllocSite site, size_t count, size_t size);
+void *Alloc_Realloc(AllocSite site, void *ptr, size_t size);
+
+/* Release a block from any of the above.  NULL is ignored. */
+void  Alloc_Free(void *ptr);
+
+/* Snapshot of one site's counters. */
+void  Alloc_GetStats(AllocSite site, AllocStats *out);
+
+/* "protocol", "json", ... for labels. */
+const char *Alloc_SiteName(AllocSite site);
+
+/* Allocation calls made by the calling thread since it started. */
+uint64_t Alloc_ThreadCalls(void);
+
+#endif /* ALLOC_H */
@@ -0,0 +1,121 @@
+/*
+ * launch.c – Coordinated game launch (see launch.h).
+ */
+
+#include "launch.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* ------------------------------------------------------------------ */
+/*  Peer set                                                          */
+/* ------------------------------------------------------------------ */
+
+int Launch_PeerAddr(const LaunchEndpoint *self, const LaunchEndpoint *peer,
+                    char *out, size_t out_len)
+{
+    /* Same public address: both sit behind one NAT, which often won't
+     * hairpin, so use the LAN address. */
+    if (peer->local_ip[0] != '\0' && strcmp(self->ip, peer->ip) == 0) {
+        snprintf(out, out_len, "%s", peer->local_ip);
+        return LAUNCH_VIA_LAN;
+    }
+
+    /* Both endpoints known: the server has told both to punch. */
+    if (self->udp_port != 0 && peer->udp_port != 0 && peer->udp_ip[0]) {
+        snprintf(out, out_len, "%s:%d", peer->udp_ip, peer->udp_port);
+        return LAUNCH_VIA_PUNCH;
+    }
+
+    snprintf(out, out_len, "%s", peer->ip);
+    return LAUNCH_VIA_PUBLIC;
+}
+
+uint32_t Launch_DelayMs(uint32_t lead_ms, int rtt_ms)
+{
+    /* game_start reaches this member about half an RTT after it leaves
+     * the server; start that much sooner. */
+    uint32_t one_way = rtt_ms > 0 ? (uint32_t)rtt_ms / 2 : 0;
+    return one_way < lead_ms ? lead_ms - one_way : 0;
+}
+
+int Launch_FormatConfig(const char *const *addrs, int count,
+                        const char *reflector, uint32_t token,
+                        char *buf, size_t buf_len)
+{
+    size_t len = 0;
+    int    n;
+
+    if (reflector && reflector[0] != '\0' && token != 0) {
+        n = snprintf(buf, buf_len,
+                     "# lobby discovery reflector (used instead of the IPs)\n"
+                     "reflector=%s\ntoken=%u\n", reflector, token);
+        if (n < 0 || (size_t)n >= buf_len) return -1;
+        len = (size_t)n;
+    }
+
+    n = snprintf(buf + len, buf_len - len,
+                 "# war3hook targets (one per line, IP or punched IP:PORT)\n");
+    if (n < 0 || (size_t)n >= buf_len - len) return -1;
+    len += (size_t)n;
+
+    for (int i = 0; i < count; i++) {
+        n = snprintf(buf + len, buf_len - len, "%s\n", addrs[i]);
+        if (n < 0 || (size_t)n >= buf_len - len) return -1;
+        len += (size_t)n;
+    }
+    return (int)len;
+}
+
+/* ------------------------------------------------------------------ */
+/*  State machine                                                     */
+/* ------------------------------------------------------------------ */
+
+void Launch_Init(Launch *l)
+{
+    memset(l, 0, sizeof(*l));
+    l->state = LAUNCH_IDLE;
+}
+
+int Launch_Stage(Launch *l, uint32_t id, uint32_t delay_ms, uint64_t now_ms)
+{
+    if (id != 0 && id == l->id) return -1;
+
+    l->state      = LAUNCH_STAGED;
+    l->id         = id;
+    l->fire_at_ms = now_ms + delay_ms;
+    l->count      = 0;
+    return 0;
+}
+
+int Launch_AddPeer(Launch *l, const char *name, const char *addr, int via)
+{
+    if (l->state != LAUNCH_STAGED || l->count >= LAUNCH_MAX_PEERS)
+        return -1;
+
+    snprintf(l->names[l->count], LAUNCH_NAME_LEN, "%s", name);
+    snprintf(l->addrs[l->count], LAUNCH_ADDR_LEN, "%s", addr);
+    l->via[l->count] = (uint8_t)via;
+    l->count++;
+    return 0;
+}
+
+uint32_t Launch_Remaining(const Launch *l, uint64_t now_ms)
+{
+    if (l->state != LAUNCH_STAGED || now_ms >= l->fire_at_ms) return 0;
+    return (uint32_t)(l->fire_at_ms - now_ms);
+}
+
+int Launch_Poll(Launch *l, uint64_t now_ms)
+{
+    if (l->state != LAUNCH_STAGED || now_ms < l->fire_at_ms) return 0;
+    l->state = LAUNCH_RUNNING;
+    return 1;
+}
+
+void Launch_Reset(Launch *l)
+{
+    l->state = LAUNCH_IDLE;
+    l->id    = 0;
+    l->count = 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * launch.h – Coordinated game launch.
+ *
+ * The room host sends start_game; the server answers every member with
+ * game_start, carrying the one peer set the member's hook should use
+ * and a per-member delay that lands all launches on the same instant
+ * (LAUNCH_LEAD_MS from the request, less half the member's lobby RTT).
+ * Each client writes war3hook.cfg from that set right away, so the hook
+ * has it the moment it is injected rather than after a reload poll, and
+ * starts War3 when the delay runs out.
+ *
+ * This file is the part both sides share and that needs no sockets or
+ * windows: choosing the address one member uses for another, the delay
+ * arithmetic, the war3hook.cfg text, and the client's launch state
+ * machine (IDLE -> STAGED -> RUNNING).
+ */
+
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LAUNCH_MAX_PEERS    16        /* MAX_ROOM_PLAYERS */
+#define LAUNCH_ADDR_LEN     48        /* "IP" or "IP:PORT" */
+#define LAUNCH_NAME_LEN     32
+#define LAUNCH_LEAD_MS      3000      /* start_game -> War3 starts */
+#define LAUNCH_COOLDOWN_S   10        /* between two starts of one room */
+
+/* How a member reaches a peer (Launch_PeerAddr). */
+#define LAUNCH_VIA_PUBLIC   0         /* public IP from the lobby */
+#define LAUNCH_VIA_LAN      1         /* same NAT: the peer's LAN IP */
+#define LAUNCH_VIA_PUNCH    2         /* punched public UDP endpoint */
+
+/* What is known about one member's addresses (strings may be ""). */
+typedef struct {
+    const char *ip;                   /* public IP of the lobby connection */
+    const char *local_ip;             /* LAN IP the client reported */
+    const char *udp_ip;               /* reflector-seen UDP endpoint */
+    int         udp_port;             /* 0 if unknown */
+} LaunchEndpoint;
+
+/*
+ * Pick the address `self` should send War3 discovery to for `peer`,
+ * following the same rules the client applies to room_peers and
+ * punch_start.  Writes it to `out` and returns a LAUNCH_VIA_* value.
+ */
+int Launch_PeerAddr(const LaunchEndpoint *self, const LaunchEndpoint *peer,
+                    char *out, size_t out_len);
+
+/* Delay for a member with lobby RTT `rtt_ms` (-1 = unknown). */
+uint32_t Launch_DelayMs(uint32_t lead_ms, int rtt_ms);
+
+/*
+ * Format war3hook.cfg: the reflector lines (if `reflector` is non-empty
+ * and `token` non-zero) and one target per line.  Returns the length,
+ * or -1 if `buf` is too small.
+ */
+int Launch_FormatConfig(const char *const *addrs, int count,
+                        const char *reflector, uint32_t token,
+                        char *buf, size_t buf_len);
+
+/* ---- Client launch state machine ---------------------------------- */
+
+typedef enum {
+    LAUNCH_IDLE,                      /* nothing pending */
+    LAUNCH_STAGED,                    /* peer set known, waiting to fire */
+    LAUNCH_RUNNING                    /* fired */
+} LaunchState;
+
+typedef struct {
+    LaunchState state;
+    uint32_t    id;                   /* server's launch id, 0 = none */
+    uint64_t    fire_at_ms;           /* local clock */
+    int         count;
+    char        names[LAUNCH_MAX_PEERS][LAUNCH_NAME_LEN];
+    char        addrs[LAUNCH_MAX_PEERS][LAUNCH_ADDR_LEN];
+    uint8_t     via[LAUNCH_MAX_PEERS];   /* LAUNCH_VIA_* */
+} Launch;
+
+void Launch_Init(Launch *l);
+
+/*
+ * Start staging launch `id`, due `delay_ms` after `now_ms`; the peer set
+ * is emptied for Launch_AddPeer.  Returns -1 (and changes nothing) for a
+ * repeat of the current id.
+ */
+int Launch_Stage(Launch *l, uint32_t id, uint32_t delay_ms, uint64_t now_ms);
+
+/* Add a peer to a staged launch.  Returns -1 if full or not staging. */
+int Launch_AddPeer(Launch *l, const char *name, const char *addr, int via);
+
+/* Milliseconds until a staged launch is due (0 if due or not staged). */
+uint32_t Launch_Remaining(const Launch *l, uint64_t now_ms);
+
+/* Returns 1 exactly once, when a staged launch is due (-> RUNNING). */
+int Launch_Poll(Launch *l, uint64_t now_ms);
+
+/* Drop any pending launch (-> IDLE), e.g. on leaving the room. */
+void Launch_Reset(Launch *l);
+
+#endif /* LAUNCH_H */
@@ -27,9 +27,24 @@
 #define MSG_ROOM_LIST    "room_list"
 #define MSG_ROOM_CREATE  "room_create"
 #define MSG_ROOM_JOIN    "room_join"
+#define MSG_QUICK_JOIN   "quick_join"
 #define MSG_ROOM_LEAVE   "room_leave"
 #define MSG_CHAT         "chat"
 #define MSG_HEARTBEAT    "heartbeat"
+#define MSG_MATCH_ENQUEUE "match_enqueue"
+#define MSG_MATCH_CANCEL  "match_cancel"
+#define MSG_CHANNEL_JOIN  "channel_join"
+#define MSG_CHANNEL_LEAVE "channel_leave"
+#define MSG_CHANNEL_CHAT  "channel_chat"
+#define MSG_WHISPER       "whisper"
+#define MSG_GAME_STATUS   "game_status"
+#define MSG_PRESENCE_SUB   "presence_subscribe"
+#define MSG_PRESENCE_UNSUB "presence_unsubscribe"
+#define MSG_RELAY_OPEN     "relay_open"
+#define MSG_PUNCH_REQUEST  "punch_request"
+#define MSG_PUNCH_RESULT   "punch_result"
+#define MSG_RTT_REPORT     "rtt_report"
+#define MSG_START_GAME     "start_game"
 
 /* ------------------------------------------------------------------ */
 /*  Server → Client message types                                     */
@@ -47,6 +62,22 @@
 #define MSG_PLAYER_LEFT    "player_left"
 #define MSG_ERROR          "error"
 #define MSG_HEARTBEAT_ACK  "heartbeat_ack"
+#define MSG_MATCH_QUEUED   "match_queued"
+#define MSG_MATCH_CANCELLED "match_cancelled"
+#define MSG_MATCH_TIMEOUT  "match_timeout"
+#define MSG_CHANNEL_JOINED "channel_joined"
+#define MSG_CHANNEL_LEFT   "channel_left"
+#define MSG_CHANNEL_MSG    "channel_msg"
+#define MSG_WHISPER_MSG    "whisper_msg"
+#define MSG_WHISPER_SENT   "whisper_sent"
+#define MSG_PRESENCE       "presence"
+#define MSG_PRESENCE_STATE "presence_state"
+#define MSG_RELAY_TICKET   "relay_ticket"
+#define MSG_PUNCH_START    "punch_start"
+#define MSG_HOST_HINT      "host_hint"
+#define MSG_MAP_UPLOAD     "map_upload"
+#define MSG_MAP_AVAILABLE  "map_available"
+#define MSG_GAME_START     "game_start"
 
 /* ------------------------------------------------------------------ */
 /*  Shared data structures                                            */
@@ -57,6 +88,7 @@ typedef struct {
     char name[MAX_ROOM_NAME];
     int  player_count;
     int  max_players;
+    int  latency_ms;     /* estimated, to the requester; -1 if unknown */
 } RoomInfo;
 
 typedef struct {
@@ -0,0 +1,159 @@
+/*
+ * probe.c – UDP latency probe engine (see probe.h).
+ */
+
+#include "probe.h"
+
+#include <string.h>
+
+/* Per-slot state of the ping window. */
+#define PROBE_SLOT_EMPTY    0
+#define PROBE_SLOT_PENDING  1
+#define PROBE_SLOT_ANSWERED 2
+#define PROBE_SLOT_LOST     3
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                           */
+/* ------------------------------------------------------------------ */
+
+static void PutU64(uint8_t *p, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--) {
+        p[i] = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+static uint64_t GetU64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+void Probe_Reset(ProbeTarget *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->srtt_us    = -1;
+    t->min_rtt_us = -1;
+}
+
+int Probe_BuildPing(ProbeTarget *t, uint64_t now_us, uint8_t *buf)
+{
+    uint16_t seq  = t->next_seq++;
+    int      slot = seq % PROBE_WINDOW;
+
+    /* The slot's previous ping falls out of the window. */
+    t->state[slot]   = PROBE_SLOT_PENDING;
+    t->sent_us[slot] = now_us;
+
+    buf[0] = PROBE_MAGIC0;
+    buf[1] = PROBE_MAGIC1;
+    buf[2] = PROBE_MAGIC2;
+    buf[3] = PROBE_MAGIC3;
+    buf[4] = PROBE_KIND_PING;
+    buf[5] = 0;
+    buf[6] = (uint8_t)(seq >> 8);
+    buf[7] = (uint8_t)seq;
+    PutU64(buf + 8, now_us);
+    return PROBE_PKT_SIZE;
+}
+
+int Probe_AddToken(uint8_t *buf, uint32_t token)
+{
+    buf[16] = (uint8_t)(token >> 24);
+    buf[17] = (uint8_t)(token >> 16);
+    buf[18] = (uint8_t)(token >> 8);
+    buf[19] = (uint8_t)token;
+    return PROBE_TOKEN_PKT_SIZE;
+}
+
+uint32_t Probe_Token(const uint8_t *buf, int len)
+{
+    if (len != PROBE_TOKEN_PKT_SIZE) return 0;
+    return ((uint32_t)buf[16] << 24) | ((uint32_t)buf[17] << 16) |
+           ((uint32_t)buf[18] << 8)  |  (uint32_t)buf[19];
+}
+
+int Probe_Classify(const uint8_t *buf, int len)
+{
+    if ((len != PROBE_PKT_SIZE && len != PROBE_TOKEN_PKT_SIZE) ||
+        buf[0] != PROBE_MAGIC0 || buf[1] != PROBE_MAGIC1 ||
+        buf[2] != PROBE_MAGIC2 || buf[3] != PROBE_MAGIC3)
+        return 0;
+
+    if (buf[4] == PROBE_KIND_PING || buf[4] == PROBE_KIND_PONG) {
+        return buf[4];
+    }
+    return 0;
+}
+
+void Probe_MakePong(uint8_t *buf)
+{
+    buf[4] = PROBE_KIND_PONG;
+}
+
+int Probe_HandlePong(ProbeTarget *t, const uint8_t *buf, int len,
+                     uint64_t now_us)
+{
+    if (Probe_Classify(buf, len) != PROBE_KIND_PONG) return -1;
+
+    uint16_t seq  = (uint16_t)((buf[6] << 8) | buf[7]);
+    uint64_t ts   = GetU64(buf + 8);
+    int      slot = seq % PROBE_WINDOW;
+
+    /* The echoed timestamp must match what we sent in that slot, which
+     * also rejects a pong for an older ping that used the same slot. */
+    if (t->state[slot] != PROBE_SLOT_PENDING || t->sent_us[slot] != ts ||
+        now_us < ts)
+        return -1;
+
+    t->state[slot] = PROBE_SLOT_ANSWERED;
+
+    uint64_t d   = now_us - ts;
+    int      rtt = d > 0x7FFFFFFF ? 0x7FFFFFFF : (int)d;
+
+    /* Same smoothing as TCP's SRTT: 7/8 old, 1/8 new. */
+    if (t->srtt_us < 0) {
+        t->srtt_us = rtt;
+    } else {
+        t->srtt_us += (rtt - t->srtt_us) / 8;
+    }
+    if (t->min_rtt_us < 0 || rtt < t->min_rtt_us) {
+        t->min_rtt_us = rtt;
+    }
+    t->samples++;
+    return rtt;
+}
+
+void Probe_Expire(ProbeTarget *t, uint64_t now_us)
+{
+    for (int i = 0; i < PROBE_WINDOW; i++) {
+        if (t->state[i] == PROBE_SLOT_PENDING &&
+            now_us - t->sent_us[i] > PROBE_TIMEOUT_US)
+            t->state[i] = PROBE_SLOT_LOST;
+    }
+}
+
+int Probe_RttMs(const ProbeTarget *t)
+{
+    if (t->srtt_us < 0) return -1;
+    return (t->srtt_us + 500) / 1000;
+}
+
+int Probe_LossPct(const ProbeTarget *t)
+{
+    int answered = 0, lost = 0;
+    for (int i = 0; i < PROBE_WINDOW; i++) {
+        if (t->state[i] == PROBE_SLOT_ANSWERED) answered++;
+        else if (t->state[i] == PROBE_SLOT_LOST) lost++;
+    }
+    if (answered + lost == 0) return 0;
+    return lost * 100 / (answered + lost);
+}
@@ -0,0 +1,89 @@
+/*
+ * probe.h – Lightweight UDP latency probes.
+ *
+ * Room members ping each other (and the lobby's UDP port) to measure
+ * round-trip time and loss; the results go to the server in rtt_report
+ * so it can recommend the best host.  This file is only the engine: it
+ * builds and checks packets and keeps per-target statistics, and never
+ * touches a socket, so the client and the server share it.
+ *
+ * Packet (16 bytes, both directions):
+ *   "W3PB" (4) | kind (1) | 0 (1) | seq (2, big-endian) | ts (8, big-endian)
+ *
+ * A pong is the ping with `kind` flipped; `ts` is the sender's clock in
+ * microseconds and comes back untouched, so the responder keeps no state.
+ *
+ * Pings to the lobby's UDP port append the sender's udp_token (4 bytes,
+ * big-endian), which the pong keeps: the server only answers logged-in
+ * clients, so it cannot be used to bounce traffic at a forged address.
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdint.h>
+
+#define PROBE_MAGIC0      'W'
+#define PROBE_MAGIC1      '3'
+#define PROBE_MAGIC2      'P'
+#define PROBE_MAGIC3      'B'
+
+#define PROBE_PKT_SIZE    16
+#define PROBE_TOKEN_PKT_SIZE (PROBE_PKT_SIZE + 4)   /* with udp_token */
+#define PROBE_KIND_PING   1
+#define PROBE_KIND_PONG   2
+
+#define PROBE_WINDOW      32         /* recent pings counted for loss    */
+#define PROBE_TIMEOUT_US  2000000    /* a ping unanswered this long is lost */
+
+typedef struct {
+    uint16_t next_seq;
+    uint64_t sent_us[PROBE_WINDOW];  /* send time, indexed by seq % window */
+    uint8_t  state[PROBE_WINDOW];    /* PROBE_SLOT_* (probe.c)            */
+
+    int      srtt_us;                /* smoothed RTT, -1 until a sample   */
+    int      min_rtt_us;
+    uint32_t samples;
+} ProbeTarget;
+
+/* Forget all history. */
+void Probe_Reset(ProbeTarget *t);
+
+/*
+ * Write the next ping for `t` into `buf` (at least PROBE_PKT_SIZE bytes).
+ * Returns the packet length.
+ */
+int Probe_BuildPing(ProbeTarget *t, uint64_t now_us, uint8_t *buf);
+
+/*
+ * Append `token` to a ping from Probe_BuildPing (`buf` must hold
+ * PROBE_TOKEN_PKT_SIZE bytes).  Returns the new length.
+ */
+int Probe_AddToken(uint8_t *buf, uint32_t token);
+
+/* The udp_token a probe packet carries, 0 if it has none. */
+uint32_t Probe_Token(const uint8_t *buf, int len);
+
+/* PROBE_KIND_PING / PROBE_KIND_PONG for a probe packet, otherwise 0. */
+int Probe_Classify(const uint8_t *buf, int len);
+
+/* Turn a received ping into its pong, in place. */
+void Probe_MakePong(uint8_t *buf);
+
+/*
+ * Account a pong from `t`.  Returns the RTT in microseconds, or -1 if
+ * it does not answer an outstanding ping (late, duplicate or forged).
+ */
+int Probe_HandlePong(ProbeTarget *t, const uint8_t *buf, int len,
+                     uint64_t now_us);
+
+/* Count pings older than PROBE_TIMEOUT_US as lost. */
+void Probe_Expire(ProbeTarget *t, uint64_t now_us);
+
+/* Smoothed RTT in milliseconds, -1 without samples. */
+int Probe_RttMs(const ProbeTarget *t);
+
+/* Lost share of the settled pings in the window, 0..100. */
+int Probe_LossPct(const ProbeTarget *t);
+
+#endif /* PROBE_H */
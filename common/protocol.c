@@ -5,6 +5,7 @@
  */
 
 #include "protocol.h"
+#include "alloc.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -29,7 +30,7 @@ uint8_t *Protocol_Frame(const char *json_str, uint32_t *out_len)
     uint32_t payload_len = (uint32_t)strlen(json_str);
     uint32_t total_len   = FRAME_HEADER_SIZE + payload_len;
 
-    uint8_t *buf = (uint8_t *)malloc(total_len);
+    uint8_t *buf = (uint8_t *)Alloc_Malloc(ALLOC_PROTOCOL, total_len);
     if (buf == NULL) {
         return NULL;
     }
@@ -46,12 +47,13 @@ uint8_t *Protocol_Frame(const char *json_str, uint32_t *out_len)
 }
 
 /* ------------------------------------------------------------------ */
-/*  Protocol_Extract                                                  */
+/*  Protocol_Peek / Protocol_Extract                                  */
 /* ------------------------------------------------------------------ */
 
-uint32_t Protocol_Extract(const uint8_t *buf, uint32_t buf_len, char **out_json)
+uint32_t Protocol_Peek(const uint8_t *buf, uint32_t buf_len,
+                       const char **out_payload, uint32_t *out_payload_len)
 {
-    if (buf == NULL || out_json == NULL) {
+    if (buf == NULL || out_payload == NULL || out_payload_len == NULL) {
         return 0;
     }
 
@@ -76,13 +78,31 @@ uint32_t Protocol_Extract(const uint8_t *buf, uint32_t buf_len, char **out_json)
         return 0;
     }
 
+    *out_payload     = (const char *)buf + FRAME_HEADER_SIZE;
+    *out_payload_len = payload_len;
+    return frame_len;
+}
+
+uint32_t Protocol_Extract(const uint8_t *buf, uint32_t buf_len, char **out_json)
+{
+    if (out_json == NULL) {
+        return 0;
+    }
+
+    const char *payload;
+    uint32_t    payload_len;
+    uint32_t    frame_len = Protocol_Peek(buf, buf_len, &payload, &payload_len);
+    if (frame_len == 0) {
+        return 0;
+    }
+
     /* Allocate a NUL-terminated copy of the JSON payload. */
-    char *json = (char *)malloc(payload_len + 1);
+    char *json = (char *)Alloc_Malloc(ALLOC_PROTOCOL, payload_len + 1);
     if (json == NULL) {
         return 0;
     }
 
-    memcpy(json, buf + FRAME_HEADER_SIZE, payload_len);
+    memcpy(json, payload, payload_len);
     json[payload_len] = '\0';
 
     *out_json = json;
@@ -18,9 +18,9 @@
 /*
  * Frame a JSON string into [4-byte len][payload].
  *
- * Returns a malloc'd buffer containing the complete frame and sets
+ * Returns an allocated buffer containing the complete frame and sets
  * *out_len to the total number of bytes (header + payload).
- * The caller is responsible for freeing the returned buffer.
+ * The caller releases the buffer with Alloc_Free (alloc.h).
  * Returns NULL on allocation failure.
  */
 uint8_t *Protocol_Frame(const char *json_str, uint32_t *out_len);
@@ -30,12 +30,22 @@ uint8_t *Protocol_Frame(const char *json_str, uint32_t *out_len);
  *
  *   buf      – pointer to the receive buffer
  *   buf_len  – number of valid bytes currently in the buffer
- *   out_json – on success, set to a malloc'd NUL-terminated JSON string
- *              (caller frees); unchanged on failure
+ *   out_json – on success, set to an allocated NUL-terminated JSON
+ *              string (caller releases with Alloc_Free); unchanged on
+ *              failure
  *
  * Returns the number of bytes consumed from buf (header + payload).
  * Returns 0 if the buffer does not yet contain a complete frame.
  */
 uint32_t Protocol_Extract(const uint8_t *buf, uint32_t buf_len, char **out_json);
 
+/*
+ * Like Protocol_Extract, without the copy: on success *out_payload
+ * points at the JSON inside `buf` (not NUL-terminated) and
+ * *out_payload_len holds its length.  The pointer is valid until the
+ * caller moves or overwrites the buffer.
+ */
+uint32_t Protocol_Peek(const uint8_t *buf, uint32_t buf_len,
+                       const char **out_payload, uint32_t *out_payload_len);
+
 #endif /* PROTOCOL_H */
@@ -0,0 +1,36 @@
+/*
+ * reflect.h – Wire format of the UDP discovery reflector.
+ *
+ * Instead of sending every War3 LAN broadcast once per peer, the hook
+ * DLL sends it once to the lobby server's UDP port (same number as the
+ * TCP port), and the server forwards it to the other members of the
+ * sender's room.
+ *
+ * Client -> server:
+ *   "W3RF" (4) | token (4, big-endian, from login_ok) | War3 payload
+ *
+ * Server -> client:
+ *   "W3RF" (4) | origin IPv4 (4, network order)       | War3 payload
+ *
+ * The hook strips the server header before War3 sees the packet and
+ * presents it as coming from origin:6112.  A packet with an empty
+ * payload only registers the sender's UDP endpoint.
+ */
+
+#ifndef REFLECT_H
+#define REFLECT_H
+
+#define REFLECT_MAGIC0      'W'
+#define REFLECT_MAGIC1      '3'
+#define REFLECT_MAGIC2      'R'
+#define REFLECT_MAGIC3      'F'
+
+#define REFLECT_HDR_SIZE    8
+#define REFLECT_MAX_PAYLOAD 1464   /* keeps header + payload under 1472 */
+
+#define REFLECT_IS_MAGIC(p) ((p)[0] == REFLECT_MAGIC0 && \
+                             (p)[1] == REFLECT_MAGIC1 && \
+                             (p)[2] == REFLECT_MAGIC2 && \
+                             (p)[3] == REFLECT_MAGIC3)
+
+#endif /* REFLECT_H */
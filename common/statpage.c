@@ -0,0 +1,59 @@
+/*
+ * statpage.c – Seqlock for the shared stats page (see statpage.h).
+ */
+
+#include "statpage.h"
+
+#include <string.h>
+
+#ifdef _MSC_VER
+#   include <windows.h>
+#   define LOAD_ACQ(p)       (*(volatile uint32_t *)(p))
+#   define LOAD_RLX(p)       (*(volatile uint32_t *)(p))
+#   define STORE_REL(p, v)   (*(volatile uint32_t *)(p) = (v))
+#   define STORE_RLX(p, v)   (*(volatile uint32_t *)(p) = (v))
+#   define FENCE_ACQ()       MemoryBarrier()
+#   define FENCE_REL()       MemoryBarrier()
+#else
+#   define LOAD_ACQ(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#   define LOAD_RLX(p)       __atomic_load_n((p), __ATOMIC_RELAXED)
+#   define STORE_REL(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#   define STORE_RLX(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#   define FENCE_ACQ()       __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#   define FENCE_REL()       __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+
+#define READ_RETRIES  1000
+
+void Statpage_BeginWrite(StatPage *page)
+{
+    STORE_RLX(&page->seq, page->seq + 1);
+    /* The odd seq must be visible before any field changes. */
+    FENCE_REL();
+}
+
+void Statpage_EndWrite(StatPage *page)
+{
+    STORE_REL(&page->seq, page->seq + 1);
+}
+
+int Statpage_Read(const StatPage *page, StatPage *out)
+{
+    for (int i = 0; i < READ_RETRIES; i++) {
+        uint32_t before = LOAD_ACQ(&page->seq);
+        if (before & 1) continue;
+
+        memcpy(out, page, sizeof(*out));
+
+        /* The copy must be complete before seq is checked again. */
+        FENCE_ACQ();
+        if (LOAD_RLX(&page->seq) != before) continue;
+
+        if (out->magic != STATPAGE_MAGIC ||
+            out->version != STATPAGE_VERSION ||
+            out->size != sizeof(StatPage))
+            return -1;
+        return 0;
+    }
+    return -1;
+}
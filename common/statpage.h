@@ -0,0 +1,84 @@
+/*
+ * statpage.h – Lobby server stats page shared through memory.
+ *
+ * The server keeps one StatPage in a POSIX shared-memory object named
+ * after its port (STATPAGE_NAME_FMT) and rewrites it every
+ * STATPAGE_INTERVAL_MS from its event loop.  Monitoring agents and
+ * lobby-top map it read-only and read it as often as they like: no
+ * socket, no syscall into the server, nothing the lobby waits on.
+ *
+ * Consistency comes from a seqlock.  The writer makes `seq` odd, updates
+ * the fields and makes it even again; a reader copies the page and
+ * keeps the copy only if `seq` was the same even value before and
+ * after.  Readers never write to the page.
+ *
+ * The layout is fixed-size and all 64-bit fields, so a reader built
+ * separately agrees with the server as long as `version` matches.
+ * This file holds no platform code; the server and the tool do the
+ * mapping.
+ */
+
+#ifndef STATPAGE_H
+#define STATPAGE_H
+
+#include <stdint.h>
+
+#define STATPAGE_MAGIC        0x54533357u   /* "W3ST" */
+#define STATPAGE_VERSION      1
+#define STATPAGE_NAME_FMT     "/war3-lobby-%d"
+#define STATPAGE_INTERVAL_MS  500
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                 /* sizeof(StatPage) */
+    uint32_t seq;                  /* seqlock, odd while being written */
+
+    uint64_t pid;
+    uint64_t started_unix;         /* seconds */
+    uint64_t updated_unix_ms;
+    uint64_t interval_ms;          /* covered by the rates below */
+
+    /* Tables */
+    uint64_t connections;
+    uint64_t users;                /* logged in */
+    uint64_t rooms;
+    uint64_t room_members;
+
+    /* Lobby TCP traffic: totals, and per second over the interval */
+    uint64_t msgs_in_total;
+    uint64_t bytes_in_total;
+    uint64_t bytes_out_total;
+    uint64_t msgs_in_per_sec;
+    uint64_t bytes_in_per_sec;
+    uint64_t bytes_out_per_sec;
+
+    /* Event loop over the interval: busy time per iteration */
+    uint64_t loop_per_sec;         /* iterations */
+    uint64_t loop_p50_ns;
+    uint64_t loop_p90_ns;
+    uint64_t loop_p99_ns;
+    uint64_t loop_max_ns;
+    uint64_t loop_stalls_total;
+
+    /* Send queues */
+    uint64_t sendq_frames;         /* queued, all connections */
+    uint64_t sendq_bytes;
+    uint64_t sendq_frames_max;     /* deepest single connection */
+    uint64_t sendq_bytes_max;
+
+    uint64_t log_dropped_total;
+} StatPage;
+
+/* Writer side: bracket every update of `page`. */
+void Statpage_BeginWrite(StatPage *page);
+void Statpage_EndWrite(StatPage *page);
+
+/*
+ * Reader side: copy a consistent snapshot of `page` into `out`.
+ * Returns 0 on success, -1 if the page is not a StatPage of this
+ * version or stayed mid-update (the server died while writing).
+ */
+int  Statpage_Read(const StatPage *page, StatPage *out);
+
+#endif /* STATPAGE_H */
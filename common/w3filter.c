@@ -0,0 +1,117 @@
+/*
+ * w3filter.c – Broadcast fanout filter (see w3filter.h).
+ */
+
+#include "w3filter.h"
+#include "w3gs.h"
+
+#include <string.h>
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+void W3Filter_Init(W3Filter *f)
+{
+    memset(f, 0, sizeof(*f));
+}
+
+void W3Filter_ForgetRecent(W3Filter *f)
+{
+    memset(f->recent, 0, sizeof(f->recent));
+    f->next_recent = 0;
+}
+
+uint32_t W3Filter_Hash(const uint8_t *buf, int len)
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ buf[i]) * 16777619u;
+    }
+    return h;
+}
+
+int W3Filter_IsRelevant(const uint8_t *buf, int len)
+{
+    switch (W3GS_PacketId(buf, len)) {
+    case W3GS_SEARCHGAME:
+    case W3GS_GAMEINFO:
+    case W3GS_CREATEGAME:
+    case W3GS_REFRESHGAME:
+    case W3GS_DECREATEGAME:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int W3Filter_Check(W3Filter *f, const uint8_t *buf, int len, uint32_t now_ms)
+{
+    if (!W3Filter_IsRelevant(buf, len)) {
+        f->ignored++;
+        return 0;
+    }
+
+    uint32_t hash = W3Filter_Hash(buf, len);
+    for (int i = 0; i < W3FILTER_RECENT; i++) {
+        W3FilterRecent *r = &f->recent[i];
+        if (r->len != len || r->hash != hash) continue;
+
+        if (now_ms - r->sent_ms < W3FILTER_REPEAT_MS) {
+            f->repeats++;
+            return 0;
+        }
+        r->sent_ms = now_ms;
+        f->forwarded++;
+        return 1;
+    }
+
+    /* New packet: overwrite the oldest entry. */
+    W3FilterRecent *r = &f->recent[f->next_recent];
+    f->next_recent = (f->next_recent + 1) % W3FILTER_RECENT;
+    r->hash    = hash;
+    r->len     = len;
+    r->sent_ms = now_ms;
+    f->forwarded++;
+    return 1;
+}
+
+int W3Filter_Allow(W3Filter *f, uint32_t addr, uint16_t port,
+                   uint32_t now_ms)
+{
+    /* Find the target's bucket, or take the least recently used one. */
+    W3FilterBucket *b = NULL, *lru = &f->buckets[0];
+    for (int i = 0; i < W3FILTER_MAX_TARGETS; i++) {
+        W3FilterBucket *c = &f->buckets[i];
+        if (c->last_ms != 0 && c->addr == addr && c->port == port) {
+            b = c;
+            break;
+        }
+        if (c->last_ms == 0 ||
+            (lru->last_ms != 0 && now_ms - c->last_ms > now_ms - lru->last_ms))
+            lru = c;
+    }
+
+    if (b == NULL) {
+        b = lru;
+        b->addr         = addr;
+        b->port         = port;
+        b->milli_tokens = W3FILTER_BURST * 1000;
+    } else {
+        uint32_t elapsed = now_ms - b->last_ms;
+        if (elapsed > W3FILTER_BURST * 1000 / W3FILTER_RATE)
+            elapsed = W3FILTER_BURST * 1000 / W3FILTER_RATE;
+        b->milli_tokens += (int)elapsed * W3FILTER_RATE;
+        if (b->milli_tokens > W3FILTER_BURST * 1000)
+            b->milli_tokens = W3FILTER_BURST * 1000;
+    }
+    /* 0 marks an unused bucket, so a clock reading of 0 becomes 1. */
+    b->last_ms = now_ms ? now_ms : 1;
+
+    if (b->milli_tokens < 1000) {
+        f->limited++;
+        return 0;
+    }
+    b->milli_tokens -= 1000;
+    return 1;
+}
@@ -0,0 +1,81 @@
+/*
+ * w3filter.h – Decides which War3 LAN broadcasts the hook fans out.
+ *
+ * War3 re-broadcasts the same discovery packets on a timer (a host sends
+ * an unchanged REFRESHGAME every few seconds, a searching client repeats
+ * SEARCHGAME), and every copy used to go to every configured target.
+ * Before fanning a broadcast out, the hook asks three questions:
+ *
+ *   1. Relevant?  Only discovery packets (SEARCHGAME, GAMEINFO,
+ *      CREATEGAME, REFRESHGAME, DECREATEGAME) are worth forwarding.
+ *   2. Repeat?    A byte-identical copy of a packet forwarded less than
+ *      W3FILTER_REPEAT_MS ago is dropped.  The first copy after that is
+ *      forwarded again, so remote game lists keep being refreshed.
+ *   3. Allowed?   Each target has a token bucket of W3FILTER_BURST
+ *      packets refilled at W3FILTER_RATE per second.
+ *
+ * Only the fanout is filtered; the real broadcast on the local network
+ * is left alone.  Times are milliseconds from any wrapping 32-bit clock
+ * (GetTickCount on Windows).  No locking: callers serialise access.
+ */
+
+#ifndef W3FILTER_H
+#define W3FILTER_H
+
+#include <stdint.h>
+
+#define W3FILTER_REPEAT_MS     5000
+#define W3FILTER_RECENT        8       /* distinct packets remembered */
+#define W3FILTER_MAX_TARGETS   32
+#define W3FILTER_BURST         10
+#define W3FILTER_RATE          5       /* packets per second, sustained */
+
+typedef struct {
+    uint32_t hash;
+    int      len;                 /* 0 = empty entry */
+    uint32_t sent_ms;
+} W3FilterRecent;
+
+typedef struct {
+    uint32_t addr;                /* IPv4, network order */
+    uint16_t port;                /* network order */
+    int      milli_tokens;        /* tokens * 1000 */
+    uint32_t last_ms;             /* last refill; 0 = unused */
+} W3FilterBucket;
+
+typedef struct {
+    W3FilterRecent recent[W3FILTER_RECENT];
+    int            next_recent;
+    W3FilterBucket buckets[W3FILTER_MAX_TARGETS];
+
+    /* Counters since W3Filter_Init. */
+    uint32_t forwarded;           /* broadcasts that passed 1 and 2 */
+    uint32_t ignored;             /* not relevant */
+    uint32_t repeats;             /* suppressed as repeats */
+    uint32_t limited;             /* per-target copies over the rate */
+} W3Filter;
+
+/* Clear all state and counters. */
+void W3Filter_Init(W3Filter *f);
+
+/* Forget remembered packets (e.g. when the target list changes, so new
+ * targets get the next copy at once).  Buckets and counters are kept. */
+void W3Filter_ForgetRecent(W3Filter *f);
+
+/* FNV-1a hash of a packet. */
+uint32_t W3Filter_Hash(const uint8_t *buf, int len);
+
+/* 1 if the packet is a W3GS discovery packet worth forwarding. */
+int W3Filter_IsRelevant(const uint8_t *buf, int len);
+
+/*
+ * Questions 1 and 2 for one broadcast.  Returns 1 if it should be fanned
+ * out (and remembers it as sent at now_ms), 0 if it should be dropped.
+ */
+int W3Filter_Check(W3Filter *f, const uint8_t *buf, int len, uint32_t now_ms);
+
+/* Question 3: 1 if one more packet may go to addr:port now, 0 if not. */
+int W3Filter_Allow(W3Filter *f, uint32_t addr, uint16_t port,
+                   uint32_t now_ms);
+
+#endif /* W3FILTER_H */
@@ -0,0 +1,166 @@
+/*
+ * w3gs.c – W3GS game announcement parsing (see w3gs.h).
+ */
+
+#include "w3gs.h"
+
+#include <string.h>
+
+/* ------------------------------------------------------------------ */
+/*  Bounded reader                                                    */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    const uint8_t *p;
+    int            left;
+    int            bad;      /* set once a read ran past the end */
+} Reader;
+
+static uint32_t ReadU32(Reader *r)
+{
+    if (r->left < 4) { r->bad = 1; r->left = 0; return 0; }
+    uint32_t v = (uint32_t)r->p[0]         | ((uint32_t)r->p[1] << 8) |
+                 ((uint32_t)r->p[2] << 16) | ((uint32_t)r->p[3] << 24);
+    r->p += 4;
+    r->left -= 4;
+    return v;
+}
+
+static uint16_t ReadU16(Reader *r)
+{
+    if (r->left < 2) { r->bad = 1; r->left = 0; return 0; }
+    uint16_t v = (uint16_t)(r->p[0] | (r->p[1] << 8));
+    r->p += 2;
+    r->left -= 2;
+    return v;
+}
+
+static uint8_t ReadU8(Reader *r)
+{
+    if (r->left < 1) { r->bad = 1; return 0; }
+    r->left--;
+    return *r->p++;
+}
+
+/*
+ * Read a NUL-terminated string.  Returns its start and sets *slen; the
+ * string is not copied.  Missing terminator marks the reader bad.
+ */
+static const uint8_t *ReadString(Reader *r, int *slen)
+{
+    const uint8_t *s   = r->p;
+    const uint8_t *nul = r->left > 0 ? memchr(s, 0, (size_t)r->left) : NULL;
+    if (nul == NULL) {
+        r->bad = 1;
+        r->left = 0;
+        *slen = 0;
+        return s;
+    }
+    *slen = (int)(nul - s);
+    r->p    += *slen + 1;
+    r->left -= *slen + 1;
+    return s;
+}
+
+/* Copy a string of `len` bytes into `dst` (truncating, always NUL-terminated). */
+static void CopyString(char *dst, int cap, const uint8_t *src, int len)
+{
+    if (len > cap - 1) len = cap - 1;
+    memcpy(dst, src, (size_t)len);
+    dst[len] = '\0';
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int W3GS_PacketId(const uint8_t *buf, int len)
+{
+    if (len < 4 || buf[0] != W3GS_HEADER) return -1;
+    if ((buf[2] | (buf[3] << 8)) != len) return -1;
+    return buf[1];
+}
+
+int W3GS_DecodeStatString(const uint8_t *in, int in_len,
+                          uint8_t *out, int out_cap)
+{
+    /* Groups of up to 7 bytes follow a mask byte.  The encoder made
+     * every byte odd so the string has no NULs: a clear mask bit means
+     * the byte was even and had 1 added. */
+    int     n    = 0;
+    uint8_t mask = 0;
+
+    for (int i = 0; i < in_len; i++) {
+        if (i % 8 == 0) {
+            mask = in[i];
+            continue;
+        }
+        if (n >= out_cap) return -1;
+        out[n++] = (mask & (1 << (i % 8))) ? in[i] : (uint8_t)(in[i] - 1);
+    }
+    return n;
+}
+
+int W3GS_ParseGameInfo(const uint8_t *buf, int len, W3GS_GameInfo *info)
+{
+    if (W3GS_PacketId(buf, len) != W3GS_GAMEINFO) return -1;
+
+    Reader r = { buf + 4, len - 4, 0 };
+    memset(info, 0, sizeof(*info));
+    info->players = -1;
+
+    ReadU32(&r);                         /* product */
+    info->version      = ReadU32(&r);
+    info->host_counter = ReadU32(&r);
+    ReadU32(&r);                         /* entry key */
+
+    int slen;
+    const uint8_t *s = ReadString(&r, &slen);
+    CopyString(info->game_name, sizeof(info->game_name), s, slen);
+
+    ReadU8(&r);                          /* unused, always 0 */
+
+    const uint8_t *stat = ReadString(&r, &slen);
+    int stat_len = slen;
+
+    info->slots_total = ReadU32(&r);
+    ReadU32(&r);                         /* game type */
+    ReadU32(&r);                         /* always 1 */
+    info->slots_open  = ReadU32(&r);
+    ReadU32(&r);                         /* up time */
+    info->port        = ReadU16(&r);
+    if (r.bad) return -1;
+
+    /* Map settings live in the encoded stat string. */
+    uint8_t dec[W3GS_MAX_GAMEINFO];
+    int dlen = W3GS_DecodeStatString(stat, stat_len, dec, sizeof(dec));
+    if (dlen < 0) return -1;
+
+    Reader m = { dec, dlen, 0 };
+    ReadU32(&m);                         /* map flags */
+    ReadU8(&m);
+    info->map_width  = ReadU16(&m);
+    info->map_height = ReadU16(&m);
+    info->map_crc    = ReadU32(&m);
+    s = ReadString(&m, &slen);
+    CopyString(info->map_path, sizeof(info->map_path), s, slen);
+    s = ReadString(&m, &slen);
+    CopyString(info->host_name, sizeof(info->host_name), s, slen);
+
+    return m.bad ? -1 : 0;
+}
+
+int W3GS_ApplyRefresh(const uint8_t *buf, int len, W3GS_GameInfo *info)
+{
+    if (W3GS_PacketId(buf, len) != W3GS_REFRESHGAME) return -1;
+
+    Reader r = { buf + 4, len - 4, 0 };
+    uint32_t host_counter = ReadU32(&r);
+    uint32_t players      = ReadU32(&r);
+    uint32_t slots        = ReadU32(&r);
+    if (r.bad || host_counter != info->host_counter) return -1;
+
+    info->players = (int)players;
+    if (slots != 0) info->slots_total = slots;
+    return 0;
+}
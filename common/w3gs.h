@@ -0,0 +1,79 @@
+/*
+ * w3gs.h – Just enough of War3's LAN game protocol (W3GS) to read game
+ * announcements.
+ *
+ * Every W3GS packet starts with a 4-byte header:
+ *   0xF7 (1) | packet id (1) | total length (2, little-endian)
+ *
+ * The ones seen on the discovery port (UDP 6112):
+ *   SEARCHGAME  0x2F  player -> broadcast, "who hosts a game?"
+ *   GAMEINFO    0x30  host   -> searcher, full game description
+ *   CREATEGAME  0x31  host   -> broadcast, a game was created
+ *   REFRESHGAME 0x32  host   -> broadcast, current player count
+ *   DECREATEGAME 0x33 host   -> broadcast, the game is gone
+ *
+ * GAMEINFO body (all integers little-endian):
+ *   product (4) | version (4) | host counter (4) | entry key (4)
+ *   game name (string) | 0 (1) | stat string (string, encoded)
+ *   slots total (4) | game type (4) | 1 (4) | slots open (4)
+ *   up time (4) | game port (2)
+ *
+ * The decoded stat string holds the map settings:
+ *   map flags (4) | 0 (1) | width (2) | height (2) | map crc (4)
+ *   map path (string) | host name (string) | ...
+ *
+ * Parsing never reads past `len`, so it is safe on untrusted input.
+ */
+
+#ifndef W3GS_H
+#define W3GS_H
+
+#include <stdint.h>
+
+#define W3GS_HEADER         0xF7
+#define W3GS_SEARCHGAME     0x2F
+#define W3GS_GAMEINFO       0x30
+#define W3GS_CREATEGAME     0x31
+#define W3GS_REFRESHGAME    0x32
+#define W3GS_DECREATEGAME   0x33
+
+#define W3GS_MAX_GAMEINFO   512     /* larger announcements are not cached */
+
+typedef struct {
+    uint32_t version;
+    uint32_t host_counter;
+    char     game_name[32];
+    char     map_path[128];
+    char     host_name[16];
+    uint16_t map_width;
+    uint16_t map_height;
+    uint32_t map_crc;
+    uint32_t slots_total;
+    uint32_t slots_open;
+    int      players;             /* from REFRESHGAME, -1 until seen */
+    uint16_t port;                /* host's TCP game port */
+} W3GS_GameInfo;
+
+/*
+ * Packet id of a W3GS packet whose header length matches `len`,
+ * or -1 if this is not one.
+ */
+int W3GS_PacketId(const uint8_t *buf, int len);
+
+/*
+ * Decode a stat string (the bytes between its start and terminating
+ * NUL) into `out`.  Returns the decoded length, or -1 if it does not fit.
+ */
+int W3GS_DecodeStatString(const uint8_t *in, int in_len,
+                          uint8_t *out, int out_cap);
+
+/* Parse a GAMEINFO packet.  Returns 0 on success, -1 if malformed. */
+int W3GS_ParseGameInfo(const uint8_t *buf, int len, W3GS_GameInfo *info);
+
+/*
+ * Apply a REFRESHGAME packet to `info` (same host counter only).
+ * Returns 0 if it was applied, -1 otherwise.
+ */
+int W3GS_ApplyRefresh(const uint8_t *buf, int len, W3GS_GameInfo *info);
+
+#endif /* W3GS_H */
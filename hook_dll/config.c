@@ -1,6 +1,7 @@
 #include "config.h"
 #include <ws2tcpip.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 TargetConfig g_config = {0};
 CRITICAL_SECTION g_configLock;
@@ -41,6 +42,42 @@ static BOOL UpdateLastModTime(void)
     return FALSE;
 }
 
+/* Parse "IP:PORT" into `out`. Returns FALSE if malformed. */
+static BOOL ParseEndpoint(const char *value, struct sockaddr_in *out)
+{
+    char host[64];
+    const char *colon = strrchr(value, ':');
+    if (!colon || colon == value || (size_t)(colon - value) >= sizeof(host))
+        return FALSE;
+    memcpy(host, value, colon - value);
+    host[colon - value] = '\0';
+
+    int port = atoi(colon + 1);
+    struct in_addr addr;
+    if (port <= 0 || port > 65535 || inet_pton(AF_INET, host, &addr) != 1)
+        return FALSE;
+
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_addr   = addr;
+    out->sin_port   = htons((USHORT)port);
+    return TRUE;
+}
+
+/* Parse "IP:PORT" into cfg->reflector; leaves it unset if malformed. */
+static void ParseReflector(TargetConfig *cfg, const char *value)
+{
+    if (!ParseEndpoint(value, &cfg->reflector)) {
+        memset(&cfg->reflector, 0, sizeof(cfg->reflector));
+        OutputDebugStringA("[war3hook] Invalid reflector address\n");
+        return;
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "[war3hook] Reflector: %s\n", value);
+    OutputDebugStringA(msg);
+}
+
 int Config_Load(TargetConfig *cfg)
 {
     EnterCriticalSection(&g_configLock);
@@ -58,6 +95,8 @@ int Config_Load(TargetConfig *cfg)
     }
 
     cfg->count = 0;
+    memset(&cfg->reflector, 0, sizeof(cfg->reflector));
+    cfg->token = 0;
 
     FILE *fp = fopen(g_cfgPath, "r");
     if (!fp) {
@@ -67,7 +106,7 @@ int Config_Load(TargetConfig *cfg)
     }
 
     char line[256];
-    while (fgets(line, sizeof(line), fp) && cfg->count < MAX_TARGET_IPS) {
+    while (fgets(line, sizeof(line), fp)) {
         /* Trim newline */
         char *nl = strchr(line, '\n');
         if (nl) *nl = '\0';
@@ -77,7 +116,32 @@ int Config_Load(TargetConfig *cfg)
         /* Skip empty lines and comments */
         if (line[0] == '\0' || line[0] == '#') continue;
 
-        if (inet_pton(AF_INET, line, &cfg->addrs[cfg->count]) == 1) {
+        if (strncmp(line, "reflector=", 10) == 0) {
+            ParseReflector(cfg, line + 10);
+            continue;
+        }
+        if (strncmp(line, "token=", 6) == 0) {
+            cfg->token = (DWORD)strtoul(line + 6, NULL, 10);
+            continue;
+        }
+
+        if (cfg->count >= MAX_TARGET_IPS) continue;
+
+        /* "IP" or "IP:PORT" (a peer's hole-punched endpoint) */
+        struct sockaddr_in ep;
+        BOOL ok = FALSE;
+        if (strchr(line, ':')) {
+            ok = ParseEndpoint(line, &ep);
+            if (ok) {
+                cfg->addrs[cfg->count] = ep.sin_addr;
+                cfg->ports[cfg->count] = ep.sin_port;
+            }
+        } else if (inet_pton(AF_INET, line, &cfg->addrs[cfg->count]) == 1) {
+            cfg->ports[cfg->count] = 0;
+            ok = TRUE;
+        }
+
+        if (ok) {
             char msg[512];
             snprintf(msg, sizeof(msg), "[war3hook] Target IP #%d: %s\n", cfg->count + 1, line);
             OutputDebugStringA(msg);
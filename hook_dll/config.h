@@ -8,10 +8,19 @@
 
 typedef struct {
     struct in_addr addrs[MAX_TARGET_IPS];
+    /* Port per target from an "IP:PORT" line (network order), 0 for a
+       bare IP. An explicit port is a hole-punched endpoint. */
+    USHORT ports[MAX_TARGET_IPS];
     int count;
+
+    /* Lobby discovery reflector: "reflector=IP:PORT" and "token=N" lines.
+       reflector.sin_port is 0 when not configured. */
+    struct sockaddr_in reflector;
+    DWORD token;
 } TargetConfig;
 
-/* Reads target IPs from war3hook.cfg next to the DLL. Returns count of IPs loaded. */
+/* Reads target IPs (and the optional reflector) from war3hook.cfg next to
+   the DLL. Returns count of IPs loaded. */
 int Config_Load(TargetConfig *cfg);
 
 /* Check if config file has been modified since last load. If so, reload.
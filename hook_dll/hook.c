@@ -1,20 +1,36 @@
 #include "hook.h"
 #include "config.h"
+#include "../common/reflect.h"
+#include "../common/w3gs.h"
+#include "../common/w3filter.h"
 #include <ws2tcpip.h>
 #include <stdio.h>
 
 /*
- * Inline Hook (Trampoline) for ws2_32.dll!sendto
+ * Inline Hooks (Trampolines) for ws2_32.dll!sendto and recvfrom
  *
  * Strategy:
- *   1. Save the first 5 bytes of the real sendto()
- *   2. Overwrite them with a JMP to our Hooked_sendto()
+ *   1. Save the first 5 bytes of the real function
+ *   2. Overwrite them with a JMP to our Hooked_xxx()
  *   3. Build a "trampoline" that executes the saved 5 bytes
- *      then JMPs back to sendto+5, so we can call the original.
+ *      then JMPs back to function+5, so we can call the original.
  *
  * This works regardless of how War3 calls sendto (IAT, GetProcAddress,
  * wsock32 forwarding, etc.) because we patch the actual function body.
  *
+ * sendto redirects War3's LAN broadcasts: either once to the lobby's
+ * discovery reflector, or (without one) once per peer in war3hook.cfg.
+ * Peers listed as "IP:PORT" are hole-punched endpoints and are also sent
+ * to directly in reflector mode, which keeps the NAT mapping open.
+ * Broadcasts pass through common/w3filter first: only discovery packets
+ * are fanned out, identical repeats are dropped for a few seconds, and
+ * each target is rate-limited.  The local broadcast itself is untouched.
+ * GAMEINFO replies (unicast to a searcher) are copied to the reflector
+ * too, at most every GAMEINFO_RELAY_MS unless they change, so the lobby
+ * can replay the game to players who join later.
+ * recvfrom unwraps packets coming back from the reflector so War3 sees
+ * them as sent by the original player on port 6112.
+ *
  * x86 only (32-bit). JMP rel32 = 0xE9 + 4-byte relative offset.
  */
 
@@ -22,21 +38,36 @@
 
 typedef int (WSAAPI *sendto_fn)(SOCKET, const char*, int, int,
                                  const struct sockaddr*, int);
-
-/* ── Globals ────────────────────────────────────────────────────────────── */
-static BYTE   g_originalBytes[JMP_SIZE] = {0};  /* saved prologue        */
-static BYTE  *g_sendtoAddr              = NULL;  /* address of real sendto */
-static BOOL   g_hookInstalled           = FALSE;
+typedef int (WSAAPI *recvfrom_fn)(SOCKET, char*, int, int,
+                                   struct sockaddr*, int*);
 
 /*
- * Trampoline: a small executable buffer that contains:
- *   [0..4]  the original 5 bytes of sendto
- *   [5..9]  JMP back to sendto+5
- *
- * Allocated with VirtualAlloc(PAGE_EXECUTE_READWRITE).
+ * One patched function.  The trampoline is a small executable buffer
+ * allocated with VirtualAlloc(PAGE_EXECUTE_READWRITE):
+ *   [0..4]  the original 5 bytes of the function
+ *   [5..9]  JMP back to function+5
  */
-static BYTE  *g_trampoline = NULL;
-static sendto_fn g_trampolineFn = NULL;  /* callable pointer to trampoline */
+typedef struct {
+    const char *name;                  /* export name in ws2_32.dll */
+    void       *detour;                /* our replacement           */
+    BYTE       *target;                /* address of the real one   */
+    BYTE        original[JMP_SIZE];    /* saved prologue            */
+    BYTE       *trampoline;
+} InlineHook;
+
+static int WSAAPI Hooked_sendto(SOCKET s, const char *buf, int len, int flags,
+                                const struct sockaddr *to, int tolen);
+static int WSAAPI Hooked_recvfrom(SOCKET s, char *buf, int len, int flags,
+                                  struct sockaddr *from, int *fromlen);
+
+/* ── Globals ────────────────────────────────────────────────────────────── */
+static InlineHook g_sendtoHook   = { "sendto",   (void *)Hooked_sendto };
+static InlineHook g_recvfromHook = { "recvfrom", (void *)Hooked_recvfrom };
+static BOOL       g_hookInstalled = FALSE;
+
+/* Callable pointers to the trampolines (set before the patch goes live) */
+#define g_trampolineFn ((sendto_fn)g_sendtoHook.trampoline)
+#define g_recvfromFn   ((recvfrom_fn)g_recvfromHook.trampoline)
 
 /* War3 LAN broadcast port */
 #define WAR3_PORT 6112
@@ -44,6 +75,55 @@ static sendto_fn g_trampolineFn = NULL;  /* callable pointer to trampoline */
 /* Hot-reload: check config every 3 seconds */
 static DWORD g_lastReloadCheck = 0;
 
+/* GAMEINFO copies to the reflector: last time and content hash */
+#define GAMEINFO_RELAY_MS 10000
+static DWORD g_gameInfoSent = 0;
+static DWORD g_gameInfoHash = 0;
+
+/* Broadcast fanout filter (g_configLock held) */
+static W3Filter g_filter;
+
+/* ── Helper: wrap one packet for the reflector (g_configLock held) ───────── */
+static void SendToReflector(SOCKET s, const char *buf, int len, int flags)
+{
+    if (len <= 0 || len > REFLECT_MAX_PAYLOAD) return;
+
+    char  pkt[REFLECT_HDR_SIZE + REFLECT_MAX_PAYLOAD];
+    DWORD tok = g_config.token;
+    pkt[0] = REFLECT_MAGIC0;
+    pkt[1] = REFLECT_MAGIC1;
+    pkt[2] = REFLECT_MAGIC2;
+    pkt[3] = REFLECT_MAGIC3;
+    pkt[4] = (char)(tok >> 24);
+    pkt[5] = (char)(tok >> 16);
+    pkt[6] = (char)(tok >> 8);
+    pkt[7] = (char)tok;
+    memcpy(pkt + REFLECT_HDR_SIZE, buf, len);
+
+    g_trampolineFn(s, pkt, REFLECT_HDR_SIZE + len, flags,
+                   (const struct sockaddr *)&g_config.reflector,
+                   sizeof(g_config.reflector));
+}
+
+/* ── Helper: copy a GAMEINFO reply to the reflector ─────────────────────── */
+static void RelayGameInfo(SOCKET s, const char *buf, int len, int flags)
+{
+    /* A changed game is relayed at once. */
+    DWORD hash = W3Filter_Hash((const uint8_t *)buf, len);
+
+    DWORD now = GetTickCount();
+    if (hash == g_gameInfoHash && now - g_gameInfoSent < GAMEINFO_RELAY_MS)
+        return;
+
+    EnterCriticalSection(&g_configLock);
+    if (g_config.reflector.sin_port != 0 && g_config.token != 0) {
+        SendToReflector(s, buf, len, flags);
+        g_gameInfoHash = hash;
+        g_gameInfoSent = now;
+    }
+    LeaveCriticalSection(&g_configLock);
+}
+
 /* ── Hooked sendto ──────────────────────────────────────────────────────── */
 static int WSAAPI Hooked_sendto(
     SOCKET s, const char *buf, int len, int flags,
@@ -53,7 +133,12 @@ static int WSAAPI Hooked_sendto(
     DWORD now = GetTickCount();
     if (now - g_lastReloadCheck > 3000) {
         g_lastReloadCheck = now;
-        Config_CheckReload(&g_config);
+        if (Config_CheckReload(&g_config)) {
+            /* New targets should not wait out the repeat window. */
+            EnterCriticalSection(&g_configLock);
+            W3Filter_ForgetRecent(&g_filter);
+            LeaveCriticalSection(&g_configLock);
+        }
     }
 
     if (to && to->sa_family == AF_INET) {
@@ -63,7 +148,33 @@ static int WSAAPI Hooked_sendto(
         if (sin->sin_addr.s_addr == INADDR_BROADCAST && port == WAR3_PORT) {
             EnterCriticalSection(&g_configLock);
 
-            if (g_config.count > 0) {
+            if (!W3Filter_Check(&g_filter, (const uint8_t *)buf, len, now)) {
+                /* Not discovery traffic, or a repeat: LAN only. */
+            } else if (g_config.reflector.sin_port != 0 && g_config.token != 0) {
+                /* One copy to the lobby; the server fans it out to the
+                 * room, so upstream cost no longer grows with room size. */
+                if (W3Filter_Allow(&g_filter,
+                                   g_config.reflector.sin_addr.s_addr,
+                                   g_config.reflector.sin_port, now))
+                    SendToReflector(s, buf, len, flags);
+
+                /* Direct copies to punched peers; they answer from the
+                 * same mapping, so War3 talks to them without the lobby. */
+                for (int i = 0; i < g_config.count; i++) {
+                    if (g_config.ports[i] == 0) continue;
+
+                    struct sockaddr_in target = *sin;
+                    target.sin_addr = g_config.addrs[i];
+                    target.sin_port = g_config.ports[i];
+                    if (!W3Filter_Allow(&g_filter, target.sin_addr.s_addr,
+                                        target.sin_port, now))
+                        continue;
+
+                    g_trampolineFn(s, buf, len, flags,
+                                   (const struct sockaddr *)&target,
+                                   sizeof(target));
+                }
+            } else if (g_config.count > 0) {
                 char dbg[256];
                 snprintf(dbg, sizeof(dbg),
                          "[war3hook] Intercepted broadcast to 255.255.255.255:%d, "
@@ -74,6 +185,11 @@ static int WSAAPI Hooked_sendto(
                 for (int i = 0; i < g_config.count; i++) {
                     struct sockaddr_in target = *sin;
                     target.sin_addr = g_config.addrs[i];
+                    if (g_config.ports[i] != 0)
+                        target.sin_port = g_config.ports[i];
+                    if (!W3Filter_Allow(&g_filter, target.sin_addr.s_addr,
+                                        target.sin_port, now))
+                        continue;
 
                     g_trampolineFn(s, buf, len, flags,
                                    (const struct sockaddr *)&target,
@@ -86,10 +202,47 @@ static int WSAAPI Hooked_sendto(
             /* Also send to original broadcast so LAN still works */
             return g_trampolineFn(s, buf, len, flags, to, tolen);
         }
+
+        /* A host answering a search: let the lobby cache the game. */
+        if (port == WAR3_PORT && len >= 4 && len <= W3GS_MAX_GAMEINFO &&
+            (BYTE)buf[0] == W3GS_HEADER && (BYTE)buf[1] == W3GS_GAMEINFO)
+            RelayGameInfo(s, buf, len, flags);
     }
     return g_trampolineFn(s, buf, len, flags, to, tolen);
 }
 
+/* ── Hooked recvfrom ────────────────────────────────────────────────────── */
+static int WSAAPI Hooked_recvfrom(
+    SOCKET s, char *buf, int len, int flags,
+    struct sockaddr *from, int *fromlen)
+{
+    int n = g_recvfromFn(s, buf, len, flags, from, fromlen);
+
+    if (n < REFLECT_HDR_SIZE || !from || !fromlen ||
+        *fromlen < (int)sizeof(struct sockaddr_in) ||
+        from->sa_family != AF_INET || !REFLECT_IS_MAGIC(buf))
+        return n;
+
+    struct sockaddr_in *sin = (struct sockaddr_in *)from;
+
+    EnterCriticalSection(&g_configLock);
+    BOOL fromReflector =
+        g_config.reflector.sin_port != 0 &&
+        sin->sin_addr.s_addr == g_config.reflector.sin_addr.s_addr &&
+        sin->sin_port == g_config.reflector.sin_port;
+    LeaveCriticalSection(&g_configLock);
+
+    if (!fromReflector) return n;
+
+    /* Present the packet as sent by the original player. */
+    memcpy(&sin->sin_addr.s_addr, buf + 4, 4);
+    sin->sin_port = htons(WAR3_PORT);
+
+    n -= REFLECT_HDR_SIZE;
+    memmove(buf, buf + REFLECT_HDR_SIZE, n);
+    return n;
+}
+
 /* ── Helper: write a JMP rel32 at `src` targeting `dst` ─────────────────── */
 static void WriteJump(BYTE *src, BYTE *dst)
 {
@@ -97,97 +250,135 @@ static void WriteJump(BYTE *src, BYTE *dst)
     *(DWORD *)(src + 1) = (DWORD)(dst - src - JMP_SIZE);
 }
 
-/* ── Public API ─────────────────────────────────────────────────────────── */
-BOOL Hook_Install(void)
+/* ── Helper: patch one function ─────────────────────────────────────────── */
+static BOOL InstallInlineHook(HMODULE hWs2, InlineHook *h)
 {
-    if (g_hookInstalled) return TRUE;
-
-    /* Make sure winsock is loaded */
-    WSADATA wsa;
-    WSAStartup(MAKEWORD(2, 2), &wsa);
-
-    /* Get the real sendto address from ws2_32.dll */
-    HMODULE hWs2 = GetModuleHandleA("ws2_32.dll");
-    if (!hWs2) {
-        hWs2 = LoadLibraryA("ws2_32.dll");
-    }
-    if (!hWs2) {
-        OutputDebugStringA("[war3hook] Cannot load ws2_32.dll\n");
-        return FALSE;
-    }
-
-    g_sendtoAddr = (BYTE *)GetProcAddress(hWs2, "sendto");
-    if (!g_sendtoAddr) {
-        OutputDebugStringA("[war3hook] Cannot find sendto in ws2_32.dll\n");
+    h->target = (BYTE *)GetProcAddress(hWs2, h->name);
+    if (!h->target) {
+        char dbg[256];
+        snprintf(dbg, sizeof(dbg),
+                 "[war3hook] Cannot find %s in ws2_32.dll\n", h->name);
+        OutputDebugStringA(dbg);
         return FALSE;
     }
 
     {
         char dbg[256];
-        snprintf(dbg, sizeof(dbg), "[war3hook] sendto @ 0x%p\n", g_sendtoAddr);
+        snprintf(dbg, sizeof(dbg), "[war3hook] %s @ 0x%p\n",
+                 h->name, h->target);
         OutputDebugStringA(dbg);
     }
 
     /* Allocate executable memory for the trampoline */
-    g_trampoline = (BYTE *)VirtualAlloc(NULL, JMP_SIZE + JMP_SIZE,
+    h->trampoline = (BYTE *)VirtualAlloc(NULL, JMP_SIZE + JMP_SIZE,
                                          MEM_COMMIT | MEM_RESERVE,
                                          PAGE_EXECUTE_READWRITE);
-    if (!g_trampoline) {
+    if (!h->trampoline) {
         OutputDebugStringA("[war3hook] VirtualAlloc for trampoline failed\n");
         return FALSE;
     }
 
     /* Save original bytes */
-    memcpy(g_originalBytes, g_sendtoAddr, JMP_SIZE);
+    memcpy(h->original, h->target, JMP_SIZE);
 
     /* Build trampoline:
-     *   [0..4] = original 5 bytes of sendto
-     *   [5..9] = JMP (sendto + 5)
+     *   [0..4] = original 5 bytes
+     *   [5..9] = JMP (target + 5)
      */
-    memcpy(g_trampoline, g_originalBytes, JMP_SIZE);
-    WriteJump(g_trampoline + JMP_SIZE, g_sendtoAddr + JMP_SIZE);
+    memcpy(h->trampoline, h->original, JMP_SIZE);
+    WriteJump(h->trampoline + JMP_SIZE, h->target + JMP_SIZE);
 
-    g_trampolineFn = (sendto_fn)g_trampoline;
-
-    /* Patch sendto: overwrite first 5 bytes with JMP to Hooked_sendto */
+    /* Patch the target: overwrite first 5 bytes with JMP to the detour */
     DWORD oldProtect;
-    if (!VirtualProtect(g_sendtoAddr, JMP_SIZE, PAGE_EXECUTE_READWRITE, &oldProtect)) {
-        OutputDebugStringA("[war3hook] VirtualProtect failed on sendto\n");
-        VirtualFree(g_trampoline, 0, MEM_RELEASE);
-        g_trampoline = NULL;
+    if (!VirtualProtect(h->target, JMP_SIZE, PAGE_EXECUTE_READWRITE, &oldProtect)) {
+        char dbg[256];
+        snprintf(dbg, sizeof(dbg),
+                 "[war3hook] VirtualProtect failed on %s\n", h->name);
+        OutputDebugStringA(dbg);
+        VirtualFree(h->trampoline, 0, MEM_RELEASE);
+        h->trampoline = NULL;
         return FALSE;
     }
 
-    WriteJump(g_sendtoAddr, (BYTE *)Hooked_sendto);
-    FlushInstructionCache(GetCurrentProcess(), g_sendtoAddr, JMP_SIZE);
+    WriteJump(h->target, (BYTE *)h->detour);
+    FlushInstructionCache(GetCurrentProcess(), h->target, JMP_SIZE);
 
-    VirtualProtect(g_sendtoAddr, JMP_SIZE, oldProtect, &oldProtect);
-
-    g_hookInstalled = TRUE;
-    OutputDebugStringA("[war3hook] Inline hook on sendto installed successfully!\n");
+    VirtualProtect(h->target, JMP_SIZE, oldProtect, &oldProtect);
     return TRUE;
 }
 
-void Hook_Uninstall(void)
+/* ── Helper: restore one function ───────────────────────────────────────── */
+static void RemoveInlineHook(InlineHook *h)
 {
-    if (!g_hookInstalled || !g_sendtoAddr) return;
+    if (!h->trampoline) return;
 
     /* Restore original bytes */
     DWORD oldProtect;
-    VirtualProtect(g_sendtoAddr, JMP_SIZE, PAGE_EXECUTE_READWRITE, &oldProtect);
-    memcpy(g_sendtoAddr, g_originalBytes, JMP_SIZE);
-    FlushInstructionCache(GetCurrentProcess(), g_sendtoAddr, JMP_SIZE);
-    VirtualProtect(g_sendtoAddr, JMP_SIZE, oldProtect, &oldProtect);
+    VirtualProtect(h->target, JMP_SIZE, PAGE_EXECUTE_READWRITE, &oldProtect);
+    memcpy(h->target, h->original, JMP_SIZE);
+    FlushInstructionCache(GetCurrentProcess(), h->target, JMP_SIZE);
+    VirtualProtect(h->target, JMP_SIZE, oldProtect, &oldProtect);
 
     /* Free trampoline */
-    if (g_trampoline) {
-        VirtualFree(g_trampoline, 0, MEM_RELEASE);
-        g_trampoline = NULL;
+    VirtualFree(h->trampoline, 0, MEM_RELEASE);
+    h->trampoline = NULL;
+    h->target     = NULL;
+}
+
+/* ── Public API ─────────────────────────────────────────────────────────── */
+BOOL Hook_Install(void)
+{
+    if (g_hookInstalled) return TRUE;
+
+    W3Filter_Init(&g_filter);
+
+    /* Make sure winsock is loaded */
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+
+    /* Get the real functions from ws2_32.dll */
+    HMODULE hWs2 = GetModuleHandleA("ws2_32.dll");
+    if (!hWs2) {
+        hWs2 = LoadLibraryA("ws2_32.dll");
+    }
+    if (!hWs2) {
+        OutputDebugStringA("[war3hook] Cannot load ws2_32.dll\n");
+        return FALSE;
     }
 
-    g_trampolineFn = NULL;
-    g_sendtoAddr = NULL;
+    if (!InstallInlineHook(hWs2, &g_sendtoHook)) {
+        return FALSE;
+    }
+
+    /* Without recvfrom, reflected packets reach War3 still wrapped and
+     * are ignored; broadcasts are still redirected. */
+    if (!InstallInlineHook(hWs2, &g_recvfromHook)) {
+        OutputDebugStringA("[war3hook] recvfrom hook failed, reflected packets will be dropped\n");
+    }
+
+    g_hookInstalled = TRUE;
+    OutputDebugStringA("[war3hook] Inline hook on sendto installed successfully!\n");
+    return TRUE;
+}
+
+void Hook_Uninstall(void)
+{
+    if (!g_hookInstalled) return;
+
+    RemoveInlineHook(&g_recvfromHook);
+    RemoveInlineHook(&g_sendtoHook);
+
     g_hookInstalled = FALSE;
 
-    OutputDebugStringA("[war3hook] Inline hook removed, sendto restored\n");
+    {
+        char dbg[256];
+        snprintf(dbg, sizeof(dbg),
+                 "[war3hook] Broadcasts: %u forwarded, %u repeats, "
+                 "%u ignored, %u copies over the rate limit\n",
+                 g_filter.forwarded, g_filter.repeats,
+                 g_filter.ignored, g_filter.limited);
+        OutputDebugStringA(dbg);
+    }
+
+    OutputDebugStringA("[war3hook] Inline hooks removed, sendto/recvfrom restored\n");
 }
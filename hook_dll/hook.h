@@ -4,10 +4,10 @@
 #include <winsock2.h>
 #include <windows.h>
 
-/* Install inline hook on ws2_32.dll!sendto */
+/* Install inline hooks on ws2_32.dll!sendto and recvfrom */
 BOOL Hook_Install(void);
 
-/* Restore original sendto bytes */
+/* Restore original sendto / recvfrom bytes */
 void Hook_Uninstall(void);
 
 #endif /* HOOK_H */
@@ -0,0 +1,427 @@
+/*
+ * admin.c – Operator control socket (see admin.h).
+ */
+
+#include "admin.h"
+#include "log.h"
+#include "../common/alloc.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+/* ------------------------------------------------------------------ */
+/*  Not available on Windows                                          */
+/* ------------------------------------------------------------------ */
+
+int Admin_Open(const char *path)
+{
+    (void)path;
+    return -1;
+}
+
+void Admin_Close(void) {}
+
+int Admin_AddFds(fd_set *readfds, fd_set *writefds, int max_fd)
+{
+    (void)readfds; (void)writefds;
+    return max_fd;
+}
+
+void Admin_Service(fd_set *readfds, fd_set *writefds, time_t now,
+                   const User users[], int user_count,
+                   const Room rooms[], int room_count)
+{
+    (void)readfds; (void)writefds; (void)now;
+    (void)users; (void)user_count; (void)rooms; (void)room_count;
+}
+
+#else  /* POSIX */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifndef MSG_NOSIGNAL
+#   define MSG_NOSIGNAL 0
+#endif
+
+typedef struct {
+    int    fd;                    /* -1 if unused */
+    time_t started;
+    char   req[ADMIN_REQ_MAX];
+    int    req_len;
+    char  *out;                   /* reply, NULL until rendered */
+    size_t out_len;
+    size_t out_off;
+} Request;
+
+/* Growable reply buffer. */
+typedef struct {
+    char  *buf;
+    size_t len;
+    size_t cap;
+    int    failed;
+} Out;
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+static int     s_listen_fd = -1;
+static char    s_path[108];       /* sizeof(sun_path) on Linux */
+static Request s_requests[ADMIN_MAX_CONNS];
+
+static void Put(Out *o, const char *fmt, ...)
+{
+    if (o->failed) return;
+
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(o->buf ? o->buf + o->len : NULL,
+                          o->buf ? o->cap - o->len : 0, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if (o->buf && o->len + (size_t)n < o->cap) {
+            o->len += (size_t)n;
+            return;
+        }
+
+        size_t cap  = o->cap ? o->cap * 2 : 4096;
+        while (cap < o->len + (size_t)n + 1) cap *= 2;
+        char  *grown = (char *)Alloc_Realloc(ALLOC_MONITOR, o->buf, cap);
+        if (grown == NULL) {
+            o->failed = 1;
+            return;
+        }
+        o->buf = grown;
+        o->cap = cap;
+    }
+}
+
+static void EndRequest(Request *r)
+{
+    close(r->fd);
+    Alloc_Free(r->out);
+    r->fd  = -1;
+    r->out = NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Reports                                                           */
+/* ------------------------------------------------------------------ */
+
+static const char *Name(const User *u)
+{
+    return u->username[0] ? u->username : "-";
+}
+
+static void ConnHeader(Out *o)
+{
+    Put(o, "%-5s %-16s %-15s %5s %10s %10s %8s %8s %6s %8s %6s %6s %7s\n",
+        "fd", "user", "ip", "room", "bytes_in", "bytes_out", "msgs_in",
+        "msgs_out", "queue", "queue_b", "rtt", "hb_age", "age");
+}
+
+static void ConnRow(Out *o, const User *u, time_t now)
+{
+    char rtt[12];
+    if (u->rtt_ms >= 0) snprintf(rtt, sizeof(rtt), "%d", u->rtt_ms);
+    else                snprintf(rtt, sizeof(rtt), "-");
+
+    Put(o, "%-5d %-16s %-15s %5d %10llu %10llu %8llu %8llu %6u %8u %6s "
+        "%6lld %7lld\n",
+        u->fd, Name(u), u->ip, u->room_id,
+        (unsigned long long)u->bytes_in,
+        (unsigned long long)u->sendq.bytes_out,
+        (unsigned long long)u->msgs_in,
+        (unsigned long long)u->sendq.frames_out,
+        u->sendq.count, u->sendq.bytes, rtt,
+        (long long)(now - u->last_heartbeat),
+        (long long)(now - u->connected));
+}
+
+static void RoomHeader(Out *o)
+{
+    Put(o, "%-5s %-20s %7s %10s %12s %10s %12s\n",
+        "id", "name", "members", "fanout", "fanout_b", "udp_out",
+        "udp_out_b");
+}
+
+static void RoomRow(Out *o, const Room *r)
+{
+    Put(o, "%-5d %-20s %4d/%-2d %10llu %12llu %10llu %12llu\n",
+        r->id, r->name, r->member_count, r->max_players,
+        (unsigned long long)r->fanout_frames,
+        (unsigned long long)r->fanout_bytes,
+        (unsigned long long)r->udp_pkts_out,
+        (unsigned long long)r->udp_bytes_out);
+}
+
+static void ReportConns(Out *o, time_t now, const User users[], int count)
+{
+    ConnHeader(o);
+    for (int i = 0; i < count; i++) {
+        if (users[i].fd != -1) ConnRow(o, &users[i], now);
+    }
+}
+
+static void ReportRooms(Out *o, const Room rooms[], int count)
+{
+    RoomHeader(o);
+    for (int i = 0; i < count; i++) {
+        if (rooms[i].id != 0) RoomRow(o, &rooms[i]);
+    }
+}
+
+/* Sort keys for `top`: each ranks a whole table once per request. */
+typedef struct {
+    uint64_t key;
+    int      index;
+} Ranked;
+
+static int CompareRanked(const void *a, const void *b)
+{
+    uint64_t ka = ((const Ranked *)a)->key;
+    uint64_t kb = ((const Ranked *)b)->key;
+    return ka < kb ? 1 : ka > kb ? -1 : 0;
+}
+
+static void TopUsers(Out *o, const char *title, time_t now,
+                     const User users[], int count, int n, int by_out)
+{
+    Ranked ranked[MAX_USERS];
+    int    len = 0;
+
+    for (int i = 0; i < count && len < MAX_USERS; i++) {
+        if (users[i].fd == -1) continue;
+        ranked[len].key   = by_out ? users[i].sendq.bytes_out
+                                   : users[i].msgs_in;
+        ranked[len].index = i;
+        len++;
+    }
+    qsort(ranked, (size_t)len, sizeof(Ranked), CompareRanked);
+
+    Put(o, "%s\n", title);
+    ConnHeader(o);
+    for (int i = 0; i < len && i < n; i++)
+        ConnRow(o, &users[ranked[i].index], now);
+    Put(o, "\n");
+}
+
+static void ReportTop(Out *o, time_t now, int n,
+                      const User users[], int user_count,
+                      const Room rooms[], int room_count)
+{
+    TopUsers(o, "-- connections by messages in --", now,
+             users, user_count, n, 0);
+    TopUsers(o, "-- connections by bytes out --", now,
+             users, user_count, n, 1);
+
+    Ranked ranked[MAX_ROOMS];
+    int    len = 0;
+    for (int i = 0; i < room_count && len < MAX_ROOMS; i++) {
+        if (rooms[i].id == 0) continue;
+        ranked[len].key   = rooms[i].fanout_bytes + rooms[i].udp_bytes_out;
+        ranked[len].index = i;
+        len++;
+    }
+    qsort(ranked, (size_t)len, sizeof(Ranked), CompareRanked);
+
+    Put(o, "-- rooms by egress (fanout + reflector) --\n");
+    RoomHeader(o);
+    for (int i = 0; i < len && i < n; i++)
+        RoomRow(o, &rooms[ranked[i].index]);
+}
+
+/* The command line is complete: render the reply. */
+static void HandleCommand(Request *r, time_t now,
+                          const User users[], int user_count,
+                          const Room rooms[], int room_count)
+{
+    Out  o = { NULL, 0, 0, 0 };
+    char cmd[16] = "";
+    int  n = ADMIN_TOP_DEFAULT;
+
+    sscanf(r->req, "%15s %d", cmd, &n);
+    if (n <= 0) n = ADMIN_TOP_DEFAULT;
+
+    if (strcmp(cmd, "conns") == 0) {
+        ReportConns(&o, now, users, user_count);
+    } else if (strcmp(cmd, "rooms") == 0) {
+        ReportRooms(&o, rooms, room_count);
+    } else if (strcmp(cmd, "top") == 0) {
+        ReportTop(&o, now, n, users, user_count, rooms, room_count);
+    } else {
+        Put(&o, "commands: conns | rooms | top [N] | help\n");
+    }
+
+    if (o.failed) {
+        Alloc_Free(o.buf);
+        return;
+    }
+    r->out     = o.buf;
+    r->out_len = o.len;
+    r->out_off = 0;
+}
+
+/* Returns -1 when the request is finished with. */
+static int OnReadable(Request *r, time_t now,
+                      const User users[], int user_count,
+                      const Room rooms[], int room_count)
+{
+    int space = ADMIN_REQ_MAX - 1 - r->req_len;
+    if (space <= 0) return -1;
+
+    ssize_t n = recv(r->fd, r->req + r->req_len, (size_t)space, 0);
+    if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK ||
+                       errno == EINTR) ? 0 : -1;
+    r->req_len += (int)n;
+    r->req[r->req_len] = '\0';
+
+    /* A newline ends the command, and so does the client closing its
+     * side without one. */
+    if (n > 0 && strchr(r->req, '\n') == NULL) return 0;
+    HandleCommand(r, now, users, user_count, rooms, room_count);
+    return r->out ? 0 : -1;
+}
+
+/* Returns -1 when the request is finished with. */
+static int OnWritable(Request *r)
+{
+    while (r->out_off < r->out_len) {
+        ssize_t n = send(r->fd, r->out + r->out_off,
+                         r->out_len - r->out_off, MSG_NOSIGNAL);
+        if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK ||
+                           errno == EINTR) ? 0 : -1;
+        r->out_off += (size_t)n;
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int Admin_Open(const char *path)
+{
+    struct sockaddr_un addr;
+
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        s_requests[i].fd  = -1;
+        s_requests[i].out = NULL;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path) ||
+        strlen(path) >= sizeof(s_path)) {
+        LOG_ERROR("[admin] socket path too long: '%s'", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    /* A previous run that was killed leaves its socket file behind. */
+    unlink(path);
+
+    /* Owner-only: the socket exposes every client's IP. */
+    mode_t old_mask = umask(077);
+    int    bound    = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+
+    if (bound < 0 || listen(fd, ADMIN_MAX_CONNS) < 0) {
+        LOG_ERROR("[admin] cannot listen on '%s'", path);
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    s_listen_fd = fd;
+    snprintf(s_path, sizeof(s_path), "%s", path);
+    LOG_INFO("[admin] control socket at %s", path);
+    return 0;
+}
+
+void Admin_Close(void)
+{
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        if (s_requests[i].fd != -1) EndRequest(&s_requests[i]);
+    }
+    if (s_listen_fd >= 0) {
+        close(s_listen_fd);
+        unlink(s_path);
+        s_listen_fd = -1;
+    }
+}
+
+int Admin_AddFds(fd_set *readfds, fd_set *writefds, int max_fd)
+{
+    if (s_listen_fd < 0) return max_fd;
+
+    FD_SET(s_listen_fd, readfds);
+    if (s_listen_fd > max_fd) max_fd = s_listen_fd;
+
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        Request *r = &s_requests[i];
+        if (r->fd == -1) continue;
+        FD_SET(r->fd, r->out ? writefds : readfds);
+        if (r->fd > max_fd) max_fd = r->fd;
+    }
+    return max_fd;
+}
+
+void Admin_Service(fd_set *readfds, fd_set *writefds, time_t now,
+                   const User users[], int user_count,
+                   const Room rooms[], int room_count)
+{
+    if (s_listen_fd < 0) return;
+
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        Request *r = &s_requests[i];
+        if (r->fd == -1) continue;
+
+        int done;
+        if (r->out == NULL && FD_ISSET(r->fd, readfds)) {
+            done = OnReadable(r, now, users, user_count, rooms, room_count);
+            if (done == 0 && r->out) done = OnWritable(r);
+        } else if (r->out && FD_ISSET(r->fd, writefds)) {
+            done = OnWritable(r);
+        } else {
+            done = now - r->started > ADMIN_TIMEOUT ? -1 : 0;
+        }
+        if (done < 0) EndRequest(r);
+    }
+
+    if (!FD_ISSET(s_listen_fd, readfds)) return;
+    for (;;) {
+        int fd = accept(s_listen_fd, NULL, NULL);
+        if (fd < 0) return;
+
+        Request *slot = NULL;
+        for (int i = 0; i < ADMIN_MAX_CONNS && !slot; i++) {
+            if (s_requests[i].fd == -1) slot = &s_requests[i];
+        }
+        if (slot == NULL) {
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        slot->fd      = fd;
+        slot->started = now;
+        slot->req_len = 0;
+        slot->out     = NULL;
+    }
+}
+
+#endif /* _WIN32 */
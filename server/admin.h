@@ -0,0 +1,59 @@
+/*
+ * admin.h – Operator control socket for War3 Lobby Server.
+ *
+ * A Unix-domain stream socket (owner-only) that answers one text
+ * command per connection and closes:
+ *
+ *   conns          every connection: traffic in and out, send queue,
+ *                  RTT, heartbeat age
+ *   rooms          every room: members, lobby fanout, reflector traffic
+ *   top [N]        the N heaviest connections and rooms (default 10)
+ *   help
+ *
+ *   $ echo top | socat - UNIX-CONNECT:war3-lobby-12000.sock
+ *
+ * Like the metrics exporter it is served from the lobby's select()
+ * loop: the counters it reports live inline in User, SendQ and Room,
+ * so answering is a walk over the tables with no locking, and every
+ * socket is non-blocking.  Not available on Windows.
+ */
+
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include "user.h"
+#include "room.h"
+
+#include <time.h>
+
+#ifdef _WIN32
+#   include <winsock2.h>
+#else
+#   include <sys/select.h>
+#endif
+
+#define ADMIN_MAX_CONNS   4
+#define ADMIN_REQ_MAX     256       /* command line, bytes */
+#define ADMIN_TIMEOUT     5         /* seconds per request */
+#define ADMIN_TOP_DEFAULT 10
+
+/* Socket path for a lobby on `port`, in the working directory. */
+#define ADMIN_PATH_FMT    "war3-lobby-%d.sock"
+
+/* Listen on `path` (a stale socket file is replaced).  Returns 0 on
+ * success, -1 on failure or where unsupported. */
+int  Admin_Open(const char *path);
+
+/* Close the listener and any request in progress; removes the file. */
+void Admin_Close(void);
+
+/* Add the admin sockets to the select() sets; returns the new highest
+ * fd. */
+int  Admin_AddFds(fd_set *readfds, fd_set *writefds, int max_fd);
+
+/* Accept, read commands, answer and time out requests. */
+void Admin_Service(fd_set *readfds, fd_set *writefds, time_t now,
+                   const User users[], int user_count,
+                   const Room rooms[], int room_count);
+
+#endif /* ADMIN_H */
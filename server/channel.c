@@ -0,0 +1,245 @@
+/*
+ * channel.c – Lobby chat channel implementation.
+ */
+
+#include "channel.h"
+#include "metrics.h"
+#include "../common/alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int    used;
+    char   name[MAX_CHANNEL_NAME];
+
+    User **members;              /* explicit membership set             */
+    int    count;
+    int    cap;
+
+    /* Messages posted since the current fanout pass started. */
+    OutFrame *backlog[CHANNEL_MAX_BACKLOG];
+    int       backlog_count;
+
+    /* The fanout pass in progress: members[0 .. cursor) have received
+     * every frame in batch[]. */
+    OutFrame *batch[CHANNEL_MAX_BACKLOG];
+    int       batch_count;
+    int       cursor;
+} Channel;
+
+static Channel s_channels[MAX_CHANNELS];
+static int     s_next_tick;      /* round-robin start for fairness */
+
+/* ------------------------------------------------------------------ */
+/*  Internal helpers                                                  */
+/* ------------------------------------------------------------------ */
+
+static int FindChannel(const char *name)
+{
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        if (s_channels[i].used && strcmp(s_channels[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* Index into user->chan_ids of channel `c`, or -1. */
+static int UserSlotOf(const User *user, int c)
+{
+    for (int k = 0; k < MAX_USER_CHANNELS; k++) {
+        if (user->chan_ids[k] == c) return k;
+    }
+    return -1;
+}
+
+/* Place `user` at position `pos` of channel `c` and update its index. */
+static void PutMember(Channel *ch, int c, int pos, User *user)
+{
+    ch->members[pos] = user;
+    user->chan_pos[UserSlotOf(user, c)] = pos;
+}
+
+static void DestroyChannel(Channel *ch)
+{
+    for (int i = 0; i < ch->backlog_count; i++) OutFrame_Release(ch->backlog[i]);
+    for (int i = 0; i < ch->batch_count; i++)   OutFrame_Release(ch->batch[i]);
+    Alloc_Free(ch->members);
+    memset(ch, 0, sizeof(*ch));
+}
+
+/* Remove the member at `pos`, keeping [0, cursor) = "already served". */
+static void RemoveMemberAt(Channel *ch, int c, int pos)
+{
+    int last = ch->count - 1;
+
+    if (pos < ch->cursor) {
+        /* Fill the hole with the last served member, then fill that
+         * spot with the last member overall. */
+        int served = ch->cursor - 1;
+        if (pos != served) PutMember(ch, c, pos, ch->members[served]);
+        if (served != last) PutMember(ch, c, served, ch->members[last]);
+        ch->cursor--;
+    } else if (pos != last) {
+        PutMember(ch, c, pos, ch->members[last]);
+    }
+    ch->count--;
+}
+
+static void LeaveSlot(User *user, int k)
+{
+    int      c  = user->chan_ids[k];
+    Channel *ch = &s_channels[c];
+
+    RemoveMemberAt(ch, c, user->chan_pos[k]);
+    user->chan_ids[k] = -1;
+    user->chan_pos[k] = -1;
+
+    if (ch->count == 0) DestroyChannel(ch);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+void Channels_Init(void)
+{
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        if (s_channels[i].used) DestroyChannel(&s_channels[i]);
+    }
+    memset(s_channels, 0, sizeof(s_channels));
+    s_next_tick = 0;
+}
+
+int Channels_Join(User *user, const char *name)
+{
+    int c = FindChannel(name);
+    if (c != -1 && UserSlotOf(user, c) != -1) return CHANNEL_ERR_MEMBER;
+
+    int k = UserSlotOf(user, -1);
+    if (k == -1) return CHANNEL_ERR_USER_LIMIT;
+
+    if (c == -1) {
+        for (int i = 0; i < MAX_CHANNELS; i++) {
+            if (!s_channels[i].used) { c = i; break; }
+        }
+        if (c == -1) return CHANNEL_ERR_NO_SLOTS;
+
+        s_channels[c].used = 1;
+        strncpy(s_channels[c].name, name, MAX_CHANNEL_NAME - 1);
+    }
+
+    Channel *ch = &s_channels[c];
+    if (ch->count >= CHANNEL_MAX_MEMBERS) return CHANNEL_ERR_FULL;
+
+    if (ch->count == ch->cap) {
+        int    ncap = ch->cap ? ch->cap * 2 : 16;
+        User **nm   = (User **)Alloc_Realloc(ALLOC_LOBBY, ch->members,
+                                             ncap * sizeof(User *));
+        if (nm == NULL) {
+            if (ch->count == 0) DestroyChannel(ch);
+            return CHANNEL_ERR_NO_SLOTS;
+        }
+        ch->members = nm;
+        ch->cap     = ncap;
+    }
+
+    user->chan_ids[k] = c;
+    PutMember(ch, c, ch->count++, user);
+    return CHANNEL_OK;
+}
+
+int Channels_Leave(User *user, const char *name)
+{
+    int c = FindChannel(name);
+    int k = (c != -1) ? UserSlotOf(user, c) : -1;
+    if (k == -1) return CHANNEL_ERR_MEMBER;
+
+    LeaveSlot(user, k);
+    return CHANNEL_OK;
+}
+
+void Channels_LeaveAll(User *user)
+{
+    for (int k = 0; k < MAX_USER_CHANNELS; k++) {
+        if (user->chan_ids[k] != -1) LeaveSlot(user, k);
+    }
+}
+
+int Channels_MemberCount(const char *name)
+{
+    int c = FindChannel(name);
+    return (c != -1) ? s_channels[c].count : 0;
+}
+
+int Channels_Post(User *user, const char *name, OutFrame *frame,
+                  time_t now)
+{
+    int c = FindChannel(name);
+    if (c == -1 || UserSlotOf(user, c) == -1) return CHANNEL_ERR_MEMBER;
+
+    /* Token bucket refill. */
+    if (now > user->chan_refill) {
+        long add = (long)(now - user->chan_refill) * CHANNEL_RATE_PER_SEC;
+        user->chan_tokens = (add >= CHANNEL_RATE_BURST - user->chan_tokens)
+                          ? CHANNEL_RATE_BURST
+                          : user->chan_tokens + (int)add;
+        user->chan_refill = now;
+    }
+    if (user->chan_tokens <= 0) return CHANNEL_ERR_RATE;
+
+    Channel *ch = &s_channels[c];
+    if (ch->backlog_count >= CHANNEL_MAX_BACKLOG) return CHANNEL_ERR_BACKLOG;
+
+    user->chan_tokens--;
+    OutFrame_Retain(frame);
+    ch->backlog[ch->backlog_count++] = frame;
+    Metrics_RecordFanout(MET_FANOUT_CHANNEL, (uint32_t)ch->count);
+    return CHANNEL_OK;
+}
+
+int Channels_Tick(void)
+{
+    int budget  = CHANNEL_FANOUT_BUDGET;
+    int pending = 0;
+
+    for (int n = 0; n < MAX_CHANNELS; n++) {
+        int      c  = (s_next_tick + n) % MAX_CHANNELS;
+        Channel *ch = &s_channels[c];
+        if (!ch->used) continue;
+
+        while (budget > 0) {
+            /* Start a new pass with everything posted so far. */
+            if (ch->batch_count == 0) {
+                if (ch->backlog_count == 0) break;
+                memcpy(ch->batch, ch->backlog,
+                       ch->backlog_count * sizeof(OutFrame *));
+                ch->batch_count   = ch->backlog_count;
+                ch->backlog_count = 0;
+                ch->cursor        = 0;
+            }
+
+            while (ch->cursor < ch->count && budget >= ch->batch_count) {
+                SendQ *q = &ch->members[ch->cursor]->sendq;
+                for (int i = 0; i < ch->batch_count; i++) {
+                    SendQ_Push(q, ch->batch[i]);
+                }
+                budget -= ch->batch_count;
+                ch->cursor++;
+            }
+
+            if (ch->cursor < ch->count) break;   /* out of budget */
+
+            for (int i = 0; i < ch->batch_count; i++) {
+                OutFrame_Release(ch->batch[i]);
+            }
+            ch->batch_count = 0;
+        }
+
+        if (ch->batch_count > 0 || ch->backlog_count > 0) {
+            if (!pending) s_next_tick = c;   /* resume here next time */
+            pending = 1;
+        }
+    }
+
+    return pending;
+}
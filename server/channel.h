@@ -0,0 +1,72 @@
+/*
+ * channel.h – Named lobby chat channels for War3 Lobby Server.
+ *
+ * Unlike room chat, which scans the whole user table, every channel keeps
+ * an explicit member array and each user remembers its position in it,
+ * so join and leave are O(1).
+ *
+ * Posting a message does not touch the members.  The message is framed
+ * once into an OutFrame and appended to the channel's backlog; fanout
+ * happens in Channels_Tick, once per event-loop iteration, under a global
+ * budget of frame pushes.  A large channel that exceeds the budget is
+ * resumed from a cursor on the next iteration, so one busy channel
+ * cannot stretch a loop iteration without bound.
+ */
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <time.h>
+#include "user.h"
+#include "sendq.h"
+
+#define MAX_CHANNELS           32
+#define MAX_CHANNEL_NAME       32
+#define CHANNEL_MAX_MEMBERS    5000    /* per-channel member cap          */
+#define CHANNEL_MAX_BACKLOG    64      /* messages waiting for fanout     */
+#define CHANNEL_FANOUT_BUDGET  8192    /* frame pushes per tick, total    */
+
+/* Per-user chat rate limit: a burst of CHANNEL_RATE_BURST messages,
+ * refilled at CHANNEL_RATE_PER_SEC messages per second. */
+#define CHANNEL_RATE_BURST     5
+#define CHANNEL_RATE_PER_SEC   1
+
+/* Return codes for Channels_Join / Channels_Post. */
+#define CHANNEL_OK              0
+#define CHANNEL_ERR_MEMBER     -1   /* already / not a member            */
+#define CHANNEL_ERR_USER_LIMIT -2   /* user is in too many channels      */
+#define CHANNEL_ERR_FULL       -3   /* channel member cap reached        */
+#define CHANNEL_ERR_NO_SLOTS   -4   /* MAX_CHANNELS channels exist       */
+#define CHANNEL_ERR_RATE       -5   /* sender is rate limited            */
+#define CHANNEL_ERR_BACKLOG    -6   /* fanout backlog is full            */
+
+/* Reset all channels. */
+void Channels_Init(void);
+
+/* Join (creating the channel on first use).  Returns a CHANNEL_* code. */
+int Channels_Join(User *user, const char *name);
+
+/* Leave one channel.  Empty channels are destroyed. */
+int Channels_Leave(User *user, const char *name);
+
+/* Leave every channel (on disconnect). */
+void Channels_LeaveAll(User *user);
+
+/* Number of members in the named channel, 0 if it does not exist. */
+int Channels_MemberCount(const char *name);
+
+/*
+ * Queue a pre-framed message for fanout to every member of the channel
+ * (the sender included).  The channel takes its own frame reference.
+ * Applies the sender's rate limit.  Returns a CHANNEL_* code.
+ */
+int Channels_Post(User *user, const char *name, OutFrame *frame,
+                  time_t now);
+
+/*
+ * Fan out queued messages, pushing at most CHANNEL_FANOUT_BUDGET frames.
+ * Returns non-zero if work is left over for the next iteration.
+ */
+int Channels_Tick(void);
+
+#endif /* CHANNEL_H */
@@ -0,0 +1,64 @@
+/*
+ * clock.c – Monotonic time source implementation.
+ */
+
+#ifndef _WIN32
+#   define _POSIX_C_SOURCE 199309L   /* clock_gettime under -std=c11 */
+#endif
+
+#include "clock.h"
+
+#ifdef _WIN32
+#   include <windows.h>
+#endif
+
+static uint64_t (*s_source)(void *ctx);
+static void      *s_source_ctx;
+
+uint64_t Clock_NowUs(void)
+{
+    if (s_source) return s_source(s_source_ctx);
+
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000u +
+           (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000u /
+           (uint64_t)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+#endif
+}
+
+uint64_t Clock_NowNs(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000u +
+           (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000u /
+           (uint64_t)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+time_t Clock_Wall(void)
+{
+    if (s_source) return (time_t)(s_source(s_source_ctx) / 1000000u);
+    return time(NULL);
+}
+
+void Clock_SetSource(uint64_t (*now_us)(void *ctx), void *ctx)
+{
+    s_source     = now_us;
+    s_source_ctx = ctx;
+}
@@ -0,0 +1,38 @@
+/*
+ * clock.h – Time sources for War3 Lobby Server.
+ *
+ * Lobby timeouts are measured in whole seconds with Clock_Wall;
+ * anything that reports latency uses Clock_NowUs / Clock_NowNs, which
+ * never jump with the wall clock.
+ *
+ * The simulator (sim.h) replaces the first two with virtual time so
+ * the lobby runs on its schedule rather than the machine's.
+ * Clock_NowNs always reads the hardware clock: it times code, and
+ * simulated time does not pass while code runs.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* Microseconds since an arbitrary fixed point (the source's epoch when
+ * one is installed). */
+uint64_t Clock_NowUs(void);
+
+/* Nanoseconds since an arbitrary fixed point, for timing short
+ * sections.  Not affected by Clock_SetSource. */
+uint64_t Clock_NowNs(void);
+
+/* Seconds since the Unix epoch, as time(NULL), for lobby timeouts. */
+time_t Clock_Wall(void);
+
+/*
+ * Take Clock_NowUs and Clock_Wall from `now_us` (microseconds since
+ * the Unix epoch) instead of the system; NULL restores the system
+ * clocks.  Install before Log_Init and before other threads start.
+ */
+void Clock_SetSource(uint64_t (*now_us)(void *ctx), void *ctx);
+
+#endif /* CLOCK_H */
@@ -0,0 +1,266 @@
+/*
+ * exporter.c – Prometheus endpoint (see exporter.h).
+ */
+
+#include "exporter.h"
+#include "metrics.h"
+#include "log.h"
+#include "../common/alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <ws2tcpip.h>
+#   define CLOSE_SOCKET(s) closesocket(s)
+#else
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#   include <netinet/in.h>
+#   include <arpa/inet.h>
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <errno.h>
+#   define CLOSE_SOCKET(s) close(s)
+#endif
+
+#ifndef MSG_NOSIGNAL
+#   define MSG_NOSIGNAL 0
+#endif
+
+typedef struct {
+    int    fd;                    /* -1 if unused */
+    time_t started;
+    char   req[EXPORTER_REQ_MAX];
+    int    req_len;
+    char  *out;                   /* response, NULL until rendered */
+    size_t out_len;
+    size_t out_off;
+} Scrape;
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+static int    s_listen_fd = -1;
+static Scrape s_scrapes[EXPORTER_MAX_CONNS];
+
+static void SetNonBlocking(int fd)
+{
+#ifdef _WIN32
+    u_long mode = 1;
+    ioctlsocket((SOCKET)fd, FIONBIO, &mode);
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+static int WouldBlock(void)
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+static void EndScrape(Scrape *s)
+{
+    CLOSE_SOCKET(s->fd);
+    Alloc_Free(s->out);
+    s->fd  = -1;
+    s->out = NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Requests                                                          */
+/* ------------------------------------------------------------------ */
+
+static void Respond(Scrape *s, const char *status, const char *body,
+                    size_t body_len)
+{
+    char head[160];
+    int  head_len = snprintf(head, sizeof(head),
+        "HTTP/1.0 %s\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n", status, body_len);
+
+    s->out = (char *)Alloc_Malloc(ALLOC_MONITOR, (size_t)head_len + body_len);
+    if (s->out == NULL) return;
+    memcpy(s->out, head, (size_t)head_len);
+    memcpy(s->out + head_len, body, body_len);
+    s->out_len = (size_t)head_len + body_len;
+    s->out_off = 0;
+}
+
+/* The request head is complete: render the answer. */
+static void HandleRequest(Scrape *s, ExporterRefreshFn refresh, void *ctx)
+{
+    if (strncmp(s->req, "GET /metrics ", 13) != 0 &&
+        strncmp(s->req, "GET /metrics?", 13) != 0) {
+        static const char nf[] = "not found, try /metrics\n";
+        Respond(s, "404 Not Found", nf, sizeof(nf) - 1);
+        return;
+    }
+
+    if (refresh) refresh(ctx);
+
+    /* Other threads keep counting, so the size can creep up between
+     * measuring and rendering: leave some room and retry if short. */
+    size_t cap  = Metrics_Render(NULL, 0) + 1024;
+    char  *body = NULL;
+    for (;;) {
+        char *grown = (char *)Alloc_Realloc(ALLOC_MONITOR, body, cap);
+        if (grown == NULL) {
+            Alloc_Free(body);
+            return;
+        }
+        body = grown;
+        size_t len = Metrics_Render(body, cap);
+        if (len < cap) {
+            Respond(s, "200 OK", body, len);
+            break;
+        }
+        cap = len + 1024;
+    }
+    Alloc_Free(body);
+}
+
+/* Returns -1 when the scrape is finished with. */
+static int OnReadable(Scrape *s, ExporterRefreshFn refresh, void *ctx)
+{
+    int space = EXPORTER_REQ_MAX - 1 - s->req_len;
+    if (space <= 0) return -1;
+
+    int n = (int)recv(s->fd, s->req + s->req_len, space, 0);
+    if (n < 0) return WouldBlock() ? 0 : -1;
+    if (n == 0) return -1;
+    s->req_len += n;
+    s->req[s->req_len] = '\0';
+
+    if (strstr(s->req, "\r\n\r\n") == NULL && strstr(s->req, "\n\n") == NULL)
+        return 0;
+    HandleRequest(s, refresh, ctx);
+    return s->out ? 0 : -1;
+}
+
+/* Returns -1 when the scrape is finished with. */
+static int OnWritable(Scrape *s)
+{
+    while (s->out_off < s->out_len) {
+        int n = (int)send(s->fd, s->out + s->out_off,
+                          (int)(s->out_len - s->out_off), MSG_NOSIGNAL);
+        if (n < 0) return WouldBlock() ? 0 : -1;
+        s->out_off += (size_t)n;
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int Exporter_Open(int port)
+{
+    for (int i = 0; i < EXPORTER_MAX_CONNS; i++) {
+        s_scrapes[i].fd  = -1;
+        s_scrapes[i].out = NULL;
+    }
+
+    int fd = (int)socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((uint16_t)port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, EXPORTER_MAX_CONNS) < 0) {
+        LOG_ERROR("[metrics] cannot listen on tcp port %d", port);
+        CLOSE_SOCKET(fd);
+        return -1;
+    }
+    SetNonBlocking(fd);
+
+    s_listen_fd = fd;
+    LOG_INFO("[metrics] serving http://*:%d/metrics", port);
+    return 0;
+}
+
+void Exporter_Close(void)
+{
+    for (int i = 0; i < EXPORTER_MAX_CONNS; i++) {
+        if (s_scrapes[i].fd != -1) EndScrape(&s_scrapes[i]);
+    }
+    if (s_listen_fd >= 0) {
+        CLOSE_SOCKET(s_listen_fd);
+        s_listen_fd = -1;
+    }
+}
+
+int Exporter_AddFds(fd_set *readfds, fd_set *writefds, int max_fd)
+{
+    if (s_listen_fd < 0) return max_fd;
+
+    FD_SET(s_listen_fd, readfds);
+    if (s_listen_fd > max_fd) max_fd = s_listen_fd;
+
+    for (int i = 0; i < EXPORTER_MAX_CONNS; i++) {
+        Scrape *s = &s_scrapes[i];
+        if (s->fd == -1) continue;
+        FD_SET(s->fd, s->out ? writefds : readfds);
+        if (s->fd > max_fd) max_fd = s->fd;
+    }
+    return max_fd;
+}
+
+void Exporter_Service(fd_set *readfds, fd_set *writefds,
+                      time_t now, ExporterRefreshFn refresh, void *ctx)
+{
+    if (s_listen_fd < 0) return;
+
+    for (int i = 0; i < EXPORTER_MAX_CONNS; i++) {
+        Scrape *s = &s_scrapes[i];
+        if (s->fd == -1) continue;
+
+        int done;
+        if (s->out == NULL && FD_ISSET(s->fd, readfds)) {
+            done = OnReadable(s, refresh, ctx);
+            /* Usually the whole answer fits the socket buffer. */
+            if (done == 0 && s->out) done = OnWritable(s);
+        } else if (s->out && FD_ISSET(s->fd, writefds)) {
+            done = OnWritable(s);
+        } else {
+            done = now - s->started > EXPORTER_TIMEOUT ? -1 : 0;
+        }
+        if (done < 0) EndScrape(s);
+    }
+
+    if (!FD_ISSET(s_listen_fd, readfds)) return;
+    for (;;) {
+        int fd = (int)accept(s_listen_fd, NULL, NULL);
+        if (fd < 0) return;
+
+        Scrape *slot = NULL;
+        for (int i = 0; i < EXPORTER_MAX_CONNS && !slot; i++) {
+            if (s_scrapes[i].fd == -1) slot = &s_scrapes[i];
+        }
+        if (slot == NULL) {
+            CLOSE_SOCKET(fd);
+            continue;
+        }
+        SetNonBlocking(fd);
+        slot->fd      = fd;
+        slot->started = now;
+        slot->req_len = 0;
+        slot->out     = NULL;
+    }
+}
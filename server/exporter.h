@@ -0,0 +1,44 @@
+/*
+ * exporter.h – Prometheus endpoint for War3 Lobby Server.
+ *
+ * A minimal HTTP/1.0 server for GET /metrics (see metrics.h), run from
+ * the lobby's select() loop rather than on a thread of its own: every
+ * socket is non-blocking, a scrape is rendered into memory in one go
+ * and written out as the socket allows, and slow or idle scrapers are
+ * dropped after EXPORTER_TIMEOUT seconds.  Off unless a metrics port is
+ * given on the command line.
+ */
+
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <time.h>
+
+#ifdef _WIN32
+#   include <winsock2.h>
+#else
+#   include <sys/select.h>
+#endif
+
+#define EXPORTER_MAX_CONNS   8
+#define EXPORTER_REQ_MAX     2048      /* request head, bytes */
+#define EXPORTER_TIMEOUT     5         /* seconds per scrape */
+
+/* Called right before rendering, to refresh gauges. */
+typedef void (*ExporterRefreshFn)(void *ctx);
+
+/* Listen on `port`.  Returns 0 on success, -1 on failure. */
+int Exporter_Open(int port);
+
+/* Close the listener and every scrape in progress. */
+void Exporter_Close(void);
+
+/* Add the exporter's sockets to the select() sets; returns the new
+ * highest fd. */
+int Exporter_AddFds(fd_set *readfds, fd_set *writefds, int max_fd);
+
+/* Accept, read requests, answer and time out scrapes. */
+void Exporter_Service(fd_set *readfds, fd_set *writefds,
+                      time_t now, ExporterRefreshFn refresh, void *ctx);
+
+#endif /* EXPORTER_H */
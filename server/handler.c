@@ -6,8 +6,22 @@
  */
 
 #include "handler.h"
+#include "match.h"
+#include "channel.h"
+#include "presence.h"
+#include "reflector.h"
+#include "relay.h"
+#include "mapstore.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "log.h"
+#include "trace.h"
+#include "clock.h"
+#include "jsonmem.h"
+#include "../common/launch.h"
 #include "../common/protocol.h"
 #include "../common/message.h"
+#include "../common/alloc.h"
 #include "../third_party/cJSON/cJSON.h"
 
 #include <stdio.h>
@@ -18,60 +32,105 @@
 #ifdef _WIN32
 #   include <winsock2.h>
 #   include <ws2tcpip.h>
-    typedef int ssize_t;
 #else
-#   include <sys/socket.h>
-#   include <unistd.h>
+#   include <arpa/inet.h>
 #endif
 
+/* A whisper is refused while the recipient has more than this many
+ * bytes waiting to be written, so one slow reader can't pile up. */
+#define WHISPER_MAX_QUEUED (64 * 1024)
+
+/* punch_start asks both ends to start probing this long after it is
+ * sent, so they open their NAT mappings at about the same time. */
+#define PUNCH_DELAY_MS 500
+
 /* ================================================================== */
 /*  Internal helpers                                                   */
 /* ================================================================== */
 
 /*
- * Send a framed JSON string to a specific socket fd.
- * Handles partial sends.
+ * Queue a framed JSON string on a single user's send queue.
+ * The event loop flushes it after the current message is handled.
+ */
+static void SendToUser(User *user, const char *json_str)
+{
+    OutFrame *frame = OutFrame_Create(json_str);
+    if (frame == NULL) return;
+
+    SendQ_Push(&user->sendq, frame);
+    OutFrame_Release(frame);
+}
+
+/*
+ * Queue one JSON string for every member of `room` except `skip`
+ * (may be NULL).  The frame is encoded once and shared by all members.
  */
-static void SendToFd(int fd, const char *json_str)
+static void SendToRoom(Room *room, const char *json_str,
+                       const User *skip)
 {
-    uint32_t frame_len = 0;
-    uint8_t *frame = Protocol_Frame(json_str, &frame_len);
+    OutFrame *frame = OutFrame_Create(json_str);
     if (frame == NULL) return;
 
     uint32_t sent = 0;
-    while (sent < frame_len) {
-        int n = send(fd, (const char *)(frame + sent),
-                     (int)(frame_len - sent), 0);
-        if (n <= 0) break;          /* connection error – give up */
-        sent += (uint32_t)n;
+    for (int i = 0; i < room->member_count; i++) {
+        if (room->members[i] != skip) {
+            SendQ_Push(&room->members[i]->sendq, frame);
+            sent++;
+        }
     }
+    Metrics_RecordFanout(MET_FANOUT_ROOM, sent);
+    TRACE_FANOUT(room->id, sent);
+
+    room->fanout_frames += sent;
+    room->fanout_bytes  += (uint64_t)sent * frame->len;
+
+    OutFrame_Release(frame);
+}
 
-    free(frame);
+/*
+ * Add what is known about `user`'s addresses to `obj`: the LAN address
+ * it reported at login and the public UDP endpoint the reflector saw.
+ * Fields that are not known yet are left out.
+ */
+static void AddEndpoint(cJSON *obj, const User *user)
+{
+    if (user->local_ip[0] != '\0') {
+        cJSON_AddStringToObject(obj, "local_ip", user->local_ip);
+    }
+    if (user->udp_port != 0) {
+        char ip[MAX_IP_STR];
+        struct in_addr a;
+        a.s_addr = user->udp_addr;
+        inet_ntop(AF_INET, &a, ip, sizeof(ip));
+        cJSON_AddStringToObject(obj, "public_ip", ip);
+        cJSON_AddNumberToObject(obj, "public_port", ntohs(user->udp_port));
+    }
 }
 
 /*
  * Build and send a room_peers message to every user in the given room.
  *
  * JSON format:
- *   {"type":"room_peers","peers":[{"username":"p1","ip":"1.2.3.4"}, ...]}
+ *   {"type":"room_peers","peers":[{"username":"p1","ip":"1.2.3.4",
+ *     "local_ip":"192.168.1.5","public_ip":"1.2.3.4","public_port":6112},
+ *     ...]}
  *
  * All peers in the room are included (the client filters itself out).
  */
-static void BroadcastRoomPeers(int room_id,
-                                User users[], int user_count)
+void Handler_BroadcastRoomPeers(Room *room)
 {
     /* Build the peers JSON array. */
     cJSON *root  = cJSON_CreateObject();
     cJSON *peers = cJSON_AddArrayToObject(root, "peers");
     cJSON_AddStringToObject(root, "type", MSG_ROOM_PEERS);
 
-    for (int i = 0; i < user_count; i++) {
-        if (users[i].fd != -1 && users[i].room_id == room_id) {
-            cJSON *peer = cJSON_CreateObject();
-            cJSON_AddStringToObject(peer, "username", users[i].username);
-            cJSON_AddStringToObject(peer, "ip", users[i].ip);
-            cJSON_AddItemToArray(peers, peer);
-        }
+    for (int i = 0; i < room->member_count; i++) {
+        const User *member = room->members[i];
+        cJSON *peer = cJSON_CreateObject();
+        cJSON_AddStringToObject(peer, "username", member->username);
+        cJSON_AddStringToObject(peer, "ip", member->ip);
+        AddEndpoint(peer, member);
+        cJSON_AddItemToArray(peers, peer);
     }
 
     char *json_str = cJSON_PrintUnformatted(root);
@@ -80,19 +139,14 @@ static void BroadcastRoomPeers(int room_id,
     if (json_str == NULL) return;
 
     /* Send to every user in the room. */
-    for (int i = 0; i < user_count; i++) {
-        if (users[i].fd != -1 && users[i].room_id == room_id) {
-            SendToFd(users[i].fd, json_str);
-        }
-    }
-
-    free(json_str);
+    SendToRoom(room, json_str, NULL);
+    cJSON_free(json_str);
 }
 
 /*
- * Send a simple JSON error message to a single fd.
+ * Send a simple JSON error message to a single user.
  */
-static void SendError(int fd, const char *message)
+static void SendError(User *user, const char *message)
 {
     cJSON *root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "type", MSG_ERROR);
@@ -102,8 +156,166 @@ static void SendError(int fd, const char *message)
     cJSON_Delete(root);
 
     if (json_str) {
-        SendToFd(fd, json_str);
-        free(json_str);
+        SendToUser(user, json_str);
+        cJSON_free(json_str);
+    }
+}
+
+/*
+ * Tell `user` to prefetch the map of `host`'s game from the map store:
+ *
+ *   {"type":"map_available","host":"p1","map":"Maps\\Download\\x.w3x",
+ *    "sha1":"...","size":123,"chunk_size":262144,"chunks":1,"port":12002}
+ *
+ * "map" is the path in the host's game, which is where War3 will look.
+ */
+static void SendMapAvailable(User *user, const User *host, const MapInfo *map)
+{
+    cJSON *msg = cJSON_CreateObject();
+    cJSON_AddStringToObject(msg, "type", MSG_MAP_AVAILABLE);
+    cJSON_AddStringToObject(msg, "host", host->username);
+    cJSON_AddStringToObject(msg, "map", host->game.map_path);
+    cJSON_AddStringToObject(msg, "sha1", map->sha1);
+    cJSON_AddNumberToObject(msg, "size", map->size);
+    cJSON_AddNumberToObject(msg, "chunk_size", MAPSTORE_CHUNK);
+    cJSON_AddNumberToObject(msg, "chunks", Mapstore_Chunks(map->size));
+    cJSON_AddNumberToObject(msg, "port", Mapstore_Port());
+    char *s = cJSON_PrintUnformatted(msg);
+    cJSON_Delete(msg);
+    if (s) { SendToUser(user, s); cJSON_free(s); }
+}
+
+/* A joiner prefetches the map of a game already announced in the room. */
+static void OfferRoomMap(User *user, const Room *room)
+{
+    time_t      now  = Clock_Wall();
+    const User *host = Rooms_Host(room, now);
+    MapInfo     map;
+    if (host && host != user && Users_LiveGame(host, now) &&
+        Mapstore_Find(host->game.map_crc, host->game.map_path, &map))
+        SendMapAvailable(user, host, &map);
+}
+
+/*
+ * Put `sender` into `room` and tell everyone about it:
+ * room_joined to the joiner, player_joined to the others, then the
+ * updated room_peers to the whole room.  The caller has already checked
+ * that the room has a free slot.
+ */
+static void JoinRoom(User *sender, Room *room)
+{
+    Rooms_AddMember(room, sender);
+    Presence_Touch(sender->username);
+
+    LOG_INFO("[room] '%s' joined room %d '%s'",
+             sender->username, room->id, room->name);
+
+    /* Send room_joined to the joiner. */
+    {
+        cJSON *resp = cJSON_CreateObject();
+        cJSON_AddStringToObject(resp, "type", MSG_ROOM_JOINED);
+        cJSON_AddNumberToObject(resp, "room_id", room->id);
+        cJSON_AddStringToObject(resp, "name", room->name);
+        char *s = cJSON_PrintUnformatted(resp);
+        cJSON_Delete(resp);
+        if (s) { SendToUser(sender, s); cJSON_free(s); }
+    }
+
+    /* Send player_joined to other members. */
+    {
+        cJSON *note = cJSON_CreateObject();
+        cJSON_AddStringToObject(note, "type", MSG_PLAYER_JOINED);
+        cJSON_AddStringToObject(note, "username", sender->username);
+        cJSON_AddStringToObject(note, "ip", sender->ip);
+        char *s = cJSON_PrintUnformatted(note);
+        cJSON_Delete(note);
+        if (s) {
+            SendToRoom(room, s, sender);
+            cJSON_free(s);
+        }
+    }
+
+    /* Broadcast updated room_peers to everyone in the room. */
+    Handler_BroadcastRoomPeers(room);
+
+    /* Already running War3: show the room's games without waiting. */
+    Reflector_ReplayGames(sender, room);
+    OfferRoomMap(sender, room);
+}
+
+/*
+ * Create a room owned by `sender` and put the creator in it:
+ * room_created followed by room_peers (just the creator).
+ * Returns the new room, or NULL if no slot is free (error already sent).
+ */
+static Room *CreateRoom(User *sender, const char *rname, int max_p,
+                        Room rooms[], int room_count)
+{
+    Room *room = Rooms_Create(rooms, room_count, rname, max_p, sender->fd);
+    if (room == NULL) {
+        SendError(sender, "no room slots available");
+        return NULL;
+    }
+
+    /* Auto-join the creator. */
+    Rooms_AddMember(room, sender);
+    Presence_Touch(sender->username);
+
+    LOG_INFO("[room] '%s' created room %d '%s' (max %d)",
+             sender->username, room->id, room->name, room->max_players);
+
+    /* Send room_created to the creator. */
+    {
+        cJSON *resp = cJSON_CreateObject();
+        cJSON_AddStringToObject(resp, "type", MSG_ROOM_CREATED);
+        cJSON_AddNumberToObject(resp, "room_id", room->id);
+        cJSON_AddStringToObject(resp, "name", room->name);
+        char *s = cJSON_PrintUnformatted(resp);
+        cJSON_Delete(resp);
+        if (s) { SendToUser(sender, s); cJSON_free(s); }
+    }
+
+    /* Send room_peers to everyone in the room (just the creator for now). */
+    Handler_BroadcastRoomPeers(room);
+    return room;
+}
+
+/*
+ * Take `user` out of its room: player_left to the remaining members,
+ * then either destroy the now-empty room or broadcast the new peers.
+ */
+static void RemoveFromRoom(User *user, Room rooms[], int room_count)
+{
+    Room *room = Rooms_FindById(rooms, room_count, user->room_id);
+    user->in_game = 0;
+    if (room == NULL) {
+        user->room_id = -1;
+        return;
+    }
+    Rooms_RemoveMember(room, user);
+    Presence_Touch(user->username);
+
+    /* Send player_left to remaining members. */
+    if (user->username[0] != '\0') {
+        cJSON *note = cJSON_CreateObject();
+        cJSON_AddStringToObject(note, "type", MSG_PLAYER_LEFT);
+        cJSON_AddStringToObject(note, "username", user->username);
+        char *s = cJSON_PrintUnformatted(note);
+        cJSON_Delete(note);
+        if (s) {
+            SendToRoom(room, s, NULL);
+            cJSON_free(s);
+        }
+    }
+
+    /* If room is now empty, destroy it. */
+    if (room->member_count == 0) {
+        LOG_INFO("[room] room %d is empty, destroying", room->id);
+        Reflector_LogRoom(room);
+        Rooms_Destroy(rooms, room_count, room->id);
+    } else {
+        /* Broadcast updated room_peers to remaining members. */
+        Handler_BroadcastRoomPeers(room);
     }
 }
 
@@ -112,53 +324,75 @@ static void SendError(int fd, const char *message)
 /* ================================================================== */
 
 /* ---- login -------------------------------------------------------- */
-static void HandleLogin(cJSON *root, User *sender,
-                         User users[], int user_count)
+static void HandleLogin(cJSON *root, User *sender)
 {
     cJSON *j_name = cJSON_GetObjectItem(root, "username");
     if (!cJSON_IsString(j_name) || j_name->valuestring[0] == '\0') {
-        SendError(sender->fd, "missing or empty username");
+        SendError(sender, "missing or empty username");
         return;
     }
 
-    const char *name = j_name->valuestring;
+    /* Truncate first so the uniqueness check sees the stored name. */
+    char name[MAX_USERNAME];
+    strncpy(name, j_name->valuestring, MAX_USERNAME - 1);
+    name[MAX_USERNAME - 1] = '\0';
 
     /* Check if username is already taken by another connected user. */
-    User *existing = Users_FindByName(users, user_count, name);
+    User *existing = Users_FindByName(name);
     if (existing != NULL && existing != sender) {
         cJSON *resp = cJSON_CreateObject();
         cJSON_AddStringToObject(resp, "type", MSG_LOGIN_FAIL);
         cJSON_AddStringToObject(resp, "reason", "username already taken");
         char *s = cJSON_PrintUnformatted(resp);
         cJSON_Delete(resp);
-        if (s) { SendToFd(sender->fd, s); free(s); }
-        printf("[login] rejected '%s' from fd %d – name taken\n", name, sender->fd);
+        if (s) { SendToUser(sender, s); cJSON_free(s); }
+        LOG_INFO("[login] rejected '%s' from fd %d – name taken", name, sender->fd);
         return;
     }
 
-    /* Accept login. */
-    strncpy(sender->username, name, MAX_USERNAME - 1);
-    sender->username[MAX_USERNAME - 1] = '\0';
+    /* Optional LAN address, used by peers behind the same NAT. */
+    cJSON *j_local = cJSON_GetObjectItem(root, "local_ip");
+    struct in_addr local;
+    if (cJSON_IsString(j_local) &&
+        inet_pton(AF_INET, j_local->valuestring, &local) == 1)
+    {
+        inet_ntop(AF_INET, &local, sender->local_ip, sizeof(sender->local_ip));
+    } else {
+        sender->local_ip[0] = '\0';
+    }
+
+    /* Accept login (re-indexing if the connection logs in again). */
+    Users_UnindexName(sender);
+    Presence_Touch(sender->username);
+    memcpy(sender->username, name, MAX_USERNAME);
+    Users_IndexName(sender);
+    Presence_Touch(sender->username);
 
     cJSON *resp = cJSON_CreateObject();
     cJSON_AddStringToObject(resp, "type", MSG_LOGIN_OK);
     cJSON_AddStringToObject(resp, "username", sender->username);
+    cJSON_AddStringToObject(resp, "public_ip", sender->ip);
+    if (Reflector_Port() != 0) {
+        /* Credentials for the discovery reflector. */
+        cJSON_AddNumberToObject(resp, "udp_port", Reflector_Port());
+        cJSON_AddNumberToObject(resp, "udp_token",
+                                Reflector_IssueToken(sender));
+    }
     char *s = cJSON_PrintUnformatted(resp);
     cJSON_Delete(resp);
-    if (s) { SendToFd(sender->fd, s); free(s); }
+    if (s) { SendToUser(sender, s); cJSON_free(s); }
 
-    printf("[login] '%s' logged in from %s (fd %d)\n",
-           sender->username, sender->ip, sender->fd);
+    LOG_INFO("[login] '%s' logged in from %s (fd %d)",
+             sender->username, sender->ip, sender->fd);
 }
 
 /* ---- room_list ---------------------------------------------------- */
-static void HandleRoomList(User *sender,
-                            User users[], int user_count,
-                            Room rooms[], int room_count)
+static void HandleRoomList(User *sender, Room rooms[], int room_count)
 {
     RoomInfo list[MAX_ROOMS];
+    time_t   now = Clock_Wall();
     int n = Rooms_GetList(rooms, room_count, list, MAX_ROOMS,
-                          users, user_count);
+                          sender->rtt_ms, now);
 
     cJSON *root  = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "type", MSG_ROOM_LIST_RES);
@@ -170,24 +404,43 @@ static void HandleRoomList(User *sender,
         cJSON_AddStringToObject(item, "name",    list[i].name);
         cJSON_AddNumberToObject(item, "players", list[i].player_count);
         cJSON_AddNumberToObject(item, "max",     list[i].max_players);
+        if (list[i].latency_ms >= 0) {
+            cJSON_AddNumberToObject(item, "latency_ms", list[i].latency_ms);
+        }
+
+        /* Live state of the game being hosted, from its GAMEINFO. */
+        const Room *room = Rooms_FindById(rooms, room_count, list[i].id);
+        const User *host = room ? Rooms_Host(room, now) : NULL;
+        if (host != NULL && Users_LiveGame(host, now)) {
+            cJSON *game = cJSON_AddObjectToObject(item, "game");
+            cJSON_AddStringToObject(game, "name",  host->game.game_name);
+            cJSON_AddStringToObject(game, "map",   host->game.map_path);
+            cJSON_AddStringToObject(game, "host",  host->username);
+            cJSON_AddNumberToObject(game, "slots", host->game.slots_total);
+            if (host->game.players >= 0) {
+                cJSON_AddNumberToObject(game, "players", host->game.players);
+            }
+        }
         cJSON_AddItemToArray(arr, item);
     }
 
     char *s = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
-    if (s) { SendToFd(sender->fd, s); free(s); }
+    if (s) { SendToUser(sender, s); cJSON_free(s); }
 }
 
 /* ---- room_create -------------------------------------------------- */
 static void HandleRoomCreate(cJSON *root, User *sender,
-                              User users[], int user_count,
                               Room rooms[], int room_count)
 {
     if (sender->room_id != -1) {
-        SendError(sender->fd, "already in a room");
+        SendError(sender, "already in a room");
         return;
     }
 
+    /* Picking a room by hand leaves the matchmaking queue. */
+    Match_Cancel(sender);
+
     cJSON *j_name = cJSON_GetObjectItem(root, "name");
     cJSON *j_max  = cJSON_GetObjectItem(root, "max_players");
 
@@ -196,118 +449,92 @@ static void HandleRoomCreate(cJSON *root, User *sender,
     if (max_p < 1)                max_p = 1;
     if (max_p > MAX_ROOM_PLAYERS) max_p = MAX_ROOM_PLAYERS;
 
-    Room *room = Rooms_Create(rooms, room_count, rname, max_p, sender->fd);
-    if (room == NULL) {
-        SendError(sender->fd, "no room slots available");
-        return;
-    }
-
-    /* Auto-join the creator. */
-    sender->room_id = room->id;
-
-    printf("[room] '%s' created room %d '%s' (max %d)\n",
-           sender->username, room->id, room->name, room->max_players);
-
-    /* Send room_created to the creator. */
-    {
-        cJSON *resp = cJSON_CreateObject();
-        cJSON_AddStringToObject(resp, "type", MSG_ROOM_CREATED);
-        cJSON_AddNumberToObject(resp, "room_id", room->id);
-        cJSON_AddStringToObject(resp, "name", room->name);
-        char *s = cJSON_PrintUnformatted(resp);
-        cJSON_Delete(resp);
-        if (s) { SendToFd(sender->fd, s); free(s); }
-    }
-
-    /* Send room_peers to everyone in the room (just the creator for now). */
-    BroadcastRoomPeers(room->id, users, user_count);
+    CreateRoom(sender, rname, max_p, rooms, room_count);
 }
 
 /* ---- room_join ---------------------------------------------------- */
 static void HandleRoomJoin(cJSON *root, User *sender,
-                            User users[], int user_count,
                             Room rooms[], int room_count)
 {
     if (sender->room_id != -1) {
-        SendError(sender->fd, "already in a room");
+        SendError(sender, "already in a room");
         return;
     }
 
+    /* Picking a room by hand leaves the matchmaking queue. */
+    Match_Cancel(sender);
+
     cJSON *j_id = cJSON_GetObjectItem(root, "room_id");
     if (!cJSON_IsNumber(j_id)) {
-        SendError(sender->fd, "missing room_id");
+        SendError(sender, "missing room_id");
         return;
     }
 
     int room_id = j_id->valueint;
     Room *room = Rooms_FindById(rooms, room_count, room_id);
     if (room == NULL) {
-        SendError(sender->fd, "room not found");
+        SendError(sender, "room not found");
+        return;
+    }
+
+    if (room->member_count >= room->max_players) {
+        SendError(sender, "room is full");
         return;
     }
 
-    int cur = Users_CountInRoom(users, user_count, room_id);
-    if (cur >= room->max_players) {
-        SendError(sender->fd, "room is full");
+    JoinRoom(sender, room);
+}
+
+/* ---- quick_join --------------------------------------------------- */
+static void HandleQuickJoin(cJSON *root, User *sender,
+                             Room rooms[], int room_count)
+{
+    if (sender->room_id != -1) {
+        SendError(sender, "already in a room");
         return;
     }
 
-    /* Join the room. */
-    sender->room_id = room_id;
+    /* Picking a room by hand leaves the matchmaking queue. */
+    Match_Cancel(sender);
 
-    printf("[room] '%s' joined room %d '%s'\n",
-           sender->username, room->id, room->name);
+    cJSON *j_filter = cJSON_GetObjectItem(root, "filter");
+    cJSON *j_name   = cJSON_GetObjectItem(root, "name");
+    cJSON *j_max    = cJSON_GetObjectItem(root, "max_players");
+    cJSON *j_create = cJSON_GetObjectItem(root, "create");
 
-    /* Send room_joined to the joiner. */
-    {
-        cJSON *resp = cJSON_CreateObject();
-        cJSON_AddStringToObject(resp, "type", MSG_ROOM_JOINED);
-        cJSON_AddNumberToObject(resp, "room_id", room->id);
-        cJSON_AddStringToObject(resp, "name", room->name);
-        char *s = cJSON_PrintUnformatted(resp);
-        cJSON_Delete(resp);
-        if (s) { SendToFd(sender->fd, s); free(s); }
+    const char *filter = cJSON_IsString(j_filter) ? j_filter->valuestring : NULL;
+
+    Room *room = Rooms_PickQuickJoin(rooms, room_count, filter,
+                                     sender->rtt_ms, Clock_Wall());
+    if (room != NULL) {
+        JoinRoom(sender, room);
+        return;
     }
 
-    /* Send player_joined to other members. */
-    {
-        cJSON *note = cJSON_CreateObject();
-        cJSON_AddStringToObject(note, "type", MSG_PLAYER_JOINED);
-        cJSON_AddStringToObject(note, "username", sender->username);
-        cJSON_AddStringToObject(note, "ip", sender->ip);
-        char *s = cJSON_PrintUnformatted(note);
-        cJSON_Delete(note);
-        if (s) {
-            for (int i = 0; i < user_count; i++) {
-                if (users[i].fd != -1 &&
-                    users[i].room_id == room_id &&
-                    users[i].fd != sender->fd)
-                {
-                    SendToFd(users[i].fd, s);
-                }
-            }
-            free(s);
-        }
+    /* Nothing fits: create one unless the client asked us not to. */
+    if (cJSON_IsFalse(j_create)) {
+        SendError(sender, "no matching room");
+        return;
     }
 
-    /* Broadcast updated room_peers to everyone in the room. */
-    BroadcastRoomPeers(room_id, users, user_count);
+    const char *rname = cJSON_IsString(j_name) ? j_name->valuestring
+                      : (filter && filter[0]) ? filter : "Quick Game";
+    int max_p = cJSON_IsNumber(j_max) ? j_max->valueint : MAX_ROOM_PLAYERS;
+    if (max_p < 1)                max_p = 1;
+    if (max_p > MAX_ROOM_PLAYERS) max_p = MAX_ROOM_PLAYERS;
+
+    CreateRoom(sender, rname, max_p, rooms, room_count);
 }
 
 /* ---- room_leave --------------------------------------------------- */
-static void HandleRoomLeave(User *sender,
-                             User users[], int user_count,
-                             Room rooms[], int room_count)
+static void HandleRoomLeave(User *sender, Room rooms[], int room_count)
 {
     if (sender->room_id == -1) {
-        SendError(sender->fd, "not in a room");
+        SendError(sender, "not in a room");
         return;
     }
 
-    int room_id = sender->room_id;
-    sender->room_id = -1;
-
-    printf("[room] '%s' left room %d\n", sender->username, room_id);
+    LOG_INFO("[room] '%s' left room %d", sender->username, sender->room_id);
 
     /* Send room_left to the leaver. */
     {
@@ -315,49 +542,25 @@ static void HandleRoomLeave(User *sender,
         cJSON_AddStringToObject(resp, "type", MSG_ROOM_LEFT);
         char *s = cJSON_PrintUnformatted(resp);
         cJSON_Delete(resp);
-        if (s) { SendToFd(sender->fd, s); free(s); }
-    }
-
-    /* Send player_left to remaining members. */
-    {
-        cJSON *note = cJSON_CreateObject();
-        cJSON_AddStringToObject(note, "type", MSG_PLAYER_LEFT);
-        cJSON_AddStringToObject(note, "username", sender->username);
-        char *s = cJSON_PrintUnformatted(note);
-        cJSON_Delete(note);
-        if (s) {
-            for (int i = 0; i < user_count; i++) {
-                if (users[i].fd != -1 && users[i].room_id == room_id) {
-                    SendToFd(users[i].fd, s);
-                }
-            }
-            free(s);
-        }
+        if (s) { SendToUser(sender, s); cJSON_free(s); }
     }
 
-    /* If room is now empty, destroy it. */
-    int remaining = Users_CountInRoom(users, user_count, room_id);
-    if (remaining == 0) {
-        printf("[room] room %d is empty, destroying\n", room_id);
-        Rooms_Destroy(rooms, room_count, room_id);
-    } else {
-        /* Broadcast updated room_peers to remaining members. */
-        BroadcastRoomPeers(room_id, users, user_count);
-    }
+    RemoveFromRoom(sender, rooms, room_count);
 }
 
 /* ---- chat --------------------------------------------------------- */
 static void HandleChat(cJSON *root, User *sender,
-                        User users[], int user_count)
+                        Room rooms[], int room_count)
 {
-    if (sender->room_id == -1) {
-        SendError(sender->fd, "not in a room");
+    Room *room = Rooms_FindById(rooms, room_count, sender->room_id);
+    if (room == NULL) {
+        SendError(sender, "not in a room");
         return;
     }
 
     cJSON *j_msg = cJSON_GetObjectItem(root, "message");
     if (!cJSON_IsString(j_msg)) {
-        SendError(sender->fd, "missing message");
+        SendError(sender, "missing message");
         return;
     }
 
@@ -370,81 +573,918 @@ static void HandleChat(cJSON *root, User *sender,
     cJSON_Delete(resp);
 
     if (s) {
-        for (int i = 0; i < user_count; i++) {
-            if (users[i].fd != -1 &&
-                users[i].room_id == sender->room_id)
-            {
-                SendToFd(users[i].fd, s);
-            }
-        }
-        free(s);
+        SendToRoom(room, s, NULL);
+        cJSON_free(s);
     }
 }
 
-/* ---- heartbeat ---------------------------------------------------- */
-static void HandleHeartbeat(User *sender)
+/* ---- match_enqueue ------------------------------------------------ */
+static void HandleMatchEnqueue(cJSON *root, User *sender)
 {
-    sender->last_heartbeat = time(NULL);
+    if (sender->username[0] == '\0') {
+        SendError(sender, "not logged in");
+        return;
+    }
+    if (sender->room_id != -1) {
+        SendError(sender, "already in a room");
+        return;
+    }
+
+    cJSON *j_size = cJSON_GetObjectItem(root, "size");
+    cJSON *j_tag  = cJSON_GetObjectItem(root, "tag");
+
+    int size = cJSON_IsNumber(j_size) ? j_size->valueint : 0;
+    if (size < 2 || size > MAX_ROOM_PLAYERS) {
+        SendError(sender, "invalid match size");
+        return;
+    }
+
+    const char *tag = cJSON_IsString(j_tag) ? j_tag->valuestring : "";
+    if (strlen(tag) >= MATCH_MAX_TAG) {
+        SendError(sender, "match tag too long");
+        return;
+    }
+
+    int rc = Match_Enqueue(sender, size, tag, Clock_Wall());
+    if (rc == -1) {
+        SendError(sender, "already queued");
+        return;
+    }
+    if (rc != 0) {
+        SendError(sender, "matchmaking is full");
+        return;
+    }
 
     cJSON *resp = cJSON_CreateObject();
-    cJSON_AddStringToObject(resp, "type", MSG_HEARTBEAT_ACK);
+    cJSON_AddStringToObject(resp, "type", MSG_MATCH_QUEUED);
+    cJSON_AddNumberToObject(resp, "size", size);
+    cJSON_AddStringToObject(resp, "tag", tag);
+    cJSON_AddNumberToObject(resp, "waiting", Match_QueueLength(sender));
     char *s = cJSON_PrintUnformatted(resp);
     cJSON_Delete(resp);
-    if (s) { SendToFd(sender->fd, s); free(s); }
+    if (s) { SendToUser(sender, s); cJSON_free(s); }
 }
 
-/* ================================================================== */
-/*  Public API                                                         */
-/* ================================================================== */
+/* ---- match_cancel ------------------------------------------------- */
+static void HandleMatchCancel(User *sender)
+{
+    if (!Match_Cancel(sender)) {
+        SendError(sender, "not queued");
+        return;
+    }
 
-void Handler_ProcessMessage(const char *json_str,
-                            User *sender,
-                            User users[], int user_count,
-                            Room rooms[], int room_count)
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddStringToObject(resp, "type", MSG_MATCH_CANCELLED);
+    char *s = cJSON_PrintUnformatted(resp);
+    cJSON_Delete(resp);
+    if (s) { SendToUser(sender, s); cJSON_free(s); }
+}
+
+/* ---- channel_join / channel_leave / channel_chat ------------------ */
+
+/* Fetch and validate the "channel" field; sends an error if invalid. */
+static const char *GetChannelName(cJSON *root, User *sender)
 {
-    if (json_str == NULL || sender == NULL) return;
+    cJSON *j_chan = cJSON_GetObjectItem(root, "channel");
+    if (!cJSON_IsString(j_chan) || j_chan->valuestring[0] == '\0' ||
+        strlen(j_chan->valuestring) >= MAX_CHANNEL_NAME)
+    {
+        SendError(sender, "invalid channel name");
+        return NULL;
+    }
+    return j_chan->valuestring;
+}
 
-    cJSON *root = cJSON_Parse(json_str);
-    if (root == NULL) {
-        printf("[handler] failed to parse JSON from fd %d\n", sender->fd);
+static void HandleChannelJoin(cJSON *root, User *sender)
+{
+    if (sender->username[0] == '\0') {
+        SendError(sender, "not logged in");
         return;
     }
 
-    cJSON *j_type = cJSON_GetObjectItem(root, "type");
-    if (!cJSON_IsString(j_type)) {
-        printf("[handler] message missing 'type' from fd %d\n", sender->fd);
-        cJSON_Delete(root);
+    const char *name = GetChannelName(root, sender);
+    if (name == NULL) return;
+
+    switch (Channels_Join(sender, name)) {
+    case CHANNEL_OK:
+        break;
+    case CHANNEL_ERR_MEMBER:
+        SendError(sender, "already in channel");
+        return;
+    case CHANNEL_ERR_USER_LIMIT:
+        SendError(sender, "too many channels");
+        return;
+    case CHANNEL_ERR_FULL:
+        SendError(sender, "channel is full");
+        return;
+    default:
+        SendError(sender, "no channel slots available");
         return;
     }
 
-    const char *type = j_type->valuestring;
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddStringToObject(resp, "type", MSG_CHANNEL_JOINED);
+    cJSON_AddStringToObject(resp, "channel", name);
+    cJSON_AddNumberToObject(resp, "members", Channels_MemberCount(name));
+    char *s = cJSON_PrintUnformatted(resp);
+    cJSON_Delete(resp);
+    if (s) { SendToUser(sender, s); cJSON_free(s); }
+}
 
-    if (strcmp(type, MSG_LOGIN) == 0) {
-        HandleLogin(root, sender, users, user_count);
-    }
-    else if (strcmp(type, MSG_ROOM_LIST) == 0) {
-        HandleRoomList(sender, users, user_count, rooms, room_count);
-    }
-    else if (strcmp(type, MSG_ROOM_CREATE) == 0) {
-        HandleRoomCreate(root, sender, users, user_count, rooms, room_count);
-    }
-    else if (strcmp(type, MSG_ROOM_JOIN) == 0) {
-        HandleRoomJoin(root, sender, users, user_count, rooms, room_count);
+static void HandleChannelLeave(cJSON *root, User *sender)
+{
+    const char *name = GetChannelName(root, sender);
+    if (name == NULL) return;
+
+    if (Channels_Leave(sender, name) != CHANNEL_OK) {
+        SendError(sender, "not in channel");
+        return;
+    }
+
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddStringToObject(resp, "type", MSG_CHANNEL_LEFT);
+    cJSON_AddStringToObject(resp, "channel", name);
+    char *s = cJSON_PrintUnformatted(resp);
+    cJSON_Delete(resp);
+    if (s) { SendToUser(sender, s); cJSON_free(s); }
+}
+
+static void HandleChannelChat(cJSON *root, User *sender)
+{
+    const char *name = GetChannelName(root, sender);
+    if (name == NULL) return;
+
+    cJSON *j_msg = cJSON_GetObjectItem(root, "message");
+    if (!cJSON_IsString(j_msg)) {
+        SendError(sender, "missing message");
+        return;
+    }
+    if (strlen(j_msg->valuestring) >= MAX_CHAT_MSG) {
+        SendError(sender, "message too long");
+        return;
+    }
+
+    /* Encode once; the channel shares this frame with every member. */
+    cJSON *note = cJSON_CreateObject();
+    cJSON_AddStringToObject(note, "type", MSG_CHANNEL_MSG);
+    cJSON_AddStringToObject(note, "channel", name);
+    cJSON_AddStringToObject(note, "from", sender->username);
+    cJSON_AddStringToObject(note, "message", j_msg->valuestring);
+    char *s = cJSON_PrintUnformatted(note);
+    cJSON_Delete(note);
+    if (s == NULL) return;
+
+    OutFrame *frame = OutFrame_Create(s);
+    cJSON_free(s);
+    if (frame == NULL) return;
+
+    int rc = Channels_Post(sender, name, frame, Clock_Wall());
+    OutFrame_Release(frame);
+
+    if (rc == CHANNEL_ERR_MEMBER) {
+        SendError(sender, "not in channel");
+    } else if (rc == CHANNEL_ERR_RATE) {
+        SendError(sender, "rate limited");
+    } else if (rc == CHANNEL_ERR_BACKLOG) {
+        SendError(sender, "channel is busy");
+    }
+}
+
+/* ---- whisper ------------------------------------------------------ */
+static void HandleWhisper(cJSON *root, User *sender)
+{
+    if (sender->username[0] == '\0') {
+        SendError(sender, "not logged in");
+        return;
+    }
+
+    cJSON *j_to  = cJSON_GetObjectItem(root, "to");
+    cJSON *j_msg = cJSON_GetObjectItem(root, "message");
+    if (!cJSON_IsString(j_to) || !cJSON_IsString(j_msg)) {
+        SendError(sender, "missing recipient or message");
+        return;
+    }
+    if (strlen(j_msg->valuestring) >= MAX_CHAT_MSG) {
+        SendError(sender, "message too long");
+        return;
+    }
+
+    User *target = Users_FindByName(j_to->valuestring);
+    if (target == NULL) {
+        SendError(sender, "user not online");
+        return;
+    }
+    if (target == sender) {
+        SendError(sender, "cannot whisper to yourself");
+        return;
+    }
+    if (target->sendq.bytes > WHISPER_MAX_QUEUED) {
+        SendError(sender, "recipient is busy");
+        return;
+    }
+
+    /* Deliver to the recipient. */
+    {
+        cJSON *note = cJSON_CreateObject();
+        cJSON_AddStringToObject(note, "type", MSG_WHISPER_MSG);
+        cJSON_AddStringToObject(note, "from", sender->username);
+        cJSON_AddStringToObject(note, "message", j_msg->valuestring);
+        char *s = cJSON_PrintUnformatted(note);
+        cJSON_Delete(note);
+        if (s) { SendToUser(target, s); cJSON_free(s); }
+    }
+
+    /* Echo to the sender with the canonical recipient name. */
+    {
+        cJSON *resp = cJSON_CreateObject();
+        cJSON_AddStringToObject(resp, "type", MSG_WHISPER_SENT);
+        cJSON_AddStringToObject(resp, "to", target->username);
+        cJSON_AddStringToObject(resp, "message", j_msg->valuestring);
+        char *s = cJSON_PrintUnformatted(resp);
+        cJSON_Delete(resp);
+        if (s) { SendToUser(sender, s); cJSON_free(s); }
+    }
+}
+
+/* ---- game_status -------------------------------------------------- */
+static void HandleGameStatus(cJSON *root, User *sender)
+{
+    cJSON *j_in_game = cJSON_GetObjectItem(root, "in_game");
+    if (!cJSON_IsBool(j_in_game)) {
+        SendError(sender, "missing in_game");
+        return;
+    }
+
+    sender->in_game = cJSON_IsTrue(j_in_game) ? 1 : 0;
+    Presence_Touch(sender->username);
+}
+
+/* ---- presence_subscribe / presence_unsubscribe -------------------- */
+static void HandlePresenceSubscribe(cJSON *root, User *sender)
+{
+    if (sender->username[0] == '\0') {
+        SendError(sender, "not logged in");
+        return;
+    }
+
+    cJSON *j_users = cJSON_GetObjectItem(root, "users");
+    if (!cJSON_IsArray(j_users)) {
+        SendError(sender, "missing users");
+        return;
+    }
+
+    /* Reply with the current status of every name subscribed to. */
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddStringToObject(resp, "type", MSG_PRESENCE_STATE);
+    cJSON *arr = cJSON_AddArrayToObject(resp, "users");
+
+    int rejected = 0;
+    cJSON *j_name = NULL;
+    cJSON_ArrayForEach(j_name, j_users) {
+        if (!cJSON_IsString(j_name) || j_name->valuestring[0] == '\0' ||
+            strlen(j_name->valuestring) >= MAX_USERNAME)
+            continue;
+
+        if (Presence_Subscribe(sender, j_name->valuestring) != 0) {
+            rejected++;
+            continue;
+        }
+
+        const User *u = Users_FindByName(j_name->valuestring);
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "username",
+                                u ? u->username : j_name->valuestring);
+        cJSON_AddStringToObject(item, "status",
+            Presence_StatusName(Presence_StatusOf(j_name->valuestring)));
+        cJSON_AddItemToArray(arr, item);
+    }
+
+    char *s = cJSON_PrintUnformatted(resp);
+    cJSON_Delete(resp);
+    if (s) { SendToUser(sender, s); cJSON_free(s); }
+
+    if (rejected > 0) {
+        SendError(sender, "too many presence subscriptions");
+    }
+}
+
+static void HandlePresenceUnsubscribe(cJSON *root, User *sender)
+{
+    cJSON *j_users = cJSON_GetObjectItem(root, "users");
+    if (!cJSON_IsArray(j_users)) {
+        Presence_UnsubscribeAll(sender);
+        return;
+    }
+
+    cJSON *j_name = NULL;
+    cJSON_ArrayForEach(j_name, j_users) {
+        if (cJSON_IsString(j_name)) {
+            Presence_Unsubscribe(sender, j_name->valuestring);
+        }
+    }
+}
+
+/* ---- relay_open --------------------------------------------------- */
+
+/* Tell one end of a relay session where to connect. */
+static void SendRelayTicket(User *user, const User *peer, uint32_t ticket,
+                            const char *role)
+{
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddStringToObject(resp, "type", MSG_RELAY_TICKET);
+    cJSON_AddStringToObject(resp, "peer", peer->username);
+    cJSON_AddNumberToObject(resp, "port", Relay_Port());
+    cJSON_AddNumberToObject(resp, "ticket", ticket);
+    cJSON_AddStringToObject(resp, "role", role);
+    char *s = cJSON_PrintUnformatted(resp);
+    cJSON_Delete(resp);
+    if (s) { SendToUser(user, s); cJSON_free(s); }
+}
+
+/*
+ * Open a relay session between `sender` and `peer`.  The requester
+ * tunnels War3's outgoing connection; the peer connects the relay to
+ * its local game port.
+ */
+static void OpenRelay(User *sender, User *peer)
+{
+    uint32_t t_sender, t_peer;
+    if (Relay_Open(sender->username, peer->username,
+                   &t_sender, &t_peer) != 0) {
+        SendError(sender, "relay unavailable");
+        return;
+    }
+
+    SendRelayTicket(sender, peer, t_sender, "connect");
+    SendRelayTicket(peer, sender, t_peer, "accept");
+}
+
+/*
+ * Resolve the "peer" field of a peer-to-peer request: another user in
+ * the sender's room.  Sends an error and returns NULL otherwise.
+ */
+static User *FindRoomPeer(cJSON *root, User *sender)
+{
+    if (sender->room_id == -1) {
+        SendError(sender, "not in a room");
+        return NULL;
+    }
+
+    cJSON *j_peer = cJSON_GetObjectItem(root, "peer");
+    User  *peer   = cJSON_IsString(j_peer)
+                  ? Users_FindByName(j_peer->valuestring)
+                  : NULL;
+    if (peer == NULL || peer == sender || peer->room_id != sender->room_id) {
+        SendError(sender, "peer not in your room");
+        return NULL;
+    }
+    return peer;
+}
+
+static void HandleRelayOpen(cJSON *root, User *sender)
+{
+    User *peer = FindRoomPeer(root, sender);
+    if (peer != NULL) {
+        OpenRelay(sender, peer);
+    }
+}
+
+/* ---- punch_request / punch_result --------------------------------- */
+
+/* Tell `user` where to probe `peer` (both endpoints must be known). */
+static void SendPunchStart(User *user, const User *peer)
+{
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddStringToObject(resp, "type", MSG_PUNCH_START);
+    cJSON_AddStringToObject(resp, "peer", peer->username);
+    AddEndpoint(resp, peer);
+    cJSON_AddNumberToObject(resp, "delay_ms", PUNCH_DELAY_MS);
+    char *s = cJSON_PrintUnformatted(resp);
+    cJSON_Delete(resp);
+    if (s) { SendToUser(user, s); cJSON_free(s); }
+}
+
+/*
+ * Start a simultaneous open between `a` and `b`.  Without both public
+ * endpoints there is nothing to punch towards, so the pair goes
+ * straight to the relay.
+ */
+static void StartPunch(User *a, User *b)
+{
+    if (a->udp_port == 0 || b->udp_port == 0) {
+        LOG_INFO("[punch] '%s' <-> '%s': endpoint unknown, using relay",
+                 a->username, b->username);
+        OpenRelay(a, b);
+        return;
+    }
+
+    SendPunchStart(a, b);
+    SendPunchStart(b, a);
+}
+
+static void HandlePunchRequest(cJSON *root, User *sender)
+{
+    User *peer = FindRoomPeer(root, sender);
+    if (peer != NULL) {
+        StartPunch(sender, peer);
+    }
+}
+
+static void HandlePunchResult(cJSON *root, User *sender)
+{
+    User *peer = FindRoomPeer(root, sender);
+    if (peer == NULL) return;
+
+    if (cJSON_IsTrue(cJSON_GetObjectItem(root, "ok"))) {
+        LOG_INFO("[punch] '%s' <-> '%s': direct",
+                 sender->username, peer->username);
+        return;
+    }
+
+    LOG_INFO("[punch] '%s' <-> '%s': failed, using relay",
+             sender->username, peer->username);
+    OpenRelay(sender, peer);
+}
+
+/* ---- rtt_report --------------------------------------------------- */
+
+/* A reported figure clamped to [0, max], or -1 if absent. */
+static int ReportedInt(cJSON *item, int max)
+{
+    if (!cJSON_IsNumber(item) || item->valuedouble < 0) return -1;
+    return item->valuedouble > max ? max : (int)item->valuedouble;
+}
+
+/*
+ * Re-evaluate the room's best host and tell the room when it changes.
+ *
+ *   {"type":"host_hint","host":"p1","max_rtt_ms":42,"mean_rtt_ms":30}
+ */
+static void UpdateHostHint(Room *room)
+{
+    int worst, mean;
+    int h = Rooms_PickHost(room, &worst, &mean);
+    if (h < 0 || room->members[h] == room->host_hint) return;
+
+    room->host_hint = room->members[h];
+    LOG_INFO("[probe] room %d: recommend host '%s' (worst %d ms, mean %d ms)",
+             room->id, room->host_hint->username, worst, mean);
+
+    cJSON *note = cJSON_CreateObject();
+    cJSON_AddStringToObject(note, "type", MSG_HOST_HINT);
+    cJSON_AddStringToObject(note, "host", room->host_hint->username);
+    cJSON_AddNumberToObject(note, "max_rtt_ms", worst);
+    cJSON_AddNumberToObject(note, "mean_rtt_ms", mean);
+    char *s = cJSON_PrintUnformatted(note);
+    cJSON_Delete(note);
+    if (s) { SendToRoom(room, s, NULL); cJSON_free(s); }
+}
+
+static void HandleRttReport(cJSON *root, User *sender,
+                            Room rooms[], int room_count)
+{
+    Room *room = Rooms_FindById(rooms, room_count, sender->room_id);
+    int   row  = room ? Rooms_MemberIndex(room, sender) : -1;
+    if (row < 0) return;   /* stale report after leaving; ignore */
+
+    room->server_rtt_ms[row] =
+        (int16_t)ReportedInt(cJSON_GetObjectItem(root, "server_rtt_ms"), 30000);
+    Users_AddRttSample(sender, room->server_rtt_ms[row]);
+
+    cJSON *peers = cJSON_GetObjectItem(root, "peers");
+    cJSON *entry = NULL;
+    cJSON_ArrayForEach(entry, peers) {
+        cJSON *j_peer = cJSON_GetObjectItem(entry, "peer");
+        if (!cJSON_IsString(j_peer)) continue;
+
+        User *peer = Users_FindByName(j_peer->valuestring);
+        int   col  = peer ? Rooms_MemberIndex(room, peer) : -1;
+        if (col < 0 || col == row) continue;
+
+        int loss = ReportedInt(cJSON_GetObjectItem(entry, "loss_pct"), 100);
+        room->rtt_ms[row][col] =
+            (int16_t)ReportedInt(cJSON_GetObjectItem(entry, "rtt_ms"), 30000);
+        room->loss_pct[row][col] = (uint8_t)(loss < 0 ? 0 : loss);
+    }
+
+    UpdateHostHint(room);
+}
+
+/* ---- heartbeat ---------------------------------------------------- */
+static void HandleHeartbeat(cJSON *root, User *sender)
+{
+    sender->last_heartbeat = Clock_Wall();
+
+    /* The client times each heartbeat by its echoed "ts" and reports
+     * the result with the next one.  Nothing verifies the figure, yet
+     * it ranks room_list and quick_join: a host reporting a low RTT
+     * moves its room up for everyone. */
+    Users_AddRttSample(sender,
+                       ReportedInt(cJSON_GetObjectItem(root, "rtt_ms"), 30000));
+
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddStringToObject(resp, "type", MSG_HEARTBEAT_ACK);
+    cJSON *j_ts = cJSON_GetObjectItem(root, "ts");
+    if (cJSON_IsNumber(j_ts)) {
+        cJSON_AddNumberToObject(resp, "ts", j_ts->valuedouble);
+    }
+    char *s = cJSON_PrintUnformatted(resp);
+    cJSON_Delete(resp);
+    if (s) { SendToUser(sender, s); cJSON_free(s); }
+}
+
+/* ---- start_game --------------------------------------------------- */
+
+static void FillLaunchEndpoint(const User *user, char udp_ip[MAX_IP_STR],
+                               LaunchEndpoint *ep)
+{
+    udp_ip[0] = '\0';
+    if (user->udp_port != 0) {
+        struct in_addr a;
+        a.s_addr = user->udp_addr;
+        inet_ntop(AF_INET, &a, udp_ip, MAX_IP_STR);
+    }
+    ep->ip       = user->ip;
+    ep->local_ip = user->local_ip;
+    ep->udp_ip   = udp_ip;
+    ep->udp_port = user->udp_port ? ntohs(user->udp_port) : 0;
+}
+
+/*
+ * The host starts the game for the whole room.  Every member gets its
+ * own peer set and a delay that has all of them start War3 together:
+ *
+ *   {"type":"game_start","launch_id":7,"delay_ms":2980,
+ *    "peers":[{"username":"p2","addr":"1.2.3.4:6112","via":"punch"},...]}
+ */
+static void HandleStartGame(User *sender, Room rooms[], int room_count)
+{
+    Room *room = Rooms_FindById(rooms, room_count, sender->room_id);
+    if (room == NULL) {
+        SendError(sender, "not in a room");
+        return;
+    }
+    time_t now = Clock_Wall();
+    if (Rooms_Host(room, now) != sender) {
+        SendError(sender, "only the room host can start the game");
+        return;
+    }
+    if (room->member_count < 2) {
+        SendError(sender, "nobody else is in the room");
+        return;
+    }
+    if (room->launch_time != 0 && now - room->launch_time < LAUNCH_COOLDOWN_S) {
+        SendError(sender, "the game is already starting");
+        return;
+    }
+
+    static uint32_t s_next_launch_id = 1;
+    room->launch_id   = s_next_launch_id++;
+    room->launch_time = now;
+
+    static const char *const via_names[] = { "public", "lan", "punch" };
+    char           udp_ips[MAX_ROOM_PLAYERS][MAX_IP_STR];
+    LaunchEndpoint eps[MAX_ROOM_PLAYERS];
+    for (int i = 0; i < room->member_count; i++) {
+        FillLaunchEndpoint(room->members[i], udp_ips[i], &eps[i]);
+    }
+
+    for (int i = 0; i < room->member_count; i++) {
+        User *member = room->members[i];
+
+        cJSON *msg = cJSON_CreateObject();
+        cJSON_AddStringToObject(msg, "type", MSG_GAME_START);
+        cJSON_AddNumberToObject(msg, "launch_id", room->launch_id);
+        cJSON_AddNumberToObject(msg, "delay_ms",
+                                Launch_DelayMs(LAUNCH_LEAD_MS, member->rtt_ms));
+        cJSON *peers = cJSON_AddArrayToObject(msg, "peers");
+
+        for (int j = 0; j < room->member_count; j++) {
+            if (j == i) continue;
+            char addr[LAUNCH_ADDR_LEN];
+            int via = Launch_PeerAddr(&eps[i], &eps[j], addr, sizeof(addr));
+
+            cJSON *peer = cJSON_CreateObject();
+            cJSON_AddStringToObject(peer, "username",
+                                    room->members[j]->username);
+            cJSON_AddStringToObject(peer, "addr", addr);
+            cJSON_AddStringToObject(peer, "via", via_names[via]);
+            cJSON_AddItemToArray(peers, peer);
+        }
+
+        char *s = cJSON_PrintUnformatted(msg);
+        cJSON_Delete(msg);
+        if (s) { SendToUser(member, s); cJSON_free(s); }
+    }
+
+    LOG_INFO("[launch] room %d: '%s' started launch %u for %d players",
+             room->id, sender->username, room->launch_id, room->member_count);
+}
+
+/* ---- map store -------------------------------------------------- */
+
+/*
+ * Get the map of each room's game into the map store: ask the host to
+ * upload it (map_upload), and once it is stored tell the rest of the
+ * room to prefetch it.  Runs once a second from Handler_Tick.
+ *
+ *   {"type":"map_upload","map":"Maps\\Download\\x.w3x","crc":123,
+ *    "port":12002,"ticket":4711}
+ */
+static void TickRoomMaps(Room rooms[], int room_count, time_t now)
+{
+    for (int i = 0; i < room_count; i++) {
+        Room       *room = &rooms[i];
+        const User *game = room->id ? Rooms_Host(room, now) : NULL;
+        if (game == NULL || Users_LiveGame(game, now) == NULL ||
+            game->game.map_crc == 0)
+            continue;
+
+        User *host = NULL;
+        for (int k = 0; k < room->member_count; k++) {
+            if (room->members[k] == game) host = room->members[k];
+        }
+        if (host == NULL) continue;
+
+        MapInfo  map;
+        uint32_t ticket;
+        if (Mapstore_Find(host->game.map_crc, host->game.map_path, &map)) {
+            if (room->map_announced == map.crc) continue;
+            room->map_announced = map.crc;
+            LOG_INFO("[mapstore] room %d: prefetching '%s' (%s)",
+                     room->id, host->game.map_path, map.sha1);
+            for (int k = 0; k < room->member_count; k++) {
+                if (room->members[k] != host)
+                    SendMapAvailable(room->members[k], host, &map);
+            }
+        } else if (Mapstore_ExpectUpload(host->game.map_crc,
+                                         host->game.map_path, &ticket) == 0) {
+            LOG_INFO("[mapstore] asking '%s' to upload '%s'",
+                     host->username, host->game.map_path);
+            cJSON *msg = cJSON_CreateObject();
+            cJSON_AddStringToObject(msg, "type", MSG_MAP_UPLOAD);
+            cJSON_AddStringToObject(msg, "map", host->game.map_path);
+            cJSON_AddNumberToObject(msg, "crc", host->game.map_crc);
+            cJSON_AddNumberToObject(msg, "port", Mapstore_Port());
+            cJSON_AddNumberToObject(msg, "ticket", ticket);
+            char *s = cJSON_PrintUnformatted(msg);
+            cJSON_Delete(msg);
+            if (s) { SendToUser(host, s); cJSON_free(s); }
+        }
+    }
+}
+
+/* ================================================================== */
+/*  Public API                                                         */
+/* ================================================================== */
+
+/*
+ * Parse and dispatch one message.  Returns its metrics index, or -1 if
+ * it could not be parsed.
+ */
+static int Dispatch(const char *json, uint32_t json_len,
+                    User *sender, Room rooms[], int room_count)
+{
+    cJSON *root = cJSON_ParseWithLength(json, json_len);
+    if (root == NULL) {
+        LOG_LIMITED(LOG_LEVEL_WARN, 5,
+                    "[handler] failed to parse JSON from fd %d", sender->fd);
+        return -1;
+    }
+
+    cJSON *j_type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(j_type)) {
+        LOG_LIMITED(LOG_LEVEL_WARN, 5,
+                    "[handler] message missing 'type' from fd %d", sender->fd);
+        cJSON_Delete(root);
+        return -1;
+    }
+
+    const char *type      = j_type->valuestring;
+    int         msg_index = Metrics_MessageIndex(type);
+
+    Profiler_Enter(MET_PHASE_HANDLE, sender->fd,
+                   Metrics_MessageName(msg_index));
+
+    if (strcmp(type, MSG_LOGIN) == 0) {
+        HandleLogin(root, sender);
+    }
+    else if (strcmp(type, MSG_ROOM_LIST) == 0) {
+        HandleRoomList(sender, rooms, room_count);
+    }
+    else if (strcmp(type, MSG_ROOM_CREATE) == 0) {
+        HandleRoomCreate(root, sender, rooms, room_count);
+    }
+    else if (strcmp(type, MSG_ROOM_JOIN) == 0) {
+        HandleRoomJoin(root, sender, rooms, room_count);
+    }
+    else if (strcmp(type, MSG_QUICK_JOIN) == 0) {
+        HandleQuickJoin(root, sender, rooms, room_count);
     }
     else if (strcmp(type, MSG_ROOM_LEAVE) == 0) {
-        HandleRoomLeave(sender, users, user_count, rooms, room_count);
+        HandleRoomLeave(sender, rooms, room_count);
     }
     else if (strcmp(type, MSG_CHAT) == 0) {
-        HandleChat(root, sender, users, user_count);
+        HandleChat(root, sender, rooms, room_count);
     }
     else if (strcmp(type, MSG_HEARTBEAT) == 0) {
-        HandleHeartbeat(sender);
+        HandleHeartbeat(root, sender);
+    }
+    else if (strcmp(type, MSG_MATCH_ENQUEUE) == 0) {
+        HandleMatchEnqueue(root, sender);
+    }
+    else if (strcmp(type, MSG_MATCH_CANCEL) == 0) {
+        HandleMatchCancel(sender);
+    }
+    else if (strcmp(type, MSG_CHANNEL_JOIN) == 0) {
+        HandleChannelJoin(root, sender);
+    }
+    else if (strcmp(type, MSG_CHANNEL_LEAVE) == 0) {
+        HandleChannelLeave(root, sender);
+    }
+    else if (strcmp(type, MSG_CHANNEL_CHAT) == 0) {
+        HandleChannelChat(root, sender);
+    }
+    else if (strcmp(type, MSG_WHISPER) == 0) {
+        HandleWhisper(root, sender);
+    }
+    else if (strcmp(type, MSG_GAME_STATUS) == 0) {
+        HandleGameStatus(root, sender);
+    }
+    else if (strcmp(type, MSG_PRESENCE_SUB) == 0) {
+        HandlePresenceSubscribe(root, sender);
+    }
+    else if (strcmp(type, MSG_PRESENCE_UNSUB) == 0) {
+        HandlePresenceUnsubscribe(root, sender);
+    }
+    else if (strcmp(type, MSG_RELAY_OPEN) == 0) {
+        HandleRelayOpen(root, sender);
+    }
+    else if (strcmp(type, MSG_PUNCH_REQUEST) == 0) {
+        HandlePunchRequest(root, sender);
+    }
+    else if (strcmp(type, MSG_PUNCH_RESULT) == 0) {
+        HandlePunchResult(root, sender);
+    }
+    else if (strcmp(type, MSG_START_GAME) == 0) {
+        HandleStartGame(sender, rooms, room_count);
+    }
+    else if (strcmp(type, MSG_RTT_REPORT) == 0) {
+        HandleRttReport(root, sender, rooms, room_count);
     }
     else {
-        printf("[handler] unknown message type '%s' from fd %d\n",
-               type, sender->fd);
-        SendError(sender->fd, "unknown message type");
+        LOG_LIMITED(LOG_LEVEL_WARN, 5,
+                    "[handler] unknown message type '%s' from fd %d",
+                    type, sender->fd);
+        SendError(sender, "unknown message type");
     }
 
     cJSON_Delete(root);
+    return msg_index;
+}
+
+void Handler_ProcessMessage(const char *json, uint32_t json_len,
+                            User *sender, Room rooms[], int room_count)
+{
+    if (json == NULL || sender == NULL) return;
+
+    int      fd      = sender->fd;
+    uint64_t started = Clock_NowNs();
+    uint64_t allocs  = Alloc_ThreadCalls();
+
+    /* Request and reply trees live in the scratch arena (jsonmem.h). */
+    JsonMem_BeginScratch();
+    int msg_index = Dispatch(json, json_len, sender, rooms, room_count);
+    JsonMem_EndScratch();
+    if (msg_index < 0) return;
+
+    uint64_t service_ns = Clock_NowNs() - started;
+    allocs = Alloc_ThreadCalls() - allocs;
+    Metrics_RecordMessage(msg_index, service_ns, allocs);
+    TRACE_DISPATCH(fd, Metrics_MessageName(msg_index), service_ns);
+}
+
+/* ------------------------------------------------------------------ */
+
+void Handler_OnDisconnect(User *user, Room rooms[], int room_count)
+{
+    if (user == NULL) return;
+
+    Match_Cancel(user);
+    Channels_LeaveAll(user);
+    Presence_UnsubscribeAll(user);
+
+    /* Evaluated on the next tick, after the slot has been freed. */
+    Presence_Touch(user->username);
+
+    if (user->room_id != -1) {
+        RemoveFromRoom(user, rooms, room_count);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+
+void Handler_OnUdpEndpoint(User *user, Room rooms[], int room_count)
+{
+    char ip[MAX_IP_STR];
+    struct in_addr a;
+    a.s_addr = user->udp_addr;
+    inet_ntop(AF_INET, &a, ip, sizeof(ip));
+    LOG_INFO("[punch] '%s' public endpoint %s:%d",
+             user->username, ip, ntohs(user->udp_port));
+
+    Room *room = Rooms_FindById(rooms, room_count, user->room_id);
+    if (room == NULL) return;
+
+    /* Everyone already reachable gets a fresh simultaneous open. */
+    for (int i = 0; i < room->member_count; i++) {
+        User *member = room->members[i];
+        if (member != user && member->udp_port != 0) {
+            SendPunchStart(user, member);
+            SendPunchStart(member, user);
+        }
+    }
+
+    /* Its War3 is up: hand it the games already running in the room. */
+    Reflector_ReplayGames(user, room);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Periodic work                                                     */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    User *users;
+    int   user_count;
+    Room *rooms;
+    int   room_count;
+} TickCtx;
+
+/*
+ * Match_Tick callback: open a room for a complete group and move every
+ * member into it.  Each member gets room_joined, then one room_peers
+ * goes to the whole room.
+ */
+static int FormMatchRoom(const MatchGroup *group, void *ctx)
+{
+    TickCtx *tc = (TickCtx *)ctx;
+
+    const char *rname = group->tag[0] ? group->tag : "Matchmaking";
+    Room *room = Rooms_Create(tc->rooms, tc->room_count, rname,
+                              group->size, group->members[0]->fd);
+    if (room == NULL) return -1;
+
+    LOG_INFO("[match] formed room %d '%s' with %d players",
+             room->id, room->name, group->count);
+
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddStringToObject(resp, "type", MSG_ROOM_JOINED);
+    cJSON_AddNumberToObject(resp, "room_id", room->id);
+    cJSON_AddStringToObject(resp, "name", room->name);
+    cJSON_AddBoolToObject(resp, "match", 1);
+    char *s = cJSON_PrintUnformatted(resp);
+    cJSON_Delete(resp);
+
+    OutFrame *frame = s ? OutFrame_Create(s) : NULL;
+    cJSON_free(s);
+
+    for (int i = 0; i < group->count; i++) {
+        Rooms_AddMember(room, group->members[i]);
+        Presence_Touch(group->members[i]->username);
+        if (frame) SendQ_Push(&group->members[i]->sendq, frame);
+    }
+    OutFrame_Release(frame);
+
+    Handler_BroadcastRoomPeers(room);
+    return 0;
+}
+
+static void ExpireMatchTicket(User *user, void *ctx)
+{
+    (void)ctx;
+
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddStringToObject(resp, "type", MSG_MATCH_TIMEOUT);
+    char *s = cJSON_PrintUnformatted(resp);
+    cJSON_Delete(resp);
+    if (s) { SendToUser(user, s); cJSON_free(s); }
+}
+
+int Handler_Tick(time_t now,
+                 User users[], int user_count,
+                 Room rooms[], int room_count)
+{
+    static time_t last_maps;
+
+    TickCtx tc = { users, user_count, rooms, room_count };
+    int busy = Match_Tick(now, FormMatchRoom, ExpireMatchTicket, &tc);
+    Presence_Tick();
+
+    if (now != last_maps) {
+        last_maps = now;
+        TickRoomMaps(rooms, room_count, now);
+    }
+
+    busy |= Channels_Tick();
+    return busy;
 }
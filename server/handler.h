@@ -7,14 +7,46 @@
 
 #include "user.h"
 #include "room.h"
+#include <time.h>
 
 /*
- * Process a complete JSON message received from `sender`.
+ * Process a complete JSON message received from `sender`: `json_len`
+ * bytes at `json`, not NUL-terminated.
  * May send responses back to the sender and/or broadcast to room members.
  */
-void Handler_ProcessMessage(const char *json_str,
-                            User *sender,
-                            User users[], int user_count,
-                            Room rooms[], int room_count);
+void Handler_ProcessMessage(const char *json, uint32_t json_len,
+                            User *sender, Room rooms[], int room_count);
+
+/*
+ * Queue a room_peers message (every member's endpoints) to each member
+ * of `room`.  Sent whenever membership or an endpoint changes.
+ */
+void Handler_BroadcastRoomPeers(Room *room);
+
+/*
+ * Clean up after a connection that is going away: leave its room and
+ * notify the remaining members.  Called by the server before the socket
+ * is closed and the slot is freed.
+ */
+void Handler_OnDisconnect(User *user, Room rooms[], int room_count);
+
+/*
+ * The reflector saw `user`'s public UDP endpoint for the first time (or
+ * it moved).  Starts hole punching with every room member whose
+ * endpoint is already known.
+ */
+void Handler_OnUdpEndpoint(User *user, Room rooms[], int room_count);
+
+/*
+ * Periodic work that runs off the message path, once per event-loop
+ * iteration: forms matchmaking rooms, expires stale tickets, publishes
+ * presence changes, fans out lobby channel chat and (once a second)
+ * gets the rooms' maps into the map store.  Returns non-zero if
+ * matchmaking or channel fanout has work left over and the loop should
+ * come back without waiting.
+ */
+int Handler_Tick(time_t now,
+                 User users[], int user_count,
+                 Room rooms[], int room_count);
 
 #endif /* HANDLER_H */
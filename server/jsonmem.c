@@ -0,0 +1,69 @@
+/*
+ * jsonmem.c – cJSON memory for the lobby server (see jsonmem.h).
+ */
+
+#include "jsonmem.h"
+#include "../common/alloc.h"
+#include "../third_party/cJSON/cJSON.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#   define THREAD_LOCAL  __declspec(thread)
+#else
+#   define THREAD_LOCAL  _Thread_local
+#endif
+
+#define SCRATCH_ALIGN  16
+
+static _Alignas(SCRATCH_ALIGN) unsigned char s_scratch[JSONMEM_SCRATCH_SIZE];
+static size_t s_scratch_used;
+
+static THREAD_LOCAL int t_in_scratch;
+
+static int InScratch(const void *p)
+{
+    return (const unsigned char *)p >= s_scratch &&
+           (const unsigned char *)p <  s_scratch + sizeof(s_scratch);
+}
+
+static void *JsonMalloc(size_t size)
+{
+    if (t_in_scratch) {
+        size_t need = (size + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+        if (need <= sizeof(s_scratch) - s_scratch_used) {
+            void *p = s_scratch + s_scratch_used;
+            s_scratch_used += need;
+            return p;
+        }
+    }
+    return Alloc_Malloc(ALLOC_JSON, size);
+}
+
+static void JsonFree(void *p)
+{
+    /* Arena blocks go when the scope ends. */
+    if (p == NULL || InScratch(p)) return;
+    Alloc_Free(p);
+}
+
+/* ------------------------------------------------------------------ */
+
+void JsonMem_Init(void)
+{
+    cJSON_Hooks hooks = { JsonMalloc, JsonFree };
+    cJSON_InitHooks(&hooks);
+}
+
+void JsonMem_BeginScratch(void)
+{
+    s_scratch_used = 0;
+    t_in_scratch   = 1;
+}
+
+void JsonMem_EndScratch(void)
+{
+    t_in_scratch   = 0;
+    s_scratch_used = 0;
+}
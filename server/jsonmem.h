@@ -0,0 +1,32 @@
+/*
+ * jsonmem.h – cJSON memory for the lobby server.
+ *
+ * Installs cJSON hooks that charge its heap use to ALLOC_JSON (alloc.h)
+ * and, while a message is being handled, serve it from a scratch arena
+ * instead: the parsed request, the reply trees and their printed
+ * strings all come from one static buffer that is simply rewound when
+ * the message is done.  Requests too large for the arena spill to the
+ * heap block by block.
+ *
+ * Nothing cJSON returns inside a scratch scope may be kept after it;
+ * printed strings are copied into OutFrames and released with
+ * cJSON_free, which is the only correct way to free them now.
+ *
+ * The arena is used by one thread at a time (the lobby thread); other
+ * threads always get the heap.
+ */
+
+#ifndef JSONMEM_H
+#define JSONMEM_H
+
+#define JSONMEM_SCRATCH_SIZE  (256 * 1024)
+
+/* Install the hooks.  Call before any cJSON use. */
+void JsonMem_Init(void);
+
+/* Serve the calling thread's cJSON allocations from the arena until
+ * JsonMem_EndScratch, which releases them all. */
+void JsonMem_BeginScratch(void);
+void JsonMem_EndScratch(void);
+
+#endif /* JSONMEM_H */
@@ -0,0 +1,323 @@
+/*
+ * log.c – Asynchronous logger (see log.h).
+ *
+ * The ring is a bounded multi-producer queue in the style of Dmitry
+ * Vyukov's: every slot carries a sequence number that tells producers
+ * whether it is free for their ticket and tells the writer whether it
+ * has been filled.  Producers take tickets with a compare-and-swap on
+ * the head; the single writer walks the tail.
+ */
+
+#ifndef _WIN32
+#   define _POSIX_C_SOURCE 200809L   /* localtime_r, nanosleep */
+#endif
+
+#include "log.h"
+#include "clock.h"
+#include "metrics.h"
+#include "thread.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _MSC_VER
+#   define LOAD_ACQ(p)       (*(volatile uint64_t *)(p))
+#   define STORE_REL(p, v)   (*(volatile uint64_t *)(p) = (v))
+#   define CAS64(p, exp, v)  (InterlockedCompareExchange64(              \
+                                  (volatile LONG64 *)(p), (LONG64)(v),   \
+                                  (LONG64)*(exp)) == (LONG64)*(exp))
+#   define ADD64(p, v)       InterlockedExchangeAdd64((volatile LONG64 *)(p), \
+                                                      (LONG64)(v))
+#   define LOAD32(p)         (*(volatile uint32_t *)(p))
+#   define STORE32(p, v)     (*(volatile uint32_t *)(p) = (v))
+#else
+#   define LOAD_ACQ(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#   define STORE_REL(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#   define CAS64(p, exp, v)  __atomic_compare_exchange_n((p), (exp), (v), 1, \
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#   define ADD64(p, v)       __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#   define LOAD32(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+#   define STORE32(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+#define LOG_IDLE_MS       5        /* writer nap when the ring is empty */
+#define LOG_BATCH_BYTES   65536    /* written with one fwrite */
+
+typedef struct {
+    uint64_t seq;                  /* ticket this slot expects next */
+    uint64_t mono_us;              /* Clock_NowUs() at the call */
+    uint8_t  level;
+    uint8_t  len;
+    char     text[LOG_TEXT_MAX];
+} LogRecord;
+
+static const char *const s_level_names[] = {
+    "DEBUG", "INFO ", "WARN ", "ERROR",
+};
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+static LogRecord s_ring[LOG_RING_SIZE];
+static uint64_t  s_head;                   /* next ticket (producers) */
+static uint64_t  s_tail;                   /* next record (writer) */
+static uint64_t  s_dropped;
+
+static uint32_t  s_async;                  /* ring in use */
+static uint32_t  s_running;                /* writer should keep going */
+static LogLevel  s_min_level = LOG_LEVEL_INFO;
+static Thread    s_writer;
+
+/* Wall clock at Log_Init, to turn record times into dates. */
+static uint64_t  s_wall0_us;
+static uint64_t  s_mono0_us;
+
+static void Nap(int ms)
+{
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec ts = { 0, (long)ms * 1000000L };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/* "2026-10-19 21:04:11.532 INFO  " for a record taken at `mono_us`. */
+static int FormatPrefix(char *out, size_t len, uint64_t mono_us,
+                        LogLevel level)
+{
+    static time_t last_sec = (time_t)-1;   /* writer thread only */
+    static char   date[24];
+
+    uint64_t wall_us = s_wall0_us + (mono_us - s_mono0_us);
+    time_t   sec     = (time_t)(wall_us / 1000000u);
+
+    if (sec != last_sec) {
+        struct tm tm;
+#ifdef _WIN32
+        localtime_s(&tm, &sec);
+#else
+        localtime_r(&sec, &tm);
+#endif
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+        last_sec = sec;
+    }
+    return snprintf(out, len, "%s.%03u %s ", date,
+                    (unsigned)(wall_us / 1000u % 1000u),
+                    s_level_names[level]);
+}
+
+/* Synchronous path: before Log_Init, after Log_Shutdown. */
+static void WriteDirect(LogLevel level, const char *text)
+{
+    char prefix[48];
+    FormatPrefix(prefix, sizeof(prefix), Clock_NowUs(), level);
+    printf("%s%s\n", prefix, text);
+    fflush(stdout);
+}
+
+/* Drop the caller's trailing newline; the writer adds its own. */
+static int TrimLen(const char *text, int n)
+{
+    if (n < 0) return 0;
+    if (n >= LOG_TEXT_MAX) n = LOG_TEXT_MAX - 1;
+    while (n > 0 && text[n - 1] == '\n') n--;
+    return n;
+}
+
+static void Enqueue(LogLevel level, const char *fmt, va_list ap,
+                    const char *suffix)
+{
+    if (level < s_min_level) return;
+
+    if (!LOAD32(&s_async)) {
+        char text[LOG_TEXT_MAX];
+        int  n = TrimLen(text, vsnprintf(text, sizeof(text), fmt, ap));
+        text[n] = '\0';
+        if (suffix) {
+            snprintf(text + n, sizeof(text) - (size_t)n, "%s", suffix);
+        }
+        WriteDirect(level, text);
+        return;
+    }
+
+    /* Claim a slot.  A slot whose sequence lags our ticket is still
+     * waiting for the writer: the ring is full. */
+    LogRecord *rec;
+    uint64_t   pos = LOAD_ACQ(&s_head);
+    for (;;) {
+        rec = &s_ring[pos & (LOG_RING_SIZE - 1)];
+        uint64_t seq  = LOAD_ACQ(&rec->seq);
+        int64_t  diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (CAS64(&s_head, &pos, pos + 1)) break;
+        } else if (diff < 0) {
+            ADD64(&s_dropped, 1);
+            Metrics_Add(MET_LOG_DROPPED, 1);
+            return;
+        } else {
+            pos = LOAD_ACQ(&s_head);
+        }
+    }
+
+    rec->mono_us = Clock_NowUs();
+    rec->level   = (uint8_t)level;
+    int n = TrimLen(rec->text, vsnprintf(rec->text, LOG_TEXT_MAX, fmt, ap));
+    if (suffix) {
+        int m = snprintf(rec->text + n, LOG_TEXT_MAX - (size_t)n, "%s",
+                         suffix);
+        n = TrimLen(rec->text, n + (m > 0 ? m : 0));
+    }
+    rec->len = (uint8_t)n;
+
+    STORE_REL(&rec->seq, pos + 1);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Writer thread                                                     */
+/* ------------------------------------------------------------------ */
+
+/* Write out every record that is ready; returns how many there were. */
+static int DrainBatch(void)
+{
+    static char out[LOG_BATCH_BYTES];
+    static uint64_t reported_drops;
+    size_t   len   = 0;
+    int      count = 0;
+    uint64_t tail  = s_tail;
+
+    for (;;) {
+        LogRecord *rec = &s_ring[tail & (LOG_RING_SIZE - 1)];
+        if (LOAD_ACQ(&rec->seq) != tail + 1) break;
+
+        if (len + LOG_TEXT_MAX + 48 > sizeof(out)) {
+            fwrite(out, 1, len, stdout);
+            len = 0;
+        }
+        len += (size_t)FormatPrefix(out + len, sizeof(out) - len,
+                                    rec->mono_us, (LogLevel)rec->level);
+        memcpy(out + len, rec->text, rec->len);
+        len += rec->len;
+        out[len++] = '\n';
+
+        /* Hand the slot back for the ticket one lap ahead. */
+        STORE_REL(&rec->seq, tail + LOG_RING_SIZE);
+        tail++;
+        count++;
+    }
+    STORE_REL(&s_tail, tail);
+
+    uint64_t dropped = LOAD_ACQ(&s_dropped);
+    if (dropped != reported_drops && len + 128 <= sizeof(out)) {
+        len += (size_t)FormatPrefix(out + len, sizeof(out) - len,
+                                    Clock_NowUs(), LOG_LEVEL_WARN);
+        len += (size_t)snprintf(out + len, sizeof(out) - len,
+                                "[log] dropped %llu records (ring full)\n",
+                                (unsigned long long)(dropped - reported_drops));
+        reported_drops = dropped;
+    }
+
+    if (len > 0) {
+        fwrite(out, 1, len, stdout);
+        fflush(stdout);
+    }
+    return count;
+}
+
+static void WriterMain(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        if (DrainBatch() > 0) continue;
+        if (!LOAD32(&s_running)) break;
+        Nap(LOG_IDLE_MS);
+    }
+    DrainBatch();
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int Log_Init(LogLevel min_level)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    s_wall0_us = (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+    s_mono0_us = Clock_NowUs();
+
+    s_min_level = min_level;
+    for (uint64_t i = 0; i < LOG_RING_SIZE; i++) s_ring[i].seq = i;
+    s_head = 0;
+    s_tail = 0;
+
+    STORE32(&s_running, 1);
+    if (Thread_Start(&s_writer, WriterMain, NULL) != 0) {
+        STORE32(&s_running, 0);
+        return -1;
+    }
+    STORE32(&s_async, 1);
+    return 0;
+}
+
+void Log_Shutdown(void)
+{
+    if (!LOAD32(&s_async)) return;
+
+    STORE32(&s_async, 0);
+    STORE32(&s_running, 0);
+    Thread_Join(&s_writer);
+}
+
+void Log_Flush(void)
+{
+    if (!LOAD32(&s_async)) return;
+
+    uint64_t target = LOAD_ACQ(&s_head);
+    while (LOAD_ACQ(&s_tail) < target) Nap(1);
+}
+
+void Log_Write(LogLevel level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    Enqueue(level, fmt, ap, NULL);
+    va_end(ap);
+}
+
+void Log_WriteLimited(LogLimit *limit, uint32_t per_sec, LogLevel level,
+                      const char *fmt, ...)
+{
+    uint64_t now = Clock_NowUs();
+
+    if (now - LOAD_ACQ(&limit->window_us) >= 1000000u) {
+        STORE_REL(&limit->window_us, now);
+        STORE32(&limit->count, 0);
+    }
+    if (LOAD32(&limit->count) >= per_sec) {
+        STORE32(&limit->suppressed, LOAD32(&limit->suppressed) + 1);
+        return;
+    }
+    STORE32(&limit->count, LOAD32(&limit->count) + 1);
+
+    char     suffix[48];
+    uint32_t suppressed = LOAD32(&limit->suppressed);
+    if (suppressed > 0) {
+        snprintf(suffix, sizeof(suffix), " (+%u similar suppressed)",
+                 suppressed);
+        STORE32(&limit->suppressed, 0);
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    Enqueue(level, fmt, ap, suppressed > 0 ? suffix : NULL);
+    va_end(ap);
+}
+
+uint64_t Log_Dropped(void)
+{
+    return LOAD_ACQ(&s_dropped);
+}
@@ -0,0 +1,88 @@
+/*
+ * log.h – Asynchronous logger for War3 Lobby Server.
+ *
+ * printf from the event loop stalls the whole lobby whenever stdout is
+ * slow (a terminal being scrolled, a pipe into journald that is
+ * backed up).  Here the caller only formats the line into a fixed-size
+ * record and claims a slot in a lock-free ring; a background thread
+ * adds the timestamp and level and does the actual writing.
+ *
+ * The ring is bounded and never waits: when it is full the record is
+ * dropped and counted (war3_log_dropped_total, and a "[log] dropped"
+ * line once there is room again).  Any thread may log.
+ *
+ * Before Log_Init and after Log_Shutdown records are written directly,
+ * so startup and shutdown messages are never lost.
+ *
+ *   2026-10-19 21:04:11.532 INFO  [login] 'alice' logged in from ...
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#define LOG_RING_SIZE     4096     /* records, power of two */
+#define LOG_TEXT_MAX      240      /* bytes per line, longer is cut */
+
+typedef enum {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+} LogLevel;
+
+/* Per-call-site state for LOG_LIMITED. */
+typedef struct {
+    uint64_t window_us;            /* start of the current second */
+    uint32_t count;                /* lines emitted in that second */
+    uint32_t suppressed;           /* lines dropped since the last one */
+} LogLimit;
+
+/* Start the writer thread; records below `min_level` are discarded.
+ * Returns 0 on success, -1 if the thread cannot start (logging then
+ * stays synchronous). */
+int  Log_Init(LogLevel min_level);
+
+/* Write out everything queued and stop the writer thread. */
+void Log_Shutdown(void);
+
+/* Wait until everything queued so far has been written.  Not for the
+ * event loop: only for startup, before printing directly to stdout. */
+void Log_Flush(void);
+
+/* Queue one line (no trailing newline needed). */
+void Log_Write(LogLevel level, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+/*
+ * Like Log_Write, but at most `per_sec` lines per second from the call
+ * site owning `limit`; the next line that gets through notes how many
+ * were suppressed.
+ */
+void Log_WriteLimited(LogLimit *limit, uint32_t per_sec, LogLevel level,
+                      const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 4, 5)))
+#endif
+    ;
+
+/* Records lost because the ring was full. */
+uint64_t Log_Dropped(void);
+
+#define LOG_DEBUG(...)  Log_Write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)   Log_Write(LOG_LEVEL_INFO,  __VA_ARGS__)
+#define LOG_WARN(...)   Log_Write(LOG_LEVEL_WARN,  __VA_ARGS__)
+#define LOG_ERROR(...)  Log_Write(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+/* Rate-limited line for messages a client can trigger at will. */
+#define LOG_LIMITED(level, per_sec, ...)                                  \
+    do {                                                                  \
+        static LogLimit log_limit_;                                       \
+        Log_WriteLimited(&log_limit_, (per_sec), (level), __VA_ARGS__);   \
+    } while (0)
+
+#endif /* LOG_H */
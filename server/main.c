@@ -3,6 +3,7 @@
  */
 
 #include "server.h"
+#include "log.h"
 #include "../common/protocol.h"
 
 #include <stdio.h>
@@ -57,14 +58,31 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* Optional Prometheus endpoint: war3-lobby-server [port] [metrics_port] */
+    int metrics_port = 0;
+    if (argc > 2) {
+        metrics_port = atoi(argv[2]);
+        if (metrics_port <= 0 || metrics_port > 65535) {
+            printf("Invalid metrics port: %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    /* Everything the server logs goes through the writer thread; this
+     * file prints the banner and results directly, after Log_Flush. */
+    Log_Init(LOG_LEVEL_INFO);
+
     printf("========================================\n");
     printf("  War3 Lobby Server\n");
     printf("========================================\n");
     printf("Initialising on port %d ...\n", port);
     fflush(stdout);
 
-    Server srv;
+    /* The user table holds a 64 KB receive buffer per slot, far too
+     * large for the main thread's stack. */
+    static Server srv;
     if (Server_Init(&srv, port) != 0) {
+        Log_Shutdown();
         printf("[ERROR] Failed to initialise server on port %d\n", port);
         printf("Possible causes:\n");
         printf("  - Port %d is already in use\n", port);
@@ -72,12 +90,20 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (metrics_port > 0 && Server_EnableMetrics(&srv, metrics_port) != 0) {
+        Log_Flush();
+        printf("[WARN] Metrics endpoint disabled (port %d unavailable)\n",
+               metrics_port);
+    }
+
+    Log_Flush();
     printf("[OK] Server is running on port %d\n", port);
     printf("Waiting for connections... (Ctrl+C to stop)\n\n");
     fflush(stdout);
 
     Server_Run(&srv);
     Server_Shutdown(&srv);
+    Log_Shutdown();
 
     return 0;
 }
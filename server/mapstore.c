@@ -0,0 +1,848 @@
+/*
+ * mapstore.c – Content-addressed War3 map cache implementation.
+ *
+ * The store thread is the only writer of the map table and the only
+ * user of the files, the chunk cache and the connections.  The lobby
+ * thread reads map info and hands out upload tickets; those tables are
+ * behind s_lock, and the store thread takes the lock only to change
+ * them.
+ */
+
+#ifdef __linux__
+#   define _GNU_SOURCE          /* sendfile, MSG_NOSIGNAL */
+#endif
+
+#include "mapstore.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+/* ------------------------------------------------------------------ */
+/*  Not available on Windows                                          */
+/* ------------------------------------------------------------------ */
+
+int Mapstore_Start(int port, const char *dir)
+{
+    (void)dir;
+    LOG_WARN("[mapstore] not supported on this platform, port %d unused",
+             port);
+    return -1;
+}
+
+void Mapstore_Stop(void) {}
+int Mapstore_Port(void) { return 0; }
+
+uint32_t Mapstore_Chunks(uint32_t size)
+{
+    return (size + MAPSTORE_CHUNK - 1) / MAPSTORE_CHUNK;
+}
+
+int Mapstore_Find(uint32_t crc, const char *path, MapInfo *out)
+{
+    (void)crc; (void)path; (void)out;
+    return 0;
+}
+
+int Mapstore_ExpectUpload(uint32_t crc, const char *path, uint32_t *ticket)
+{
+    (void)crc; (void)path; (void)ticket;
+    return -1;
+}
+
+#else  /* POSIX */
+
+#include "sha1.h"
+#include "thread.h"
+#include "clock.h"
+#include "metrics.h"
+#include "../common/alloc.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#ifdef __linux__
+#   include <sys/sendfile.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#   define MSG_NOSIGNAL 0
+#endif
+
+#define MAPSTORE_POLL_MS    200
+#define MAPSTORE_GET_SIZE   (4 + SHA1_DIGEST_SIZE + 4)
+#define MAPSTORE_PUT_SIZE   12
+
+typedef struct {
+    int      used;
+    MapInfo  info;
+    uint8_t  digest[SHA1_DIGEST_SIZE];
+    int      fd;                          /* store thread only */
+    uint8_t  hits[MAPSTORE_MAX_CHUNKS];   /* requests per chunk, saturating */
+} Map;
+
+typedef struct CacheChunk CacheChunk;
+struct CacheChunk {
+    int         map;
+    uint32_t    index;
+    uint8_t    *data;
+    uint32_t    len;
+    int         busy;                     /* replies sending from it */
+    CacheChunk *prev, *next;              /* LRU list, most recent first */
+};
+
+typedef struct {
+    int      used;
+    uint32_t ticket;
+    uint32_t crc;
+    char     path[128];
+    time_t   expires;
+} Expect;
+
+enum { CONN_REQUEST, CONN_UPLOAD, CONN_REPLY };
+
+typedef struct {
+    int         fd;
+    int         state;
+    time_t      last;                     /* last progress */
+    uint8_t     req[MAPSTORE_GET_SIZE];
+    int         got;
+
+    /* Upload in progress */
+    int         file_fd;
+    uint32_t    left;
+    Sha1Ctx     sha;
+    Expect      expect;
+    char        tmp[256];
+
+    /* Reply in progress: header, then a body from memory or a file */
+    uint8_t     hdr[1 + SHA1_DIGEST_SIZE];
+    int         hdr_len, hdr_off;
+    CacheChunk *chunk;
+    int         src_fd;
+    off_t       src_off;
+    uint32_t    body_off, body_len;
+    int         close_after;
+} Conn;
+
+/* Shared with the lobby thread. */
+static Mutex    s_lock;
+static Map      s_maps[MAPSTORE_MAX_MAPS];
+static Expect   s_expect[MAPSTORE_MAX_UPLOADS];
+
+/* Store thread only. */
+static char        s_dir[200];
+static CacheChunk *s_lru_head, *s_lru_tail;
+static size_t      s_cache_bytes;
+static Conn        s_conns[MAPSTORE_MAX_CONNS];
+static int         s_conn_count;
+static uint8_t     s_io[65536];
+static uint64_t    s_served_file, s_served_cache;
+
+static Thread       s_thread;
+static int          s_listen_fd = -1;
+static int          s_port;
+static volatile int s_stop;
+static uint32_t     s_rng;
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                           */
+/* ------------------------------------------------------------------ */
+
+static const char *BaseName(const char *path)
+{
+    const char *b = path;
+    for (const char *p = path; *p; p++) {
+        if (*p == '\\' || *p == '/') b = p + 1;
+    }
+    return b;
+}
+
+/* The same map can sit at different paths on different hosts; the CRC
+ * and the file name identify it. */
+static int SameMap(const MapInfo *m, uint32_t crc, const char *path)
+{
+    return m->crc == crc && strcmp(BaseName(m->path), BaseName(path)) == 0;
+}
+
+static uint32_t NextTicket(void)
+{
+    uint32_t t;
+    do {
+        s_rng ^= s_rng << 13;
+        s_rng ^= s_rng >> 17;
+        s_rng ^= s_rng << 5;
+        t = s_rng;
+    } while (t == 0);
+    return t;
+}
+
+static uint32_t GetU32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+}
+
+static void PutU32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static int HexToDigest(const char *hex, uint8_t digest[SHA1_DIGEST_SIZE])
+{
+    for (int i = 0; i < SHA1_DIGEST_SIZE; i++) {
+        unsigned v;
+        if (sscanf(hex + i * 2, "%2x", &v) != 1) return -1;
+        digest[i] = (uint8_t)v;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Map table                                                         */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Add a stored file to the table.  Store thread (or startup) only.  A
+ * path too long for MapInfo is refused: cut short, it matches nothing.
+ */
+static int AddMap(const uint8_t digest[SHA1_DIGEST_SIZE], uint32_t crc,
+                  const char *path, uint32_t size, int fd)
+{
+    int rc = -1;
+    if (strlen(path) >= sizeof(s_maps[0].info.path)) return -1;
+
+    Mutex_Lock(&s_lock);
+    for (int i = 0; i < MAPSTORE_MAX_MAPS; i++) {
+        Map *m = &s_maps[i];
+        if (m->used) continue;
+
+        memset(m, 0, sizeof(*m));
+        m->used = 1;
+        memcpy(m->digest, digest, SHA1_DIGEST_SIZE);
+        Sha1_Hex(digest, m->info.sha1);
+        m->info.crc  = crc;
+        m->info.size = size;
+        snprintf(m->info.path, sizeof(m->info.path), "%s", path);
+        m->fd = fd;
+        rc = i;
+        break;
+    }
+    Mutex_Unlock(&s_lock);
+    return rc;
+}
+
+static Map *FindDigest(const uint8_t digest[SHA1_DIGEST_SIZE])
+{
+    for (int i = 0; i < MAPSTORE_MAX_MAPS; i++) {
+        if (s_maps[i].used &&
+            memcmp(s_maps[i].digest, digest, SHA1_DIGEST_SIZE) == 0)
+            return &s_maps[i];
+    }
+    return NULL;
+}
+
+/* Load <sha1>.meta / <sha1>.w3x pairs left by a previous run. */
+static void LoadDir(void)
+{
+    DIR *d = opendir(s_dir);
+    if (d == NULL) return;
+
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        size_t n = strlen(e->d_name);
+        if (n != 45 || strcmp(e->d_name + 40, ".meta") != 0) continue;
+
+        uint8_t digest[SHA1_DIGEST_SIZE];
+        if (HexToDigest(e->d_name, digest) != 0) continue;
+
+        /* A name cut short would open some other file: skip it. */
+        char file[PATH_MAX], line[200];
+        if (snprintf(file, sizeof(file), "%s/%s", s_dir, e->d_name) >=
+            (int)sizeof(file))
+            continue;
+        FILE *f = fopen(file, "r");
+        if (f == NULL) continue;
+        unsigned crc;
+        int ok = fgets(line, sizeof(line), f) != NULL &&
+                 sscanf(line, "%8x ", &crc) == 1 && strlen(line) > 9;
+        fclose(f);
+        if (!ok) continue;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (snprintf(file, sizeof(file), "%s/%.40s.w3x", s_dir, e->d_name) >=
+            (int)sizeof(file))
+            continue;
+        int fd = open(file, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size > MAPSTORE_MAX_SIZE ||
+            AddMap(digest, crc, line + 9, (uint32_t)st.st_size, fd) < 0) {
+            if (fd >= 0) close(fd);
+        }
+    }
+    closedir(d);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Chunk cache                                                       */
+/* ------------------------------------------------------------------ */
+
+static void LruUnlink(CacheChunk *c)
+{
+    if (c->prev) c->prev->next = c->next; else s_lru_head = c->next;
+    if (c->next) c->next->prev = c->prev; else s_lru_tail = c->prev;
+    c->prev = c->next = NULL;
+}
+
+static void LruPushFront(CacheChunk *c)
+{
+    c->prev = NULL;
+    c->next = s_lru_head;
+    if (s_lru_head) s_lru_head->prev = c; else s_lru_tail = c;
+    s_lru_head = c;
+}
+
+static CacheChunk *CacheFind(int map, uint32_t index)
+{
+    /* At most MAPSTORE_CACHE_BYTES / MAPSTORE_CHUNK entries. */
+    for (CacheChunk *c = s_lru_head; c; c = c->next) {
+        if (c->map == map && c->index == index) {
+            LruUnlink(c);
+            LruPushFront(c);
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/* Read a chunk into the cache, evicting idle chunks from the tail.
+ * Returns NULL if it does not fit or cannot be read. */
+static CacheChunk *CacheLoad(int map, uint32_t index, uint32_t len)
+{
+    CacheChunk *c = s_lru_tail;
+    while (s_cache_bytes + len > MAPSTORE_CACHE_BYTES && c) {
+        CacheChunk *prev = c->prev;
+        if (c->busy == 0) {
+            LruUnlink(c);
+            s_cache_bytes -= c->len;
+            Alloc_Free(c->data);
+            Alloc_Free(c);
+        }
+        c = prev;
+    }
+    if (s_cache_bytes + len > MAPSTORE_CACHE_BYTES) return NULL;
+
+    c = (CacheChunk *)Alloc_Calloc(ALLOC_MAPSTORE, 1, sizeof(*c));
+    if (c == NULL) return NULL;
+    c->data = (uint8_t *)Alloc_Malloc(ALLOC_MAPSTORE, len);
+    if (c->data == NULL ||
+        pread(s_maps[map].fd, c->data, len,
+              (off_t)index * MAPSTORE_CHUNK) != (ssize_t)len) {
+        Alloc_Free(c->data);
+        Alloc_Free(c);
+        return NULL;
+    }
+    c->map   = map;
+    c->index = index;
+    c->len   = len;
+    LruPushFront(c);
+    s_cache_bytes += len;
+    return c;
+}
+
+static void CacheClear(void)
+{
+    while (s_lru_head) {
+        CacheChunk *c = s_lru_head;
+        LruUnlink(c);
+        Alloc_Free(c->data);
+        Alloc_Free(c);
+    }
+    s_cache_bytes = 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Connections                                                       */
+/* ------------------------------------------------------------------ */
+
+static void CloseConn(Conn *c)
+{
+    if (c->chunk) c->chunk->busy--;
+    if (c->file_fd >= 0) {
+        close(c->file_fd);
+        unlink(c->tmp);
+    }
+    close(c->fd);
+    c->fd = -1;
+}
+
+static void StartReply(Conn *c, const uint8_t *hdr, int hdr_len)
+{
+    memcpy(c->hdr, hdr, (size_t)hdr_len);
+    c->hdr_len  = hdr_len;
+    c->hdr_off  = 0;
+    c->body_off = 0;
+    c->state    = CONN_REPLY;
+}
+
+static void HandleGet(Conn *c)
+{
+    uint8_t  hdr[5] = { 1, 0, 0, 0, 0 };
+    uint32_t index  = GetU32(c->req + 4 + SHA1_DIGEST_SIZE);
+    Map     *m      = FindDigest(c->req + 4);
+
+    c->chunk    = NULL;
+    c->body_len = 0;
+    if (m == NULL || index >= Mapstore_Chunks(m->info.size)) {
+        StartReply(c, hdr, 5);
+        return;
+    }
+
+    int      map = (int)(m - s_maps);
+    uint32_t len = m->info.size - index * MAPSTORE_CHUNK;
+    if (len > MAPSTORE_CHUNK) len = MAPSTORE_CHUNK;
+    if (m->hits[index] < 255) m->hits[index]++;
+
+    /* First request: straight from the file.  Repeats (the rest of the
+     * room) come from memory. */
+    CacheChunk *chunk = CacheFind(map, index);
+#ifdef __linux__
+    if (chunk == NULL && m->hits[index] > 1)
+#else
+    if (chunk == NULL)
+#endif
+        chunk = CacheLoad(map, index, len);
+
+    if (chunk) {
+        chunk->busy++;
+        c->chunk = chunk;
+        s_served_cache++;
+        Metrics_Add(MET_MAP_CHUNKS_CACHE, 1);
+    } else {
+        c->src_fd  = m->fd;
+        c->src_off = (off_t)index * MAPSTORE_CHUNK;
+        s_served_file++;
+        Metrics_Add(MET_MAP_CHUNKS_FILE, 1);
+    }
+    c->body_len = len;
+    hdr[0] = 0;
+    PutU32(hdr + 1, len);
+    StartReply(c, hdr, 5);
+}
+
+/* Claim an upload ticket.  Returns 0 and fills *out if it was valid. */
+static int ClaimTicket(uint32_t ticket, time_t now, Expect *out)
+{
+    int rc = -1;
+    Mutex_Lock(&s_lock);
+    for (int i = 0; i < MAPSTORE_MAX_UPLOADS; i++) {
+        Expect *e = &s_expect[i];
+        if (!e->used || e->ticket != ticket) continue;
+        if (now < e->expires) {
+            *out = *e;
+            rc = 0;
+        }
+        e->used = 0;
+        break;
+    }
+    Mutex_Unlock(&s_lock);
+    return rc;
+}
+
+static int StartUpload(Conn *c, time_t now)
+{
+    uint32_t ticket = GetU32(c->req + 4);
+    uint32_t size   = GetU32(c->req + 8);
+
+    if (size == 0 || size > MAPSTORE_MAX_SIZE ||
+        ClaimTicket(ticket, now, &c->expect) != 0)
+        return -1;
+
+    snprintf(c->tmp, sizeof(c->tmp), "%s/upload-%08x.tmp", s_dir, ticket);
+    c->file_fd = open(c->tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (c->file_fd < 0) return -1;
+
+    Sha1_Init(&c->sha);
+    c->left  = size;
+    c->state = CONN_UPLOAD;
+    LOG_INFO("[mapstore] receiving '%s' (%u bytes)", c->expect.path, size);
+    return 0;
+}
+
+/* The last byte arrived: name the file by content and publish it. */
+static int FinishUpload(Conn *c)
+{
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    char    hex[41], file[256], meta[256];
+    Sha1_Final(&c->sha, digest);
+    Sha1_Hex(digest, hex);
+
+    int written = fsync(c->file_fd) == 0;
+    close(c->file_fd);
+    c->file_fd = -1;
+    if (!written) {
+        unlink(c->tmp);
+        return -1;
+    }
+
+    uint8_t reply[1 + SHA1_DIGEST_SIZE];
+    reply[0] = 0;
+    memcpy(reply + 1, digest, SHA1_DIGEST_SIZE);
+    StartReply(c, reply, sizeof(reply));
+    c->close_after = 1;
+
+    if (FindDigest(digest)) {
+        unlink(c->tmp);          /* same content under another name */
+        return 0;
+    }
+
+    snprintf(file, sizeof(file), "%s/%s.w3x", s_dir, hex);
+    snprintf(meta, sizeof(meta), "%s/%s.meta", s_dir, hex);
+    FILE *f = fopen(meta, "w");
+    if (f == NULL || rename(c->tmp, file) != 0) {
+        if (f) fclose(f);
+        unlink(c->tmp);
+        return -1;
+    }
+    fprintf(f, "%08x %s\n", c->expect.crc, c->expect.path);
+    fclose(f);
+
+    struct stat st;
+    int fd = open(file, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        AddMap(digest, c->expect.crc, c->expect.path,
+               (uint32_t)st.st_size, fd) < 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    LOG_INFO("[mapstore] stored '%s' as %s (%u bytes)",
+             c->expect.path, hex, (unsigned)st.st_size);
+    return 0;
+}
+
+/* Readable: request bytes or upload data.  Returns -1 to close. */
+static int OnReadable(Conn *c, time_t now)
+{
+    if (c->state == CONN_UPLOAD) {
+        size_t  want = c->left < sizeof(s_io) ? c->left : sizeof(s_io);
+        ssize_t n    = recv(c->fd, s_io, want, 0);
+        if (n == 0) return -1;
+        if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+        if (write(c->file_fd, s_io, (size_t)n) != n) return -1;
+        Sha1_Update(&c->sha, s_io, (size_t)n);
+        c->left -= (uint32_t)n;
+        c->last  = now;
+        return c->left == 0 ? FinishUpload(c) : 0;
+    }
+
+    /* Request header: its first four bytes say how long it is. */
+    int need = (c->got >= 4 && memcmp(c->req, "W3MU", 4) == 0)
+             ? MAPSTORE_PUT_SIZE : MAPSTORE_GET_SIZE;
+    if (c->got < 4) need = 4;
+
+    ssize_t n = recv(c->fd, c->req + c->got, (size_t)(need - c->got), 0);
+    if (n == 0) return -1;
+    if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    c->got += (int)n;
+    c->last = now;
+    if (c->got < need) return 0;
+
+    if (need == 4) {
+        return (memcmp(c->req, "W3MU", 4) == 0 ||
+                memcmp(c->req, "W3MG", 4) == 0) ? 0 : -1;
+    }
+    c->got = 0;
+    if (need == MAPSTORE_PUT_SIZE) return StartUpload(c, now);
+    HandleGet(c);
+    return 0;
+}
+
+/* Writable: push the reply.  Returns -1 to close. */
+static int OnWritable(Conn *c, time_t now)
+{
+    while (c->hdr_off < c->hdr_len) {
+        ssize_t n = send(c->fd, c->hdr + c->hdr_off,
+                         (size_t)(c->hdr_len - c->hdr_off), MSG_NOSIGNAL);
+        if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+        c->hdr_off += (int)n;
+        c->last     = now;
+    }
+
+    while (c->body_off < c->body_len) {
+        size_t  left = c->body_len - c->body_off;
+        ssize_t n;
+        if (c->chunk) {
+            n = send(c->fd, c->chunk->data + c->body_off, left, MSG_NOSIGNAL);
+        } else {
+#ifdef __linux__
+            off_t off = c->src_off + c->body_off;
+            n = sendfile(c->fd, c->src_fd, &off, left);
+#else
+            if (left > sizeof(s_io)) left = sizeof(s_io);
+            n = pread(c->src_fd, s_io, left, c->src_off + c->body_off);
+            if (n > 0) n = send(c->fd, s_io, (size_t)n, MSG_NOSIGNAL);
+#endif
+        }
+        if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+        if (n == 0) return -1;
+        c->body_off += (uint32_t)n;
+        Metrics_Add(MET_MAP_BYTES_OUT, (uint64_t)n);
+        c->last      = now;
+    }
+
+    if (c->chunk) {
+        c->chunk->busy--;
+        c->chunk = NULL;
+    }
+    if (c->close_after) return -1;
+    c->state = CONN_REQUEST;
+    return 0;
+}
+
+static void AcceptConns(time_t now)
+{
+    while (1) {
+        int fd = accept(s_listen_fd, NULL, NULL);
+        if (fd < 0) return;
+        if (s_conn_count >= MAPSTORE_MAX_CONNS) {
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+        Conn *c = &s_conns[s_conn_count++];
+        memset(c, 0, sizeof(*c));
+        c->fd      = fd;
+        c->file_fd = -1;
+        c->state   = CONN_REQUEST;
+        c->last    = now;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Store thread                                                      */
+/* ------------------------------------------------------------------ */
+
+static void StoreThread(void *arg)
+{
+    (void)arg;
+    struct pollfd fds[1 + MAPSTORE_MAX_CONNS];
+
+    while (!s_stop) {
+        int nconns = s_conn_count;
+        fds[0].fd     = s_listen_fd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < nconns; i++) {
+            fds[1 + i].fd     = s_conns[i].fd;
+            fds[1 + i].events = s_conns[i].state == CONN_REPLY ? POLLOUT
+                                                               : POLLIN;
+        }
+
+        int    ready = poll(fds, (nfds_t)(1 + nconns), MAPSTORE_POLL_MS);
+        time_t now   = time(NULL);
+
+        for (int i = 0; ready > 0 && i < nconns; i++) {
+            Conn *c  = &s_conns[i];
+            short ev = fds[1 + i].revents;
+            if (ev == 0) continue;
+
+            int rc = 0;
+            if (ev & (POLLERR | POLLNVAL)) {
+                rc = -1;
+            } else if (c->state == CONN_REPLY) {
+                rc = OnWritable(c, now);
+            } else {
+                rc = OnReadable(c, now);
+            }
+            /* A reply may be ready at once (cached chunk, small file). */
+            if (rc == 0 && c->state == CONN_REPLY) rc = OnWritable(c, now);
+            if (rc != 0) CloseConn(c);
+        }
+
+        for (int i = 0; i < s_conn_count; i++) {
+            if (s_conns[i].fd >= 0 &&
+                now - s_conns[i].last > MAPSTORE_IDLE_TIMEOUT)
+                CloseConn(&s_conns[i]);
+        }
+
+        /* Compact closed connections before accepting new ones, so the
+         * poll set above still matched s_conns. */
+        for (int i = 0; i < s_conn_count; ) {
+            if (s_conns[i].fd < 0) s_conns[i] = s_conns[--s_conn_count];
+            else i++;
+        }
+        if (ready > 0 && (fds[0].revents & POLLIN)) AcceptConns(now);
+    }
+
+    for (int i = 0; i < s_conn_count; i++) CloseConn(&s_conns[i]);
+    s_conn_count = 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int Mapstore_Start(int port, const char *dir)
+{
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        LOG_ERROR("[mapstore] cannot create '%s'", dir);
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LOG_ERROR("[mapstore] socket() failed");
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((uint16_t)port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 64) < 0)
+    {
+        LOG_ERROR("[mapstore] bind()/listen() failed on port %d", port);
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN);
+
+    Mutex_Init(&s_lock);
+    memset(s_maps, 0, sizeof(s_maps));
+    memset(s_expect, 0, sizeof(s_expect));
+    snprintf(s_dir, sizeof(s_dir), "%s", dir);
+    LoadDir();
+
+    s_rng = (uint32_t)time(NULL) ^ (uint32_t)Clock_NowUs() ^ 0x9E3779B9u;
+    if (s_rng == 0) s_rng = 1;
+    s_listen_fd = fd;
+    s_stop      = 0;
+
+    if (Thread_Start(&s_thread, StoreThread, NULL) != 0) {
+        LOG_ERROR("[mapstore] failed to start the store thread");
+        close(fd);
+        s_listen_fd = -1;
+        Mutex_Destroy(&s_lock);
+        return -1;
+    }
+
+    int count = 0;
+    for (int i = 0; i < MAPSTORE_MAX_MAPS; i++) count += s_maps[i].used;
+    s_port = port;
+    LOG_INFO("[mapstore] listening on tcp port %d (%d maps in '%s')",
+             port, count, dir);
+    return 0;
+}
+
+void Mapstore_Stop(void)
+{
+    if (s_port == 0) return;
+
+    s_stop = 1;
+    Thread_Join(&s_thread);
+
+    LOG_INFO("[mapstore] served %llu chunks from files, %llu from memory",
+             (unsigned long long)s_served_file,
+             (unsigned long long)s_served_cache);
+
+    CacheClear();
+    for (int i = 0; i < MAPSTORE_MAX_MAPS; i++) {
+        if (s_maps[i].used) close(s_maps[i].fd);
+        s_maps[i].used = 0;
+    }
+    close(s_listen_fd);
+    s_listen_fd = -1;
+    s_port      = 0;
+    Mutex_Destroy(&s_lock);
+}
+
+int Mapstore_Port(void)
+{
+    return s_port;
+}
+
+uint32_t Mapstore_Chunks(uint32_t size)
+{
+    return (size + MAPSTORE_CHUNK - 1) / MAPSTORE_CHUNK;
+}
+
+int Mapstore_Find(uint32_t crc, const char *path, MapInfo *out)
+{
+    if (s_port == 0) return 0;
+
+    int found = 0;
+    Mutex_Lock(&s_lock);
+    for (int i = 0; i < MAPSTORE_MAX_MAPS; i++) {
+        if (s_maps[i].used && SameMap(&s_maps[i].info, crc, path)) {
+            *out  = s_maps[i].info;
+            found = 1;
+            break;
+        }
+    }
+    Mutex_Unlock(&s_lock);
+    return found;
+}
+
+int Mapstore_ExpectUpload(uint32_t crc, const char *path, uint32_t *ticket)
+{
+    MapInfo info;
+    if (s_port == 0) return -1;
+    if (Mapstore_Find(crc, path, &info)) return 1;
+
+    time_t now = time(NULL);
+    int    rc  = -1;
+    Mutex_Lock(&s_lock);
+    Expect *slot = NULL;
+    for (int i = 0; i < MAPSTORE_MAX_UPLOADS; i++) {
+        Expect *e = &s_expect[i];
+        if (e->used && now < e->expires) {
+            MapInfo m;
+            m.crc = e->crc;
+            snprintf(m.path, sizeof(m.path), "%s", e->path);
+            if (SameMap(&m, crc, path)) {
+                rc = 2;
+                break;
+            }
+        } else if (slot == NULL) {
+            slot = e;
+        }
+    }
+    if (rc != 2 && slot) {
+        memset(slot, 0, sizeof(*slot));
+        slot->used    = 1;
+        slot->ticket  = NextTicket();
+        slot->crc     = crc;
+        slot->expires = now + MAPSTORE_UPLOAD_TIMEOUT;
+        snprintf(slot->path, sizeof(slot->path), "%s", path);
+        *ticket = slot->ticket;
+        rc = 0;
+    }
+    Mutex_Unlock(&s_lock);
+    return rc;
+}
+
+#endif /* _WIN32 */
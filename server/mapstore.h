@@ -0,0 +1,87 @@
+/*
+ * mapstore.h – Content-addressed War3 map cache for War3 Lobby Server.
+ *
+ * War3 transfers a map the joiner lacks from the host, inside the game
+ * connection, at a few KB/s; a new map can hold up the start for
+ * minutes.  The map store moves that transfer ahead of time and off the
+ * host's uplink:
+ *
+ *   1. When a room member's game (reflector GAMEINFO cache) uses a map
+ *      the store does not have, the lobby sends the host map_upload with
+ *      a ticket; the host's client uploads the file once.
+ *   2. The store names it by SHA-1 and indexes it by the map CRC and
+ *      path from GAMEINFO.
+ *   3. Every other member, now and on later joins, gets map_available
+ *      and fetches the map in MAPSTORE_CHUNK pieces, over as many
+ *      parallel connections as it likes, resuming at any chunk.
+ *
+ * Wire format on the map port (lobby port + 2), integers big-endian:
+ *
+ *   upload   "W3MU" | ticket (4) | size (4) | size bytes
+ *            <- status (1, 0 = stored) | sha1 (20)
+ *   get      "W3MG" | sha1 (20) | chunk index (4)
+ *            <- status (1, 0 = ok) | length (4) | length bytes
+ *
+ * A connection may send any number of get requests back to back.
+ *
+ * The store runs on its own thread with its own poll() loop, like the
+ * relay.  Chunks are sent straight from the file with sendfile() on
+ * Linux; a chunk asked for a second time is kept in an in-memory LRU
+ * cache (MAPSTORE_CACHE_BYTES), since a room fetches the same map
+ * several times over in a short burst.  Files live in MAPSTORE_DIR as
+ * <sha1>.w3x with a <sha1>.meta line holding the CRC and path, and are
+ * picked up again on restart.
+ *
+ * POSIX only; on Windows Mapstore_Start fails and the lobby runs without
+ * it (War3's own in-game download still works).
+ */
+
+#ifndef MAPSTORE_H
+#define MAPSTORE_H
+
+#include <stdint.h>
+
+#define MAPSTORE_DIR            "maps"
+#define MAPSTORE_CHUNK          (256 * 1024)
+#define MAPSTORE_MAX_SIZE       (8 * 1024 * 1024)  /* War3 1.2x map limit */
+#define MAPSTORE_MAX_CHUNKS     (MAPSTORE_MAX_SIZE / MAPSTORE_CHUNK)
+#define MAPSTORE_MAX_MAPS       256
+#define MAPSTORE_MAX_CONNS      128
+#define MAPSTORE_MAX_UPLOADS    16
+#define MAPSTORE_CACHE_BYTES    (64 * 1024 * 1024)
+#define MAPSTORE_UPLOAD_TIMEOUT 60      /* seconds to start using a ticket */
+#define MAPSTORE_IDLE_TIMEOUT   30      /* seconds without progress */
+
+typedef struct {
+    char     sha1[41];            /* hex */
+    uint32_t crc;                 /* War3 map CRC from GAMEINFO */
+    char     path[128];           /* map path from GAMEINFO */
+    uint32_t size;
+} MapInfo;
+
+/*
+ * Load the maps in `dir` and start the store thread on `port`.
+ * Returns 0 on success, -1 on failure (the lobby runs without it).
+ */
+int Mapstore_Start(int port, const char *dir);
+
+/* Stop the thread and close every connection. */
+void Mapstore_Stop(void);
+
+/* TCP port in use, 0 if the store is not running. */
+int Mapstore_Port(void);
+
+/* Number of chunks a map of `size` bytes is served in. */
+uint32_t Mapstore_Chunks(uint32_t size);
+
+/* Look up a stored map.  Returns 1 and fills *out if found. */
+int Mapstore_Find(uint32_t crc, const char *path, MapInfo *out);
+
+/*
+ * Ask for a map to be uploaded.  Returns 0 and a new ticket, 1 if the
+ * map is already stored, 2 if an upload of it is already expected, or
+ * -1 if the store is not running or busy.  Called from the lobby thread.
+ */
+int Mapstore_ExpectUpload(uint32_t crc, const char *path, uint32_t *ticket);
+
+#endif /* MAPSTORE_H */
@@ -0,0 +1,263 @@
+/*
+ * match.c – Matchmaking queue implementation.
+ *
+ * Tickets and queues live in fixed pools linked by index.  Each ticket
+ * sits on two doubly-linked lists: its queue (FIFO by arrival) and the
+ * global age list, which is also in arrival order so expiry only ever
+ * looks at the oldest tickets.
+ */
+
+#include "match.h"
+#include <string.h>
+
+typedef struct {
+    User  *user;                 /* NULL if the ticket slot is free     */
+    int    queue;                /* index into s_queues                 */
+    int    prev, next;           /* neighbours in the queue             */
+    int    age_prev, age_next;   /* neighbours in the global age list   */
+    time_t enqueued;
+} Ticket;
+
+typedef struct {
+    int  used;
+    int  size;
+    char tag[MATCH_MAX_TAG];
+    int  head, tail, count;      /* ticket FIFO                         */
+    int  hash_next;              /* next queue in the same hash bucket  */
+    int  ready;                  /* on the ready list                   */
+    int  ready_next;
+} Queue;
+
+static Ticket s_tickets[MATCH_MAX_TICKETS];
+static Queue  s_queues[MATCH_MAX_QUEUES];
+static int    s_buckets[MATCH_HASH_BUCKETS];
+
+static int s_free_ticket;        /* free lists, linked through next /   */
+static int s_free_queue;         /* hash_next                           */
+static int s_age_head, s_age_tail;
+static int s_ready_head, s_ready_tail;
+static int s_waiting;
+
+/* ------------------------------------------------------------------ */
+/*  Internal helpers                                                  */
+/* ------------------------------------------------------------------ */
+
+static unsigned HashKey(int size, const char *tag)
+{
+    /* FNV-1a over the tag, seeded with the size. */
+    unsigned h = 2166136261u ^ (unsigned)size;
+    for (const unsigned char *p = (const unsigned char *)tag; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h % MATCH_HASH_BUCKETS;
+}
+
+/* Find the queue for (size, tag), creating it if `create` is set. */
+static int FindQueue(int size, const char *tag, int create)
+{
+    unsigned b = HashKey(size, tag);
+    for (int q = s_buckets[b]; q != -1; q = s_queues[q].hash_next) {
+        if (s_queues[q].size == size && strcmp(s_queues[q].tag, tag) == 0)
+            return q;
+    }
+    if (!create || s_free_queue == -1) return -1;
+
+    int q = s_free_queue;
+    s_free_queue = s_queues[q].hash_next;
+
+    memset(&s_queues[q], 0, sizeof(s_queues[q]));
+    s_queues[q].used = 1;
+    s_queues[q].size = size;
+    strncpy(s_queues[q].tag, tag, MATCH_MAX_TAG - 1);
+    s_queues[q].head = s_queues[q].tail = -1;
+    s_queues[q].ready_next = -1;
+    s_queues[q].hash_next  = s_buckets[b];
+    s_buckets[b] = q;
+    return q;
+}
+
+/* Return an empty queue to the free pool so arbitrary tags can't leak. */
+static void ReleaseQueueIfIdle(int q)
+{
+    Queue *qu = &s_queues[q];
+    if (qu->count > 0 || qu->ready) return;
+
+    unsigned b = HashKey(qu->size, qu->tag);
+    int *link = &s_buckets[b];
+    while (*link != q) link = &s_queues[*link].hash_next;
+    *link = qu->hash_next;
+
+    qu->used      = 0;
+    qu->hash_next = s_free_queue;
+    s_free_queue  = q;
+}
+
+static void MarkReady(int q)
+{
+    Queue *qu = &s_queues[q];
+    if (qu->ready || qu->count < qu->size) return;
+
+    qu->ready      = 1;
+    qu->ready_next = -1;
+    if (s_ready_tail == -1) s_ready_head = q;
+    else                    s_queues[s_ready_tail].ready_next = q;
+    s_ready_tail = q;
+}
+
+/* Unlink ticket `t` from its queue and the age list and free it. */
+static void RemoveTicket(int t)
+{
+    Ticket *tk = &s_tickets[t];
+    Queue  *qu = &s_queues[tk->queue];
+
+    if (tk->prev != -1) s_tickets[tk->prev].next = tk->next;
+    else                qu->head = tk->next;
+    if (tk->next != -1) s_tickets[tk->next].prev = tk->prev;
+    else                qu->tail = tk->prev;
+    qu->count--;
+
+    if (tk->age_prev != -1) s_tickets[tk->age_prev].age_next = tk->age_next;
+    else                    s_age_head = tk->age_next;
+    if (tk->age_next != -1) s_tickets[tk->age_next].age_prev = tk->age_prev;
+    else                    s_age_tail = tk->age_prev;
+
+    tk->user->match_ticket = -1;
+    tk->user = NULL;
+    tk->next = s_free_ticket;
+    s_free_ticket = t;
+    s_waiting--;
+
+    ReleaseQueueIfIdle(tk->queue);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+void Match_Init(void)
+{
+    for (int i = 0; i < MATCH_MAX_TICKETS; i++) {
+        s_tickets[i].user = NULL;
+        s_tickets[i].next = (i + 1 < MATCH_MAX_TICKETS) ? i + 1 : -1;
+    }
+    for (int i = 0; i < MATCH_MAX_QUEUES; i++) {
+        s_queues[i].used      = 0;
+        s_queues[i].hash_next = (i + 1 < MATCH_MAX_QUEUES) ? i + 1 : -1;
+    }
+    for (int i = 0; i < MATCH_HASH_BUCKETS; i++) {
+        s_buckets[i] = -1;
+    }
+    s_free_ticket = 0;
+    s_free_queue  = 0;
+    s_age_head = s_age_tail = -1;
+    s_ready_head = s_ready_tail = -1;
+    s_waiting = 0;
+}
+
+int Match_Enqueue(User *user, int size, const char *tag, time_t now)
+{
+    if (user->match_ticket != -1) return -1;
+    if (tag == NULL) tag = "";
+    if (s_free_ticket == -1) return -2;
+
+    int q = FindQueue(size, tag, 1);
+    if (q == -1) return -2;
+
+    int t = s_free_ticket;
+    s_free_ticket = s_tickets[t].next;
+
+    Ticket *tk = &s_tickets[t];
+    tk->user     = user;
+    tk->queue    = q;
+    tk->enqueued = now;
+
+    /* Append to the queue FIFO. */
+    Queue *qu = &s_queues[q];
+    tk->prev = qu->tail;
+    tk->next = -1;
+    if (qu->tail != -1) s_tickets[qu->tail].next = t;
+    else                qu->head = t;
+    qu->tail = t;
+    qu->count++;
+
+    /* Append to the global age list. */
+    tk->age_prev = s_age_tail;
+    tk->age_next = -1;
+    if (s_age_tail != -1) s_tickets[s_age_tail].age_next = t;
+    else                  s_age_head = t;
+    s_age_tail = t;
+
+    user->match_ticket = t;
+    s_waiting++;
+
+    MarkReady(q);
+    return 0;
+}
+
+int Match_Cancel(User *user)
+{
+    if (user == NULL || user->match_ticket == -1) return 0;
+    RemoveTicket(user->match_ticket);
+    return 1;
+}
+
+int Match_QueueLength(const User *user)
+{
+    if (user == NULL || user->match_ticket == -1) return 0;
+    return s_queues[s_tickets[user->match_ticket].queue].count;
+}
+
+int Match_Waiting(void)
+{
+    return s_waiting;
+}
+
+int Match_Tick(time_t now, Match_FormFn form, Match_ExpireFn expire,
+               void *ctx)
+{
+    /* ---- Expire tickets that have waited too long ---- */
+    while (s_age_head != -1 &&
+           now - s_tickets[s_age_head].enqueued > MATCH_TIMEOUT)
+    {
+        User *user = s_tickets[s_age_head].user;
+        RemoveTicket(s_age_head);
+        if (expire) expire(user, ctx);
+    }
+
+    /* ---- Form groups from ready queues ---- */
+    int formed = 0;
+    while (s_ready_head != -1 && formed < MATCH_TICK_GROUPS) {
+        int    q  = s_ready_head;
+        Queue *qu = &s_queues[q];
+
+        if (qu->count < qu->size) {
+            /* Cancellations shrank it below a full group. */
+            s_ready_head = qu->ready_next;
+            if (s_ready_head == -1) s_ready_tail = -1;
+            qu->ready = 0;
+            ReleaseQueueIfIdle(q);
+            continue;
+        }
+
+        MatchGroup group;
+        group.count = 0;
+        group.size  = qu->size;
+        memcpy(group.tag, qu->tag, MATCH_MAX_TAG);
+        for (int t = qu->head; t != -1 && group.count < qu->size;
+             t = s_tickets[t].next) {
+            group.members[group.count++] = s_tickets[t].user;
+        }
+
+        if (form(&group, ctx) != 0) break;   /* retry next tick */
+
+        /* The queue stays on the ready list while it can still
+         * fill another group. */
+        for (int i = 0; i < group.count; i++) {
+            RemoveTicket(group.members[i]->match_ticket);
+        }
+        formed++;
+    }
+
+    return formed == MATCH_TICK_GROUPS && s_ready_head != -1;
+}
@@ -0,0 +1,70 @@
+/*
+ * match.h – Matchmaking queues for War3 Lobby Server.
+ *
+ * Players enqueue with a room size and an optional tag (map / mode).
+ * Every distinct (size, tag) pair gets its own FIFO queue, found through
+ * a hash table, so enqueue and cancel are O(1).  A queue that holds at
+ * least `size` tickets is put on a ready list; Match_Tick, called once
+ * per event-loop iteration, drains the ready list and hands each full
+ * group to the caller, which creates the room.
+ */
+
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <time.h>
+#include "../common/message.h"
+#include "user.h"
+
+#define MATCH_MAX_TICKETS  4096     /* players waiting at once          */
+#define MATCH_MAX_QUEUES   512      /* distinct (size, tag) queues      */
+#define MATCH_HASH_BUCKETS 1024
+#define MATCH_MAX_TAG      32
+#define MATCH_TIMEOUT      300      /* seconds before a ticket expires  */
+#define MATCH_TICK_GROUPS  64       /* groups formed per tick at most   */
+
+typedef struct {
+    User *members[MAX_ROOM_PLAYERS];
+    int   count;
+    int   size;
+    char  tag[MATCH_MAX_TAG];
+} MatchGroup;
+
+/*
+ * Called by Match_Tick for each complete group.  Return 0 if the group
+ * was placed in a room (its tickets are then consumed), non-zero to
+ * leave it queued and stop forming groups for this tick.
+ */
+typedef int  (*Match_FormFn)(const MatchGroup *group, void *ctx);
+
+/* Called by Match_Tick for every ticket that waited MATCH_TIMEOUT. */
+typedef void (*Match_ExpireFn)(User *user, void *ctx);
+
+/* Reset all queues and tickets. */
+void Match_Init(void);
+
+/*
+ * Queue `user` for a room of `size` players with the given tag
+ * (NULL or "" for any).  Returns 0 on success, -1 if the user is
+ * already queued, -2 if the queue tables are full.
+ */
+int Match_Enqueue(User *user, int size, const char *tag, time_t now);
+
+/* Remove `user` from its queue, if any.  Returns 1 if it was queued. */
+int Match_Cancel(User *user);
+
+/* Number of tickets waiting in the queue `user` is in (0 if none). */
+int Match_QueueLength(const User *user);
+
+/* Total number of waiting tickets. */
+int Match_Waiting(void);
+
+/*
+ * Expire old tickets, then form up to MATCH_TICK_GROUPS groups from
+ * ready queues.  Returns non-zero if that budget ran out with queues
+ * still ready, so the caller should come back without waiting.
+ */
+int Match_Tick(time_t now, Match_FormFn form, Match_ExpireFn expire,
+               void *ctx);
+
+#endif /* MATCH_H */
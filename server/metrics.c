@@ -0,0 +1,446 @@
+/*
+ * metrics.c – Counters and latency histograms (see metrics.h).
+ */
+
+#include "metrics.h"
+#include "../common/message.h"
+#include "../common/alloc.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#   include <windows.h>
+#   define THREAD_LOCAL      __declspec(thread)
+#   define LOAD64(p)         (*(volatile uint64_t *)(p))
+#   define STORE64(p, v)     (*(volatile uint64_t *)(p) = (v))
+#   define ADD64(p, v)       InterlockedExchangeAdd64((volatile LONG64 *)(p), \
+                                                      (LONG64)(v))
+#   define FETCH_INC(p)      (InterlockedIncrement((volatile LONG *)(p)) - 1)
+#else
+#   define THREAD_LOCAL      _Thread_local
+#   define LOAD64(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+#   define STORE64(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#   define ADD64(p, v)       __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#   define FETCH_INC(p)      __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+#endif
+
+/* Client message types, in the order they are exported; anything else
+ * is counted under the last entry. */
+static const char *const s_msg_types[] = {
+    MSG_LOGIN, MSG_ROOM_LIST, MSG_ROOM_CREATE, MSG_ROOM_JOIN,
+    MSG_QUICK_JOIN, MSG_ROOM_LEAVE, MSG_CHAT, MSG_HEARTBEAT,
+    MSG_MATCH_ENQUEUE, MSG_MATCH_CANCEL, MSG_CHANNEL_JOIN,
+    MSG_CHANNEL_LEAVE, MSG_CHANNEL_CHAT, MSG_WHISPER, MSG_GAME_STATUS,
+    MSG_PRESENCE_SUB, MSG_PRESENCE_UNSUB, MSG_RELAY_OPEN,
+    MSG_PUNCH_REQUEST, MSG_PUNCH_RESULT, MSG_RTT_REPORT, MSG_START_GAME,
+    "other",
+};
+#define MSG_TYPE_COUNT ((int)(sizeof(s_msg_types) / sizeof(s_msg_types[0])))
+
+typedef struct {
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t sum;
+} Hist;
+
+typedef struct {
+    uint64_t counters[MET_COUNTER_COUNT];
+    Hist     messages[MSG_TYPE_COUNT];
+    uint64_t message_allocs[MSG_TYPE_COUNT];
+    Hist     fanout[MET_FANOUT_COUNT];
+    Hist     phases[MET_PHASE_COUNT];
+    Hist     loop_busy;
+} Shard;
+
+/* Exported name, labels and help of each counter.  Consecutive entries
+ * with the same name form one family. */
+static const struct {
+    const char *name;
+    const char *labels;
+    const char *help;
+} s_counters[MET_COUNTER_COUNT] = {
+    [MET_CONN_ACCEPTED]    = { "war3_connections_accepted_total", NULL,
+                               "Lobby connections accepted." },
+    [MET_CONN_REJECTED]    = { "war3_connections_rejected_total", NULL,
+                               "Lobby connections refused: no slot or fd." },
+    [MET_CONN_CLOSED]      = { "war3_connections_closed_total", NULL,
+                               "Lobby connections closed." },
+    [MET_BYTES_IN]         = { "war3_lobby_received_bytes_total", NULL,
+                               "Bytes read from lobby connections." },
+    [MET_BYTES_OUT]        = { "war3_lobby_sent_bytes_total", NULL,
+                               "Bytes written to lobby connections." },
+    [MET_UDP_PKTS_IN]      = { "war3_reflector_received_packets_total", NULL,
+                               "Datagrams received by the reflector." },
+    [MET_UDP_PKTS_OUT]     = { "war3_reflector_sent_packets_total", NULL,
+                               "Datagrams forwarded by the reflector." },
+    [MET_UDP_BYTES_IN]     = { "war3_reflector_received_bytes_total", NULL,
+                               "War3 payload bytes received by the reflector." },
+    [MET_UDP_BYTES_OUT]    = { "war3_reflector_sent_bytes_total", NULL,
+                               "War3 payload bytes forwarded by the reflector." },
+    [MET_RELAY_SESSIONS]   = { "war3_relay_sessions_total", NULL,
+                               "Relay sessions finished." },
+    [MET_RELAY_BYTES]      = { "war3_relay_bytes_total", NULL,
+                               "Bytes carried by the game relay." },
+    [MET_MAP_CHUNKS_FILE]  = { "war3_map_chunks_served_total",
+                               "source=\"file\"",
+                               "Map chunks served, by where they were read." },
+    [MET_MAP_CHUNKS_CACHE] = { "war3_map_chunks_served_total",
+                               "source=\"cache\"", NULL },
+    [MET_MAP_BYTES_OUT]    = { "war3_map_sent_bytes_total", NULL,
+                               "Map bytes sent by the map store." },
+    [MET_LOOP_STALLS]      = { "war3_loop_stalls_total", NULL,
+                               "Event-loop iterations over the watchdog limit." },
+    [MET_LOG_DROPPED]      = { "war3_log_dropped_total", NULL,
+                               "Log records dropped because the ring was full." },
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} s_gauges[MET_GAUGE_COUNT] = {
+    [MET_GAUGE_CONNECTIONS]  = { "war3_connections",
+                                 "Open lobby connections." },
+    [MET_GAUGE_USERS]        = { "war3_users", "Logged-in users." },
+    [MET_GAUGE_ROOMS]        = { "war3_rooms", "Open rooms." },
+    [MET_GAUGE_ROOM_MEMBERS] = { "war3_room_members",
+                                 "Users in a room." },
+};
+
+static const char *const s_phase_names[MET_PHASE_COUNT] = {
+    [MET_PHASE_POLL]   = "poll",
+    [MET_PHASE_ACCEPT] = "accept",
+    [MET_PHASE_UDP]    = "udp",
+    [MET_PHASE_SCRAPE] = "scrape",
+    [MET_PHASE_ADMIN]  = "admin",
+    [MET_PHASE_RECV]   = "recv",
+    [MET_PHASE_PARSE]  = "parse",
+    [MET_PHASE_HANDLE] = "handle",
+    [MET_PHASE_TIMERS] = "timers",
+    [MET_PHASE_SEND]   = "send",
+};
+
+static const char *const s_fanout_kinds[MET_FANOUT_COUNT] = {
+    [MET_FANOUT_ROOM]      = "room",
+    [MET_FANOUT_CHANNEL]   = "channel",
+    [MET_FANOUT_REFLECTOR] = "reflector",
+};
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+/* The last shard is shared (atomic adds) by any threads beyond
+ * METRICS_MAX_SHARDS - 1; the others belong to one thread each. */
+static Shard s_shards[METRICS_MAX_SHARDS];
+static int   s_shard_next;
+static int64_t s_gauge_values[MET_GAUGE_COUNT];
+
+static THREAD_LOCAL Shard *t_shard;
+static THREAD_LOCAL int    t_shared;
+
+static Shard *MyShard(void)
+{
+    if (t_shard == NULL) {
+        int i = FETCH_INC(&s_shard_next);
+        if (i >= METRICS_MAX_SHARDS - 1) {
+            i        = METRICS_MAX_SHARDS - 1;
+            t_shared = 1;
+        }
+        t_shard = &s_shards[i];
+    }
+    return t_shard;
+}
+
+/* Only the owning thread writes an unshared slot, so a plain
+ * read-modify-write is enough; readers just need untorn values. */
+static void Bump(uint64_t *p, uint64_t n)
+{
+    if (t_shared) {
+        ADD64(p, n);
+    } else {
+        STORE64(p, LOAD64(p) + n);
+    }
+}
+
+static int BucketIndex(uint64_t v)
+{
+    const uint64_t top = ((uint64_t)1 << (METRICS_MAX_EXP + 1)) - 1;
+    if (v > top) v = top;
+    if (v < (1u << METRICS_SUB_BITS)) return (int)v;
+
+    int e = 63;
+    while (!(v >> e)) e--;
+    int sub = (int)(v >> (e - METRICS_SUB_BITS)) & ((1 << METRICS_SUB_BITS) - 1);
+    return (e - METRICS_SUB_BITS + 1) * (1 << METRICS_SUB_BITS) + sub;
+}
+
+static void Record(Hist *h, uint64_t v)
+{
+    Bump(&h->buckets[BucketIndex(v)], 1);
+    Bump(&h->sum, v);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Recording                                                         */
+/* ------------------------------------------------------------------ */
+
+void Metrics_Add(MetricCounter c, uint64_t n)
+{
+    Bump(&MyShard()->counters[c], n);
+}
+
+uint64_t Metrics_Counter(MetricCounter c)
+{
+    uint64_t v = 0;
+    for (int s = 0; s < METRICS_MAX_SHARDS; s++)
+        v += LOAD64(&s_shards[s].counters[c]);
+    return v;
+}
+
+void Metrics_SetGauge(MetricGauge g, int64_t value)
+{
+    s_gauge_values[g] = value;
+}
+
+int Metrics_MessageIndex(const char *type)
+{
+    for (int i = 0; i < MSG_TYPE_COUNT - 1; i++) {
+        if (strcmp(type, s_msg_types[i]) == 0) return i;
+    }
+    return MSG_TYPE_COUNT - 1;
+}
+
+const char *Metrics_MessageName(int index)
+{
+    if (index < 0 || index >= MSG_TYPE_COUNT) index = MSG_TYPE_COUNT - 1;
+    return s_msg_types[index];
+}
+
+void Metrics_RecordMessage(int index, uint64_t service_ns, uint64_t allocs)
+{
+    if (index < 0 || index >= MSG_TYPE_COUNT) index = MSG_TYPE_COUNT - 1;
+    Shard *s = MyShard();
+    Record(&s->messages[index], service_ns);
+    if (allocs) Bump(&s->message_allocs[index], allocs);
+}
+
+void Metrics_RecordFanout(MetricFanout kind, uint32_t recipients)
+{
+    Record(&MyShard()->fanout[kind], recipients);
+}
+
+void Metrics_RecordPhase(MetricPhase phase, uint64_t ns)
+{
+    Record(&MyShard()->phases[phase], ns);
+}
+
+void Metrics_RecordLoop(uint64_t busy_ns)
+{
+    Record(&MyShard()->loop_busy, busy_ns);
+}
+
+const char *Metrics_PhaseName(MetricPhase phase)
+{
+    return s_phase_names[phase];
+}
+
+/* ------------------------------------------------------------------ */
+/*  Prometheus text format                                            */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    char  *buf;
+    size_t cap;
+    size_t len;                /* may run past cap: the size needed */
+} Out;
+
+static void Put(Out *o, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(o->len < o->cap ? o->buf + o->len : NULL,
+                      o->len < o->cap ? o->cap - o->len : 0, fmt, ap);
+    va_end(ap);
+    if (n > 0) o->len += (size_t)n;
+}
+
+static void Family(Out *o, const char *name, const char *type,
+                   const char *help)
+{
+    Put(o, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Sum a histogram over all shards; returns the observation count. */
+static uint64_t SumHist(size_t offset, uint64_t buckets[METRICS_BUCKETS],
+                        uint64_t *sum)
+{
+    uint64_t count = 0;
+    memset(buckets, 0, METRICS_BUCKETS * sizeof(uint64_t));
+    *sum = 0;
+    for (int s = 0; s < METRICS_MAX_SHARDS; s++) {
+        const Hist *h = (const Hist *)((const char *)&s_shards[s] + offset);
+        for (int b = 0; b < METRICS_BUCKETS; b++) {
+            uint64_t v = LOAD64(&h->buckets[b]);
+            buckets[b] += v;
+            count      += v;
+        }
+        *sum += LOAD64(&h->sum);
+    }
+    return count;
+}
+
+/*
+ * One histogram series, labelled unless `label` is empty.  Buckets end
+ * at 2^k - 1 for k in [first_exp, last_exp], which the log-linear
+ * buckets split exactly; `scale` converts recorded units to exported
+ * ones.
+ */
+static void Series(Out *o, const char *name, const char *label,
+                   const uint64_t buckets[METRICS_BUCKETS], uint64_t count,
+                   uint64_t sum, double scale, int first_exp, int last_exp)
+{
+    const char *sep  = label[0] ? "," : "";
+    uint64_t    cum  = 0;
+    int         next = 0;
+    for (int k = first_exp; k <= last_exp; k++) {
+        int end = BucketIndex((uint64_t)1 << k);
+        while (next < end) cum += buckets[next++];
+        Put(o, "%s_bucket{%s%sle=\"%.6g\"} %llu\n", name, label, sep,
+            (double)(((uint64_t)1 << k) - 1) * scale,
+            (unsigned long long)cum);
+    }
+    Put(o, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, label, sep,
+        (unsigned long long)count);
+    if (label[0]) {
+        Put(o, "%s_sum{%s} %.9g\n", name, label, (double)sum * scale);
+        Put(o, "%s_count{%s} %llu\n", name, label, (unsigned long long)count);
+    } else {
+        Put(o, "%s_sum %.9g\n", name, (double)sum * scale);
+        Put(o, "%s_count %llu\n", name, (unsigned long long)count);
+    }
+}
+
+size_t Metrics_Render(char *buf, size_t buf_len)
+{
+    Out o = { buf, buf_len, 0 };
+    static uint64_t buckets[METRICS_BUCKETS];    /* lobby thread only */
+    char label[64];
+
+    for (int c = 0; c < MET_COUNTER_COUNT; c++) {
+        uint64_t v = Metrics_Counter((MetricCounter)c);
+
+        if (c == 0 || strcmp(s_counters[c].name, s_counters[c - 1].name) != 0)
+            Family(&o, s_counters[c].name, "counter", s_counters[c].help);
+        if (s_counters[c].labels)
+            Put(&o, "%s{%s} %llu\n", s_counters[c].name, s_counters[c].labels,
+                (unsigned long long)v);
+        else
+            Put(&o, "%s %llu\n", s_counters[c].name, (unsigned long long)v);
+    }
+
+    for (int g = 0; g < MET_GAUGE_COUNT; g++) {
+        Family(&o, s_gauges[g].name, "gauge", s_gauges[g].help);
+        Put(&o, "%s %lld\n", s_gauges[g].name,
+            (long long)s_gauge_values[g]);
+    }
+
+    /* Messages per type: the counter comes from the histogram count. */
+    uint64_t counts[MSG_TYPE_COUNT], sums[MSG_TYPE_COUNT];
+    for (int t = 0; t < MSG_TYPE_COUNT; t++)
+        counts[t] = SumHist(offsetof(Shard, messages) + t * sizeof(Hist),
+                            buckets, &sums[t]);
+
+    Family(&o, "war3_messages_total", "counter",
+           "Client messages handled, by type.");
+    for (int t = 0; t < MSG_TYPE_COUNT; t++) {
+        if (counts[t] == 0) continue;
+        Put(&o, "war3_messages_total{type=\"%s\"} %llu\n", s_msg_types[t],
+            (unsigned long long)counts[t]);
+    }
+
+    Family(&o, "war3_handler_allocations_total", "counter",
+           "Heap allocations made while handling client messages, by type.");
+    for (int t = 0; t < MSG_TYPE_COUNT; t++) {
+        if (counts[t] == 0) continue;
+        uint64_t allocs = 0;
+        for (int s = 0; s < METRICS_MAX_SHARDS; s++)
+            allocs += LOAD64(&s_shards[s].message_allocs[t]);
+        Put(&o, "war3_handler_allocations_total{type=\"%s\"} %llu\n",
+            s_msg_types[t], (unsigned long long)allocs);
+    }
+
+    Family(&o, "war3_handler_seconds", "histogram",
+           "Time to parse and handle one client message, by type.");
+    for (int t = 0; t < MSG_TYPE_COUNT; t++) {
+        if (counts[t] == 0) continue;
+        uint64_t sum;
+        uint64_t count = SumHist(offsetof(Shard, messages) + t * sizeof(Hist),
+                                 buckets, &sum);
+        snprintf(label, sizeof(label), "type=\"%s\"", s_msg_types[t]);
+        /* 1 us .. 17 s */
+        Series(&o, "war3_handler_seconds", label, buckets, count, sum,
+               1e-9, 10, 34);
+    }
+
+    Family(&o, "war3_fanout_recipients", "histogram",
+           "Recipients reached by one broadcast, by kind.");
+    for (int k = 0; k < MET_FANOUT_COUNT; k++) {
+        uint64_t sum;
+        uint64_t count = SumHist(offsetof(Shard, fanout) + k * sizeof(Hist),
+                                 buckets, &sum);
+        snprintf(label, sizeof(label), "kind=\"%s\"", s_fanout_kinds[k]);
+        Series(&o, "war3_fanout_recipients", label, buckets, count, sum,
+               1.0, 0, 9);
+    }
+
+    Family(&o, "war3_loop_phase_seconds", "histogram",
+           "Time one event-loop iteration spent in each phase.");
+    for (int p = 0; p < MET_PHASE_COUNT; p++) {
+        uint64_t sum;
+        uint64_t count = SumHist(offsetof(Shard, phases) + p * sizeof(Hist),
+                                 buckets, &sum);
+        snprintf(label, sizeof(label), "phase=\"%s\"", s_phase_names[p]);
+        Series(&o, "war3_loop_phase_seconds", label, buckets, count, sum,
+               1e-9, 10, 34);
+    }
+
+    {
+        uint64_t sum;
+        uint64_t count = SumHist(offsetof(Shard, loop_busy), buckets, &sum);
+        Family(&o, "war3_loop_busy_seconds", "histogram",
+               "Busy time of one event-loop iteration (excluding the poll).");
+        Series(&o, "war3_loop_busy_seconds", "", buckets, count, sum,
+               1e-9, 10, 34);
+    }
+
+    /* Heap use by subsystem (alloc.h). */
+    AllocStats st[ALLOC_SITE_COUNT];
+    for (int a = 0; a < ALLOC_SITE_COUNT; a++)
+        Alloc_GetStats((AllocSite)a, &st[a]);
+
+    Family(&o, "war3_alloc_calls_total", "counter",
+           "Heap allocations, by subsystem.");
+    for (int a = 0; a < ALLOC_SITE_COUNT; a++)
+        Put(&o, "war3_alloc_calls_total{site=\"%s\"} %llu\n",
+            Alloc_SiteName((AllocSite)a), (unsigned long long)st[a].calls);
+    Family(&o, "war3_alloc_bytes_total", "counter",
+           "Bytes requested from the heap, by subsystem.");
+    for (int a = 0; a < ALLOC_SITE_COUNT; a++)
+        Put(&o, "war3_alloc_bytes_total{site=\"%s\"} %llu\n",
+            Alloc_SiteName((AllocSite)a), (unsigned long long)st[a].bytes);
+    Family(&o, "war3_alloc_live_bytes", "gauge",
+           "Heap bytes currently allocated, by subsystem.");
+    for (int a = 0; a < ALLOC_SITE_COUNT; a++)
+        Put(&o, "war3_alloc_live_bytes{site=\"%s\"} %llu\n",
+            Alloc_SiteName((AllocSite)a),
+            (unsigned long long)st[a].live_bytes);
+    Family(&o, "war3_alloc_peak_bytes", "gauge",
+           "Most heap bytes allocated at once, by subsystem.");
+    for (int a = 0; a < ALLOC_SITE_COUNT; a++)
+        Put(&o, "war3_alloc_peak_bytes{site=\"%s\"} %llu\n",
+            Alloc_SiteName((AllocSite)a),
+            (unsigned long long)st[a].peak_bytes);
+
+    return o.len;
+}
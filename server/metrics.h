@@ -0,0 +1,121 @@
+/*
+ * metrics.h – Counters and latency histograms for War3 Lobby Server.
+ *
+ * Every thread that records (the lobby loop, the relay workers, the map
+ * store) gets its own shard on first use, so recording is a couple of
+ * relaxed loads and stores with no locks and no shared cache lines.
+ * Reading sums the shards; a shard is only ever written by its owner.
+ *
+ * Histograms are log-linear in the manner of HdrHistogram: values below
+ * 8 get a bucket each, and every power of two above that is split into
+ * 8 sub-buckets (at most 12.5% relative error).  They are exported as
+ * Prometheus histograms with one bucket per power of two.
+ *
+ * Gauges (connections, rooms, ...) are set by the lobby thread right
+ * before a scrape (see exporter.h), not tracked on every change.
+ *
+ * Event-loop phase timings come from the profiler (profiler.h).
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_MAX_SHARDS    8        /* recording threads */
+#define METRICS_SUB_BITS      3        /* 8 sub-buckets per power of two */
+#define METRICS_MAX_EXP       40       /* values are clamped below 2^41 */
+#define METRICS_BUCKETS       ((METRICS_MAX_EXP - 1) * (1 << METRICS_SUB_BITS))
+
+typedef enum {
+    MET_CONN_ACCEPTED,                 /* lobby TCP connections */
+    MET_CONN_REJECTED,                 /* no user slot, or fd too high */
+    MET_CONN_CLOSED,
+    MET_BYTES_IN,                      /* lobby TCP payload */
+    MET_BYTES_OUT,
+    MET_UDP_PKTS_IN,                   /* reflector */
+    MET_UDP_PKTS_OUT,
+    MET_UDP_BYTES_IN,
+    MET_UDP_BYTES_OUT,
+    MET_RELAY_SESSIONS,                /* finished relay sessions */
+    MET_RELAY_BYTES,
+    MET_MAP_CHUNKS_FILE,               /* map chunks sent from the file */
+    MET_MAP_CHUNKS_CACHE,              /* ... and from the chunk cache */
+    MET_MAP_BYTES_OUT,
+    MET_LOOP_STALLS,                   /* iterations over the watchdog limit */
+    MET_LOG_DROPPED,                   /* log records lost, ring full */
+    MET_COUNTER_COUNT
+} MetricCounter;
+
+typedef enum {
+    MET_GAUGE_CONNECTIONS,
+    MET_GAUGE_USERS,                   /* logged in */
+    MET_GAUGE_ROOMS,
+    MET_GAUGE_ROOM_MEMBERS,
+    MET_GAUGE_COUNT
+} MetricGauge;
+
+typedef enum {
+    MET_FANOUT_ROOM,                   /* frames queued per room broadcast */
+    MET_FANOUT_CHANNEL,                /* members reached per channel pass */
+    MET_FANOUT_REFLECTOR,              /* datagrams sent per datagram in */
+    MET_FANOUT_COUNT
+} MetricFanout;
+
+typedef enum {
+    MET_PHASE_POLL,                    /* waiting in select() */
+    MET_PHASE_ACCEPT,
+    MET_PHASE_UDP,                     /* reflector drain */
+    MET_PHASE_SCRAPE,                  /* metrics exporter */
+    MET_PHASE_ADMIN,                   /* admin socket */
+    MET_PHASE_RECV,                    /* recv() on client sockets */
+    MET_PHASE_PARSE,                   /* framing and JSON parsing */
+    MET_PHASE_HANDLE,                  /* message handlers */
+    MET_PHASE_TIMERS,                  /* heartbeats and Handler_Tick */
+    MET_PHASE_SEND,                    /* flushing send queues */
+    MET_PHASE_COUNT
+} MetricPhase;
+
+/* Add `n` to a counter. */
+void Metrics_Add(MetricCounter c, uint64_t n);
+
+/* Current value of a counter, summed over all threads. */
+uint64_t Metrics_Counter(MetricCounter c);
+
+/* Set a gauge.  Lobby thread only. */
+void Metrics_SetGauge(MetricGauge g, int64_t value);
+
+/*
+ * Index of a client message type for Metrics_RecordMessage; unknown
+ * types share one index.
+ */
+int Metrics_MessageIndex(const char *type);
+
+/* Exported name of a message index ("other" for unknown types). */
+const char *Metrics_MessageName(int index);
+
+/* One handled message of type `index`, which took `service_ns` and made
+ * `allocs` heap allocations. */
+void Metrics_RecordMessage(int index, uint64_t service_ns, uint64_t allocs);
+
+/* Time one event-loop iteration spent in `phase`. */
+void Metrics_RecordPhase(MetricPhase phase, uint64_t ns);
+
+/* One event-loop iteration's busy time (everything but the poll). */
+void Metrics_RecordLoop(uint64_t busy_ns);
+
+/* Exported name of a phase ("poll", "recv", ...). */
+const char *Metrics_PhaseName(MetricPhase phase);
+
+/* One broadcast that reached `recipients`. */
+void Metrics_RecordFanout(MetricFanout kind, uint32_t recipients);
+
+/*
+ * Write every metric in the Prometheus text exposition format.
+ * Returns the length written, or the length needed if it is larger
+ * than `buf_len` (nothing useful is written then).
+ */
+size_t Metrics_Render(char *buf, size_t buf_len);
+
+#endif /* METRICS_H */
@@ -0,0 +1,274 @@
+/*
+ * presence.c – Friend presence subscription implementation.
+ *
+ * Topics and subscriptions live in fixed pools linked by index.  A
+ * subscription sits on two lists: its topic's watcher list (doubly
+ * linked, for O(1) removal) and its watcher's own list (singly linked,
+ * at most PRESENCE_MAX_WATCH long).
+ */
+
+#include "presence.h"
+#include "../common/message.h"
+#include "../third_party/cJSON/cJSON.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int            used;
+    char           name[MAX_USERNAME];  /* canonical once seen online */
+    int            hash_next;           /* also the free-list link    */
+    int            subs;                /* head of the watcher list   */
+    int            sub_count;
+    PresenceStatus last;                /* what watchers were told    */
+    int            dirty;
+    int            dirty_next;
+} Topic;
+
+typedef struct {
+    User *watcher;               /* NULL if the slot is free           */
+    int   topic;
+    int   prev, next;            /* topic watcher list                 */
+    int   user_next;             /* watcher's list; free-list link     */
+} Sub;
+
+static Topic s_topics[PRESENCE_MAX_TOPICS];
+static Sub   s_subs[PRESENCE_MAX_SUBS];
+static int   s_buckets[PRESENCE_BUCKETS];
+static int   s_free_topic, s_free_sub;
+static int   s_dirty_head;
+
+/* ------------------------------------------------------------------ */
+/*  Internal helpers                                                  */
+/* ------------------------------------------------------------------ */
+
+static int FindTopic(const char *name)
+{
+    unsigned b = Users_NameHash(name) & (PRESENCE_BUCKETS - 1);
+    for (int t = s_buckets[b]; t != -1; t = s_topics[t].hash_next) {
+        if (Users_NameEqual(s_topics[t].name, name)) return t;
+    }
+    return -1;
+}
+
+static int CreateTopic(const char *name)
+{
+    if (s_free_topic == -1) return -1;
+
+    int t = s_free_topic;
+    s_free_topic = s_topics[t].hash_next;
+
+    /* Until the user is seen online, the subscriber's spelling is all
+     * there is. */
+    const User *u = Users_FindByName(name);
+
+    Topic *tp = &s_topics[t];
+    memset(tp, 0, sizeof(*tp));
+    tp->used = 1;
+    if (u) memcpy(tp->name, u->username, MAX_USERNAME);
+    else   strncpy(tp->name, name, MAX_USERNAME - 1);
+    tp->subs = -1;
+    tp->last = Presence_StatusOf(name);
+
+    unsigned b = Users_NameHash(name) & (PRESENCE_BUCKETS - 1);
+    tp->hash_next = s_buckets[b];
+    s_buckets[b]  = t;
+    return t;
+}
+
+/* Free a topic nobody watches.  Dirty topics are freed by the tick. */
+static void ReleaseTopicIfIdle(int t)
+{
+    Topic *tp = &s_topics[t];
+    if (tp->sub_count > 0 || tp->dirty) return;
+
+    unsigned b = Users_NameHash(tp->name) & (PRESENCE_BUCKETS - 1);
+    int *link = &s_buckets[b];
+    while (*link != t) link = &s_topics[*link].hash_next;
+    *link = tp->hash_next;
+
+    tp->used      = 0;
+    tp->hash_next = s_free_topic;
+    s_free_topic  = t;
+}
+
+/* Unlink subscription `i` from its topic and return it to the pool.
+ * The caller fixes up the watcher's own list. */
+static void FreeSub(int i)
+{
+    Sub   *sb = &s_subs[i];
+    Topic *tp = &s_topics[sb->topic];
+
+    if (sb->prev != -1) s_subs[sb->prev].next = sb->next;
+    else                tp->subs = sb->next;
+    if (sb->next != -1) s_subs[sb->next].prev = sb->prev;
+    tp->sub_count--;
+
+    int t = sb->topic;
+    sb->watcher   = NULL;
+    sb->user_next = s_free_sub;
+    s_free_sub    = i;
+
+    ReleaseTopicIfIdle(t);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+void Presence_Init(void)
+{
+    for (int i = 0; i < PRESENCE_MAX_TOPICS; i++) {
+        s_topics[i].used      = 0;
+        s_topics[i].hash_next = (i + 1 < PRESENCE_MAX_TOPICS) ? i + 1 : -1;
+    }
+    for (int i = 0; i < PRESENCE_MAX_SUBS; i++) {
+        s_subs[i].watcher   = NULL;
+        s_subs[i].user_next = (i + 1 < PRESENCE_MAX_SUBS) ? i + 1 : -1;
+    }
+    for (int i = 0; i < PRESENCE_BUCKETS; i++) {
+        s_buckets[i] = -1;
+    }
+    s_free_topic = 0;
+    s_free_sub   = 0;
+    s_dirty_head = -1;
+}
+
+const char *Presence_StatusName(PresenceStatus status)
+{
+    switch (status) {
+    case PRESENCE_ONLINE:  return "online";
+    case PRESENCE_IN_ROOM: return "in_room";
+    case PRESENCE_IN_GAME: return "in_game";
+    default:               return "offline";
+    }
+}
+
+PresenceStatus Presence_StatusOf(const char *username)
+{
+    User *u = Users_FindByName(username);
+    if (u == NULL)       return PRESENCE_OFFLINE;
+    if (u->in_game)      return PRESENCE_IN_GAME;
+    if (u->room_id != -1) return PRESENCE_IN_ROOM;
+    return PRESENCE_ONLINE;
+}
+
+int Presence_Subscribe(User *watcher, const char *username)
+{
+    int t = FindTopic(username);
+    if (t != -1) {
+        for (int i = watcher->watch_head; i != -1; i = s_subs[i].user_next) {
+            if (s_subs[i].topic == t) return 0;
+        }
+    }
+    if (watcher->watch_count >= PRESENCE_MAX_WATCH) return -1;
+    if (s_free_sub == -1) return -2;
+
+    if (t == -1) {
+        t = CreateTopic(username);
+        if (t == -1) return -2;
+    }
+
+    int i = s_free_sub;
+    s_free_sub = s_subs[i].user_next;
+
+    Sub   *sb = &s_subs[i];
+    Topic *tp = &s_topics[t];
+    sb->watcher = watcher;
+    sb->topic   = t;
+    sb->prev    = -1;
+    sb->next    = tp->subs;
+    if (tp->subs != -1) s_subs[tp->subs].prev = i;
+    tp->subs = i;
+    tp->sub_count++;
+
+    sb->user_next       = watcher->watch_head;
+    watcher->watch_head = i;
+    watcher->watch_count++;
+    return 0;
+}
+
+int Presence_Unsubscribe(User *watcher, const char *username)
+{
+    int t = FindTopic(username);
+    if (t == -1) return -1;
+
+    int *link = &watcher->watch_head;
+    while (*link != -1 && s_subs[*link].topic != t) {
+        link = &s_subs[*link].user_next;
+    }
+    if (*link == -1) return -1;
+
+    int i = *link;
+    *link = s_subs[i].user_next;
+    watcher->watch_count--;
+    FreeSub(i);
+    return 0;
+}
+
+void Presence_UnsubscribeAll(User *watcher)
+{
+    int i = watcher->watch_head;
+    while (i != -1) {
+        int next = s_subs[i].user_next;
+        FreeSub(i);
+        i = next;
+    }
+    watcher->watch_head  = -1;
+    watcher->watch_count = 0;
+}
+
+void Presence_Touch(const char *username)
+{
+    if (username == NULL || username[0] == '\0') return;
+
+    int t = FindTopic(username);
+    if (t == -1 || s_topics[t].dirty) return;
+
+    s_topics[t].dirty      = 1;
+    s_topics[t].dirty_next = s_dirty_head;
+    s_dirty_head = t;
+}
+
+int Presence_Tick(void)
+{
+    int evaluated = 0;
+
+    while (s_dirty_head != -1) {
+        int    t  = s_dirty_head;
+        Topic *tp = &s_topics[t];
+        s_dirty_head = tp->dirty_next;
+        tp->dirty = 0;
+        evaluated++;
+
+        /* Keep the user's own spelling, so offline notes carry the
+         * same name as online ones. */
+        const User *u = Users_FindByName(tp->name);
+        if (u) memcpy(tp->name, u->username, MAX_USERNAME);
+
+        PresenceStatus now = Presence_StatusOf(tp->name);
+        if (now != tp->last && tp->sub_count > 0) {
+            cJSON *note = cJSON_CreateObject();
+            cJSON_AddStringToObject(note, "type", MSG_PRESENCE);
+            cJSON_AddStringToObject(note, "username", tp->name);
+            cJSON_AddStringToObject(note, "status",
+                                    Presence_StatusName(now));
+            char *s = cJSON_PrintUnformatted(note);
+            cJSON_Delete(note);
+
+            OutFrame *frame = s ? OutFrame_Create(s) : NULL;
+            cJSON_free(s);
+            if (frame) {
+                for (int i = tp->subs; i != -1; i = s_subs[i].next) {
+                    SendQ_Push(&s_subs[i].watcher->sendq, frame);
+                }
+                OutFrame_Release(frame);
+            }
+        }
+        tp->last = now;
+
+        ReleaseTopicIfIdle(t);
+    }
+
+    return evaluated;
+}
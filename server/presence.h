@@ -0,0 +1,64 @@
+/*
+ * presence.h – Friend presence subscriptions for War3 Lobby Server.
+ *
+ * A user subscribes to a list of usernames and is told whenever one of
+ * them changes between offline / online / in_room / in_game.
+ *
+ * The module keeps a reverse index: every watched name is a "topic" in a
+ * hash table holding the list of subscriptions that watch it.  Code that
+ * may change a user's status calls Presence_Touch, which only marks the
+ * topic dirty (O(1), and nothing at all if nobody watches that name).
+ * Presence_Tick, once per event-loop iteration, re-evaluates each dirty
+ * topic and notifies its watchers only if the status actually differs
+ * from what they were last told, so a connection that flaps several
+ * times within one iteration produces at most one update.
+ */
+
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include "user.h"
+
+#define PRESENCE_MAX_WATCH   100                          /* per user  */
+#ifndef PRESENCE_MAX_SUBS       /* the microbenchmarks build with more */
+#define PRESENCE_MAX_SUBS    (MAX_USERS * PRESENCE_MAX_WATCH)
+#endif
+#define PRESENCE_MAX_TOPICS  PRESENCE_MAX_SUBS
+#define PRESENCE_BUCKETS     4096                         /* power of 2 */
+
+typedef enum {
+    PRESENCE_OFFLINE,
+    PRESENCE_ONLINE,
+    PRESENCE_IN_ROOM,
+    PRESENCE_IN_GAME
+} PresenceStatus;
+
+/* Reset all topics and subscriptions. */
+void Presence_Init(void);
+
+/* Wire name of a status ("offline", "online", "in_room", "in_game"). */
+const char *Presence_StatusName(PresenceStatus status);
+
+/* Current status of the named user (looked up through the name index). */
+PresenceStatus Presence_StatusOf(const char *username);
+
+/*
+ * Subscribe `watcher` to `username`.  Returns 0 on success (or if the
+ * subscription already exists), -1 if the watcher is at
+ * PRESENCE_MAX_WATCH, -2 if the tables are full.
+ */
+int Presence_Subscribe(User *watcher, const char *username);
+
+/* Drop one subscription.  Returns 0 on success, -1 if not subscribed. */
+int Presence_Unsubscribe(User *watcher, const char *username);
+
+/* Drop every subscription held by `watcher` (on disconnect). */
+void Presence_UnsubscribeAll(User *watcher);
+
+/* The status of `username` may have changed; mark it for the next tick. */
+void Presence_Touch(const char *username);
+
+/* Publish changes for all dirty topics.  Returns topics evaluated. */
+int Presence_Tick(void);
+
+#endif /* PRESENCE_H */
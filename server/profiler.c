@@ -0,0 +1,210 @@
+/*
+ * profiler.c – Event-loop phase profiler and stall watchdog (see
+ * profiler.h).
+ */
+
+#include "profiler.h"
+#include "clock.h"
+#include "log.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NS_PER_MS  1000000u
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+static uint64_t s_stall_ns = (uint64_t)PROFILER_STALL_MS * NS_PER_MS;
+static uint64_t s_poll_budget_ns;
+
+/* Current iteration. */
+static uint64_t s_begin_ns;
+static uint64_t s_mark_ns;                 /* start of the current span */
+static MetricPhase s_phase;
+static int         s_fd;
+static const char *s_what;
+static uint64_t s_phase_ns[MET_PHASE_COUNT];
+static uint32_t s_ran;                     /* bit per phase entered */
+
+/* Longest single span of the current iteration. */
+static uint64_t    s_worst_ns;
+static MetricPhase s_worst_phase;
+static int         s_worst_fd;
+static const char *s_worst_what;
+
+/* Report rate limiting. */
+static uint64_t s_last_report_ns;
+static uint32_t s_suppressed;
+static uint64_t s_last_dump_ns;
+
+/* Busy times since the last Profiler_TakeWindow. */
+static uint64_t s_window[PROFILER_WINDOW];
+static uint64_t s_window_count;
+static uint64_t s_window_max;
+
+/* Charge the span that ends now to the current phase. */
+static void CloseSpan(uint64_t now)
+{
+    uint64_t span = now - s_mark_ns;
+
+    s_phase_ns[s_phase] += span;
+    s_ran |= 1u << s_phase;
+    if (s_phase != MET_PHASE_POLL && span > s_worst_ns) {
+        s_worst_ns    = span;
+        s_worst_phase = s_phase;
+        s_worst_fd    = s_fd;
+        s_worst_what  = s_what;
+    }
+    s_mark_ns = now;
+}
+
+static void Report(uint64_t now, uint64_t busy_ns, int poll_overrun)
+{
+    if (s_last_report_ns != 0 && now - s_last_report_ns < 1000u * NS_PER_MS) {
+        s_suppressed++;
+        return;
+    }
+
+    char detail[64] = "";
+    if (s_worst_fd >= 0 && s_worst_what)
+        snprintf(detail, sizeof(detail), " (fd %d, %s)", s_worst_fd,
+                 s_worst_what);
+    else if (s_worst_fd >= 0)
+        snprintf(detail, sizeof(detail), " (fd %d)", s_worst_fd);
+    else if (s_worst_what)
+        snprintf(detail, sizeof(detail), " (%s)", s_worst_what);
+
+    char phases[256];
+    int  len = 0;
+    for (int p = 0; p < MET_PHASE_COUNT && len < (int)sizeof(phases); p++) {
+        if (!(s_ran & (1u << p))) continue;
+        int n = snprintf(phases + len, sizeof(phases) - (size_t)len,
+                         "%s%s %.1f", len ? " " : "",
+                         Metrics_PhaseName((MetricPhase)p),
+                         (double)s_phase_ns[p] / NS_PER_MS);
+        if (n < 0) break;
+        len += n;
+    }
+    phases[sizeof(phases) - 1] = '\0';
+
+    if (poll_overrun) {
+        LOG_WARN("[watchdog] select() returned %llu ms late; %s ms",
+                 (unsigned long long)((s_phase_ns[MET_PHASE_POLL] -
+                                       s_poll_budget_ns) / NS_PER_MS), phases);
+    } else {
+        LOG_WARN("[watchdog] loop stalled %llu ms: longest %s %.1f ms%s; "
+                 "%s ms",
+                 (unsigned long long)(busy_ns / NS_PER_MS),
+                 Metrics_PhaseName(s_worst_phase),
+                 (double)s_worst_ns / NS_PER_MS, detail, phases);
+    }
+    if (s_suppressed > 0) {
+        LOG_WARN("[watchdog] (%u more stalls in the last second)",
+                 s_suppressed);
+        s_suppressed = 0;
+    }
+    s_last_report_ns = now;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+void Profiler_Init(uint32_t stall_ms)
+{
+    if (stall_ms == 0) stall_ms = PROFILER_STALL_MS;
+    s_stall_ns       = (uint64_t)stall_ms * NS_PER_MS;
+    s_last_report_ns = 0;
+    s_suppressed     = 0;
+    s_last_dump_ns   = 0;
+}
+
+void Profiler_Begin(uint32_t poll_timeout_ms)
+{
+    uint64_t now = Clock_NowNs();
+
+    memset(s_phase_ns, 0, sizeof(s_phase_ns));
+    s_ran            = 0;
+    s_worst_ns       = 0;
+    s_begin_ns       = now;
+    s_mark_ns        = now;
+    s_phase          = MET_PHASE_POLL;
+    s_fd             = -1;
+    s_what           = NULL;
+    s_poll_budget_ns = (uint64_t)poll_timeout_ms * NS_PER_MS;
+}
+
+void Profiler_Enter(MetricPhase phase, int fd, const char *what)
+{
+    CloseSpan(Clock_NowNs());
+    s_phase = phase;
+    s_fd    = fd;
+    s_what  = what;
+}
+
+void Profiler_End(void)
+{
+    uint64_t now = Clock_NowNs();
+    CloseSpan(now);
+
+    for (int p = 0; p < MET_PHASE_COUNT; p++) {
+        if (s_ran & (1u << p))
+            Metrics_RecordPhase((MetricPhase)p, s_phase_ns[p]);
+    }
+
+    uint64_t busy = now - s_begin_ns - s_phase_ns[MET_PHASE_POLL];
+    Metrics_RecordLoop(busy);
+
+    s_window[s_window_count % PROFILER_WINDOW] = busy;
+    s_window_count++;
+    if (busy > s_window_max) s_window_max = busy;
+
+    /* A late select() means the whole process was held up (swapping,
+     * a stopped VM, SIGSTOP), not any one phase. */
+    int poll_overrun =
+        s_phase_ns[MET_PHASE_POLL] > s_poll_budget_ns + s_stall_ns;
+
+    if (busy > s_stall_ns || poll_overrun) {
+        Metrics_Add(MET_LOOP_STALLS, 1);
+        Trace_Record(TRACE_EV_STALL, -1, busy,
+                     Metrics_PhaseName(s_worst_phase));
+        Report(now, busy, poll_overrun && busy <= s_stall_ns);
+
+        /* Keep the flight recorder's view of the stall, but not one
+         * file per stalled iteration under sustained overload. */
+        if (s_last_dump_ns == 0 ||
+            now - s_last_dump_ns >= PROFILER_DUMP_INTERVAL_S * 1000000000ull) {
+            Trace_Dump("stall");
+            s_last_dump_ns = now;
+        }
+    }
+}
+
+static int CompareU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+void Profiler_TakeWindow(ProfilerWindow *out)
+{
+    size_t n = s_window_count < PROFILER_WINDOW ? (size_t)s_window_count
+                                                : PROFILER_WINDOW;
+
+    memset(out, 0, sizeof(*out));
+    out->iterations = s_window_count;
+    out->max_ns     = s_window_max;
+    if (n > 0) {
+        /* Sorted in place: the window is discarded anyway. */
+        qsort(s_window, n, sizeof(s_window[0]), CompareU64);
+        out->p50_ns = s_window[(n - 1) * 50 / 100];
+        out->p90_ns = s_window[(n - 1) * 90 / 100];
+        out->p99_ns = s_window[(n - 1) * 99 / 100];
+    }
+    s_window_count = 0;
+    s_window_max   = 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * profiler.h – Event-loop phase profiler and stall watchdog.
+ *
+ * The lobby loop marks where it is (waiting in select(), accepting,
+ * receiving, parsing, handling, timers, flushing) and which connection
+ * or message it is working on.  Each mark costs one monotonic clock
+ * read (a vDSO call on Linux, QueryPerformanceCounter on Windows).
+ *
+ * At the end of every iteration the time spent in each phase goes into
+ * the war3_loop_phase_seconds histograms (metrics.h).  If the iteration
+ * was busy for longer than the stall limit, or select() came back much
+ * later than its timeout, the watchdog logs the phase breakdown and the
+ * longest single span with its connection and message type:
+ *
+ *   [watchdog] loop stalled 1834 ms: longest handle 1790 ms (fd 9,
+ *   room_create); recv 0.1 parse 0.2 handle 1790.3 send 43.1 ms
+ *
+ * Reports are limited to one per second; the rest are only counted.
+ * A stall also dumps the flight recorder (trace.h), at most once per
+ * PROFILER_DUMP_INTERVAL_S.  Lobby thread only.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "metrics.h"
+
+#include <stdint.h>
+
+#define PROFILER_STALL_MS     200      /* default watchdog limit */
+#define PROFILER_DUMP_INTERVAL_S  60   /* flight recorder dumps on stall */
+#define PROFILER_WINDOW       4096     /* busy-time samples kept per window */
+
+/* Busy time per iteration over one window (Profiler_TakeWindow). */
+typedef struct {
+    uint64_t iterations;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+} ProfilerWindow;
+
+/* Reset and set the watchdog limit (0 = PROFILER_STALL_MS). */
+void Profiler_Init(uint32_t stall_ms);
+
+/* Start an iteration, in the poll phase; select() will wait at most
+ * `poll_timeout_ms`. */
+void Profiler_Begin(uint32_t poll_timeout_ms);
+
+/*
+ * Switch to `phase`, working on connection `fd` (-1 if none) and
+ * message `what` (a static string or NULL).
+ */
+void Profiler_Enter(MetricPhase phase, int fd, const char *what);
+
+/* Finish the iteration: record the phases and run the watchdog. */
+void Profiler_End(void);
+
+/*
+ * Summarise the iterations since the previous call and start a new
+ * window.  Percentiles are over the last PROFILER_WINDOW of them; the
+ * maximum and count are over all.
+ */
+void Profiler_TakeWindow(ProfilerWindow *out);
+
+#endif /* PROFILER_H */
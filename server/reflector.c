@@ -0,0 +1,432 @@
+/*
+ * reflector.c – UDP discovery reflector implementation.
+ *
+ * A received datagram is forwarded in place: the token field of the
+ * client header is overwritten with the origin address, which turns the
+ * receive buffer into the outgoing packet.  Every copy of a batch then
+ * points at the same buffers and goes out in one sendmmsg() pass.
+ *
+ * UDP GSO (UDP_SEGMENT) is not used: it splits one buffer into segments
+ * for a single destination, while the reflector sends one payload to
+ * several destinations.
+ */
+
+#ifdef __linux__
+#   define _GNU_SOURCE          /* recvmmsg / sendmmsg */
+#endif
+
+#include "reflector.h"
+#include "metrics.h"
+#include "log.h"
+#include "clock.h"
+#include "../common/reflect.h"
+#include "../common/probe.h"
+#include "../common/w3gs.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+    typedef int socklen_t;
+#   define CLOSE_SOCKET(s) closesocket(s)
+#else
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#   include <netinet/in.h>
+#   include <arpa/inet.h>
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <errno.h>
+#   define CLOSE_SOCKET(s) close(s)
+#endif
+
+#define REFLECTOR_BUF_SIZE  2048
+#define REFLECTOR_MAX_OUT   (REFLECTOR_BATCH * (MAX_ROOM_PLAYERS - 1))
+
+typedef struct {
+    uint8_t            data[REFLECTOR_BUF_SIZE];
+    int                len;
+    struct sockaddr_in from;
+} Datagram;
+
+typedef struct {
+    const uint8_t     *data;
+    int                len;
+    struct sockaddr_in to;
+} OutPacket;
+
+static int      s_fd = -1;
+static int      s_port;
+static uint32_t s_rng;
+
+static Datagram  s_in[REFLECTOR_BATCH];
+static OutPacket s_out[REFLECTOR_MAX_OUT];
+static int       s_out_count;
+
+#ifdef __linux__
+static struct mmsghdr s_rmsg[REFLECTOR_BATCH];
+static struct iovec   s_riov[REFLECTOR_BATCH];
+static struct mmsghdr s_smsg[REFLECTOR_MAX_OUT];
+static struct iovec   s_siov[REFLECTOR_MAX_OUT];
+#endif
+
+/* ------------------------------------------------------------------ */
+/*  Batched socket I/O                                                */
+/* ------------------------------------------------------------------ */
+
+/* Read up to REFLECTOR_BATCH datagrams into s_in.  Returns the count. */
+static int RecvBatch(void)
+{
+#ifdef __linux__
+    for (int i = 0; i < REFLECTOR_BATCH; i++) {
+        s_rmsg[i].msg_hdr.msg_namelen = sizeof(s_in[i].from);
+    }
+    int n = recvmmsg(s_fd, s_rmsg, REFLECTOR_BATCH, MSG_DONTWAIT, NULL);
+    if (n <= 0) return 0;
+    for (int i = 0; i < n; i++) {
+        s_in[i].len = (s_rmsg[i].msg_hdr.msg_flags & MSG_TRUNC)
+                    ? -1 : (int)s_rmsg[i].msg_len;
+    }
+    return n;
+#else
+    int n = 0;
+    while (n < REFLECTOR_BATCH) {
+        socklen_t alen = sizeof(s_in[n].from);
+        int r = recvfrom(s_fd, (char *)s_in[n].data, REFLECTOR_BUF_SIZE, 0,
+                         (struct sockaddr *)&s_in[n].from, &alen);
+        if (r < 0) {
+#   ifdef _WIN32
+            /* An ICMP port-unreachable from an earlier send surfaces
+             * here on Windows; it says nothing about this socket. */
+            if (WSAGetLastError() == WSAECONNRESET) continue;
+#   endif
+            break;
+        }
+        s_in[n++].len = r;
+    }
+    return n;
+#endif
+}
+
+/* Send everything in s_out.  Discovery is lossy by design, so packets
+ * the kernel will not take right now are dropped. */
+static void SendBatch(void)
+{
+#ifdef __linux__
+    for (int i = 0; i < s_out_count; i++) {
+        s_siov[i].iov_base = (void *)s_out[i].data;
+        s_siov[i].iov_len  = (size_t)s_out[i].len;
+        memset(&s_smsg[i].msg_hdr, 0, sizeof(s_smsg[i].msg_hdr));
+        s_smsg[i].msg_hdr.msg_name    = &s_out[i].to;
+        s_smsg[i].msg_hdr.msg_namelen = sizeof(s_out[i].to);
+        s_smsg[i].msg_hdr.msg_iov     = &s_siov[i];
+        s_smsg[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    int sent = 0;
+    while (sent < s_out_count) {
+        int r = sendmmsg(s_fd, s_smsg + sent,
+                         (unsigned)(s_out_count - sent), MSG_DONTWAIT);
+        if (r > 0) {
+            sent += r;
+        } else if (r < 0 && errno == EINTR) {
+            continue;
+        } else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            sent++;   /* this destination failed; skip it */
+        }
+    }
+#else
+    for (int i = 0; i < s_out_count; i++) {
+        sendto(s_fd, (const char *)s_out[i].data, s_out[i].len, 0,
+               (const struct sockaddr *)&s_out[i].to, sizeof(s_out[i].to));
+    }
+#endif
+    s_out_count = 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Forwarding                                                        */
+/* ------------------------------------------------------------------ */
+
+static User *FindByToken(uint32_t token)
+{
+    User *user = Users_FindByToken(token);
+    if (user == NULL || user->fd == -1) return NULL;
+    return user;
+}
+
+/*
+ * Keep the sender's latest game announcement.  `pkt` is the packet as
+ * it will be forwarded (origin header already in place).
+ */
+static void CacheGame(User *sender, const uint8_t *pkt, int len)
+{
+    const uint8_t *w3 = pkt + REFLECT_HDR_SIZE;
+    int            n  = len - REFLECT_HDR_SIZE;
+
+    switch (W3GS_PacketId(w3, n)) {
+    case W3GS_GAMEINFO:
+        if (n > W3GS_MAX_GAMEINFO) return;
+        if (sender->game_pkt_len != len ||
+            memcmp(sender->game_pkt, pkt, (size_t)len) != 0)
+        {
+            W3GS_GameInfo info;
+            if (W3GS_ParseGameInfo(w3, n, &info) != 0) return;
+
+            /* GAMEINFO has no player count; keep the last refresh's. */
+            if (sender->game_pkt_len > 0 &&
+                sender->game.host_counter == info.host_counter)
+                info.players = sender->game.players;
+
+            if (sender->game_pkt_len == 0 ||
+                strcmp(sender->game.game_name, info.game_name) != 0)
+                LOG_INFO("[reflector] '%s' hosts '%s' (%s)",
+                         sender->username, info.game_name, info.map_path);
+
+            memcpy(sender->game_pkt, pkt, (size_t)len);
+            sender->game_pkt_len = len;
+            sender->game         = info;
+        }
+        sender->game_seen = Clock_Wall();
+        break;
+
+    case W3GS_REFRESHGAME:
+        if (sender->game_pkt_len > 0 &&
+            W3GS_ApplyRefresh(w3, n, &sender->game) == 0)
+            sender->game_seen = Clock_Wall();
+        break;
+
+    case W3GS_DECREATEGAME:
+        sender->game_pkt_len = 0;
+        break;
+    }
+}
+
+static void HandleDatagram(Datagram *d, Room rooms[], int room_count,
+                           Reflector_EndpointFn on_endpoint, void *ctx)
+{
+    /* Latency probes from logged-in clients are echoed straight back. */
+    if (Probe_Classify(d->data, d->len) == PROBE_KIND_PING) {
+        if (FindByToken(Probe_Token(d->data, d->len)) == NULL) return;
+        Probe_MakePong(d->data);
+        OutPacket *out = &s_out[s_out_count++];
+        out->to   = d->from;
+        out->data = d->data;
+        out->len  = d->len;
+        return;
+    }
+
+    if (d->len < REFLECT_HDR_SIZE || !REFLECT_IS_MAGIC(d->data)) return;
+
+    uint32_t token = ((uint32_t)d->data[4] << 24) |
+                     ((uint32_t)d->data[5] << 16) |
+                     ((uint32_t)d->data[6] << 8)  |
+                      (uint32_t)d->data[7];
+    User *sender = FindByToken(token);
+    if (sender == NULL) return;
+
+    /* Remember where this client's copies should go. */
+    if (sender->udp_addr != d->from.sin_addr.s_addr ||
+        sender->udp_port != d->from.sin_port)
+    {
+        sender->udp_addr = d->from.sin_addr.s_addr;
+        sender->udp_port = d->from.sin_port;
+        if (on_endpoint) on_endpoint(sender, ctx);
+    }
+
+    int payload = d->len - REFLECT_HDR_SIZE;
+    if (payload == 0 || payload > REFLECT_MAX_PAYLOAD) return;
+
+    Room *room = Rooms_FindById(rooms, room_count, sender->room_id);
+    if (room == NULL) return;
+
+    room->udp_pkts_in++;
+    room->udp_bytes_in += (uint64_t)payload;
+    Metrics_Add(MET_UDP_PKTS_IN, 1);
+    Metrics_Add(MET_UDP_BYTES_IN, (uint64_t)payload);
+
+    /* Token out, origin in: the buffer is now the outgoing packet. */
+    memcpy(d->data + 4, &d->from.sin_addr.s_addr, 4);
+    CacheGame(sender, d->data, d->len);
+
+    uint32_t fanout = 0;
+    for (int i = 0; i < room->member_count; i++) {
+        User *member = room->members[i];
+        if (member == sender || member->udp_port == 0) continue;
+
+        OutPacket *out = &s_out[s_out_count++];
+        memset(&out->to, 0, sizeof(out->to));
+        out->to.sin_family      = AF_INET;
+        out->to.sin_addr.s_addr = member->udp_addr;
+        out->to.sin_port        = member->udp_port;
+        out->data = d->data;
+        out->len  = d->len;
+
+        room->udp_pkts_out++;
+        room->udp_bytes_out += (uint64_t)payload;
+        fanout++;
+    }
+    Metrics_Add(MET_UDP_PKTS_OUT, fanout);
+    Metrics_Add(MET_UDP_BYTES_OUT, (uint64_t)fanout * (uint64_t)payload);
+    Metrics_RecordFanout(MET_FANOUT_REFLECTOR, fanout);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int Reflector_Open(int port)
+{
+    Reflector_Close();
+
+    int fd = (int)socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        LOG_ERROR("[reflector] socket() failed");
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((uint16_t)port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOG_ERROR("[reflector] bind() failed on udp port %d", port);
+        CLOSE_SOCKET(fd);
+        return -1;
+    }
+    if (port == 0) {
+        /* Ephemeral port (the microbenchmarks): report the real one. */
+        socklen_t alen = sizeof(addr);
+        getsockname(fd, (struct sockaddr *)&addr, &alen);
+        port = ntohs(addr.sin_port);
+    }
+
+    /* Room for a burst of searches while the loop is busy elsewhere. */
+    int rcvbuf = 1024 * 1024;
+#ifdef _WIN32
+    u_long mode = 1;
+    ioctlsocket((SOCKET)fd, FIONBIO, &mode);
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char *)&rcvbuf,
+               sizeof(rcvbuf));
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+#endif
+
+#ifdef __linux__
+    memset(s_rmsg, 0, sizeof(s_rmsg));
+    for (int i = 0; i < REFLECTOR_BATCH; i++) {
+        s_riov[i].iov_base = s_in[i].data;
+        s_riov[i].iov_len  = REFLECTOR_BUF_SIZE;
+        s_rmsg[i].msg_hdr.msg_name   = &s_in[i].from;
+        s_rmsg[i].msg_hdr.msg_iov    = &s_riov[i];
+        s_rmsg[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+
+    s_fd        = fd;
+    s_port      = port;
+    s_rng       = (uint32_t)time(NULL) ^ (uint32_t)Clock_NowUs();
+    if (s_rng == 0) s_rng = 1;
+    s_out_count = 0;
+
+    LOG_INFO("[reflector] listening on udp port %d", port);
+    return fd;
+}
+
+void Reflector_Close(void)
+{
+    if (s_fd >= 0) {
+        CLOSE_SOCKET(s_fd);
+    }
+    s_fd   = -1;
+    s_port = 0;
+}
+
+int Reflector_Port(void)
+{
+    return s_port;
+}
+
+uint32_t Reflector_IssueToken(User *user)
+{
+    /* All 32 bits are random; the token index finds the owner. */
+    uint32_t t;
+    do {
+        s_rng ^= s_rng << 13;
+        s_rng ^= s_rng >> 17;
+        s_rng ^= s_rng << 5;
+        t = s_rng;
+    } while (t == 0 || Users_FindByToken(t) != NULL);
+
+    Users_SetToken(user, t);
+    user->udp_addr  = 0;
+    user->udp_port  = 0;
+    user->game_pkt_len = 0;
+    return user->udp_token;
+}
+
+int Reflector_Drain(Room rooms[], int room_count,
+                    Reflector_EndpointFn on_endpoint, void *ctx)
+{
+    if (s_fd < 0) return 0;
+
+    int total = 0;
+    while (total < REFLECTOR_POLL_BUDGET) {
+        int n = RecvBatch();
+        if (n == 0) break;
+
+        for (int i = 0; i < n; i++) {
+            HandleDatagram(&s_in[i], rooms, room_count, on_endpoint, ctx);
+        }
+        SendBatch();   /* before the next receive reuses s_in */
+
+        total += n;
+        if (n < REFLECTOR_BATCH) break;
+    }
+    return total;
+}
+
+void Reflector_ReplayGames(User *to, const Room *room)
+{
+    if (s_fd < 0 || to->udp_port == 0) return;
+
+    time_t now = Clock_Wall();
+    for (int i = 0; i < room->member_count; i++) {
+        const User *member = room->members[i];
+        if (member == to || Users_LiveGame(member, now) == NULL) continue;
+
+        /* Flush first if a batch in progress has filled the queue; its
+         * packets still point at valid receive buffers. */
+        if (s_out_count == REFLECTOR_MAX_OUT) SendBatch();
+
+        OutPacket *out = &s_out[s_out_count++];
+        memset(&out->to, 0, sizeof(out->to));
+        out->to.sin_family      = AF_INET;
+        out->to.sin_addr.s_addr = to->udp_addr;
+        out->to.sin_port        = to->udp_port;
+        out->data = member->game_pkt;
+        out->len  = member->game_pkt_len;
+    }
+    SendBatch();
+}
+
+void Reflector_LogRoom(const Room *room)
+{
+    if (room->udp_pkts_in == 0) return;
+
+    LOG_INFO("[reflector] room %d: %llu pkts / %llu bytes in, "
+             "%llu pkts / %llu bytes out", room->id,
+             (unsigned long long)room->udp_pkts_in,
+             (unsigned long long)room->udp_bytes_in,
+             (unsigned long long)room->udp_pkts_out,
+             (unsigned long long)room->udp_bytes_out);
+}
@@ -0,0 +1,79 @@
+/*
+ * reflector.h – UDP discovery reflector for War3 Lobby Server.
+ *
+ * War3 finds LAN games by broadcasting to 255.255.255.255:6112.  The
+ * hook DLL used to repeat every broadcast once per room member, so a
+ * host's upstream cost grew with the room.  With the reflector the hook
+ * sends each packet once to the lobby server's UDP port and the server
+ * forwards it to every other member of the sender's room, taking the
+ * member list straight from Room (see common/reflect.h for the header).
+ *
+ * Senders authenticate with the udp_token issued in login_ok, a random
+ * 32-bit value found through the token index in user.c.  Each valid packet also
+ * records the sender's public UDP endpoint (its NAT mapping), which is
+ * where the other members' traffic is sent and what peers are told to
+ * punch towards.
+ *
+ * The latest W3GS GAMEINFO each member's game announces is cached on
+ * the user (parsed with common/w3gs.h) and replayed to a player as soon
+ * as its endpoint is known, so a joiner sees running games at once
+ * instead of after the next search cycle.
+ *
+ * The same port answers latency probes (common/probe.h) that carry a
+ * valid token, so clients can include their RTT to the server in
+ * rtt_report.
+ *
+ * On Linux the socket is drained with recvmmsg() and all copies of a
+ * batch go out in sendmmsg() calls, so a burst costs a handful of
+ * syscalls instead of one per datagram per member.  Other platforms use
+ * plain recvfrom()/sendto().
+ */
+
+#ifndef REFLECTOR_H
+#define REFLECTOR_H
+
+#include <stdint.h>
+#include "user.h"
+#include "room.h"
+
+#define REFLECTOR_BATCH        32     /* datagrams per receive call     */
+#define REFLECTOR_POLL_BUDGET  1024   /* datagrams per Reflector_Drain  */
+
+/*
+ * Open the UDP socket on `port` (non-blocking; 0 picks a free one, see
+ * Reflector_Port).  Returns the socket fd
+ * for the caller's select() set, or -1 on failure; the lobby keeps
+ * running without a reflector in that case.
+ */
+int Reflector_Open(int port);
+
+/* Close the socket. */
+void Reflector_Close(void);
+
+/* UDP port in use, 0 if the reflector is not running. */
+int Reflector_Port(void);
+
+/* Issue a fresh token for `user` (stored in user->udp_token). */
+uint32_t Reflector_IssueToken(User *user);
+
+/* Called when a user's public UDP endpoint is first seen or changes. */
+typedef void (*Reflector_EndpointFn)(User *user, void *ctx);
+
+/*
+ * Receive and forward waiting datagrams, at most REFLECTOR_POLL_BUDGET.
+ * `on_endpoint` (may be NULL) runs for every sender whose endpoint moved.
+ * Returns the number of datagrams read.
+ */
+int Reflector_Drain(Room rooms[], int room_count,
+                    Reflector_EndpointFn on_endpoint, void *ctx);
+
+/*
+ * Send `to` the cached GAMEINFO of every other member of `room` whose
+ * game is still live.  Does nothing until `to` has a UDP endpoint.
+ */
+void Reflector_ReplayGames(User *to, const Room *room);
+
+/* Log a room's reflector counters (called when the room is destroyed). */
+void Reflector_LogRoom(const Room *room);
+
+#endif /* REFLECTOR_H */
@@ -0,0 +1,669 @@
+/*
+ * relay.c – TCP game-session relay implementation.
+ *
+ * Every relay thread polls the shared listening socket, the connections
+ * it accepted that have not finished their hello, and the sessions it
+ * owns.  A connection whose ticket is the first of its pair is parked in
+ * the ticket table; the thread that receives the second half takes both
+ * sockets and owns the session from then on.
+ */
+
+#ifdef __linux__
+#   define _GNU_SOURCE          /* splice */
+#endif
+
+#include "relay.h"
+#include "thread.h"
+#include "clock.h"
+#include "metrics.h"
+#include "log.h"
+#include "user.h"
+#include "exporter.h"
+#include "admin.h"
+#include "mapstore.h"
+#include "../common/message.h"
+#include "../common/alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+    typedef int socklen_t;
+#   define CLOSE_SOCKET(s) closesocket(s)
+#   define poll            WSAPoll
+#   define SHUT_WR         SD_SEND
+    typedef WSAPOLLFD      PollFd;
+#else
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <arpa/inet.h>
+#   include <sys/resource.h>
+#   include <sys/select.h>
+#   include <poll.h>
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <errno.h>
+#   include <signal.h>
+#   define CLOSE_SOCKET(s) close(s)
+    typedef struct pollfd  PollFd;
+#endif
+
+#define RELAY_POLL_MS 200
+
+/* Descriptors one session holds: both sockets, plus a pipe per flow. */
+#ifdef __linux__
+#   define RELAY_SESSION_FDS 6
+#else
+#   define RELAY_SESSION_FDS 2
+#endif
+
+/* Descriptors kept for the rest of the process: lobby connections,
+ * exporter and admin connections, the map store's open maps,
+ * connections and upload files, listeners, stdio and the log. */
+#define RELAY_FD_RESERVE \
+    (MAX_USERS + EXPORTER_MAX_CONNS + ADMIN_MAX_CONNS + \
+     MAPSTORE_MAX_MAPS + MAPSTORE_MAX_CONNS + MAPSTORE_MAX_UPLOADS + 16)
+
+/* One direction of a session. */
+typedef struct {
+    int      from, to;
+#ifdef __linux__
+    int      pipe[2];
+#else
+    char    *buf;
+    int      off;
+#endif
+    int      queued;             /* bytes read but not yet written     */
+    int      eof;                /* `from` is done, `to` was shut down */
+    uint64_t bytes;
+    uint64_t since_us;           /* when `queued` last became non-zero */
+    uint64_t wait_total_us;      /* time data spent inside the relay   */
+    uint64_t wait_max_us;
+    uint32_t wait_samples;
+} Flow;
+
+typedef struct {
+    int      used;
+    uint32_t id;
+    char     names[2][MAX_USERNAME];
+    Flow     flow[2];            /* [0] a -> b, [1] b -> a */
+    uint64_t started_us;
+} Session;
+
+typedef struct {
+    int     fd;
+    time_t  since;
+    uint8_t hello[RELAY_HELLO_SIZE];
+    int     got;
+} Pending;
+
+typedef struct {
+    Thread   thread;
+    Session *sessions;           /* RELAY_MAX_SESSIONS slots */
+    Pending  pending[RELAY_MAX_PENDING];
+    int      pending_count;
+} Worker;
+
+/* Ticket table, shared with the lobby thread. */
+typedef struct {
+    int      used;
+    uint32_t id;
+    uint32_t ticket[2];
+    int      parked[2];          /* connection waiting for its partner */
+    char     names[2][MAX_USERNAME];
+    time_t   expires;
+} Pair;
+
+static Mutex    s_lock;
+static Pair     s_pairs[RELAY_MAX_SESSIONS];
+static uint32_t s_rng;
+static uint32_t s_next_id;
+
+static Worker   s_workers[RELAY_THREADS];
+static int      s_listen_fd = -1;
+static int      s_port;
+static int      s_max_sessions;  /* SessionBudget() */
+static volatile int s_stop;
+
+/* ------------------------------------------------------------------ */
+/*  Socket helpers                                                    */
+/* ------------------------------------------------------------------ */
+
+static void SetNonBlocking(int fd)
+{
+#ifdef _WIN32
+    u_long mode = 1;
+    ioctlsocket((SOCKET)fd, FIONBIO, &mode);
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#   ifdef SO_NOSIGPIPE
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
+#   endif
+#endif
+}
+
+/*
+ * Sessions per thread (and open pairs) that fit the descriptor limit,
+ * at most RELAY_MAX_SESSIONS.  The lobby select()s its connections,
+ * which only works below FD_SETSIZE, so the process is budgeted under
+ * that as well as RLIMIT_NOFILE.
+ */
+static int SessionBudget(void)
+{
+#ifdef _WIN32
+    return RELAY_MAX_SESSIONS;
+#else
+    long limit = FD_SETSIZE;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+        (long)rl.rlim_cur < limit)
+    {
+        limit = (long)rl.rlim_cur;
+    }
+
+    /* Every thread holds its pending hellos and sessions; every open
+     * pair at most one parked socket. */
+    long n = (limit - RELAY_FD_RESERVE - RELAY_THREADS * RELAY_MAX_PENDING)
+           / (RELAY_THREADS * RELAY_SESSION_FDS + 1);
+    if (n > RELAY_MAX_SESSIONS) n = RELAY_MAX_SESSIONS;
+    return n > 0 ? (int)n : 0;
+#endif
+}
+
+static int WouldBlock(void)
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+/* ------------------------------------------------------------------ */
+/*  Ticket table                                                      */
+/* ------------------------------------------------------------------ */
+
+static uint32_t NextTicket(void)
+{
+    uint32_t t;
+    do {
+        s_rng ^= s_rng << 13;
+        s_rng ^= s_rng >> 17;
+        s_rng ^= s_rng << 5;
+        t = s_rng;
+    } while (t == 0);
+    return t;
+}
+
+/*
+ * Present a completed hello.  Returns 1 and fills *out if this was the
+ * second half of a pair (the caller now owns both sockets), 0 if the
+ * connection was parked, -1 if the ticket is unknown.
+ */
+static int ClaimTicket(uint32_t ticket, int fd, Session *out)
+{
+    int rc = -1;
+    if (ticket == 0) return -1;   /* the "already used" marker */
+
+    Mutex_Lock(&s_lock);
+    for (int i = 0; i < RELAY_MAX_SESSIONS; i++) {
+        Pair *p = &s_pairs[i];
+        if (!p->used) continue;
+
+        int side = (p->ticket[0] == ticket) ? 0
+                 : (p->ticket[1] == ticket) ? 1 : -1;
+        if (side == -1) continue;
+
+        p->ticket[side] = 0;     /* single use */
+        if (p->parked[!side] == -1) {
+            p->parked[side] = fd;
+            rc = 0;
+        } else {
+            memset(out, 0, sizeof(*out));
+            out->id = p->id;
+            memcpy(out->names, p->names, sizeof(out->names));
+            out->flow[0].from = out->flow[1].to = (side == 0) ? fd : p->parked[0];
+            out->flow[1].from = out->flow[0].to = (side == 1) ? fd : p->parked[1];
+            p->used = 0;
+            rc = 1;
+        }
+        break;
+    }
+    Mutex_Unlock(&s_lock);
+    return rc;
+}
+
+/* Drop pairs whose partner never showed up. */
+static void ExpirePairs(time_t now)
+{
+    Mutex_Lock(&s_lock);
+    for (int i = 0; i < RELAY_MAX_SESSIONS; i++) {
+        Pair *p = &s_pairs[i];
+        if (!p->used || now < p->expires) continue;
+
+        LOG_INFO("[relay] session %u expired ('%s' <-> '%s')",
+                 p->id, p->names[0], p->names[1]);
+        for (int k = 0; k < 2; k++) {
+            if (p->parked[k] != -1) CLOSE_SOCKET(p->parked[k]);
+        }
+        p->used = 0;
+    }
+    Mutex_Unlock(&s_lock);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Sessions                                                          */
+/* ------------------------------------------------------------------ */
+
+static int StartSession(Worker *w, const Session *proto)
+{
+    for (int i = 0; i < s_max_sessions; i++) {
+        Session *s = &w->sessions[i];
+        if (s->used) continue;
+
+        *s = *proto;
+        for (int k = 0; k < 2; k++) {
+            Flow *f = &s->flow[k];
+#ifdef __linux__
+            if (pipe(f->pipe) != 0) {
+                if (k == 1) { close(s->flow[0].pipe[0]); close(s->flow[0].pipe[1]); }
+                return -1;
+            }
+            fcntl(f->pipe[0], F_SETFL, O_NONBLOCK);
+            fcntl(f->pipe[1], F_SETFL, O_NONBLOCK);
+#else
+            f->buf = (char *)Alloc_Malloc(ALLOC_RELAY, RELAY_CHUNK);
+            if (f->buf == NULL) {
+                if (k == 1) Alloc_Free(s->flow[0].buf);
+                return -1;
+            }
+#endif
+        }
+
+        /* Game traffic is many small packets; don't let Nagle hold them. */
+        int opt = 1;
+        setsockopt(s->flow[0].from, IPPROTO_TCP, TCP_NODELAY,
+                   (const char *)&opt, sizeof(opt));
+        setsockopt(s->flow[1].from, IPPROTO_TCP, TCP_NODELAY,
+                   (const char *)&opt, sizeof(opt));
+
+        s->used       = 1;
+        s->started_us = Clock_NowUs();
+        LOG_INFO("[relay] session %u started ('%s' <-> '%s')",
+                 s->id, s->names[0], s->names[1]);
+        return 0;
+    }
+    return -1;
+}
+
+static void EndSession(Session *s)
+{
+    uint64_t secs_x1000 = (Clock_NowUs() - s->started_us) / 1000u;
+    if (secs_x1000 == 0) secs_x1000 = 1;
+
+    for (int k = 0; k < 2; k++) {
+        Flow *f = &s->flow[k];
+        LOG_INFO("[relay] session %u %s -> %s: %llu bytes, %llu B/s, "
+                 "wait avg %llu us max %llu us",
+                 s->id, s->names[k], s->names[!k],
+                 (unsigned long long)f->bytes,
+                 (unsigned long long)(f->bytes * 1000u / secs_x1000),
+                 (unsigned long long)(f->wait_samples
+                                      ? f->wait_total_us / f->wait_samples : 0),
+                 (unsigned long long)f->wait_max_us);
+#ifdef __linux__
+        close(f->pipe[0]);
+        close(f->pipe[1]);
+#else
+        Alloc_Free(f->buf);
+#endif
+    }
+    CLOSE_SOCKET(s->flow[0].from);
+    CLOSE_SOCKET(s->flow[1].from);
+    s->used = 0;
+    Metrics_Add(MET_RELAY_SESSIONS, 1);
+}
+
+/* Move as much as the sockets allow.  Returns -1 on a hard error. */
+static int PumpFlow(Flow *f)
+{
+    if (!f->eof && f->queued < RELAY_CHUNK) {
+#ifdef __linux__
+        ssize_t n = splice(f->from, NULL, f->pipe[1], NULL,
+                           (size_t)(RELAY_CHUNK - f->queued),
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#else
+        int n = (f->queued == 0)
+              ? recv(f->from, f->buf, RELAY_CHUNK, 0) : -2;
+        if (n > 0) f->off = 0;
+#endif
+        if (n > 0) {
+            if (f->queued == 0) f->since_us = Clock_NowUs();
+            f->queued += (int)n;
+            f->bytes  += (uint64_t)n;
+            Metrics_Add(MET_RELAY_BYTES, (uint64_t)n);
+        } else if (n == 0) {
+            f->eof = 1;
+        } else if (n == -1 && !WouldBlock()) {
+            return -1;
+        }
+    }
+
+    if (f->queued > 0) {
+#ifdef __linux__
+        ssize_t n = splice(f->pipe[0], NULL, f->to, NULL, (size_t)f->queued,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#else
+        int n = send(f->to, f->buf + f->off, f->queued, 0);
+        if (n > 0) f->off += n;
+#endif
+        if (n > 0) {
+            f->queued -= (int)n;
+            if (f->queued == 0) {
+                uint64_t waited = Clock_NowUs() - f->since_us;
+                f->wait_total_us += waited;
+                if (waited > f->wait_max_us) f->wait_max_us = waited;
+                f->wait_samples++;
+            }
+        } else if (n < 0 && !WouldBlock()) {
+            return -1;
+        }
+    }
+
+    /* Pass the half-close on once everything has been delivered. */
+    if (f->eof == 1 && f->queued == 0) {
+        shutdown(f->to, SHUT_WR);
+        f->eof = 2;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Relay thread                                                      */
+/* ------------------------------------------------------------------ */
+
+static void AcceptPending(Worker *w, time_t now)
+{
+    while (1) {
+        int fd = (int)accept(s_listen_fd, NULL, NULL);
+        if (fd < 0) return;
+
+        if (w->pending_count >= RELAY_MAX_PENDING) {
+            CLOSE_SOCKET(fd);
+            continue;
+        }
+        SetNonBlocking(fd);
+
+        Pending *p = &w->pending[w->pending_count++];
+        p->fd    = fd;
+        p->since = now;
+        p->got   = 0;
+    }
+}
+
+/* Read hello bytes.  Returns 1 if `p` is finished with (and removed). */
+static int ReadHello(Worker *w, Pending *p, time_t now)
+{
+    int n = recv(p->fd, (char *)p->hello + p->got,
+                 RELAY_HELLO_SIZE - p->got, 0);
+    if (n > 0) p->got += n;
+
+    int fail = (n == 0) || (n < 0 && !WouldBlock()) ||
+               (now - p->since > RELAY_HELLO_TIMEOUT);
+
+    if (!fail && p->got < RELAY_HELLO_SIZE) return 0;
+
+    if (!fail && memcmp(p->hello, "W3RL", 4) == 0) {
+        uint32_t ticket = ((uint32_t)p->hello[4] << 24) |
+                          ((uint32_t)p->hello[5] << 16) |
+                          ((uint32_t)p->hello[6] << 8)  |
+                           (uint32_t)p->hello[7];
+        Session proto;
+        int rc = ClaimTicket(ticket, p->fd, &proto);
+        if (rc == 1) {
+            if (StartSession(w, &proto) != 0) {
+                LOG_LIMITED(LOG_LEVEL_WARN, 5,
+                            "[relay] no session slot for %u", proto.id);
+                CLOSE_SOCKET(proto.flow[0].from);
+                CLOSE_SOCKET(proto.flow[1].from);
+            }
+            fail = 0;
+        } else {
+            fail = (rc != 0);
+        }
+    } else {
+        fail = 1;
+    }
+
+    if (fail) CLOSE_SOCKET(p->fd);
+    return 1;
+}
+
+static void RelayThread(void *arg)
+{
+    Worker *w = (Worker *)arg;
+    PollFd  fds[1 + RELAY_MAX_PENDING + 2 * RELAY_MAX_SESSIONS];
+    int     owner[1 + RELAY_MAX_PENDING + 2 * RELAY_MAX_SESSIONS];
+    time_t  last_expire = 0;
+
+    while (!s_stop) {
+        int nfds = 0;
+
+        fds[nfds].fd = s_listen_fd;
+        fds[nfds].events = POLLIN;
+        owner[nfds++] = -1;
+
+        for (int i = 0; i < w->pending_count; i++) {
+            fds[nfds].fd = w->pending[i].fd;
+            fds[nfds].events = POLLIN;
+            owner[nfds++] = -1;
+        }
+
+        for (int i = 0; i < RELAY_MAX_SESSIONS; i++) {
+            Session *s = &w->sessions[i];
+            if (!s->used) continue;
+            for (int k = 0; k < 2; k++) {
+                /* This socket reads for flow k and writes for flow !k. */
+                short ev = 0;
+                if (!s->flow[k].eof && s->flow[k].queued < RELAY_CHUNK)
+                    ev |= POLLIN;
+                if (s->flow[!k].queued > 0) ev |= POLLOUT;
+                fds[nfds].fd = s->flow[k].from;
+                fds[nfds].events = ev;
+                owner[nfds++] = i;
+            }
+        }
+
+        int ready = poll(fds, (unsigned)nfds, RELAY_POLL_MS);
+        time_t now = time(NULL);
+
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            AcceptPending(w, now);
+        }
+
+        /* Hellos: the poll set is stale past this point for pendings,
+         * so every pending connection is simply tried. */
+        for (int i = 0; i < w->pending_count; ) {
+            if (ReadHello(w, &w->pending[i], now)) {
+                w->pending[i] = w->pending[--w->pending_count];
+            } else {
+                i++;
+            }
+        }
+
+        /* Sessions with activity. */
+        for (int j = 0; ready > 0 && j < nfds; j++) {
+            if (owner[j] < 0 || fds[j].revents == 0) continue;
+
+            Session *s = &w->sessions[owner[j]];
+            if (!s->used) continue;
+
+            if (PumpFlow(&s->flow[0]) != 0 || PumpFlow(&s->flow[1]) != 0 ||
+                (s->flow[0].eof == 2 && s->flow[1].eof == 2) ||
+                (fds[j].revents & (POLLERR | POLLNVAL)))
+            {
+                EndSession(s);
+            }
+        }
+
+        if (w == &s_workers[0] && now != last_expire) {
+            last_expire = now;
+            ExpirePairs(now);
+        }
+    }
+
+    for (int i = 0; i < w->pending_count; i++) CLOSE_SOCKET(w->pending[i].fd);
+    w->pending_count = 0;
+    for (int i = 0; i < RELAY_MAX_SESSIONS; i++) {
+        if (w->sessions[i].used) EndSession(&w->sessions[i]);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int Relay_Start(int port)
+{
+    s_max_sessions = SessionBudget();
+    if (s_max_sessions == 0) {
+        LOG_ERROR("[relay] file descriptor limit too low for the relay");
+        return -1;
+    }
+
+    int fd = (int)socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LOG_ERROR("[relay] socket() failed");
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((uint16_t)port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 64) < 0)
+    {
+        LOG_ERROR("[relay] bind()/listen() failed on port %d", port);
+        CLOSE_SOCKET(fd);
+        return -1;
+    }
+    if (port == 0) {
+        /* Ephemeral port (the microbenchmarks): report the real one. */
+        socklen_t alen = sizeof(addr);
+        getsockname(fd, (struct sockaddr *)&addr, &alen);
+        port = ntohs(addr.sin_port);
+    }
+    SetNonBlocking(fd);
+
+#ifndef _WIN32
+    /* splice() into a socket the peer has closed raises SIGPIPE. */
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    Mutex_Init(&s_lock);
+    memset(s_pairs, 0, sizeof(s_pairs));
+    s_rng       = (uint32_t)time(NULL) ^ (uint32_t)Clock_NowUs();
+    if (s_rng == 0) s_rng = 1;
+    s_next_id   = 1;
+    s_listen_fd = fd;
+    s_stop      = 0;
+
+    for (int i = 0; i < RELAY_THREADS; i++) {
+        Worker *w = &s_workers[i];
+        w->pending_count = 0;
+        w->sessions = (Session *)Alloc_Calloc(ALLOC_RELAY, RELAY_MAX_SESSIONS,
+                                              sizeof(Session));
+        if (w->sessions == NULL || Thread_Start(&w->thread, RelayThread, w) != 0) {
+            LOG_ERROR("[relay] failed to start relay thread %d", i);
+            Alloc_Free(w->sessions);
+            s_stop = 1;
+            for (int k = 0; k < i; k++) {
+                Thread_Join(&s_workers[k].thread);
+                Alloc_Free(s_workers[k].sessions);
+            }
+            CLOSE_SOCKET(fd);
+            s_listen_fd = -1;
+            Mutex_Destroy(&s_lock);
+            return -1;
+        }
+    }
+
+    s_port = port;
+    LOG_INFO("[relay] listening on tcp port %d (%d threads, %d sessions each)",
+             port, RELAY_THREADS, s_max_sessions);
+    return 0;
+}
+
+void Relay_Stop(void)
+{
+    if (s_port == 0) return;
+
+    s_stop = 1;
+    for (int i = 0; i < RELAY_THREADS; i++) {
+        Thread_Join(&s_workers[i].thread);
+        Alloc_Free(s_workers[i].sessions);
+        s_workers[i].sessions = NULL;
+    }
+
+    for (int i = 0; i < RELAY_MAX_SESSIONS; i++) {
+        for (int k = 0; k < 2; k++) {
+            if (s_pairs[i].used && s_pairs[i].parked[k] != -1)
+                CLOSE_SOCKET(s_pairs[i].parked[k]);
+        }
+        s_pairs[i].used = 0;
+    }
+
+    CLOSE_SOCKET(s_listen_fd);
+    s_listen_fd = -1;
+    s_port      = 0;
+    Mutex_Destroy(&s_lock);
+}
+
+int Relay_Port(void)
+{
+    return s_port;
+}
+
+int Relay_Open(const char *a, const char *b,
+               uint32_t *ticket_a, uint32_t *ticket_b)
+{
+    if (s_port == 0) return -1;
+
+    int rc = -1;
+    Mutex_Lock(&s_lock);
+    for (int i = 0; i < s_max_sessions; i++) {
+        Pair *p = &s_pairs[i];
+        if (p->used) continue;
+
+        memset(p, 0, sizeof(*p));
+        p->used      = 1;
+        p->id        = s_next_id++;
+        p->ticket[0] = NextTicket();
+        p->ticket[1] = NextTicket();
+        p->parked[0] = p->parked[1] = -1;
+        p->expires   = time(NULL) + RELAY_TICKET_TIMEOUT;
+        strncpy(p->names[0], a, MAX_USERNAME - 1);
+        strncpy(p->names[1], b, MAX_USERNAME - 1);
+
+        *ticket_a = p->ticket[0];
+        *ticket_b = p->ticket[1];
+        rc = 0;
+        break;
+    }
+    Mutex_Unlock(&s_lock);
+    return rc;
+}
@@ -0,0 +1,60 @@
+/*
+ * relay.h – TCP game-session relay for War3 Lobby Server.
+ *
+ * Players behind symmetric NAT can discover a game but cannot open the
+ * TCP 6112 connection to its host.  The relay gives both ends a rendez-
+ * vous on the server instead: the lobby issues one ticket to each side
+ * (relay_open / relay_ticket), each side connects to the relay port and
+ * sends an 8-byte hello, and once both have arrived the relay forwards
+ * bytes between the two connections until either closes.
+ *
+ *   hello = "W3RL" (4) | ticket (4, big-endian)
+ *
+ * The relay runs on its own threads with its own poll() loop, so game
+ * traffic never waits on lobby work and vice versa.  The only state
+ * shared with the lobby is the ticket table, behind a mutex.
+ *
+ * On Linux each direction is moved with splice() through a pipe, so
+ * payload bytes are never copied into user space.  Elsewhere a plain
+ * recv()/send() buffer is used.  Every session records its byte counts,
+ * throughput and how long data waited inside the relay; the figures are
+ * logged when the session ends.
+ */
+
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdint.h>
+
+#define RELAY_THREADS         2
+#define RELAY_MAX_SESSIONS    256    /* pairs + sessions, fds permitting  */
+#define RELAY_MAX_PENDING     64     /* per thread, waiting for a hello   */
+#define RELAY_TICKET_TIMEOUT  30     /* seconds to use a ticket pair      */
+#define RELAY_HELLO_TIMEOUT   10     /* seconds to send the hello         */
+#define RELAY_CHUNK           65536  /* bytes in flight per direction     */
+
+#define RELAY_HELLO_SIZE      8
+
+/*
+ * Start the relay threads, listening on `port` (0 picks a free one, see
+ * Relay_Port).  Sessions are capped so the relay, the lobby and its
+ * other sockets fit RLIMIT_NOFILE and FD_SETSIZE.  Returns 0 on success,
+ * -1 on failure; the lobby keeps running without a relay in that case.
+ */
+int Relay_Start(int port);
+
+/* Stop the relay threads and close every session. */
+void Relay_Stop(void);
+
+/* TCP port in use, 0 if the relay is not running. */
+int Relay_Port(void);
+
+/*
+ * Open a ticket pair for a session between `a` and `b` (names are only
+ * used for logging).  Returns 0 and fills both tickets, or -1 if the
+ * relay is not running or full.  Called from the lobby thread.
+ */
+int Relay_Open(const char *a, const char *b,
+               uint32_t *ticket_a, uint32_t *ticket_b);
+
+#endif /* RELAY_H */
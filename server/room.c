@@ -3,6 +3,7 @@
  */
 
 #include "room.h"
+#include <limits.h>
 #include <string.h>
 
 /* Simple monotonically increasing room-id counter. */
@@ -19,6 +20,7 @@ void Rooms_Init(Room rooms[], int count)
         rooms[i].name[0]     = '\0';
         rooms[i].max_players = 0;
         rooms[i].creator_fd  = -1;
+        rooms[i].member_count = 0;
     }
 }
 
@@ -34,6 +36,17 @@ Room *Rooms_Create(Room rooms[], int count,
             rooms[i].id          = s_next_room_id++;
             rooms[i].max_players = max_players;
             rooms[i].creator_fd  = creator_fd;
+            rooms[i].member_count = 0;
+            rooms[i].udp_pkts_in   = 0;
+            rooms[i].udp_bytes_in  = 0;
+            rooms[i].udp_pkts_out  = 0;
+            rooms[i].udp_bytes_out = 0;
+            rooms[i].fanout_frames = 0;
+            rooms[i].fanout_bytes  = 0;
+            rooms[i].host_hint     = NULL;
+            rooms[i].map_announced = 0;
+            rooms[i].launch_id     = 0;
+            rooms[i].launch_time   = 0;
 
             strncpy(rooms[i].name, name, MAX_ROOM_NAME - 1);
             rooms[i].name[MAX_ROOM_NAME - 1] = '\0';
@@ -70,26 +83,198 @@ void Rooms_Destroy(Room rooms[], int count, int id)
             rooms[i].name[0]     = '\0';
             rooms[i].max_players = 0;
             rooms[i].creator_fd  = -1;
+            for (int k = 0; k < rooms[i].member_count; k++) {
+                rooms[i].members[k]->room_id = -1;
+            }
+            rooms[i].member_count = 0;
+            rooms[i].host_hint    = NULL;
             return;
         }
     }
 }
 
+/* ------------------------------------------------------------------ */
+/*  Rooms_AddMember / Rooms_RemoveMember                              */
+/* ------------------------------------------------------------------ */
+
+void Rooms_AddMember(Room *room, User *user)
+{
+    if (room->member_count >= MAX_ROOM_PLAYERS) return;
+
+    /* Nothing measured yet between the newcomer and anyone else. */
+    int k = room->member_count;
+    for (int j = 0; j < MAX_ROOM_PLAYERS; j++) {
+        room->rtt_ms[k][j]   = -1;
+        room->rtt_ms[j][k]   = -1;
+        room->loss_pct[k][j] = 0;
+        room->loss_pct[j][k] = 0;
+    }
+    room->server_rtt_ms[k] = -1;
+
+    room->members[room->member_count++] = user;
+    user->room_id = room->id;
+}
+
+void Rooms_RemoveMember(Room *room, User *user)
+{
+    for (int k = 0; k < room->member_count; k++) {
+        if (room->members[k] == user) {
+            /* Shift down so the list stays in join order. */
+            int tail = room->member_count - k - 1;
+            memmove(&room->members[k], &room->members[k + 1],
+                    tail * sizeof(User *));
+
+            /* The RTT matrix loses row k and column k the same way. */
+            memmove(&room->rtt_ms[k], &room->rtt_ms[k + 1],
+                    tail * sizeof(room->rtt_ms[0]));
+            memmove(&room->loss_pct[k], &room->loss_pct[k + 1],
+                    tail * sizeof(room->loss_pct[0]));
+            memmove(&room->server_rtt_ms[k], &room->server_rtt_ms[k + 1],
+                    tail * sizeof(room->server_rtt_ms[0]));
+            for (int i = 0; i < room->member_count - 1; i++) {
+                memmove(&room->rtt_ms[i][k], &room->rtt_ms[i][k + 1],
+                        tail * sizeof(room->rtt_ms[0][0]));
+                memmove(&room->loss_pct[i][k], &room->loss_pct[i][k + 1],
+                        tail * sizeof(room->loss_pct[0][0]));
+            }
+
+            room->member_count--;
+            break;
+        }
+    }
+    if (room->host_hint == user) room->host_hint = NULL;
+    user->room_id = -1;
+}
+
+int Rooms_MemberIndex(const Room *room, const User *user)
+{
+    for (int k = 0; k < room->member_count; k++) {
+        if (room->members[k] == user) return k;
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Rooms_PickHost                                                    */
+/* ------------------------------------------------------------------ */
+
+/* Cost of the a<->b link in milliseconds, or -1 if nothing is known. */
+static int PairCost(const Room *room, int a, int b)
+{
+    int ab = room->rtt_ms[a][b];
+    int ba = room->rtt_ms[b][a];
+
+    if (ab >= 0 || ba >= 0) {
+        int rtt  = (ab >= 0 && ba >= 0) ? (ab + ba) / 2
+                 : (ab >= 0 ? ab : ba);
+        int loss = 0;
+        if (ab >= 0) loss = room->loss_pct[a][b];
+        if (ba >= 0 && room->loss_pct[b][a] > loss) loss = room->loss_pct[b][a];
+        return rtt + loss * ROOM_LOSS_PENALTY_MS;
+    }
+
+    /* No direct probe got through: the path via the server is what the
+     * relay would give them, so it is a fair estimate. */
+    if (room->server_rtt_ms[a] >= 0 && room->server_rtt_ms[b] >= 0) {
+        return room->server_rtt_ms[a] + room->server_rtt_ms[b];
+    }
+    return -1;
+}
+
+int Rooms_PickHost(const Room *room, int *worst_ms, int *mean_ms)
+{
+    int n = room->member_count;
+    if (n < 2) return -1;
+
+    int best = -1, best_worst = 0, best_sum = 0;
+
+    for (int h = 0; h < n; h++) {
+        int worst = 0, sum = 0, complete = 1;
+        for (int m = 0; m < n && complete; m++) {
+            if (m == h) continue;
+            int c = PairCost(room, h, m);
+            if (c < 0) {
+                complete = 0;
+            } else {
+                if (c > worst) worst = c;
+                sum += c;
+            }
+        }
+        if (!complete) continue;
+
+        if (best < 0 || worst < best_worst ||
+            (worst == best_worst && sum < best_sum))
+        {
+            best       = h;
+            best_worst = worst;
+            best_sum   = sum;
+        }
+    }
+
+    if (best >= 0) {
+        *worst_ms = best_worst;
+        *mean_ms  = best_sum / (n - 1);
+    }
+    return best;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Rooms_Host                                                        */
+/* ------------------------------------------------------------------ */
+
+const User *Rooms_Host(const Room *room, time_t now)
+{
+    if (room->member_count == 0) return NULL;
+
+    const User *creator = room->members[0];
+    for (int k = 0; k < room->member_count; k++) {
+        if (room->members[k]->fd == room->creator_fd) {
+            creator = room->members[k];
+            break;
+        }
+    }
+    if (Users_LiveGame(creator, now)) return creator;
+
+    for (int k = 0; k < room->member_count; k++) {
+        if (Users_LiveGame(room->members[k], now)) return room->members[k];
+    }
+    return creator;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Rooms_EstimateLatency                                             */
+/* ------------------------------------------------------------------ */
+
+int Rooms_EstimateLatency(const Room *room, int viewer_rtt_ms, time_t now)
+{
+    const User *host = Rooms_Host(room, now);
+    if (host == NULL || viewer_rtt_ms < 0 || host->rtt_ms < 0) return -1;
+    return viewer_rtt_ms + host->rtt_ms;
+}
+
 /* ------------------------------------------------------------------ */
 /*  Rooms_GetList                                                     */
 /* ------------------------------------------------------------------ */
 
+/* Known latencies first, ascending; unknown ones after. */
+static int LatencyBefore(const RoomInfo *a, const RoomInfo *b)
+{
+    if (a->latency_ms < 0) return 0;
+    return b->latency_ms < 0 || a->latency_ms < b->latency_ms;
+}
+
 int Rooms_GetList(Room rooms[], int count,
                   RoomInfo *out_list, int out_max,
-                  User users[], int user_count)
+                  int viewer_rtt_ms, time_t now)
 {
     int n = 0;
     for (int i = 0; i < count && n < out_max; i++) {
         if (rooms[i].id != 0) {
             out_list[n].id           = rooms[i].id;
             out_list[n].max_players  = rooms[i].max_players;
-            out_list[n].player_count = Users_CountInRoom(users, user_count,
-                                                         rooms[i].id);
+            out_list[n].player_count = rooms[i].member_count;
+            out_list[n].latency_ms   =
+                Rooms_EstimateLatency(&rooms[i], viewer_rtt_ms, now);
 
             strncpy(out_list[n].name, rooms[i].name, MAX_ROOM_NAME - 1);
             out_list[n].name[MAX_ROOM_NAME - 1] = '\0';
@@ -97,5 +282,61 @@ int Rooms_GetList(Room rooms[], int count,
             n++;
         }
     }
+
+    /* Insertion sort: stable, and the list is at most MAX_ROOMS long. */
+    for (int i = 1; i < n; i++) {
+        RoomInfo cur = out_list[i];
+        int j = i;
+        while (j > 0 && LatencyBefore(&cur, &out_list[j - 1])) {
+            out_list[j] = out_list[j - 1];
+            j--;
+        }
+        out_list[j] = cur;
+    }
     return n;
 }
+
+/* ------------------------------------------------------------------ */
+/*  Rooms_PickQuickJoin                                               */
+/* ------------------------------------------------------------------ */
+
+/* Latency band for quick_join, INT_MAX when there is no estimate. */
+static int LatencyBand(const Room *room, int viewer_rtt_ms, time_t now)
+{
+    int ms = Rooms_EstimateLatency(room, viewer_rtt_ms, now);
+    return ms < 0 ? INT_MAX : ms / ROOM_LATENCY_BAND_MS;
+}
+
+Room *Rooms_PickQuickJoin(Room rooms[], int count,
+                          const char *filter, int viewer_rtt_ms,
+                          time_t now)
+{
+    Room *best      = NULL;
+    int   best_cur  = 0;
+    int   best_band = INT_MAX;
+
+    for (int i = 0; i < count; i++) {
+        if (rooms[i].id == 0) continue;
+        if (filter && filter[0] && strstr(rooms[i].name, filter) == NULL)
+            continue;
+
+        int cur = rooms[i].member_count;
+        if (cur >= rooms[i].max_players) continue;
+
+        int band = LatencyBand(&rooms[i], viewer_rtt_ms, now);
+        if (best != NULL && band != best_band) {
+            if (band > best_band) continue;
+        } else if (best != NULL) {
+            /* Same band: compare fill ratios cur/max without floating
+             * point, then age. */
+            int lhs = cur * best->max_players;
+            int rhs = best_cur * rooms[i].max_players;
+            if (lhs < rhs || (lhs == rhs && rooms[i].id > best->id))
+                continue;
+        }
+        best      = &rooms[i];
+        best_cur  = cur;
+        best_band = band;
+    }
+    return best;
+}
@@ -8,13 +8,51 @@
 #include "../common/message.h"
 #include "user.h"
 
+#ifndef MAX_ROOMS
 #define MAX_ROOMS 64
+#endif
+
+/* Host scoring: each percent of probe loss on a pair counts as this
+ * many milliseconds of extra latency. */
+#define ROOM_LOSS_PENALTY_MS 5
+
+/* quick_join: latency estimates within this many milliseconds of each
+ * other count as equally close, and fill level decides. */
+#define ROOM_LATENCY_BAND_MS 25
 
 typedef struct {
     int id;                      /* room id, 0 if slot unused */
     char name[MAX_ROOM_NAME];
     int max_players;
     int creator_fd;              /* fd of the creator */
+
+    /* Members in join order; user->room_id mirrors this list */
+    User *members[MAX_ROOM_PLAYERS];
+    int member_count;
+
+    /* Discovery traffic through the UDP reflector (see reflector.h) */
+    uint64_t udp_pkts_in;
+    uint64_t udp_bytes_in;
+    uint64_t udp_pkts_out;
+    uint64_t udp_bytes_out;
+
+    /* Lobby messages broadcast to members (admin.h) */
+    uint64_t fanout_frames;      /* frames queued, one per recipient */
+    uint64_t fanout_bytes;
+
+    /* Latency reports (rtt_report), indexed like members[]: row i is
+     * what members[i] measured.  -1 = not measured. */
+    int16_t rtt_ms[MAX_ROOM_PLAYERS][MAX_ROOM_PLAYERS];
+    uint8_t loss_pct[MAX_ROOM_PLAYERS][MAX_ROOM_PLAYERS];
+    int16_t server_rtt_ms[MAX_ROOM_PLAYERS];
+    const User *host_hint;       /* last recommended host, or NULL */
+
+    /* CRC of the map members were last told to prefetch (mapstore.h) */
+    uint32_t map_announced;
+
+    /* Last coordinated launch (launch.h), 0 / 0 if none yet */
+    uint32_t launch_id;
+    time_t   launch_time;
 } Room;
 
 /* Initialise all room slots to "unused". */
@@ -34,12 +72,64 @@ Room *Rooms_FindById(Room rooms[], int count, int id);
 void Rooms_Destroy(Room rooms[], int count, int id);
 
 /*
- * Fill out_list with RoomInfo entries for every active room.
- * player_count is computed by scanning the users array.
- * Returns the number of entries written (at most out_max).
+ * Put `user` into `room` (sets user->room_id).  The caller has already
+ * checked member_count < max_players.
+ */
+void Rooms_AddMember(Room *room, User *user);
+
+/* Take `user` out of `room` (resets user->room_id to -1). */
+void Rooms_RemoveMember(Room *room, User *user);
+
+/* Position of `user` in room->members, or -1. */
+int Rooms_MemberIndex(const Room *room, const User *user);
+
+/*
+ * The room's host, the one answer for starting the game, latency
+ * estimates and the room's game: the member whose War3 game is live
+ * (see Users_LiveGame; the creator's if several are), else the creator
+ * while still a member, else the member in the room longest.  NULL
+ * only for an empty room.
+ */
+const User *Rooms_Host(const Room *room, time_t now);
+
+/*
+ * Recommend a host from the room's RTT matrix: the member whose worst
+ * latency to the others is lowest, ties broken by the mean.  A pair
+ * nobody measured directly is estimated as the sum of both members'
+ * latency to the server.  Returns the member index and fills the
+ * candidate's worst / mean in milliseconds, or -1 if fewer than two
+ * members or no candidate has a figure for every pair.
+ */
+int Rooms_PickHost(const Room *room, int *worst_ms, int *mean_ms);
+
+/*
+ * Estimated RTT in milliseconds between a player whose lobby RTT is
+ * `viewer_rtt_ms` and Rooms_Host: the path through the server, viewer +
+ * host.  -1 if either side is unmeasured.
+ */
+int Rooms_EstimateLatency(const Room *room, int viewer_rtt_ms, time_t now);
+
+/*
+ * Fill out_list with RoomInfo entries for every active room, ranked by
+ * latency_ms for a viewer with lobby RTT `viewer_rtt_ms` (rooms without
+ * an estimate keep creation order, after the ranked ones).
+ * player_count comes from each room's member list.  Returns the number
+ * of entries written (at most out_max).
  */
 int Rooms_GetList(Room rooms[], int count,
                   RoomInfo *out_list, int out_max,
-                  User users[], int user_count);
+                  int viewer_rtt_ms, time_t now);
+
+/*
+ * Pick a room for quick_join among the non-full rooms whose name
+ * contains `filter` (NULL or "" matches every room): the lowest
+ * Rooms_EstimateLatency for a player with lobby RTT `viewer_rtt_ms`, in
+ * ROOM_LATENCY_BAND_MS bands, rooms without an estimate last; then the
+ * highest fill level; then the older room.  Returns NULL if no room
+ * fits.
+ */
+Room *Rooms_PickQuickJoin(Room rooms[], int count,
+                          const char *filter, int viewer_rtt_ms,
+                          time_t now);
 
 #endif /* ROOM_H */
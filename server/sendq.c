@@ -0,0 +1,202 @@
+/*
+ * sendq.c – Per-connection outbound frame queue implementation.
+ */
+
+#include "sendq.h"
+#include "metrics.h"
+#include "../common/protocol.h"
+#include "../common/alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <winsock2.h>
+#else
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#   include <sys/uio.h>
+#   include <arpa/inet.h>
+#   include <errno.h>
+#endif
+
+/* Maximum number of frames handed to one gathered write. */
+#define SENDQ_IOV_MAX 64
+
+/* ------------------------------------------------------------------ */
+/*  OutFrame                                                          */
+/* ------------------------------------------------------------------ */
+
+#define SMALL_FRAME_SIZE \
+    (sizeof(OutFrame) + FRAME_HEADER_SIZE + SENDQ_SMALL_FRAME)
+
+/* Released small frames, all SMALL_FRAME_SIZE bytes. */
+static OutFrame *s_pool[SENDQ_POOL_MAX];
+static int       s_pool_count;
+
+/* Bytes copied into frames by OutFrame_Create, header included. */
+static uint64_t  s_bytes_framed;
+
+OutFrame *OutFrame_Create(const char *json_str)
+{
+    if (json_str == NULL) return NULL;
+
+    uint32_t payload_len = (uint32_t)strlen(json_str);
+    OutFrame *f;
+    if (payload_len > SENDQ_SMALL_FRAME) {
+        f = (OutFrame *)Alloc_Malloc(ALLOC_SENDQ, sizeof(OutFrame)
+                                     + FRAME_HEADER_SIZE + payload_len);
+    } else if (s_pool_count > 0) {
+        f = s_pool[--s_pool_count];
+    } else {
+        f = (OutFrame *)Alloc_Malloc(ALLOC_SENDQ, SMALL_FRAME_SIZE);
+    }
+    if (f == NULL) return NULL;
+
+    f->refcount = 1;
+    f->len      = FRAME_HEADER_SIZE + payload_len;
+
+    uint32_t net_len = htonl(payload_len);
+    memcpy(f->data, &net_len, FRAME_HEADER_SIZE);
+    memcpy(f->data + FRAME_HEADER_SIZE, json_str, payload_len);
+    s_bytes_framed += f->len;
+    return f;
+}
+
+uint64_t OutFrame_BytesFramed(void)
+{
+    return s_bytes_framed;
+}
+
+void OutFrame_Retain(OutFrame *frame)
+{
+    if (frame) frame->refcount++;
+}
+
+void OutFrame_Release(OutFrame *frame)
+{
+    if (frame == NULL || --frame->refcount != 0) return;
+
+    if (frame->len <= FRAME_HEADER_SIZE + SENDQ_SMALL_FRAME &&
+        s_pool_count < SENDQ_POOL_MAX) {
+        s_pool[s_pool_count++] = frame;
+    } else {
+        Alloc_Free(frame);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  SendQ                                                             */
+/* ------------------------------------------------------------------ */
+
+void SendQ_Init(SendQ *q)
+{
+    memset(q, 0, sizeof(*q));
+}
+
+void SendQ_Clear(SendQ *q)
+{
+    while (q->count > 0) {
+        OutFrame_Release(q->frames[q->head]);
+        q->head = (q->head + 1) % SENDQ_MAX_FRAMES;
+        q->count--;
+    }
+    SendQ_Init(q);
+}
+
+int SendQ_Push(SendQ *q, OutFrame *frame)
+{
+    if (frame == NULL) return -1;
+
+    if (q->count >= SENDQ_MAX_FRAMES ||
+        q->bytes + frame->len > SENDQ_MAX_BYTES) {
+        q->overflow = 1;
+        return -1;
+    }
+
+    OutFrame_Retain(frame);
+    q->frames[(q->head + q->count) % SENDQ_MAX_FRAMES] = frame;
+    q->count++;
+    q->bytes += frame->len;
+    q->frames_out++;
+    return 0;
+}
+
+/* Drop `n` bytes from the front of the queue after a successful write. */
+static void SendQ_Consume(SendQ *q, uint32_t n)
+{
+    q->bytes     -= n;
+    q->bytes_out += n;
+    while (n > 0 && q->count > 0) {
+        OutFrame *f   = q->frames[q->head];
+        uint32_t left = f->len - q->head_off;
+        if (n < left) {
+            q->head_off += n;
+            return;
+        }
+        n -= left;
+        OutFrame_Release(f);
+        q->head     = (q->head + 1) % SENDQ_MAX_FRAMES;
+        q->head_off = 0;
+        q->count--;
+    }
+}
+
+int SendQ_Flush(SendQ *q, int fd)
+{
+    while (q->count > 0) {
+        uint32_t nvec = q->count < SENDQ_IOV_MAX ? q->count : SENDQ_IOV_MAX;
+
+#ifdef _WIN32
+        WSABUF iov[SENDQ_IOV_MAX];
+        for (uint32_t i = 0; i < nvec; i++) {
+            OutFrame *f  = q->frames[(q->head + i) % SENDQ_MAX_FRAMES];
+            uint32_t off = (i == 0) ? q->head_off : 0;
+            iov[i].buf = (char *)(f->data + off);
+            iov[i].len = (ULONG)(f->len - off);
+        }
+        DWORD sent = 0;
+        if (WSASend((SOCKET)fd, iov, (DWORD)nvec, &sent, 0, NULL, NULL) != 0) {
+            return (WSAGetLastError() == WSAEWOULDBLOCK) ? 0 : -1;
+        }
+        SendQ_Consume(q, (uint32_t)sent);
+        Metrics_Add(MET_BYTES_OUT, sent);
+#else
+        struct iovec iov[SENDQ_IOV_MAX];
+        for (uint32_t i = 0; i < nvec; i++) {
+            OutFrame *f  = q->frames[(q->head + i) % SENDQ_MAX_FRAMES];
+            uint32_t off = (i == 0) ? q->head_off : 0;
+            iov[i].iov_base = f->data + off;
+            iov[i].iov_len  = f->len - off;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = nvec;
+#   ifdef MSG_NOSIGNAL
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+#   else
+        ssize_t n = sendmsg(fd, &msg, 0);
+#   endif
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        SendQ_Consume(q, (uint32_t)n);
+        Metrics_Add(MET_BYTES_OUT, (uint64_t)n);
+#endif
+    }
+    return 0;
+}
+
+int SendQ_FlushTo(SendQ *q, SendQ_WriteFn write, void *ctx)
+{
+    while (q->count > 0) {
+        OutFrame *f = q->frames[q->head];
+        int n = write(ctx, f->data + q->head_off, f->len - q->head_off);
+        if (n <= 0) return n;
+        SendQ_Consume(q, (uint32_t)n);
+        Metrics_Add(MET_BYTES_OUT, (uint64_t)n);
+    }
+    return 0;
+}
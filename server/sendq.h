@@ -0,0 +1,85 @@
+/*
+ * sendq.h – Per-connection outbound frame queue for War3 Lobby Server.
+ *
+ * Handlers never write to a socket directly.  A JSON message is framed
+ * once into a reference-counted OutFrame, which is then pushed onto the
+ * SendQ of every recipient.  The event loop flushes each queue with a
+ * single gathered write per iteration, so everything a handler queues
+ * for one client while processing a message leaves in the same flush.
+ */
+
+#ifndef SENDQ_H
+#define SENDQ_H
+
+#include <stdint.h>
+
+#define SENDQ_MAX_FRAMES 256            /* frames queued per connection   */
+#define SENDQ_MAX_BYTES  (512 * 1024)   /* unsent bytes per connection    */
+#define SENDQ_SMALL_FRAME 1024          /* payloads up to this are pooled */
+#define SENDQ_POOL_MAX   512            /* released small frames kept     */
+
+typedef struct {
+    int      refcount;
+    uint32_t len;                /* header + payload                     */
+    uint8_t  data[];             /* [4-byte big-endian len][JSON]        */
+} OutFrame;
+
+typedef struct {
+    OutFrame *frames[SENDQ_MAX_FRAMES];  /* ring buffer                  */
+    uint32_t  head;              /* index of the oldest frame            */
+    uint32_t  count;             /* frames in the ring                   */
+    uint32_t  head_off;          /* bytes of frames[head] already sent   */
+    uint32_t  bytes;             /* unsent bytes across all frames       */
+    int       overflow;          /* set when a push hit the limits       */
+
+    /* Totals since the connection opened (admin.h) */
+    uint64_t  frames_out;        /* frames queued                        */
+    uint64_t  bytes_out;         /* bytes written to the socket          */
+} SendQ;
+
+/*
+ * Frame a JSON string into a new OutFrame with a reference count of 1.
+ * Returns NULL on allocation failure.  Frames with payloads up to
+ * SENDQ_SMALL_FRAME come from a pool, so steady lobby traffic does not
+ * touch the heap.  Lobby thread only.
+ */
+OutFrame *OutFrame_Create(const char *json_str);
+
+/* Take / drop a reference.  The frame is freed (or returned to the
+ * pool) when the count hits 0. */
+void OutFrame_Retain(OutFrame *frame);
+void OutFrame_Release(OutFrame *frame);
+
+/* Bytes copied into frames by OutFrame_Create so far (header
+ * included).  The microbenchmarks report it per operation. */
+uint64_t OutFrame_BytesFramed(void);
+
+/* Initialise an empty queue. */
+void SendQ_Init(SendQ *q);
+
+/* Release every queued frame and reset the queue. */
+void SendQ_Clear(SendQ *q);
+
+/*
+ * Queue a frame (takes its own reference).
+ * Returns 0 on success, -1 if the queue is over its frame or byte limit;
+ * in that case q->overflow is set and the frame is not queued.
+ */
+int SendQ_Push(SendQ *q, OutFrame *frame);
+
+/*
+ * Write as much queued data as the (non-blocking) socket accepts.
+ * Returns 0 if the socket is still healthy (the queue may be non-empty),
+ * -1 on a fatal socket error.
+ */
+int SendQ_Flush(SendQ *q, int fd);
+
+/*
+ * As SendQ_Flush, through `write` instead of a socket (simulated
+ * transports).  `write` takes up to `len` bytes and returns how many
+ * it accepted, 0 if it is full for now, or -1 on a fatal error.
+ */
+typedef int (*SendQ_WriteFn)(void *ctx, const uint8_t *data, uint32_t len);
+int SendQ_FlushTo(SendQ *q, SendQ_WriteFn write, void *ctx);
+
+#endif /* SENDQ_H */
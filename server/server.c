@@ -1,38 +1,31 @@
 /*
- * server.c – TCP server core implementation using select().
- *
- * Cross-platform: compiles on Windows (winsock2) and POSIX (Linux/macOS).
+ * server.c – Server core: the event loop over a Transport.
  */
 
 #include "server.h"
 #include "handler.h"
+#include "match.h"
+#include "channel.h"
+#include "presence.h"
+#include "relay.h"
+#include "mapstore.h"
+#include "metrics.h"
+#include "exporter.h"
+#include "profiler.h"
+#include "log.h"
+#include "trace.h"
+#include "admin.h"
+#include "stats.h"
+#include "jsonmem.h"
+#include "clock.h"
 #include "../common/protocol.h"
 #include "../common/message.h"
-#include "../third_party/cJSON/cJSON.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#ifdef _WIN32
-#   include <winsock2.h>
-#   include <ws2tcpip.h>
-#   pragma comment(lib, "ws2_32.lib")
-    typedef int socklen_t;
-#   define CLOSE_SOCKET(s) closesocket(s)
-#else
-#   include <sys/types.h>
-#   include <sys/socket.h>
-#   include <sys/select.h>
-#   include <netinet/in.h>
-#   include <arpa/inet.h>
-#   include <unistd.h>
-#   include <fcntl.h>
-#   include <errno.h>
-#   define CLOSE_SOCKET(s) close(s)
-#endif
-
 /* Heartbeat timeout in seconds.  Users that don't send a heartbeat
  * within this interval are disconnected. */
 #define HEARTBEAT_TIMEOUT 60
@@ -42,327 +35,357 @@
 /* ================================================================== */
 
 /*
- * Disconnect a user: leave room if in one, close socket, free slot.
+ * Disconnect a user: leave room if in one, close the connection, free
+ * the slot.
  */
-static void DisconnectUser(User *user, User users[], int user_count,
-                           Room rooms[], int room_count)
+static void DisconnectUser(Server *srv, User *user)
 {
-    printf("[server] disconnecting '%s' (fd %d, ip %s)\n",
-           user->username[0] ? user->username : "(no name)",
-           user->fd, user->ip);
-
-    /* If the user is in a room, perform a room-leave. */
-    if (user->room_id != -1) {
-        int room_id = user->room_id;
-        user->room_id = -1;
-
-        /* Notify remaining room members. */
-        if (user->username[0] != '\0') {
-            /* Build player_left JSON. */
-            cJSON *note = cJSON_CreateObject();
-            cJSON_AddStringToObject(note, "type", MSG_PLAYER_LEFT);
-            cJSON_AddStringToObject(note, "username", user->username);
-            char *s = cJSON_PrintUnformatted(note);
-            cJSON_Delete(note);
-            if (s) {
-                for (int i = 0; i < user_count; i++) {
-                    if (users[i].fd != -1 && users[i].room_id == room_id) {
-                        /* Re-use SendToFd logic inline to avoid circular dep. */
-                        uint32_t frame_len = 0;
-                        uint8_t *frame = Protocol_Frame(s, &frame_len);
-                        if (frame) {
-                            uint32_t sent = 0;
-                            while (sent < frame_len) {
-                                int n = send(users[i].fd,
-                                             (const char *)(frame + sent),
-                                             (int)(frame_len - sent), 0);
-                                if (n <= 0) break;
-                                sent += (uint32_t)n;
-                            }
-                            free(frame);
-                        }
-                    }
-                }
-                free(s);
-            }
+    LOG_INFO("[server] disconnecting '%s' (fd %d, ip %s)",
+             user->username[0] ? user->username : "(no name)",
+             user->fd, user->ip);
+    TRACE_DISCONNECT(user->fd, user->username);
+
+    Handler_OnDisconnect(user, srv->rooms, MAX_ROOMS);
+
+    srv->transport->close(srv->transport->ctx, user->fd);
+    Users_FreeSlot(user);
+    Metrics_Add(MET_CONN_CLOSED, 1);
+}
+
+/* Fill the table and send-queue fields of a stats page from the tables. */
+static void CountTables(const Server *srv, StatPage *page)
+{
+    for (int i = 0; i < MAX_USERS; i++) {
+        const User *u = &srv->users[i];
+        if (u->fd == -1) continue;
+        page->connections++;
+        if (u->username[0] != '\0') page->users++;
+
+        page->sendq_frames += u->sendq.count;
+        page->sendq_bytes  += u->sendq.bytes;
+        if (u->sendq.count > page->sendq_frames_max)
+            page->sendq_frames_max = u->sendq.count;
+        if (u->sendq.bytes > page->sendq_bytes_max)
+            page->sendq_bytes_max = u->sendq.bytes;
+    }
+    for (int i = 0; i < MAX_ROOMS; i++) {
+        if (srv->rooms[i].id == 0) continue;
+        page->rooms++;
+        page->room_members += (uint64_t)srv->rooms[i].member_count;
+    }
+}
+
+void Server_RefreshGauges(void *ctx)
+{
+    StatPage page;
+    memset(&page, 0, sizeof(page));
+    CountTables((const Server *)ctx, &page);
+
+    Metrics_SetGauge(MET_GAUGE_CONNECTIONS, (int64_t)page.connections);
+    Metrics_SetGauge(MET_GAUGE_USERS, (int64_t)page.users);
+    Metrics_SetGauge(MET_GAUGE_ROOMS, (int64_t)page.rooms);
+    Metrics_SetGauge(MET_GAUGE_ROOM_MEMBERS, (int64_t)page.room_members);
+}
+
+/* Rewrite the shared stats page once STATPAGE_INTERVAL_MS has passed. */
+static void PublishStats(Server *srv)
+{
+    uint64_t now_us = Clock_NowUs();
+    if (!Stats_Enabled() || now_us < srv->stats_next_us) return;
+    srv->stats_next_us = now_us + STATPAGE_INTERVAL_MS * 1000u;
+
+    StatPage page;
+    memset(&page, 0, sizeof(page));
+    CountTables(srv, &page);
+
+    page.msgs_in_total     = srv->msgs_in;
+    page.bytes_in_total    = Metrics_Counter(MET_BYTES_IN);
+    page.bytes_out_total   = Metrics_Counter(MET_BYTES_OUT);
+    page.loop_stalls_total = Metrics_Counter(MET_LOOP_STALLS);
+    page.log_dropped_total = Metrics_Counter(MET_LOG_DROPPED);
+
+    ProfilerWindow win;
+    Profiler_TakeWindow(&win);
+    page.loop_p50_ns = win.p50_ns;
+    page.loop_p90_ns = win.p90_ns;
+    page.loop_p99_ns = win.p99_ns;
+    page.loop_max_ns = win.max_ns;
+
+    Stats_Publish(&page, win.iterations);
+}
+
+/*
+ * Flush every pending send queue.  Connections whose queue overflowed
+ * (a client that stopped reading) or whose socket failed are dropped.
+ */
+static void FlushAll(Server *srv)
+{
+    const Transport *t = srv->transport;
+
+    for (int i = 0; i < MAX_USERS; i++) {
+        User *user = &srv->users[i];
+        if (user->fd == -1) continue;
+
+        if (user->sendq.overflow) {
+            LOG_WARN("[server] send queue overflow for '%s' (fd %d)",
+                     user->username[0] ? user->username : "(no name)",
+                     user->fd);
+            DisconnectUser(srv, user);
+            continue;
         }
+        if (user->sendq.count == 0) continue;
 
-        /* Destroy room if empty, otherwise broadcast updated peers. */
-        int remaining = Users_CountInRoom(users, user_count, room_id);
-        if (remaining == 0) {
-            printf("[server] room %d is empty, destroying\n", room_id);
-            Rooms_Destroy(rooms, room_count, room_id);
-        } else {
-            /* Broadcast room_peers to remaining members. */
-            cJSON *root  = cJSON_CreateObject();
-            cJSON_AddStringToObject(root, "type", MSG_ROOM_PEERS);
-            cJSON *peers = cJSON_AddArrayToObject(root, "peers");
-            for (int i = 0; i < user_count; i++) {
-                if (users[i].fd != -1 && users[i].room_id == room_id) {
-                    cJSON *peer = cJSON_CreateObject();
-                    cJSON_AddStringToObject(peer, "username",
-                                            users[i].username);
-                    cJSON_AddStringToObject(peer, "ip", users[i].ip);
-                    cJSON_AddItemToArray(peers, peer);
-                }
-            }
-            char *s = cJSON_PrintUnformatted(root);
-            cJSON_Delete(root);
-            if (s) {
-                for (int i = 0; i < user_count; i++) {
-                    if (users[i].fd != -1 && users[i].room_id == room_id) {
-                        uint32_t frame_len = 0;
-                        uint8_t *frame = Protocol_Frame(s, &frame_len);
-                        if (frame) {
-                            uint32_t sent = 0;
-                            while (sent < frame_len) {
-                                int n = send(users[i].fd,
-                                             (const char *)(frame + sent),
-                                             (int)(frame_len - sent), 0);
-                                if (n <= 0) break;
-                                sent += (uint32_t)n;
-                            }
-                            free(frame);
-                        }
-                    }
-                }
-                free(s);
-            }
+        Profiler_Enter(MET_PHASE_SEND, user->fd, NULL);
+        if (t->flush(t->ctx, user->fd, &user->sendq) != 0) {
+            DisconnectUser(srv, user);
         }
     }
-
-    CLOSE_SOCKET(user->fd);
-    Users_FreeSlot(user);
 }
 
 /* ================================================================== */
 /*  Public API                                                         */
 /* ================================================================== */
 
-int Server_Init(Server *srv, int port)
+void Server_InitTransport(Server *srv, const Transport *transport)
 {
-    if (srv == NULL) return -1;
-
     memset(srv, 0, sizeof(*srv));
-    srv->port      = port;
-    srv->listen_fd = -1;
+    srv->transport = transport;
 
+    JsonMem_Init();
     Users_Init(srv->users, MAX_USERS);
     Rooms_Init(srv->rooms, MAX_ROOMS);
+    Match_Init();
+    Channels_Init();
+    Presence_Init();
+    Profiler_Init(0);
+}
 
-#ifdef _WIN32
-    WSADATA wsa;
-    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
-        printf("[server] WSAStartup failed\n");
-        return -1;
-    }
-#endif
+/* ------------------------------------------------------------------ */
 
-    /* Create listening socket. */
-    srv->listen_fd = (int)socket(AF_INET, SOCK_STREAM, 0);
-    if (srv->listen_fd < 0) {
-        printf("[server] socket() failed\n");
-        return -1;
-    }
+int Server_Init(Server *srv, int port)
+{
+    static Transport tcp;
 
-    /* Allow address reuse. */
-    int opt = 1;
-#ifdef _WIN32
-    setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR,
-               (const char *)&opt, sizeof(opt));
-#else
-    setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR,
-               &opt, sizeof(opt));
-#endif
-
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family      = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port        = htons((uint16_t)port);
-
-    if (bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        printf("[server] bind() failed on port %d\n", port);
-        CLOSE_SOCKET(srv->listen_fd);
-        srv->listen_fd = -1;
-        return -1;
+    if (srv == NULL) return -1;
+    if (Transport_OpenTcp(&tcp, port) != 0) return -1;
+
+    Server_InitTransport(srv, &tcp);
+    srv->port = port;
+
+    /* Game-session relay on the next port, on its own threads. */
+    if (port < 65535) {
+        Relay_Start(port + 1);
     }
 
-    if (listen(srv->listen_fd, 16) < 0) {
-        printf("[server] listen() failed\n");
-        CLOSE_SOCKET(srv->listen_fd);
-        srv->listen_fd = -1;
-        return -1;
+    /* Map store two ports up, also on its own thread. */
+    if (port < 65534) {
+        Mapstore_Start(port + 2, MAPSTORE_DIR);
     }
 
+    /* Operator queries over a Unix socket named after the port. */
+    char admin_path[64];
+    snprintf(admin_path, sizeof(admin_path), ADMIN_PATH_FMT, port);
+    Admin_Open(admin_path);
+
+    /* Stats page for lobby-top and monitoring agents. */
+    Stats_Open(port);
+
     return 0;
 }
 
 /* ------------------------------------------------------------------ */
 
-void Server_Run(Server *srv)
+int Server_EnableMetrics(Server *srv, int port)
 {
-    if (srv == NULL || srv->listen_fd < 0) return;
+    if (srv == NULL || Exporter_Open(port) != 0) return -1;
+    srv->metrics_port = port;
+    return 0;
+}
 
-    printf("[server] entering main event loop\n");
+/* ------------------------------------------------------------------ */
 
-    while (1) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(srv->listen_fd, &readfds);
+int Server_Poll(Server *srv, uint32_t max_wait_ms)
+{
+    const Transport *t = srv->transport;
 
-        int max_fd = srv->listen_fd;
+    if (Trace_DumpRequested()) Trace_Dump("SIGUSR1");
 
-        for (int i = 0; i < MAX_USERS; i++) {
-            if (srv->users[i].fd != -1) {
-                FD_SET(srv->users[i].fd, &readfds);
-                if (srv->users[i].fd > max_fd) {
-                    max_fd = srv->users[i].fd;
-                }
-            }
+    uint32_t wait_ms = srv->busy ? 0 : max_wait_ms;
+
+    /* Idle, still wake up when the stats page is due. */
+    if (wait_ms > 0 && Stats_Enabled()) {
+        uint64_t now_us = Clock_NowUs();
+        uint64_t due_us = srv->stats_next_us > now_us
+                        ? srv->stats_next_us - now_us : 0;
+        if (due_us < (uint64_t)wait_ms * 1000u) {
+            wait_ms = (uint32_t)((due_us + 999u) / 1000u);
         }
+    }
 
-        struct timeval tv;
-        tv.tv_sec  = 1;
-        tv.tv_usec = 0;
-
-        int ready = select(max_fd + 1, &readfds, NULL, NULL, &tv);
-        if (ready < 0) {
-#ifdef _WIN32
-            int err = WSAGetLastError();
-            if (err == WSAEINTR) continue;
-#else
-            if (errno == EINTR) continue;
-#endif
-            printf("[server] select() error\n");
-            break;
+    Profiler_Begin(wait_ms);
+    if (t->wait(t->ctx, srv, wait_ms) != 0) return -1;
+
+    /* ---- Accept a new connection ---- */
+    char ip[MAX_IP_STR];
+    int  conn = t->accept(t->ctx, ip);
+    if (conn >= 0) {
+        Profiler_Enter(MET_PHASE_ACCEPT, -1, NULL);
+        User *slot = Users_AllocSlot(srv->users, MAX_USERS);
+        if (slot == NULL) {
+            LOG_LIMITED(LOG_LEVEL_WARN, 5,
+                        "[server] no user slots available, rejecting");
+            t->close(t->ctx, conn);
+            Metrics_Add(MET_CONN_REJECTED, 1);
+        } else {
+            Metrics_Add(MET_CONN_ACCEPTED, 1);
+            TRACE_ACCEPT(conn);
+
+            slot->fd             = conn;
+            slot->room_id        = -1;
+            slot->connected      = Clock_Wall();
+            slot->last_heartbeat = slot->connected;
+            slot->recv_len       = 0;
+            slot->username[0]    = '\0';
+            memcpy(slot->ip, ip, MAX_IP_STR);
+
+            LOG_INFO("[server] new connection from %s (fd %d)",
+                     slot->ip, slot->fd);
         }
+    }
 
-        /* ---- Accept new connections ---- */
-        if (ready > 0 && FD_ISSET(srv->listen_fd, &readfds)) {
-            struct sockaddr_in client_addr;
-            socklen_t addr_len = sizeof(client_addr);
-            int client_fd = (int)accept(srv->listen_fd,
-                                        (struct sockaddr *)&client_addr,
-                                        &addr_len);
-            if (client_fd >= 0) {
-                User *slot = Users_AllocSlot(srv->users, MAX_USERS);
-                if (slot == NULL) {
-                    printf("[server] no user slots available, rejecting\n");
-                    CLOSE_SOCKET(client_fd);
-                } else {
-                    slot->fd             = client_fd;
-                    slot->room_id        = -1;
-                    slot->last_heartbeat = time(NULL);
-                    slot->recv_len       = 0;
-                    slot->username[0]    = '\0';
-
-                    /* Store client IP from accept(). */
-                    inet_ntop(AF_INET, &client_addr.sin_addr,
-                              slot->ip, MAX_IP_STR);
-
-                    printf("[server] new connection from %s (fd %d)\n",
-                           slot->ip, slot->fd);
-                }
-            }
+    /* ---- The transport's own sockets (UDP, metrics, admin) ---- */
+    if (t->service) t->service(t->ctx, srv);
+
+    /* ---- Handle readable client connections ---- */
+    for (int i = 0; i < MAX_USERS; i++) {
+        if (srv->users[i].fd == -1) continue;
+        if (!t->readable(t->ctx, srv->users[i].fd)) continue;
+
+        User *user = &srv->users[i];
+        int space  = (int)(MAX_MSG_SIZE - user->recv_len);
+        if (space <= 0) {
+            /* Buffer full with no complete message – protocol error. */
+            LOG_WARN("[server] recv buffer overflow for fd %d", user->fd);
+            DisconnectUser(srv, user);
+            continue;
         }
 
-        /* ---- Handle readable client sockets ---- */
-        for (int i = 0; i < MAX_USERS; i++) {
-            if (srv->users[i].fd == -1) continue;
-            if (!FD_ISSET(srv->users[i].fd, &readfds)) continue;
-
-            User *user = &srv->users[i];
-            int space  = (int)(MAX_MSG_SIZE - user->recv_len);
-            if (space <= 0) {
-                /* Buffer full with no complete message – protocol error. */
-                printf("[server] recv buffer overflow for fd %d\n", user->fd);
-                DisconnectUser(user, srv->users, MAX_USERS,
-                               srv->rooms, MAX_ROOMS);
-                continue;
-            }
+        Profiler_Enter(MET_PHASE_RECV, user->fd, NULL);
+        int n = t->recv(t->ctx, user->fd, user->recv_buf + user->recv_len,
+                        (uint32_t)space);
+        if (n == TRANSPORT_AGAIN) continue;
+        if (n <= 0) {
+            /* Connection closed or error. */
+            DisconnectUser(srv, user);
+            continue;
+        }
 
-            int n = recv(user->fd,
-                         (char *)(user->recv_buf + user->recv_len),
-                         space, 0);
-            if (n <= 0) {
-                /* Connection closed or error. */
-                DisconnectUser(user, srv->users, MAX_USERS,
-                               srv->rooms, MAX_ROOMS);
-                continue;
-            }
+        user->recv_len += (uint32_t)n;
+        Metrics_Add(MET_BYTES_IN, (uint64_t)n);
+        user->bytes_in += (uint64_t)n;
+        TRACE_RECV(user->fd, n);
+
+        /* Extract and process complete messages, in place. */
+        while (1) {
+            const char *json;
+            uint32_t    json_len;
+            Profiler_Enter(MET_PHASE_PARSE, user->fd, NULL);
+            uint32_t consumed = Protocol_Peek(user->recv_buf,
+                                              user->recv_len,
+                                              &json, &json_len);
+            if (consumed == 0) break;
+
+            user->msgs_in++;
+            srv->msgs_in++;
+            Handler_ProcessMessage(json, json_len, user,
+                                   srv->rooms, MAX_ROOMS);
 
-            user->recv_len += (uint32_t)n;
-
-            /* Extract and process complete messages. */
-            while (1) {
-                char *json_str = NULL;
-                uint32_t consumed = Protocol_Extract(user->recv_buf,
-                                                     user->recv_len,
-                                                     &json_str);
-                if (consumed == 0) break;
-
-                Handler_ProcessMessage(json_str, user,
-                                       srv->users, MAX_USERS,
-                                       srv->rooms, MAX_ROOMS);
-                free(json_str);
-
-                /* Shift remaining data to the front of the buffer. */
-                uint32_t remaining = user->recv_len - consumed;
-                if (remaining > 0) {
-                    memmove(user->recv_buf,
-                            user->recv_buf + consumed,
-                            remaining);
-                }
-                user->recv_len = remaining;
-
-                /* Safety: if user was disconnected during processing,
-                 * stop processing further messages. */
-                if (user->fd == -1) break;
+            /* Shift remaining data to the front of the buffer. */
+            uint32_t remaining = user->recv_len - consumed;
+            if (remaining > 0) {
+                memmove(user->recv_buf,
+                        user->recv_buf + consumed,
+                        remaining);
             }
+            user->recv_len = remaining;
+
+            /* Safety: if user was disconnected during processing,
+             * stop processing further messages. */
+            if (user->fd == -1) break;
         }
+    }
 
-        /* ---- Heartbeat timeout check ---- */
-        {
-            time_t now = time(NULL);
-            for (int i = 0; i < MAX_USERS; i++) {
-                if (srv->users[i].fd == -1) continue;
-                if (now - srv->users[i].last_heartbeat > HEARTBEAT_TIMEOUT) {
-                    printf("[server] heartbeat timeout for '%s' (fd %d)\n",
-                           srv->users[i].username[0]
-                               ? srv->users[i].username : "(no name)",
-                           srv->users[i].fd);
-                    DisconnectUser(&srv->users[i], srv->users, MAX_USERS,
-                                   srv->rooms, MAX_ROOMS);
-                }
+    /* ---- Heartbeat timeout check ---- */
+    Profiler_Enter(MET_PHASE_TIMERS, -1, NULL);
+    {
+        time_t now = Clock_Wall();
+        for (int i = 0; i < MAX_USERS; i++) {
+            if (srv->users[i].fd == -1) continue;
+            if (now - srv->users[i].last_heartbeat > HEARTBEAT_TIMEOUT) {
+                LOG_INFO("[server] heartbeat timeout for '%s' (fd %d)",
+                         srv->users[i].username[0]
+                             ? srv->users[i].username : "(no name)",
+                         srv->users[i].fd);
+                DisconnectUser(srv, &srv->users[i]);
             }
         }
     }
+
+    /* ---- Timer-driven work (matchmaking, presence, channels) ---- */
+    srv->busy = Handler_Tick(Clock_Wall(), srv->users, MAX_USERS,
+                             srv->rooms, MAX_ROOMS);
+
+    /* ---- Flush queued replies and broadcasts ---- */
+    FlushAll(srv);
+
+    /* ---- Shared stats page ---- */
+    Profiler_Enter(MET_PHASE_TIMERS, -1, NULL);
+    PublishStats(srv);
+
+    Profiler_End();
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+
+void Server_Run(Server *srv)
+{
+    if (srv == NULL || srv->transport == NULL) return;
+
+    LOG_INFO("[server] entering main event loop");
+
+    Trace_InstallSignal();
+    while (Server_Poll(srv, 1000) == 0) {
+    }
 }
 
 /* ------------------------------------------------------------------ */
 
 void Server_Shutdown(Server *srv)
 {
-    if (srv == NULL) return;
+    if (srv == NULL || srv->transport == NULL) return;
+
+    const Transport *t = srv->transport;
 
-    printf("[server] shutting down\n");
+    LOG_INFO("[server] shutting down");
 
     /* Close all client connections. */
     for (int i = 0; i < MAX_USERS; i++) {
         if (srv->users[i].fd != -1) {
-            CLOSE_SOCKET(srv->users[i].fd);
+            t->close(t->ctx, srv->users[i].fd);
             Users_FreeSlot(&srv->users[i]);
         }
     }
 
-    /* Close listening socket. */
-    if (srv->listen_fd >= 0) {
-        CLOSE_SOCKET(srv->listen_fd);
-        srv->listen_fd = -1;
-    }
+    /* Stop the relay and map store threads. */
+    Relay_Stop();
+    Mapstore_Stop();
+
+    Exporter_Close();
+    Admin_Close();
+    Stats_Close();
 
-#ifdef _WIN32
-    WSACleanup();
-#endif
+    /* Listener, reflector and anything else the transport opened. */
+    if (t->shutdown) t->shutdown(t->ctx);
+    srv->transport = NULL;
 }
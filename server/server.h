@@ -1,5 +1,10 @@
 /*
- * server.h – TCP server core for War3 Lobby Server.
+ * server.h – Server core for War3 Lobby Server.
+ *
+ * The core owns the user and room tables and runs one event-loop
+ * iteration per Server_Poll; connection I/O goes through a Transport
+ * (transport.h), so the same loop serves TCP clients or a simulated
+ * network (sim.h).
  */
 
 #ifndef SERVER_H
@@ -7,21 +12,52 @@
 
 #include "user.h"
 #include "room.h"
+#include "transport.h"
 
-typedef struct {
-    int listen_fd;
-    int port;
+typedef struct Server {
+    const Transport *transport;
+    int port;                    /* 0 for a simulated network */
+    int metrics_port;            /* Prometheus endpoint, 0 if off */
+    int busy;                    /* tick work left: poll without waiting */
+    uint64_t msgs_in;            /* lobby messages received, all users */
+    uint64_t stats_next_us;      /* next stats page publish */
     User users[MAX_USERS];
     Room rooms[MAX_ROOMS];
 } Server;
 
-/* Initialise the server: create listening socket, bind, listen. */
+/*
+ * Initialise the server on TCP `port`: listening socket and reflector,
+ * relay and map store threads, admin socket and stats page.
+ */
 int Server_Init(Server *srv, int port);
 
-/* Main event loop (blocking).  Uses select() for multiplexing. */
+/*
+ * Initialise only the lobby core over `transport`, which must outlive
+ * the server: tables, matchmaking, channels, presence.  No sockets,
+ * threads or files are opened.
+ */
+void Server_InitTransport(Server *srv, const Transport *transport);
+
+/* Serve Prometheus metrics on `port` from the event loop (exporter.h).
+ * Returns 0 on success, -1 if the port cannot be opened. */
+int Server_EnableMetrics(Server *srv, int port);
+
+/*
+ * Run one event-loop iteration: wait up to `max_wait_ms` for activity
+ * (less when timers or tick work are due), accept, read and dispatch
+ * messages, expire heartbeats, run Handler_Tick and flush replies.
+ * Returns 0, or -1 if the transport failed.
+ */
+int Server_Poll(Server *srv, uint32_t max_wait_ms);
+
+/* Main event loop (blocking): Server_Poll until the transport fails. */
 void Server_Run(Server *srv);
 
-/* Graceful shutdown: close all connections and the listening socket. */
+/* Exporter callback: set the table gauges before a scrape.  `srv` is
+ * the Server. */
+void Server_RefreshGauges(void *srv);
+
+/* Graceful shutdown: close all connections and the transport. */
 void Server_Shutdown(Server *srv);
 
 #endif /* SERVER_H */
@@ -0,0 +1,125 @@
+/*
+ * sha1.c – SHA-1 (FIPS 180-4) implementation.
+ */
+
+#include "sha1.h"
+
+#include <string.h>
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* ------------------------------------------------------------------ */
+/*  Compression                                                       */
+/* ------------------------------------------------------------------ */
+
+static void Transform(uint32_t h[5], const uint8_t block[64])
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) |
+               ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) |
+                (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = ROL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL(b, 30);
+        b = a;
+        a = t;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+void Sha1_Init(Sha1Ctx *ctx)
+{
+    ctx->h[0]   = 0x67452301;
+    ctx->h[1]   = 0xEFCDAB89;
+    ctx->h[2]   = 0x98BADCFE;
+    ctx->h[3]   = 0x10325476;
+    ctx->h[4]   = 0xC3D2E1F0;
+    ctx->length = 0;
+    ctx->used   = 0;
+}
+
+void Sha1_Update(Sha1Ctx *ctx, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    ctx->length += len;
+
+    while (len > 0) {
+        size_t n = 64 - (size_t)ctx->used;
+        if (n > len) n = len;
+        memcpy(ctx->block + ctx->used, p, n);
+        ctx->used += (int)n;
+        p   += n;
+        len -= n;
+        if (ctx->used == 64) {
+            Transform(ctx->h, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+void Sha1_Final(Sha1Ctx *ctx, uint8_t digest[SHA1_DIGEST_SIZE])
+{
+    uint64_t bits = ctx->length * 8;
+    uint8_t  pad  = 0x80;
+    Sha1_Update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != 56) {
+        Sha1_Update(ctx, &pad, 1);
+    }
+
+    uint8_t len_be[8];
+    for (int i = 0; i < 8; i++) {
+        len_be[i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    Sha1_Update(ctx, len_be, 8);
+
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4]     = (uint8_t)(ctx->h[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx->h[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->h[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx->h[i];
+    }
+}
+
+void Sha1_Hex(const uint8_t digest[SHA1_DIGEST_SIZE], char out[41])
+{
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < SHA1_DIGEST_SIZE; i++) {
+        out[i * 2]     = hex[digest[i] >> 4];
+        out[i * 2 + 1] = hex[digest[i] & 15];
+    }
+    out[40] = '\0';
+}
@@ -0,0 +1,30 @@
+/*
+ * sha1.h – SHA-1 for War3 Lobby Server.
+ *
+ * Only used to name stored maps by content (mapstore.h), not for
+ * anything security-sensitive.
+ */
+
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA1_DIGEST_SIZE 20
+
+typedef struct {
+    uint32_t h[5];
+    uint64_t length;              /* bytes hashed so far */
+    uint8_t  block[64];
+    int      used;                /* bytes waiting in block */
+} Sha1Ctx;
+
+void Sha1_Init(Sha1Ctx *ctx);
+void Sha1_Update(Sha1Ctx *ctx, const void *data, size_t len);
+void Sha1_Final(Sha1Ctx *ctx, uint8_t digest[SHA1_DIGEST_SIZE]);
+
+/* Lower-case hex of a digest into `out` (41 bytes with the NUL). */
+void Sha1_Hex(const uint8_t digest[SHA1_DIGEST_SIZE], char out[41]);
+
+#endif /* SHA1_H */
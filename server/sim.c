@@ -0,0 +1,489 @@
+/*
+ * sim.c – Simulated network and clock (see sim.h).
+ */
+
+#include "sim.h"
+#include "server.h"
+#include "clock.h"
+#include "../common/protocol.h"
+#include "../common/alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#   define LOAD64(p)      (*(volatile uint64_t *)(p))
+#   define STORE64(p, v)  (*(volatile uint64_t *)(p) = (v))
+#else
+#   define LOAD64(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#   define STORE64(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+/* One direction of a connection.  Bytes [head, ready) have arrived and
+ * are unread, [ready, len) are still on the wire. */
+typedef struct {
+    uint8_t  *data;
+    uint32_t  head;
+    uint32_t  ready;
+    uint32_t  len;
+    uint32_t  cap;
+    int       eof;               /* the writer's close has arrived */
+} Pipe;
+
+typedef struct {
+    Pipe    up;                  /* client → server */
+    Pipe    down;                /* server → client */
+    char    ip[MAX_IP_STR];
+    uint8_t client_open;
+    uint8_t server_open;         /* accepted and not yet closed */
+    uint8_t server_closed;
+    uint8_t listed;              /* on the readable list */
+} SimConn;
+
+typedef enum {
+    EV_CONNECT,
+    EV_UP,                       /* `bytes` reach the server */
+    EV_DOWN,                     /* `bytes` reach the client */
+    EV_UP_EOF,
+    EV_DOWN_EOF
+} EventKind;
+
+typedef struct {
+    uint64_t at_us;
+    uint32_t conn;
+    uint32_t kind;
+    uint32_t bytes;
+} Event;
+
+/* Growable FIFO of uint32_t or Event, indices wrap at cap. */
+typedef struct {
+    void     *items;
+    uint32_t  head;
+    uint32_t  count;
+    uint32_t  cap;
+} Ring;
+
+static uint64_t  s_now_us;
+static uint64_t  s_wake_us;
+static uint32_t  s_latency_us;
+static int       s_up_pending;   /* server-side input since the last wait */
+
+static SimConn  *s_conns;
+static uint32_t  s_nconns;
+static uint32_t  s_conns_cap;
+
+static Ring      s_events;       /* Event, in delivery order */
+static Ring      s_accepts;      /* uint32_t conn, waiting for accept */
+static Ring      s_readable;     /* uint32_t conn, for Sim_NextReadable */
+
+static SimStats  s_stats;
+
+/* ------------------------------------------------------------------ */
+/*  Containers                                                        */
+/* ------------------------------------------------------------------ */
+
+static void *RingSlot(Ring *r, uint32_t i, size_t size)
+{
+    return (uint8_t *)r->items + (size_t)((r->head + i) % r->cap) * size;
+}
+
+static void RingPush(Ring *r, const void *item, size_t size)
+{
+    if (r->count == r->cap) {
+        uint32_t cap   = r->cap ? r->cap * 2 : 256;
+        uint8_t *items = (uint8_t *)Alloc_Malloc(ALLOC_SIM, cap * size);
+        if (items == NULL) abort();
+        for (uint32_t i = 0; i < r->count; i++)
+            memcpy(items + i * size, RingSlot(r, i, size), size);
+        Alloc_Free(r->items);
+        r->items = items;
+        r->head  = 0;
+        r->cap   = cap;
+    }
+    memcpy(RingSlot(r, r->count, size), item, size);
+    r->count++;
+}
+
+static void RingPop(Ring *r, void *item, size_t size)
+{
+    memcpy(item, RingSlot(r, 0, size), size);
+    r->head = (r->head + 1) % r->cap;
+    r->count--;
+}
+
+static void RingFree(Ring *r)
+{
+    Alloc_Free(r->items);
+    memset(r, 0, sizeof(*r));
+}
+
+static int PipeAppend(Pipe *p, const uint8_t *data, uint32_t n)
+{
+    if (p->len + n > p->cap && p->head > 0) {
+        memmove(p->data, p->data + p->head, p->len - p->head);
+        p->ready -= p->head;
+        p->len   -= p->head;
+        p->head   = 0;
+    }
+    if (p->len + n > p->cap) {
+        uint32_t cap = p->cap ? p->cap : 1024;
+        while (cap < p->len + n) cap *= 2;
+        uint8_t *grown = (uint8_t *)Alloc_Realloc(ALLOC_SIM, p->data, cap);
+        if (grown == NULL) return -1;
+        p->data = grown;
+        p->cap  = cap;
+    }
+    memcpy(p->data + p->len, data, n);
+    p->len += n;
+    return 0;
+}
+
+static void PipeFree(Pipe *p)
+{
+    Alloc_Free(p->data);
+    p->data = NULL;
+    p->head = p->ready = p->len = p->cap = 0;
+}
+
+/* Bytes the receiver has not read yet, arrived or not. */
+static uint32_t PipeUnread(const Pipe *p)
+{
+    return p->len - p->head;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Events                                                            */
+/* ------------------------------------------------------------------ */
+
+static void Schedule(uint32_t conn, EventKind kind, uint32_t bytes)
+{
+    Event ev = { s_now_us + s_latency_us, conn, (uint32_t)kind, bytes };
+    RingPush(&s_events, &ev, sizeof(ev));
+}
+
+static void ListReadable(uint32_t conn)
+{
+    if (s_conns[conn].listed) return;
+    s_conns[conn].listed = 1;
+    RingPush(&s_readable, &conn, sizeof(conn));
+}
+
+/* Both ends are done with it: drop the buffers, keep the id. */
+static void MaybeRelease(SimConn *c)
+{
+    if (c->client_open || !c->server_closed) return;
+    PipeFree(&c->up);
+    PipeFree(&c->down);
+}
+
+/* Deliver every event due at or before now. */
+static void Deliver(void)
+{
+    while (s_events.count > 0) {
+        const Event *next = (const Event *)RingSlot(&s_events, 0,
+                                                    sizeof(Event));
+        if (next->at_us > s_now_us) break;
+
+        Event ev;
+        RingPop(&s_events, &ev, sizeof(ev));
+        s_stats.deliveries++;
+
+        SimConn *c = &s_conns[ev.conn];
+        switch ((EventKind)ev.kind) {
+        case EV_CONNECT:
+            RingPush(&s_accepts, &ev.conn, sizeof(ev.conn));
+            break;
+        case EV_UP:
+            if (!c->server_closed) {
+                c->up.ready += ev.bytes;
+                s_stats.bytes_up += ev.bytes;
+                s_up_pending = 1;
+            }
+            break;
+        case EV_UP_EOF:
+            c->up.eof = 1;
+            s_up_pending = 1;
+            break;
+        case EV_DOWN:
+            if (c->client_open) {
+                c->down.ready += ev.bytes;
+                s_stats.bytes_down += ev.bytes;
+                ListReadable(ev.conn);
+            }
+            break;
+        case EV_DOWN_EOF:
+            c->down.eof = 1;
+            if (c->client_open) ListReadable(ev.conn);
+            break;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Transport                                                         */
+/* ------------------------------------------------------------------ */
+
+static SimConn *ServerConn(int conn)
+{
+    return &s_conns[conn - SIM_FD_BASE];
+}
+
+static int SimReadable(void *ctx, int conn)
+{
+    (void)ctx;
+    const SimConn *c = ServerConn(conn);
+    return c->up.ready > c->up.head || c->up.eof;
+}
+
+/* Is anything waiting for the server or the driver right now?  Input
+ * the server has not read is tracked by s_up_pending rather than by
+ * scanning every connection: each iteration reads all readable users,
+ * and SimRecv sets it again if it left bytes behind. */
+static int WorkPending(void)
+{
+    return s_accepts.count > 0 || s_readable.count > 0 ||
+           s_wake_us <= s_now_us || s_up_pending;
+}
+
+static int SimWait(void *ctx, Server *srv, uint32_t timeout_ms)
+{
+    (void)ctx;
+    (void)srv;
+
+    Deliver();
+    if (timeout_ms == 0 || WorkPending()) {
+        s_up_pending = 0;
+        return 0;
+    }
+
+    uint64_t limit = s_now_us + (uint64_t)timeout_ms * 1000u;
+    uint64_t until = limit;
+    if (s_wake_us < until) until = s_wake_us;
+    if (s_events.count > 0) {
+        const Event *next = (const Event *)RingSlot(&s_events, 0,
+                                                    sizeof(Event));
+        if (next->at_us < until) until = next->at_us;
+    }
+
+    /* Whole ticks: everything due within one is handled in one pass. */
+    until = (until + SIM_TICK_US - 1) / SIM_TICK_US * SIM_TICK_US;
+    if (until > limit) until = limit;
+
+    STORE64(&s_now_us, until);
+    Deliver();
+    s_up_pending = 0;
+    return 0;
+}
+
+static int SimAccept(void *ctx, char ip[MAX_IP_STR])
+{
+    (void)ctx;
+    if (s_accepts.count == 0) return -1;
+
+    uint32_t conn;
+    RingPop(&s_accepts, &conn, sizeof(conn));
+    s_conns[conn].server_open = 1;
+    memcpy(ip, s_conns[conn].ip, MAX_IP_STR);
+    return SIM_FD_BASE + (int)conn;
+}
+
+static int SimRecv(void *ctx, int conn, uint8_t *buf, uint32_t len)
+{
+    (void)ctx;
+    Pipe *p = &ServerConn(conn)->up;
+
+    uint32_t n = p->ready - p->head;
+    if (n == 0) return p->eof ? 0 : TRANSPORT_AGAIN;
+    if (n > len) n = len;
+
+    memcpy(buf, p->data + p->head, n);
+    p->head += n;
+    if (p->head < p->ready) s_up_pending = 1;
+    return (int)n;
+}
+
+static int SimWrite(void *ctx, const uint8_t *data, uint32_t len)
+{
+    uint32_t conn = (uint32_t)(uintptr_t)ctx;
+    SimConn *c    = &s_conns[conn];
+
+    /* The client has gone; its end of stream is on the way. */
+    if (!c->client_open) return (int)len;
+
+    uint32_t room = SIM_WINDOW - PipeUnread(&c->down);
+    if (room == 0) {
+        s_stats.window_full++;
+        return 0;
+    }
+    if (len > room) len = room;
+    if (PipeAppend(&c->down, data, len) != 0) return -1;
+
+    Schedule(conn, EV_DOWN, len);
+    return (int)len;
+}
+
+static int SimFlush(void *ctx, int conn, SendQ *q)
+{
+    (void)ctx;
+    uintptr_t idx = (uintptr_t)(conn - SIM_FD_BASE);
+    return SendQ_FlushTo(q, SimWrite, (void *)idx);
+}
+
+static void SimClose(void *ctx, int conn)
+{
+    (void)ctx;
+    SimConn *c = ServerConn(conn);
+
+    c->server_open   = 0;
+    c->server_closed = 1;
+    Schedule((uint32_t)(conn - SIM_FD_BASE), EV_DOWN_EOF, 0);
+    PipeFree(&c->up);
+    MaybeRelease(c);
+}
+
+static uint64_t SimClock(void *ctx)
+{
+    (void)ctx;
+    return LOAD64(&s_now_us);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+void Sim_Init(Transport *t, uint64_t start_us, uint32_t latency_us)
+{
+    Sim_Shutdown();
+
+    s_now_us     = start_us;
+    s_wake_us    = UINT64_MAX;
+    s_up_pending = 0;
+    s_latency_us = latency_us;
+    Clock_SetSource(SimClock, NULL);
+
+    memset(t, 0, sizeof(*t));
+    t->wait     = SimWait;
+    t->accept   = SimAccept;
+    t->readable = SimReadable;
+    t->recv     = SimRecv;
+    t->flush    = SimFlush;
+    t->close    = SimClose;
+}
+
+void Sim_Shutdown(void)
+{
+    for (uint32_t i = 0; i < s_nconns; i++) {
+        PipeFree(&s_conns[i].up);
+        PipeFree(&s_conns[i].down);
+    }
+    Alloc_Free(s_conns);
+    s_conns     = NULL;
+    s_nconns    = 0;
+    s_conns_cap = 0;
+
+    RingFree(&s_events);
+    RingFree(&s_accepts);
+    RingFree(&s_readable);
+    memset(&s_stats, 0, sizeof(s_stats));
+    Clock_SetSource(NULL, NULL);
+}
+
+uint64_t Sim_NowUs(void)
+{
+    return s_now_us;
+}
+
+void Sim_WakeAt(uint64_t at_us)
+{
+    s_wake_us = at_us;
+}
+
+int Sim_Connect(const char *ip)
+{
+    if (s_nconns == s_conns_cap) {
+        uint32_t cap = s_conns_cap ? s_conns_cap * 2 : 1024;
+        SimConn *grown = (SimConn *)Alloc_Realloc(ALLOC_SIM, s_conns,
+                                                  cap * sizeof(SimConn));
+        if (grown == NULL) return -1;
+        s_conns     = grown;
+        s_conns_cap = cap;
+    }
+
+    uint32_t conn = s_nconns++;
+    SimConn *c    = &s_conns[conn];
+    memset(c, 0, sizeof(*c));
+    strncpy(c->ip, ip, MAX_IP_STR - 1);
+    c->client_open = 1;
+
+    s_stats.connects++;
+    Schedule(conn, EV_CONNECT, 0);
+    return (int)conn;
+}
+
+int Sim_Send(int client, const char *json)
+{
+    SimConn *c = &s_conns[client];
+    if (!c->client_open || c->server_closed) return -1;
+
+    uint32_t len;
+    uint8_t *frame = Protocol_Frame(json, &len);
+    if (frame == NULL) return -1;
+
+    int rc = -1;
+    if (PipeUnread(&c->up) + len > SIM_WINDOW) {
+        s_stats.window_full++;
+    } else if (PipeAppend(&c->up, frame, len) == 0) {
+        Schedule((uint32_t)client, EV_UP, len);
+        rc = 0;
+    }
+    Alloc_Free(frame);
+    return rc;
+}
+
+int Sim_Recv(int client, const char **json, uint32_t *json_len)
+{
+    SimConn *c = &s_conns[client];
+    if (!c->client_open) return -1;
+
+    Pipe *p = &c->down;
+    uint32_t used = Protocol_Peek(p->data + p->head, p->ready - p->head,
+                                  json, json_len);
+    if (used > 0) {
+        p->head += used;
+        return 1;
+    }
+    if (p->eof && p->head == p->ready) {
+        /* Everything read: the client side is finished too. */
+        c->client_open = 0;
+        MaybeRelease(c);
+        return -1;
+    }
+    return 0;
+}
+
+void Sim_Close(int client)
+{
+    SimConn *c = &s_conns[client];
+    if (!c->client_open) return;
+
+    c->client_open = 0;
+    Schedule((uint32_t)client, EV_UP_EOF, 0);
+    PipeFree(&c->down);
+    MaybeRelease(c);
+}
+
+int Sim_NextReadable(void)
+{
+    while (s_readable.count > 0) {
+        uint32_t conn;
+        RingPop(&s_readable, &conn, sizeof(conn));
+        s_conns[conn].listed = 0;
+        if (s_conns[conn].client_open) return (int)conn;
+    }
+    return -1;
+}
+
+void Sim_GetStats(SimStats *out)
+{
+    *out = s_stats;
+}
@@ -0,0 +1,91 @@
+/*
+ * sim.h – Simulated network and clock for War3 Lobby Server.
+ *
+ * A Transport (transport.h) whose connections are in-memory byte
+ * streams, plus a virtual clock installed with Clock_SetSource.  A
+ * driver (tools/lobby-sim.c) plays the clients through the Sim_*
+ * client calls and runs the unchanged server core with Server_Poll;
+ * nothing touches the kernel or the real clock, so a run is exactly
+ * reproducible and an hour of lobby time takes as long as the work in
+ * it.
+ *
+ * Model: every byte, connect and close takes the same one-way latency
+ * to reach the other side, so deliveries happen in the order they were
+ * sent.  Each direction holds at most SIM_WINDOW bytes not yet read by
+ * the receiver, like a socket buffer: a client that stops reading
+ * backs up into the server's send queue.
+ *
+ * Time only moves inside the transport's wait, which jumps straight to
+ * the earliest of: the server's timeout, the next delivery, and the
+ * driver's next timer (Sim_WakeAt), rounded up to a whole SIM_TICK_US
+ * so that everything due within one tick is handled in one pass.  It
+ * does not move while the server or the driver has work waiting.
+ *
+ * Single-threaded: the driver and the server core share one thread.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include "transport.h"
+
+#include <stdint.h>
+
+#define SIM_WINDOW   (256 * 1024)   /* unread bytes per direction */
+#define SIM_FD_BASE  1000           /* server-side handle of client 0 */
+#define SIM_TICK_US  10000          /* time advances in whole ticks */
+
+typedef struct {
+    uint64_t connects;
+    uint64_t bytes_up;               /* client → server, delivered */
+    uint64_t bytes_down;             /* server → client, delivered */
+    uint64_t deliveries;             /* delivery events processed */
+    uint64_t window_full;            /* writes refused for a full window */
+} SimStats;
+
+/*
+ * Reset the network, start virtual time at `start_us` (microseconds
+ * since the Unix epoch) with one-way latency `latency_us`, install
+ * the virtual clock and fill `t`.  Call before Log_Init.
+ */
+void Sim_Init(Transport *t, uint64_t start_us, uint32_t latency_us);
+
+/* Free every connection and restore the system clock. */
+void Sim_Shutdown(void);
+
+/* Current virtual time, microseconds since the Unix epoch. */
+uint64_t Sim_NowUs(void);
+
+/* The next wait returns no later than `at_us`: the driver's next timer
+ * (UINT64_MAX for none). */
+void Sim_WakeAt(uint64_t at_us);
+
+/* ---- Client side ---------------------------------------------------- */
+
+/* Open a connection from `ip`; the server can accept it one latency
+ * from now.  Returns the client id (ids are never reused). */
+int  Sim_Connect(const char *ip);
+
+/* Frame and send one JSON message.  Returns 0, or -1 if the connection
+ * is closed or its window is full (the message is dropped). */
+int  Sim_Send(int client, const char *json);
+
+/*
+ * Take the next complete message that has arrived: 1 with *json /
+ * *json_len set (not NUL-terminated; valid until the next Sim_Recv or
+ * Server_Poll), 0 if none, -1 once the server has closed the
+ * connection and everything it sent has been read.
+ */
+int  Sim_Recv(int client, const char **json, uint32_t *json_len);
+
+/* Close from the client side; the server reads end of stream one
+ * latency from now. */
+void Sim_Close(int client);
+
+/* Next client that has had data or a close delivered since it was last
+ * returned, or -1 if none. */
+int  Sim_NextReadable(void);
+
+void Sim_GetStats(SimStats *out);
+
+#endif /* SIM_H */
@@ -0,0 +1,139 @@
+/*
+ * stats.c – Shared-memory stats page (see stats.h).
+ */
+
+#include "stats.h"
+#include "clock.h"
+#include "log.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+
+int  Stats_Open(int port) { (void)port; return -1; }
+void Stats_Close(void) {}
+int  Stats_Enabled(void) { return 0; }
+void Stats_Publish(const StatPage *snap, uint64_t loop_iterations)
+{
+    (void)snap; (void)loop_iterations;
+}
+
+#else  /* POSIX */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static StatPage *s_page;
+static char      s_name[64];
+
+/* Previous publish, for the rates. */
+static uint64_t  s_prev_us;
+static StatPage  s_prev;
+
+static uint64_t PerSec(uint64_t now_total, uint64_t prev_total,
+                       uint64_t elapsed_us)
+{
+    if (elapsed_us == 0 || now_total < prev_total) return 0;
+    return ((now_total - prev_total) * 1000000u + elapsed_us / 2) /
+           elapsed_us;
+}
+
+int Stats_Open(int port)
+{
+    snprintf(s_name, sizeof(s_name), STATPAGE_NAME_FMT, port);
+
+    /* Readable by everyone on the box, like the metrics endpoint: the
+     * page holds counts only, no addresses or names. */
+    int fd = shm_open(s_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_WARN("[stats] cannot create shared memory '%s'", s_name);
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(StatPage)) != 0) {
+        close(fd);
+        shm_unlink(s_name);
+        LOG_WARN("[stats] cannot size shared memory '%s'", s_name);
+        return -1;
+    }
+
+    void *p = mmap(NULL, sizeof(StatPage), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(s_name);
+        LOG_WARN("[stats] cannot map shared memory '%s'", s_name);
+        return -1;
+    }
+
+    s_page = (StatPage *)p;
+    memset(s_page, 0, sizeof(*s_page));
+    Statpage_BeginWrite(s_page);
+    s_page->magic        = STATPAGE_MAGIC;
+    s_page->version      = STATPAGE_VERSION;
+    s_page->size         = sizeof(StatPage);
+    s_page->pid          = (uint64_t)getpid();
+    s_page->started_unix = (uint64_t)time(NULL);
+    Statpage_EndWrite(s_page);
+
+    memset(&s_prev, 0, sizeof(s_prev));
+    s_prev_us = Clock_NowUs();
+
+    LOG_INFO("[stats] stats page at /dev/shm%s", s_name);
+    return 0;
+}
+
+void Stats_Close(void)
+{
+    if (s_page == NULL) return;
+    munmap(s_page, sizeof(StatPage));
+    shm_unlink(s_name);
+    s_page = NULL;
+}
+
+int Stats_Enabled(void)
+{
+    return s_page != NULL;
+}
+
+void Stats_Publish(const StatPage *snap, uint64_t loop_iterations)
+{
+    if (s_page == NULL) return;
+
+    uint64_t now_us  = Clock_NowUs();
+    uint64_t elapsed = now_us - s_prev_us;
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+
+    StatPage page = *snap;
+    page.pid             = s_page->pid;
+    page.started_unix    = s_page->started_unix;
+    page.updated_unix_ms = (uint64_t)ts.tv_sec * 1000u +
+                           (uint64_t)ts.tv_nsec / 1000000u;
+    page.interval_ms     = elapsed / 1000u;
+
+    page.msgs_in_per_sec   = PerSec(snap->msgs_in_total,
+                                    s_prev.msgs_in_total, elapsed);
+    page.bytes_in_per_sec  = PerSec(snap->bytes_in_total,
+                                    s_prev.bytes_in_total, elapsed);
+    page.bytes_out_per_sec = PerSec(snap->bytes_out_total,
+                                    s_prev.bytes_out_total, elapsed);
+    page.loop_per_sec      = PerSec(loop_iterations, 0, elapsed);
+
+    /* The header up to and including seq never changes after
+     * Stats_Open; copy everything after it. */
+    const size_t body = offsetof(StatPage, pid);
+    Statpage_BeginWrite(s_page);
+    memcpy((char *)s_page + body, (const char *)&page + body,
+           sizeof(StatPage) - body);
+    Statpage_EndWrite(s_page);
+
+    s_prev    = *snap;
+    s_prev_us = now_us;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,35 @@
+/*
+ * stats.h – Publishes the shared-memory stats page (common/statpage.h).
+ *
+ * The lobby thread fills a StatPage with what it knows (table counts,
+ * totals, queue depths, loop percentiles) every STATPAGE_INTERVAL_MS;
+ * this module works out the per-second rates and copies it into the
+ * shared object under the seqlock.  Nothing here ever blocks: the page
+ * is plain memory and readers never touch the server.
+ *
+ * POSIX shared memory only; on Windows Stats_Open fails and the rest
+ * does nothing.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "../common/statpage.h"
+
+/* Create /war3-lobby-<port>.  Returns 0 on success, -1 on failure. */
+int  Stats_Open(int port);
+
+/* Unmap and remove the page. */
+void Stats_Close(void);
+
+/* Is a page open? (Callers skip gathering otherwise.) */
+int  Stats_Enabled(void);
+
+/*
+ * Publish `snap`.  The caller fills the tables, totals, loop and queue
+ * fields and passes the loop iterations since the last publish; the
+ * header, timestamps and per-second rates are set here.
+ */
+void Stats_Publish(const StatPage *snap, uint64_t loop_iterations);
+
+#endif /* STATS_H */
@@ -0,0 +1,87 @@
+/*
+ * thread.c – Thread and mutex wrapper implementation.
+ */
+
+#include "thread.h"
+
+/* ------------------------------------------------------------------ */
+/*  Threads                                                           */
+/* ------------------------------------------------------------------ */
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadEntry(LPVOID param)
+{
+    Thread *t = (Thread *)param;
+    t->fn(t->arg);
+    return 0;
+}
+#else
+static void *ThreadEntry(void *param)
+{
+    Thread *t = (Thread *)param;
+    t->fn(t->arg);
+    return NULL;
+}
+#endif
+
+int Thread_Start(Thread *t, ThreadFn fn, void *arg)
+{
+    t->fn  = fn;
+    t->arg = arg;
+#ifdef _WIN32
+    t->handle = CreateThread(NULL, 0, ThreadEntry, t, 0, NULL);
+    return t->handle ? 0 : -1;
+#else
+    return pthread_create(&t->handle, NULL, ThreadEntry, t) == 0 ? 0 : -1;
+#endif
+}
+
+void Thread_Join(Thread *t)
+{
+#ifdef _WIN32
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+#else
+    pthread_join(t->handle, NULL);
+#endif
+}
+
+/* ------------------------------------------------------------------ */
+/*  Mutexes                                                           */
+/* ------------------------------------------------------------------ */
+
+void Mutex_Init(Mutex *m)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(&m->cs);
+#else
+    pthread_mutex_init(&m->m, NULL);
+#endif
+}
+
+void Mutex_Destroy(Mutex *m)
+{
+#ifdef _WIN32
+    DeleteCriticalSection(&m->cs);
+#else
+    pthread_mutex_destroy(&m->m);
+#endif
+}
+
+void Mutex_Lock(Mutex *m)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&m->cs);
+#else
+    pthread_mutex_lock(&m->m);
+#endif
+}
+
+void Mutex_Unlock(Mutex *m)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&m->cs);
+#else
+    pthread_mutex_unlock(&m->m);
+#endif
+}
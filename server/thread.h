@@ -0,0 +1,51 @@
+/*
+ * thread.h – Minimal thread and mutex wrappers for War3 Lobby Server.
+ *
+ * The lobby itself is single-threaded; these exist for the services
+ * that deliberately run beside it (the TCP relay).  pthreads on POSIX,
+ * Win32 threads and critical sections on Windows.
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#ifdef _WIN32
+#   include <winsock2.h>
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#endif
+
+typedef void (*ThreadFn)(void *arg);
+
+typedef struct {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    ThreadFn fn;
+    void    *arg;
+} Thread;
+
+typedef struct {
+#ifdef _WIN32
+    CRITICAL_SECTION cs;
+#else
+    pthread_mutex_t m;
+#endif
+} Mutex;
+
+/* Start `fn(arg)` on a new thread.  `t` must stay valid until joined.
+ * Returns 0 on success, -1 on failure. */
+int  Thread_Start(Thread *t, ThreadFn fn, void *arg);
+
+/* Wait for a started thread to finish. */
+void Thread_Join(Thread *t);
+
+void Mutex_Init(Mutex *m);
+void Mutex_Destroy(Mutex *m);
+void Mutex_Lock(Mutex *m);
+void Mutex_Unlock(Mutex *m);
+
+#endif /* THREAD_H */
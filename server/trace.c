@@ -0,0 +1,151 @@
+/*
+ * trace.c – Flight recorder (see trace.h).
+ */
+
+#ifndef _WIN32
+#   define _POSIX_C_SOURCE 200809L   /* sigaction, SIGUSR1 */
+#endif
+
+#include "trace.h"
+#include "clock.h"
+#include "log.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    uint64_t ns;                   /* Clock_NowNs() */
+    uint64_t value;
+    int32_t  fd;
+    uint8_t  ev;
+    char     text[TRACE_TEXT];
+} TraceRecord;
+
+static const char *const s_event_names[TRACE_EV_COUNT] = {
+    [TRACE_EV_ACCEPT]     = "accept",
+    [TRACE_EV_RECV]       = "recv",
+    [TRACE_EV_DISPATCH]   = "dispatch",
+    [TRACE_EV_FANOUT]     = "fanout",
+    [TRACE_EV_DISCONNECT] = "disconnect",
+    [TRACE_EV_STALL]      = "stall",
+};
+
+/* ------------------------------------------------------------------ */
+/*  Internal state                                                    */
+/* ------------------------------------------------------------------ */
+
+static TraceRecord s_ring[TRACE_EVENTS];
+static uint64_t    s_next;                 /* events recorded so far */
+
+static volatile sig_atomic_t s_dump_requested;
+
+#ifdef SIGUSR1
+static void OnSigUsr1(int sig)
+{
+    (void)sig;
+    s_dump_requested = 1;
+}
+#endif
+
+/* One event as a line; times are relative to the dump. */
+static void WriteEvent(FILE *f, const TraceRecord *r, uint64_t now)
+{
+    fprintf(f, "%12.3f ms  %-10s ", -(double)(now - r->ns) / 1e6,
+            s_event_names[r->ev]);
+
+    switch ((TraceEvent)r->ev) {
+    case TRACE_EV_ACCEPT:
+        fprintf(f, "fd %d\n", r->fd);
+        break;
+    case TRACE_EV_RECV:
+        fprintf(f, "fd %d  %llu bytes\n", r->fd,
+                (unsigned long long)r->value);
+        break;
+    case TRACE_EV_DISPATCH:
+        fprintf(f, "fd %d  %-16s %.3f ms\n", r->fd, r->text,
+                (double)r->value / 1e6);
+        break;
+    case TRACE_EV_FANOUT:
+        fprintf(f, "room %d  %llu recipients\n", r->fd,
+                (unsigned long long)r->value);
+        break;
+    case TRACE_EV_DISCONNECT:
+        fprintf(f, "fd %d  '%s'\n", r->fd, r->text);
+        break;
+    case TRACE_EV_STALL:
+        fprintf(f, "%.3f ms busy, longest %s\n", (double)r->value / 1e6,
+                r->text);
+        break;
+    default:
+        fprintf(f, "\n");
+        break;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+void Trace_Record(TraceEvent ev, int fd, uint64_t value, const char *text)
+{
+    TraceRecord *r = &s_ring[s_next % TRACE_EVENTS];
+
+    r->ns    = Clock_NowNs();
+    r->value = value;
+    r->fd    = fd;
+    r->ev    = (uint8_t)ev;
+    if (text) {
+        snprintf(r->text, sizeof(r->text), "%s", text);
+    } else {
+        r->text[0] = '\0';
+    }
+    s_next++;
+}
+
+int Trace_Dump(const char *reason)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "flight-%lld.log", (long long)time(NULL));
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        LOG_WARN("[trace] cannot write '%s'", path);
+        return -1;
+    }
+
+    uint64_t now   = Clock_NowNs();
+    uint64_t count = s_next < TRACE_EVENTS ? s_next : TRACE_EVENTS;
+
+    fprintf(f, "# war3 lobby flight recorder: %s, last %llu events\n",
+            reason, (unsigned long long)count);
+    for (uint64_t i = s_next - count; i < s_next; i++)
+        WriteEvent(f, &s_ring[i % TRACE_EVENTS], now);
+    fclose(f);
+
+    LOG_INFO("[trace] flight recorder (%s, %llu events) written to %s",
+             reason, (unsigned long long)count, path);
+    return 0;
+}
+
+void Trace_InstallSignal(void)
+{
+#ifdef SIGUSR1
+    /* No SA_RESTART: if the signal lands on the lobby thread select()
+     * returns EINTR and the dump happens at once; otherwise it waits
+     * for the poll timeout (at most a second). */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnSigUsr1;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+#endif
+}
+
+int Trace_DumpRequested(void)
+{
+    if (!s_dump_requested) return 0;
+    s_dump_requested = 0;
+    return 1;
+}
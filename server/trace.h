@@ -0,0 +1,103 @@
+/*
+ * trace.h – USDT probes and flight recorder for War3 Lobby Server.
+ *
+ * Two views of what the lobby loop has been doing, both always on:
+ *
+ *   - USDT probes (provider "war3") at accept, message receive,
+ *     dispatch, room fanout and disconnect.  Built in when <sys/sdt.h>
+ *     is available (systemtap-sdt-dev); each is a single nop until
+ *     bpftrace or perf attaches, e.g.
+ *
+ *       bpftrace -e 'usdt:./war3-lobby-server:war3:msg_dispatch
+ *                    { @[str(arg1)] = hist(arg2); }'
+ *
+ *   - A flight recorder: the same events, plus stalls, kept in a ring
+ *     of the last TRACE_EVENTS.  It is written to a file on SIGUSR1
+ *     and when the watchdog sees a stall (profiler.h), so a latency
+ *     spike can be reconstructed after the fact without debug builds.
+ *
+ * Lobby thread only.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_EVENTS     2048      /* flight recorder depth */
+#define TRACE_TEXT       24        /* message type / user name, cut */
+
+#if defined(__has_include)
+#   if __has_include(<sys/sdt.h>) && !defined(WAR3_NO_USDT)
+#       include <sys/sdt.h>
+#       define TRACE_HAVE_USDT 1
+#   endif
+#endif
+
+#ifdef TRACE_HAVE_USDT
+#   define TRACE_PROBE1(name, a)        DTRACE_PROBE1(war3, name, a)
+#   define TRACE_PROBE2(name, a, b)     DTRACE_PROBE2(war3, name, a, b)
+#   define TRACE_PROBE3(name, a, b, c)  DTRACE_PROBE3(war3, name, a, b, c)
+#else
+#   define TRACE_PROBE1(name, a)        ((void)0)
+#   define TRACE_PROBE2(name, a, b)     ((void)0)
+#   define TRACE_PROBE3(name, a, b, c)  ((void)0)
+#endif
+
+typedef enum {
+    TRACE_EV_ACCEPT,               /* fd */
+    TRACE_EV_RECV,                 /* fd, bytes */
+    TRACE_EV_DISPATCH,             /* fd, service ns, message type */
+    TRACE_EV_FANOUT,               /* room id, recipients */
+    TRACE_EV_DISCONNECT,           /* fd, user name */
+    TRACE_EV_STALL,                /* busy ns, longest phase */
+    TRACE_EV_COUNT
+} TraceEvent;
+
+/* Append one event to the flight recorder.  `text` may be NULL. */
+void Trace_Record(TraceEvent ev, int fd, uint64_t value, const char *text);
+
+/*
+ * Write the flight recorder, oldest event first, to
+ * flight-<time>.log in the working directory.  Returns 0 on success.
+ */
+int  Trace_Dump(const char *reason);
+
+/* Dump on SIGUSR1 (where there is one).  The signal only sets a flag;
+ * the event loop polls Trace_DumpRequested() and dumps from there. */
+void Trace_InstallSignal(void);
+int  Trace_DumpRequested(void);
+
+/* ---- Probe + recorder pairs used by the lobby ---- */
+
+#define TRACE_ACCEPT(fd)                                                  \
+    do {                                                                  \
+        TRACE_PROBE1(accept, (fd));                                       \
+        Trace_Record(TRACE_EV_ACCEPT, (fd), 0, NULL);                     \
+    } while (0)
+
+#define TRACE_RECV(fd, bytes)                                             \
+    do {                                                                  \
+        TRACE_PROBE2(msg_recv, (fd), (bytes));                            \
+        Trace_Record(TRACE_EV_RECV, (fd), (uint64_t)(bytes), NULL);       \
+    } while (0)
+
+#define TRACE_DISPATCH(fd, type, ns)                                      \
+    do {                                                                  \
+        TRACE_PROBE3(msg_dispatch, (fd), (type), (ns));                   \
+        Trace_Record(TRACE_EV_DISPATCH, (fd), (ns), (type));              \
+    } while (0)
+
+#define TRACE_FANOUT(room_id, recipients)                                 \
+    do {                                                                  \
+        TRACE_PROBE2(fanout, (room_id), (recipients));                    \
+        Trace_Record(TRACE_EV_FANOUT, (room_id), (recipients), NULL);     \
+    } while (0)
+
+#define TRACE_DISCONNECT(fd, name)                                        \
+    do {                                                                  \
+        TRACE_PROBE2(disconnect, (fd), (name));                           \
+        Trace_Record(TRACE_EV_DISCONNECT, (fd), 0, (name));               \
+    } while (0)
+
+#endif /* TRACE_H */
@@ -0,0 +1,335 @@
+/*
+ * transport.c – TCP transport: listener, select() and the sockets that
+ * ride on the same loop (see transport.h).
+ *
+ * Cross-platform: compiles on Windows (winsock2) and POSIX (Linux/macOS).
+ */
+
+#include "transport.h"
+#include "server.h"
+#include "handler.h"
+#include "reflector.h"
+#include "exporter.h"
+#include "admin.h"
+#include "profiler.h"
+#include "metrics.h"
+#include "clock.h"
+#include "log.h"
+
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+#   pragma comment(lib, "ws2_32.lib")
+    typedef int socklen_t;
+#   define CLOSE_SOCKET(s) closesocket(s)
+#else
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#   include <sys/select.h>
+#   include <netinet/in.h>
+#   include <arpa/inet.h>
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <errno.h>
+#   define CLOSE_SOCKET(s) close(s)
+#endif
+
+/* Pause on the listener after accept() ran out of descriptors. */
+#define TCP_ACCEPT_BACKOFF_MS 250
+
+typedef struct {
+    int      listen_fd;
+    int      udp_fd;                 /* discovery reflector, -1 if none */
+    fd_set   readfds;                /* as select() left them */
+    fd_set   writefds;
+    int      ready;                  /* select() result */
+    uint64_t accept_resume_us;       /* listener left out of select() until */
+} Tcp;
+
+static Tcp s_tcp = { .listen_fd = -1, .udp_fd = -1 };
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                           */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Put a client socket into non-blocking mode so a slow reader can never
+ * stall the event loop; its data waits in the user's SendQ instead.
+ */
+static void SetNonBlocking(int fd)
+{
+#ifdef _WIN32
+    u_long mode = 1;
+    ioctlsocket((SOCKET)fd, FIONBIO, &mode);
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#   ifdef SO_NOSIGPIPE
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
+#   endif
+#endif
+}
+
+/* Reflector callback: hand endpoint changes to the message handler. */
+static void OnUdpEndpoint(User *user, void *ctx)
+{
+    Server *srv = (Server *)ctx;
+    Handler_OnUdpEndpoint(user, srv->rooms, MAX_ROOMS);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Operations                                                        */
+/* ------------------------------------------------------------------ */
+
+static int TcpWait(void *ctx, Server *srv, uint32_t timeout_ms)
+{
+    Tcp *t = (Tcp *)ctx;
+
+    FD_ZERO(&t->readfds);
+    FD_ZERO(&t->writefds);
+
+    /* Out of descriptors, the pending connection would keep the listener
+     * readable and the loop spinning: leave it out for a while. */
+    uint64_t now_us = Clock_NowUs();
+    if (now_us >= t->accept_resume_us) {
+        FD_SET(t->listen_fd, &t->readfds);
+    } else {
+        uint32_t resume_ms = (uint32_t)((t->accept_resume_us - now_us + 999u)
+                                        / 1000u);
+        if (resume_ms < timeout_ms) timeout_ms = resume_ms;
+    }
+
+    int max_fd = t->listen_fd;
+
+    if (t->udp_fd >= 0) {
+        FD_SET(t->udp_fd, &t->readfds);
+        if (t->udp_fd > max_fd) max_fd = t->udp_fd;
+    }
+
+    max_fd = Exporter_AddFds(&t->readfds, &t->writefds, max_fd);
+    max_fd = Admin_AddFds(&t->readfds, &t->writefds, max_fd);
+
+    for (int i = 0; i < MAX_USERS; i++) {
+        if (srv->users[i].fd != -1) {
+            FD_SET(srv->users[i].fd, &t->readfds);
+            if (srv->users[i].sendq.count > 0) {
+                FD_SET(srv->users[i].fd, &t->writefds);
+            }
+            if (srv->users[i].fd > max_fd) {
+                max_fd = srv->users[i].fd;
+            }
+        }
+    }
+
+    struct timeval tv;
+    tv.tv_sec  = (long)(timeout_ms / 1000u);
+    tv.tv_usec = (long)(timeout_ms % 1000u) * 1000;
+
+    t->ready = select(max_fd + 1, &t->readfds, &t->writefds, NULL, &tv);
+    if (t->ready < 0) {
+        /* Nothing is ready; the caller simply comes back. */
+        FD_ZERO(&t->readfds);
+        FD_ZERO(&t->writefds);
+#ifdef _WIN32
+        if (WSAGetLastError() == WSAEINTR) return 0;
+#else
+        if (errno == EINTR) return 0;
+#endif
+        LOG_ERROR("[server] select() error");
+        return -1;
+    }
+    return 0;
+}
+
+static int TcpAccept(void *ctx, char ip[MAX_IP_STR])
+{
+    Tcp *t = (Tcp *)ctx;
+    if (t->ready <= 0 || !FD_ISSET(t->listen_fd, &t->readfds)) return -1;
+
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+    int client_fd = (int)accept(t->listen_fd,
+                                (struct sockaddr *)&client_addr,
+                                &addr_len);
+    if (client_fd < 0) {
+#ifdef _WIN32
+        int out_of_fds = WSAGetLastError() == WSAEMFILE;
+#else
+        int out_of_fds = errno == EMFILE || errno == ENFILE;
+#endif
+        if (out_of_fds) {
+            LOG_LIMITED(LOG_LEVEL_WARN, 1,
+                        "[server] accept(): out of file descriptors, "
+                        "pausing for %d ms", TCP_ACCEPT_BACKOFF_MS);
+            t->accept_resume_us = Clock_NowUs()
+                                + (uint64_t)TCP_ACCEPT_BACKOFF_MS * 1000u;
+        }
+        return -1;
+    }
+
+#ifndef _WIN32
+    /* FD_SET on a descriptor past FD_SETSIZE writes beyond the fd_set. */
+    if (client_fd >= FD_SETSIZE) {
+        LOG_LIMITED(LOG_LEVEL_WARN, 5,
+                    "[server] fd %d is beyond FD_SETSIZE, rejecting",
+                    client_fd);
+        CLOSE_SOCKET(client_fd);
+        Metrics_Add(MET_CONN_REJECTED, 1);
+        return -1;
+    }
+#endif
+
+    SetNonBlocking(client_fd);
+    inet_ntop(AF_INET, &client_addr.sin_addr, ip, MAX_IP_STR);
+    return client_fd;
+}
+
+static int TcpReadable(void *ctx, int conn)
+{
+    return FD_ISSET(conn, &((Tcp *)ctx)->readfds) != 0;
+}
+
+static int TcpRecv(void *ctx, int conn, uint8_t *buf, uint32_t len)
+{
+    (void)ctx;
+
+    int n = recv(conn, (char *)buf, (int)len, 0);
+    if (n < 0) {
+#ifdef _WIN32
+        if (WSAGetLastError() == WSAEWOULDBLOCK) return TRANSPORT_AGAIN;
+#else
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return TRANSPORT_AGAIN;
+#endif
+        return -1;
+    }
+    return n;
+}
+
+static int TcpFlush(void *ctx, int conn, SendQ *q)
+{
+    (void)ctx;
+    return SendQ_Flush(q, conn);
+}
+
+static void TcpClose(void *ctx, int conn)
+{
+    (void)ctx;
+    CLOSE_SOCKET(conn);
+}
+
+static void TcpService(void *ctx, Server *srv)
+{
+    Tcp *t = (Tcp *)ctx;
+
+    /* ---- Reflect discovery datagrams ---- */
+    if (t->ready > 0 && t->udp_fd >= 0 && FD_ISSET(t->udp_fd, &t->readfds)) {
+        Profiler_Enter(MET_PHASE_UDP, t->udp_fd, NULL);
+        Reflector_Drain(srv->rooms, MAX_ROOMS, OnUdpEndpoint, srv);
+    }
+
+    /* ---- Metrics scrapes ---- */
+    if (srv->metrics_port > 0) {
+        Profiler_Enter(MET_PHASE_SCRAPE, -1, NULL);
+        Exporter_Service(&t->readfds, &t->writefds, time(NULL),
+                         Server_RefreshGauges, srv);
+    }
+
+    /* ---- Admin queries ---- */
+    Profiler_Enter(MET_PHASE_ADMIN, -1, NULL);
+    Admin_Service(&t->readfds, &t->writefds, time(NULL),
+                  srv->users, MAX_USERS, srv->rooms, MAX_ROOMS);
+}
+
+static void TcpShutdown(void *ctx)
+{
+    Tcp *t = (Tcp *)ctx;
+
+    /* Close the reflector socket. */
+    Reflector_Close();
+    t->udp_fd = -1;
+
+    /* Close listening socket. */
+    if (t->listen_fd >= 0) {
+        CLOSE_SOCKET(t->listen_fd);
+        t->listen_fd = -1;
+    }
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+/* ------------------------------------------------------------------ */
+/*  Public API                                                        */
+/* ------------------------------------------------------------------ */
+
+int Transport_OpenTcp(Transport *t, int port)
+{
+    Tcp *tcp = &s_tcp;
+
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        LOG_ERROR("[server] WSAStartup failed");
+        return -1;
+    }
+#endif
+
+    /* Create listening socket. */
+    tcp->listen_fd = (int)socket(AF_INET, SOCK_STREAM, 0);
+    if (tcp->listen_fd < 0) {
+        LOG_ERROR("[server] socket() failed");
+        return -1;
+    }
+
+    /* Allow address reuse. */
+    int opt = 1;
+#ifdef _WIN32
+    setsockopt(tcp->listen_fd, SOL_SOCKET, SO_REUSEADDR,
+               (const char *)&opt, sizeof(opt));
+#else
+    setsockopt(tcp->listen_fd, SOL_SOCKET, SO_REUSEADDR,
+               &opt, sizeof(opt));
+#endif
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((uint16_t)port);
+
+    if (bind(tcp->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOG_ERROR("[server] bind() failed on port %d", port);
+        CLOSE_SOCKET(tcp->listen_fd);
+        tcp->listen_fd = -1;
+        return -1;
+    }
+
+    if (listen(tcp->listen_fd, 16) < 0) {
+        LOG_ERROR("[server] listen() failed");
+        CLOSE_SOCKET(tcp->listen_fd);
+        tcp->listen_fd = -1;
+        return -1;
+    }
+
+    /* The UDP reflector shares the port number; the lobby works
+     * without it (clients fall back to per-peer broadcasts). */
+    tcp->udp_fd = Reflector_Open(port);
+
+    memset(t, 0, sizeof(*t));
+    t->ctx      = tcp;
+    t->wait     = TcpWait;
+    t->accept   = TcpAccept;
+    t->readable = TcpReadable;
+    t->recv     = TcpRecv;
+    t->flush    = TcpFlush;
+    t->close    = TcpClose;
+    t->service  = TcpService;
+    t->shutdown = TcpShutdown;
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * transport.h – Connection I/O beneath the lobby server core.
+ *
+ * server.c never touches a socket: each Server_Poll iteration asks its
+ * Transport to wait for activity, accept at most one connection, read
+ * from the connections that have data and flush their send queues.  A
+ * connection is an int handle kept in User.fd; handles are never -1
+ * and stay unique while open.
+ *
+ * Transport_OpenTcp is the real one: a TCP listener and select(),
+ * which also services the sockets that only exist there (UDP
+ * reflector, metrics exporter, admin socket).  sim.h provides an
+ * in-memory network with virtual time.
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "sendq.h"
+#include "../common/message.h"
+
+#include <stdint.h>
+
+struct Server;
+
+/* recv: nothing to read right now. */
+#define TRANSPORT_AGAIN  (-2)
+
+typedef struct {
+    void *ctx;
+
+    /* Block up to `timeout_ms` for activity on the listener and the
+     * server's connections.  Returns -1 on a fatal error. */
+    int  (*wait)(void *ctx, struct Server *srv, uint32_t timeout_ms);
+
+    /* Take one pending connection: its handle and the peer's address
+     * as text.  -1 if none is waiting. */
+    int  (*accept)(void *ctx, char ip[MAX_IP_STR]);
+
+    /* Did the last wait report `conn` readable (data or end of stream)? */
+    int  (*readable)(void *ctx, int conn);
+
+    /* Read up to `len` bytes: the count, 0 when the peer has closed,
+     * TRANSPORT_AGAIN if there is nothing yet, -1 on error. */
+    int  (*recv)(void *ctx, int conn, uint8_t *buf, uint32_t len);
+
+    /* Write as much of `q` as the connection accepts; as SendQ_Flush. */
+    int  (*flush)(void *ctx, int conn, SendQ *q);
+
+    void (*close)(void *ctx, int conn);
+
+    /* Per-iteration work for the transport's own sockets, after wait.
+     * NULL if it has none. */
+    void (*service)(void *ctx, struct Server *srv);
+
+    /* Release the listener and everything else the transport opened. */
+    void (*shutdown)(void *ctx);
+} Transport;
+
+/*
+ * Listen on TCP `port` and open the UDP reflector on the same port.
+ * Fills `t`; returns 0, or -1 if the listener cannot be opened.
+ */
+int Transport_OpenTcp(Transport *t, int port);
+
+#endif /* TRANSPORT_H */
@@ -5,19 +5,76 @@
 #include "user.h"
 #include <string.h>
 
+/* Username hash index: buckets of users chained through name_next. */
+static User *s_name_index[USER_NAME_BUCKETS];
+
+/* udp_token index: buckets of users chained through token_next. */
+static User *s_token_index[USER_TOKEN_BUCKETS];
+
+/* ------------------------------------------------------------------ */
+/*  Users_NameHash / Users_NameEqual                                  */
+/* ------------------------------------------------------------------ */
+
+static unsigned char FoldChar(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+/* FNV-1a over the case-folded name. */
+unsigned Users_NameHash(const char *name)
+{
+    unsigned h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= FoldChar(*p);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int Users_NameEqual(const char *a, const char *b)
+{
+    while (*a && FoldChar((unsigned char)*a) == FoldChar((unsigned char)*b)) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
 /* ------------------------------------------------------------------ */
 /*  Users_Init                                                        */
 /* ------------------------------------------------------------------ */
 
 void Users_Init(User users[], int count)
 {
+    memset(s_name_index, 0, sizeof(s_name_index));
+    memset(s_token_index, 0, sizeof(s_token_index));
+
     for (int i = 0; i < count; i++) {
         users[i].fd             = -1;
         users[i].username[0]    = '\0';
         users[i].ip[0]          = '\0';
+        users[i].local_ip[0]    = '\0';
         users[i].room_id        = -1;
+        users[i].match_ticket   = -1;
+        users[i].in_game        = 0;
         users[i].last_heartbeat = 0;
+        users[i].rtt_ms         = -1;
+        users[i].game_pkt_len   = 0;
         users[i].recv_len       = 0;
+        users[i].chan_tokens    = 0;
+        users[i].chan_refill    = 0;
+        for (int k = 0; k < MAX_USER_CHANNELS; k++) {
+            users[i].chan_ids[k] = -1;
+            users[i].chan_pos[k] = -1;
+        }
+        SendQ_Init(&users[i].sendq);
+        users[i].name_next      = NULL;
+        users[i].watch_head     = -1;
+        users[i].watch_count    = 0;
+        users[i].udp_token      = 0;
+        users[i].token_next     = NULL;
+        users[i].udp_addr       = 0;
+        users[i].udp_port       = 0;
     }
 }
 
@@ -39,13 +96,77 @@ User *Users_FindByFd(User users[], int count, int fd)
 /*  Users_FindByName                                                  */
 /* ------------------------------------------------------------------ */
 
-User *Users_FindByName(User users[], int count, const char *name)
+User *Users_FindByName(const char *name)
 {
-    if (name == NULL) return NULL;
+    if (name == NULL || name[0] == '\0') return NULL;
 
-    for (int i = 0; i < count; i++) {
-        if (users[i].fd != -1 && strcmp(users[i].username, name) == 0) {
-            return &users[i];
+    unsigned b = Users_NameHash(name) & (USER_NAME_BUCKETS - 1);
+    for (User *u = s_name_index[b]; u; u = u->name_next) {
+        if (Users_NameEqual(u->username, name)) {
+            return u;
+        }
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Users_IndexName / Users_UnindexName                               */
+/* ------------------------------------------------------------------ */
+
+void Users_IndexName(User *user)
+{
+    if (user == NULL || user->username[0] == '\0') return;
+
+    unsigned b = Users_NameHash(user->username) & (USER_NAME_BUCKETS - 1);
+    user->name_next = s_name_index[b];
+    s_name_index[b] = user;
+}
+
+void Users_UnindexName(User *user)
+{
+    if (user == NULL || user->username[0] == '\0') return;
+
+    unsigned b = Users_NameHash(user->username) & (USER_NAME_BUCKETS - 1);
+    User **link = &s_name_index[b];
+    while (*link && *link != user) link = &(*link)->name_next;
+    if (*link) *link = user->name_next;
+    user->name_next = NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Users_SetToken / Users_FindByToken                                */
+/* ------------------------------------------------------------------ */
+
+/* Tokens are random, so their low bits are already a good hash. */
+static unsigned TokenBucket(uint32_t token)
+{
+    return token & (USER_TOKEN_BUCKETS - 1);
+}
+
+void Users_SetToken(User *user, uint32_t token)
+{
+    if (user->udp_token != 0) {
+        User **link = &s_token_index[TokenBucket(user->udp_token)];
+        while (*link && *link != user) link = &(*link)->token_next;
+        if (*link) *link = user->token_next;
+        user->token_next = NULL;
+    }
+
+    user->udp_token = token;
+    if (token != 0) {
+        unsigned b = TokenBucket(token);
+        user->token_next = s_token_index[b];
+        s_token_index[b] = user;
+    }
+}
+
+User *Users_FindByToken(uint32_t token)
+{
+    if (token == 0) return NULL;
+
+    for (User *u = s_token_index[TokenBucket(token)]; u; u = u->token_next) {
+        if (u->udp_token == token) {
+            return u;
         }
     }
     return NULL;
@@ -73,12 +194,34 @@ void Users_FreeSlot(User *user)
 {
     if (user == NULL) return;
 
+    Users_UnindexName(user);
+
     user->fd             = -1;
     user->username[0]    = '\0';
     user->ip[0]          = '\0';
+    user->local_ip[0]    = '\0';
     user->room_id        = -1;
+    user->match_ticket   = -1;
+    user->in_game        = 0;
+    user->watch_head     = -1;
+    user->watch_count    = 0;
+    Users_SetToken(user, 0);
+    user->udp_addr       = 0;
+    user->udp_port       = 0;
     user->last_heartbeat = 0;
+    user->rtt_ms         = -1;
+    user->game_pkt_len   = 0;
     user->recv_len       = 0;
+    user->chan_tokens    = 0;
+    user->chan_refill    = 0;
+    user->connected      = 0;
+    user->bytes_in       = 0;
+    user->msgs_in        = 0;
+    for (int k = 0; k < MAX_USER_CHANNELS; k++) {
+        user->chan_ids[k] = -1;
+        user->chan_pos[k] = -1;
+    }
+    SendQ_Clear(&user->sendq);
     memset(user->recv_buf, 0, sizeof(user->recv_buf));
 }
 
@@ -96,3 +239,29 @@ int Users_CountInRoom(User users[], int count, int room_id)
     }
     return n;
 }
+
+/* ------------------------------------------------------------------ */
+/*  Users_AddRttSample                                                */
+/* ------------------------------------------------------------------ */
+
+void Users_AddRttSample(User *user, int rtt_ms)
+{
+    if (rtt_ms < 0) return;
+
+    if (user->rtt_ms < 0) {
+        user->rtt_ms = rtt_ms;
+    } else {
+        user->rtt_ms += (rtt_ms - user->rtt_ms) / 4;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Users_LiveGame                                                    */
+/* ------------------------------------------------------------------ */
+
+const W3GS_GameInfo *Users_LiveGame(const User *user, time_t now)
+{
+    if (user->game_pkt_len == 0 || now - user->game_seen > USER_GAME_TTL)
+        return NULL;
+    return &user->game;
+}
@@ -9,20 +9,71 @@
 #include <time.h>
 #include "../common/message.h"
 #include "../common/protocol.h"
+#include "../common/reflect.h"
+#include "../common/w3gs.h"
+#include "sendq.h"
 
-#define MAX_USERS 256
+#ifndef MAX_USERS
+#define MAX_USERS 256           /* the simulator builds with more */
+#endif
+#define USER_GAME_TTL 60        /* seconds a cached game stays live */
+#define MAX_USER_CHANNELS 4     /* lobby channels one user may join */
+#define USER_NAME_BUCKETS 1024  /* username hash index, power of two */
+#define USER_TOKEN_BUCKETS 1024 /* udp_token index, power of two */
 
-typedef struct {
+typedef struct User User;
+
+struct User {
     int fd;                      /* socket fd, -1 if slot unused */
     char username[MAX_USERNAME]; /* from message.h               */
     char ip[MAX_IP_STR];        /* client's public IP (from accept) */
+    char local_ip[MAX_IP_STR];  /* LAN address the client reported  */
     int room_id;                /* -1 if not in a room           */
+    int match_ticket;           /* matchmaking ticket, -1 if none */
+    int in_game;                /* client reported War3 running  */
     time_t last_heartbeat;
+    int rtt_ms;                 /* smoothed lobby RTT, -1 if unknown */
+
+    /* Lobby channels: channel index and position in its member array */
+    int chan_ids[MAX_USER_CHANNELS];   /* -1 if slot unused */
+    int chan_pos[MAX_USER_CHANNELS];
+    int chan_tokens;                   /* chat rate-limit bucket */
+    time_t chan_refill;
+
+    /* Traffic since the connection opened (admin.h); the outbound
+     * side is counted in sendq */
+    time_t   connected;
+    uint64_t bytes_in;
+    uint64_t msgs_in;
 
     /* Receive buffer for TCP framing */
     uint8_t recv_buf[MAX_MSG_SIZE];
     uint32_t recv_len;
-} User;
+
+    /* Outbound frames waiting for the socket to become writable */
+    SendQ sendq;
+
+    /* Next user in the same username hash bucket */
+    User *name_next;
+
+    /* Presence subscriptions held by this user (see presence.h) */
+    int watch_head;             /* -1 if none */
+    int watch_count;
+
+    /* Discovery reflector (see reflector.h) */
+    uint32_t udp_token;         /* issued in login_ok, 0 if none    */
+    User    *token_next;        /* next in the same token bucket    */
+    uint32_t udp_addr;          /* last UDP source, network order;  */
+    uint16_t udp_port;          /* 0 until the first packet arrives */
+
+    /* Latest GAMEINFO this user's War3 announced through the reflector,
+     * kept exactly as the reflector forwards it (header included) so it
+     * can be replayed to players who join later. */
+    uint8_t  game_pkt[REFLECT_HDR_SIZE + W3GS_MAX_GAMEINFO];
+    int      game_pkt_len;      /* 0 if none */
+    time_t   game_seen;         /* last GAMEINFO / REFRESHGAME */
+    W3GS_GameInfo game;         /* parsed from game_pkt */
+};
 
 /* Initialise all user slots to "unused". */
 void Users_Init(User users[], int count);
@@ -30,8 +81,34 @@ void Users_Init(User users[], int count);
 /* Find the user slot that owns the given socket fd.  Returns NULL if none. */
 User *Users_FindByFd(User users[], int count, int fd);
 
-/* Find the user slot with the given username.  Returns NULL if none. */
-User *Users_FindByName(User users[], int count, const char *name);
+/*
+ * Find the logged-in user with the given username.  Names are compared
+ * case-insensitively (ASCII letters only).  O(1) through the name index.
+ * Returns NULL if none.
+ */
+User *Users_FindByName(const char *name);
+
+/*
+ * Add a user to the name index under its current username.  Call after
+ * a successful login; Users_FreeSlot and Users_UnindexName remove it.
+ */
+void Users_IndexName(User *user);
+
+/* Remove a user from the name index (no-op if it is not indexed). */
+void Users_UnindexName(User *user);
+
+/*
+ * Replace the user's udp_token (0 = none) and keep the token index in
+ * step.  Users_FreeSlot clears it.
+ */
+void Users_SetToken(User *user, uint32_t token);
+
+/* The user holding `token`, or NULL.  O(1) through the token index. */
+User *Users_FindByToken(uint32_t token);
+
+/* Case-folded username hash and comparison used by the name index. */
+unsigned Users_NameHash(const char *name);
+int      Users_NameEqual(const char *a, const char *b);
 
 /* Allocate the first free slot (fd == -1).  Returns NULL if full. */
 User *Users_AllocSlot(User users[], int count);
@@ -42,4 +119,17 @@ void Users_FreeSlot(User *user);
 /* Count how many active users are in the given room. */
 int Users_CountInRoom(User users[], int count, int room_id);
 
+/*
+ * Fold one RTT measurement (milliseconds) into user->rtt_ms.  Samples
+ * come from heartbeats and rtt_report, so a 1/4 gain keeps the estimate
+ * current without following every spike.
+ */
+void Users_AddRttSample(User *user, int rtt_ms);
+
+/*
+ * The game `user` is hosting, if its announcement was refreshed within
+ * USER_GAME_TTL seconds of `now`; NULL otherwise.
+ */
+const W3GS_GameInfo *Users_LiveGame(const User *user, time_t now);
+
 #endif /* USER_H */
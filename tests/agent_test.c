@@ -0,0 +1,344 @@
+/*
+ * agent_test.c – End-to-end loopback test of the LAN agent: a lobby
+ * server and war3-lan-agent processes on this machine, with the test
+ * playing each agent's War3 on its own broadcast port.
+ *
+ *   1. Agent "host" creates a room, agent "joiner" joins it.
+ *   2. The host's War3 announces a game (GAMEINFO); it must be
+ *      injected, byte for byte, on the joiner's port.
+ *   3. Agent "late" joins: the lobby replays the cached GAMEINFO.
+ *   4. The host's War3 withdraws the game (DECREATEGAME); both the
+ *      joiner and the late member must see it.
+ *   5. Agent "after" joins: no GAMEINFO may be replayed.  A search from
+ *      the joiner, which "after" does receive, shows its registration
+ *      went through.
+ *
+ * Usage: agent_test <war3-lobby-server> <war3-lan-agent> <fixture dir>
+ * Logs go to agent_test_*.log in the working directory.  Linux only.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "test.h"
+#include "../common/w3gs.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PROCS      5
+#define PKT_MAX        2048
+#define WAIT_MS        10000          /* for anything that should happen */
+#define QUIET_MS       2000           /* for replays that should not */
+
+static const char *s_server_bin;
+static const char *s_agent_bin;
+static const char *s_fixtures;
+
+static pid_t s_procs[MAX_PROCS];
+static int   s_nprocs;
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                           */
+/* ------------------------------------------------------------------ */
+
+static uint64_t NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void SleepMs(int ms)
+{
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static int Load(const char *name, uint8_t *buf)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", s_fixtures, name);
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        exit(1);
+    }
+    int len = (int)fread(buf, 1, PKT_MAX, f);
+    fclose(f);
+    return len;
+}
+
+/* A port nothing is bound to right now (TCP or UDP per `type`). */
+static int FreePort(int type)
+{
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+
+    int fd = socket(AF_INET, type, 0);
+    bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *)&addr, &alen);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/* Start `argv` with stdout and stderr in `log`. */
+static void Spawn(const char *log, char *const argv[])
+{
+    /* Truncated here, not in the child, so WaitLog never reads the
+     * previous run's lines. */
+    int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (fd >= 0) {
+            dup2(fd, 1);
+            dup2(fd, 2);
+            close(fd);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (fd >= 0) close(fd);
+    s_procs[s_nprocs++] = pid;
+}
+
+static void StopAll(void)
+{
+    for (int i = s_nprocs - 1; i >= 0; i--) {
+        kill(s_procs[i], SIGTERM);
+        waitpid(s_procs[i], NULL, 0);
+    }
+    s_nprocs = 0;
+}
+
+/* Wait until `log` contains `what`; the number after it, or -1. */
+static int WaitLog(const char *log, const char *what)
+{
+    uint64_t deadline = NowMs() + WAIT_MS;
+    char     text[16384];
+
+    while (NowMs() < deadline) {
+        FILE *f = fopen(log, "r");
+        if (f != NULL) {
+            size_t n = fread(text, 1, sizeof(text) - 1, f);
+            fclose(f);
+            text[n] = '\0';
+            const char *at = strstr(text, what);
+            if (at != NULL) return atoi(at + strlen(what));
+        }
+        SleepMs(50);
+    }
+    fprintf(stderr, "timed out waiting for '%s' in %s\n", what, log);
+    return -1;
+}
+
+/* Wait until the lobby accepts connections on `port`. */
+static int WaitListening(int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons((uint16_t)port);
+
+    uint64_t deadline = NowMs() + WAIT_MS;
+    while (NowMs() < deadline) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        close(fd);
+        if (ok) return 0;
+        SleepMs(50);
+    }
+    return -1;
+}
+
+/* Start an agent; room_id 0 creates a room.  Returns the room it is in. */
+static int StartAgent(const char *name, int lan_port, int lobby_port,
+                      int room_id)
+{
+    char log[64], lan[16], lobby[16], room[16];
+    snprintf(log, sizeof(log), "agent_test_%s.log", name);
+    snprintf(lan, sizeof(lan), "%d", lan_port);
+    snprintf(lobby, sizeof(lobby), "%d", lobby_port);
+    snprintf(room, sizeof(room), "%d", room_id);
+
+    char *argv[] = {
+        (char *)s_agent_bin, "-p", lan, "127.0.0.1", lobby, (char *)name,
+        room_id > 0 ? room : NULL, NULL
+    };
+    Spawn(log, argv);
+    return WaitLog(log, "[agent] in room ");
+}
+
+/*
+ * The War3 side of one agent: a socket on 255.255.255.255:lan_port,
+ * where the agent injects what the room sends.
+ */
+static int War3Socket(int lan_port)
+{
+    int on = 1;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    addr.sin_port        = htons((uint16_t)lan_port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "bind 255.255.255.255:%d: %s\n", lan_port,
+                strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+/* War3 broadcasting on its LAN port, where the agent captures it. */
+static void Broadcast(int fd, int lan_port, const uint8_t *pkt, int len)
+{
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family      = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    to.sin_port        = htons((uint16_t)lan_port);
+    sendto(fd, pkt, (size_t)len, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+/* Next datagram on `fd` within `ms`; its length, or -1. */
+static int Receive(int fd, uint8_t *buf, int ms)
+{
+    struct pollfd p = { fd, POLLIN, 0 };
+    if (poll(&p, 1, ms) <= 0) return -1;
+    return (int)recv(fd, buf, PKT_MAX, 0);
+}
+
+/*
+ * Wait up to `ms` for a packet with W3GS id `id` on `fd`, skipping
+ * others; every GAMEINFO seen is counted in *gameinfos.  Returns the
+ * length (packet in `buf`), or -1.
+ */
+static int Expect(int fd, int id, uint8_t *buf, int ms, int *gameinfos)
+{
+    uint64_t deadline = NowMs() + (uint64_t)ms;
+    uint64_t now;
+
+    while ((now = NowMs()) < deadline) {
+        int len = Receive(fd, buf, (int)(deadline - now));
+        if (len < 0) break;
+        int got = W3GS_PacketId(buf, len);
+        if (got == W3GS_GAMEINFO && gameinfos != NULL) (*gameinfos)++;
+        if (got == id) return len;
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------ */
+
+static void Run(void)
+{
+    uint8_t gameinfo[PKT_MAX], decreate[PKT_MAX], buf[PKT_MAX];
+    int     gameinfo_len = Load("gameinfo.bin", gameinfo);
+    int     decreate_len = Load("decreategame.bin", decreate);
+
+    int  lobby_port = FreePort(SOCK_STREAM);
+    char lobby_arg[16];
+    snprintf(lobby_arg, sizeof(lobby_arg), "%d", lobby_port);
+    char *server_argv[] = { (char *)s_server_bin, lobby_arg, NULL };
+    Spawn("agent_test_server.log", server_argv);
+    if (WaitListening(lobby_port) != 0) {
+        fprintf(stderr, "lobby server did not come up\n");
+        t_failures++;
+        return;
+    }
+
+    int port_host   = FreePort(SOCK_DGRAM);
+    int port_joiner = FreePort(SOCK_DGRAM);
+    int w3_host     = War3Socket(port_host);
+    int w3_joiner   = War3Socket(port_joiner);
+
+    /* 1. */
+    int room = StartAgent("host", port_host, lobby_port, 0);
+    CHECK(room > 0);
+    if (room <= 0) return;
+    CHECK_EQ(StartAgent("joiner", port_joiner, lobby_port, room), room);
+
+    /* 2. Announce until the joiner sees it; each copy's up time differs,
+     *    as War3's do, so the agent's repeat filter lets it through. */
+    int      len = -1;
+    uint64_t deadline = NowMs() + WAIT_MS;
+    while (len < 0 && NowMs() < deadline) {
+        gameinfo[gameinfo_len - 6]++;
+        Broadcast(w3_host, port_host, gameinfo, gameinfo_len);
+        len = Expect(w3_joiner, W3GS_GAMEINFO, buf, 250, NULL);
+    }
+    CHECK_EQ(len, gameinfo_len);
+    CHECK(len == gameinfo_len && memcmp(buf, gameinfo, (size_t)len) == 0);
+
+    /* 3. */
+    int port_late = FreePort(SOCK_DGRAM);
+    int w3_late   = War3Socket(port_late);
+    CHECK_EQ(StartAgent("late", port_late, lobby_port, room), room);
+    len = Expect(w3_late, W3GS_GAMEINFO, buf, WAIT_MS, NULL);
+    CHECK_EQ(len, gameinfo_len);
+    CHECK(len == gameinfo_len && memcmp(buf, gameinfo, (size_t)len) == 0);
+
+    /* 4. */
+    Broadcast(w3_host, port_host, decreate, decreate_len);
+    len = Expect(w3_joiner, W3GS_DECREATEGAME, buf, WAIT_MS, NULL);
+    CHECK(len == decreate_len && memcmp(buf, decreate, (size_t)len) == 0);
+    len = Expect(w3_late, W3GS_DECREATEGAME, buf, WAIT_MS, NULL);
+    CHECK(len == decreate_len && memcmp(buf, decreate, (size_t)len) == 0);
+
+    /* 5. */
+    int port_after = FreePort(SOCK_DGRAM);
+    int w3_after   = War3Socket(port_after);
+    int replayed   = 0;
+    CHECK_EQ(StartAgent("after", port_after, lobby_port, room), room);
+    Expect(w3_after, -1, buf, QUIET_MS, &replayed);
+
+    uint8_t search[16] = { W3GS_HEADER, W3GS_SEARCHGAME, 16, 0,
+                           'P', 'X', '3', 'W', 26, 0, 0, 0, 0, 0, 0, 0 };
+    len = -1;
+    deadline = NowMs() + WAIT_MS;
+    while (len < 0 && NowMs() < deadline) {
+        search[12]++;
+        Broadcast(w3_joiner, port_joiner, search, sizeof(search));
+        len = Expect(w3_after, W3GS_SEARCHGAME, buf, 250, &replayed);
+    }
+    CHECK_EQ(len, (int)sizeof(search));
+    CHECK_EQ(replayed, 0);
+
+    close(w3_host);
+    close(w3_joiner);
+    close(w3_late);
+    close(w3_after);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "usage: agent_test <server> <agent> <fixtures>\n");
+        return 2;
+    }
+    s_server_bin = argv[1];
+    s_agent_bin  = argv[2];
+    s_fixtures   = argv[3];
+
+    Run();
+    StopAll();
+    return TEST_RESULT();
+}
@@ -0,0 +1,121 @@
+/*
+ * alloc_test.c – Heartbeat and chat stay off the heap (common/alloc.h).
+ *
+ * A room of ALLOC_TEST_MEMBERS logged-in users, each on one end of a
+ * socketpair (harness.h), is driven through Handler_ProcessMessage as
+ * the server loop would: every reply is flushed and the other end
+ * drained between messages.  After ALLOC_TEST_WARMUP messages of each type (filling the
+ * frame pool), ALLOC_TEST_MESSAGES more must make no allocation calls
+ * on this thread.  Unix only (socketpair).
+ */
+
+#include "test.h"
+#include "harness.h"
+#include "../server/handler.h"
+#include "../server/log.h"
+#include "../common/alloc.h"
+
+#include <string.h>
+
+#define ALLOC_TEST_MEMBERS   8
+#define ALLOC_TEST_WARMUP    100
+#define ALLOC_TEST_MESSAGES  1000
+
+static User s_users[ALLOC_TEST_MEMBERS];
+static Room s_rooms[4];
+static int  s_peer[ALLOC_TEST_MEMBERS];     /* our end of each socketpair */
+
+static const char s_heartbeat_req[] = "{\"type\":\"heartbeat\",\"ts\":12345}";
+static const char s_chat_req[] =
+    "{\"type\":\"chat\",\"message\":\"gl hf, map is dota 6.83d\"}";
+
+/* ------------------------------------------------------------------ */
+
+static void Send(User *u, const char *json)
+{
+    Handler_ProcessMessage(json, (uint32_t)strlen(json), u,
+                           s_rooms, (int)(sizeof(s_rooms) /
+                                          sizeof(s_rooms[0])));
+}
+
+static void DrainAll(void)
+{
+    for (int i = 0; i < ALLOC_TEST_MEMBERS; i++)
+        Harness_Drain(&s_users[i], s_peer[i]);
+}
+
+/* Log everyone in and put them in one room. */
+static int Setup(void)
+{
+    Harness_Init(s_users, ALLOC_TEST_MEMBERS,
+                 s_rooms, (int)(sizeof(s_rooms) / sizeof(s_rooms[0])));
+
+    for (int i = 0; i < ALLOC_TEST_MEMBERS; i++) {
+        User *u = Harness_Connect(s_users, ALLOC_TEST_MEMBERS, &s_peer[i]);
+        if (u == NULL) return -1;
+        snprintf(u->ip, MAX_IP_STR, "10.0.0.%d", 1 + i);
+
+        char req[96];
+        snprintf(req, sizeof(req),
+                 "{\"type\":\"login\",\"username\":\"player%d\"}", i);
+        Send(u, req);
+        if (u->username[0] == '\0') return -1;
+    }
+
+    Send(&s_users[0], "{\"type\":\"room_create\",\"name\":\"alloc\","
+                      "\"max_players\":12}");
+    char join[64];
+    snprintf(join, sizeof(join), "{\"type\":\"room_join\",\"room_id\":%d}",
+             s_users[0].room_id);
+    for (int i = 1; i < ALLOC_TEST_MEMBERS; i++) Send(&s_users[i], join);
+    DrainAll();
+
+    Room *room = Rooms_FindById(s_rooms, 4, s_users[0].room_id);
+    return room != NULL && room->member_count == ALLOC_TEST_MEMBERS ? 0 : -1;
+}
+
+/* Allocation calls made by `count` messages `json`, spread over users. */
+static uint64_t Drive(const char *json, int count)
+{
+    uint64_t allocs = 0;
+
+    for (int k = 0; k < count; k++) {
+        uint64_t before = Alloc_ThreadCalls();
+        Send(&s_users[k % ALLOC_TEST_MEMBERS], json);
+        allocs += Alloc_ThreadCalls() - before;
+        DrainAll();
+    }
+    return allocs;
+}
+
+/* ------------------------------------------------------------------ */
+
+static void TestSteadyState(const char *json)
+{
+    Drive(json, ALLOC_TEST_WARMUP);
+    uint64_t allocs = Drive(json, ALLOC_TEST_MESSAGES);
+    if (allocs != 0)
+        fprintf(stderr, "%s: %llu allocation(s) in %d messages\n", json,
+                (unsigned long long)allocs, ALLOC_TEST_MESSAGES);
+    CHECK_EQ(allocs, 0);
+}
+
+int main(void)
+{
+    Log_Init(LOG_LEVEL_WARN);
+    CHECK_EQ(Setup(), 0);
+
+    TestSteadyState(s_heartbeat_req);
+    TestSteadyState(s_chat_req);
+
+    /* Interleaved, as a real room sends them. */
+    uint64_t allocs = 0;
+    for (int k = 0; k < ALLOC_TEST_MESSAGES / 2; k++) {
+        allocs += Drive(s_heartbeat_req, 1);
+        allocs += Drive(s_chat_req, 1);
+    }
+    CHECK_EQ(allocs, 0);
+
+    Log_Shutdown();
+    return TEST_RESULT();
+}
@@ -0,0 +1,161 @@
+/*
+ * channel_test.c – Unit tests for the budgeted channel fanout
+ * (server/channel.h).
+ *
+ * A pass that outlasts one tick's budget resumes from a cursor, with
+ * members[0 .. cursor) already served.  Members leaving mid-pass are
+ * swapped out so that stays true; every remaining member must get the
+ * batch exactly once, in order.
+ */
+
+#include "test.h"
+#include "../server/channel.h"
+
+#include <stdio.h>
+
+#define MEMBERS   500
+#define POSTERS   8
+#define MESSAGES  (POSTERS * CHANNEL_RATE_BURST)
+
+static User      s_users[MEMBERS];
+static int       s_left[MEMBERS];
+static OutFrame *s_frames[MESSAGES];
+
+/* Each user is in one channel, so its position is in slot 0. */
+static int Position(const User *u)
+{
+    return u->chan_pos[0];
+}
+
+/* The member at `pos` of the channel. */
+static User *MemberAt(int pos)
+{
+    for (int i = 0; i < MEMBERS; i++) {
+        if (!s_left[i] && Position(&s_users[i]) == pos) return &s_users[i];
+    }
+    return NULL;
+}
+
+/* Members served so far this pass; they must be exactly the first
+ * ones.  Returns the count (the cursor), or -1 if the prefix is broken. */
+static int Served(void)
+{
+    int served = 0, ok = 1;
+    for (int i = 0; i < MEMBERS; i++) {
+        if (!s_left[i] && s_users[i].sendq.count > 0) served++;
+    }
+    for (int i = 0; i < MEMBERS; i++) {
+        if (s_left[i]) continue;
+        if ((s_users[i].sendq.count > 0) != (Position(&s_users[i]) < served))
+            ok = 0;
+    }
+    return ok ? served : -1;
+}
+
+static void Leave(User *u)
+{
+    CHECK(u != NULL);
+    if (u == NULL) return;
+    CHECK_EQ(Channels_Leave(u, "fanout"), CHANNEL_OK);
+    s_left[u - s_users] = 1;
+}
+
+/* ------------------------------------------------------------------ */
+
+static void TestLeaveMidPass(void)
+{
+    const time_t now = 1000000;
+
+    Channels_Init();
+    Users_Init(s_users, MEMBERS);
+    for (int i = 0; i < MEMBERS; i++) {
+        s_users[i].fd = 3 + i;
+        SendQ_Init(&s_users[i].sendq);
+        CHECK_EQ(Channels_Join(&s_users[i], "fanout"), CHANNEL_OK);
+    }
+
+    /* A batch too big for one tick: CHANNEL_FANOUT_BUDGET / MESSAGES
+     * members are served per tick, fewer than MEMBERS. */
+    for (int m = 0; m < MESSAGES; m++) {
+        char json[32];
+        snprintf(json, sizeof(json), "{\"n\":%d}", m);
+        s_frames[m] = OutFrame_Create(json);
+        CHECK_EQ(Channels_Post(&s_users[m % POSTERS], "fanout",
+                               s_frames[m], now), CHANNEL_OK);
+    }
+
+    int per_tick = CHANNEL_FANOUT_BUDGET / MESSAGES;
+    CHECK(3 * per_tick > MEMBERS && 2 * per_tick < MEMBERS - 10);
+
+    CHECK(Channels_Tick() != 0);
+    int cursor = Served();
+    CHECK_EQ(cursor, per_tick);
+
+    /* Before the cursor: the last served member, then one further in,
+     * then the first. */
+    Leave(MemberAt(cursor - 1));
+    CHECK_EQ(Served(), --cursor);
+    Leave(MemberAt(cursor / 2));
+    CHECK_EQ(Served(), --cursor);
+    Leave(MemberAt(0));
+    CHECK_EQ(Served(), --cursor);
+
+    /* At the cursor, after it, and the last member. */
+    Leave(MemberAt(cursor));
+    CHECK_EQ(Served(), cursor);
+    Leave(MemberAt(cursor + 10));
+    CHECK_EQ(Served(), cursor);
+    Leave(MemberAt(Channels_MemberCount("fanout") - 1));
+    CHECK_EQ(Served(), cursor);
+
+    /* The next tick carries on from the cursor. */
+    CHECK(Channels_Tick() != 0);
+    cursor = Served();
+    CHECK(cursor > per_tick && cursor < Channels_MemberCount("fanout"));
+
+    /* Three more from the served part, across both ticks' share. */
+    Leave(MemberAt(cursor - 1));
+    CHECK_EQ(Served(), --cursor);
+    Leave(MemberAt(1));
+    CHECK_EQ(Served(), --cursor);
+    Leave(MemberAt(per_tick));
+    CHECK_EQ(Served(), --cursor);
+
+    int ticks = 0;
+    while (Channels_Tick() != 0 && ticks < 100) ticks++;
+    CHECK(ticks < 100);
+    CHECK_EQ(Channels_MemberCount("fanout"), MEMBERS - 9);
+
+    /* Every remaining member: each message once, in order. */
+    int wrong = 0;
+    for (int i = 0; i < MEMBERS; i++) {
+        if (s_left[i]) continue;
+        SendQ *q = &s_users[i].sendq;
+        if (q->count != MESSAGES) { wrong++; continue; }
+        for (int m = 0; m < MESSAGES; m++) {
+            if (q->frames[(q->head + (uint32_t)m) % SENDQ_MAX_FRAMES] !=
+                s_frames[m])
+            {
+                wrong++;
+                break;
+            }
+        }
+    }
+    CHECK_EQ(wrong, 0);
+
+    /* Nothing more to send. */
+    CHECK_EQ(Channels_Tick(), 0);
+
+    for (int m = 0; m < MESSAGES; m++) OutFrame_Release(s_frames[m]);
+    for (int i = 0; i < MEMBERS; i++) {
+        if (!s_left[i]) Channels_LeaveAll(&s_users[i]);
+        SendQ_Clear(&s_users[i].sendq);
+    }
+    CHECK_EQ(Channels_MemberCount("fanout"), 0);
+}
+
+int main(void)
+{
+    TestLeaveMidPass();
+    return TEST_RESULT();
+}
@@ -0,0 +1,68 @@
+/*
+ * harness.c – In-process lobby for tests and microbenchmarks (see
+ * harness.h).
+ */
+
+#include "harness.h"
+#include "../server/sendq.h"
+#include "../server/match.h"
+#include "../server/channel.h"
+#include "../server/presence.h"
+#include "../server/profiler.h"
+#include "../server/jsonmem.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static int SetNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void Harness_Init(User users[], int user_count, Room rooms[], int room_count)
+{
+    JsonMem_Init();
+    Users_Init(users, user_count);
+    Rooms_Init(rooms, room_count);
+    Match_Init();
+    Channels_Init();
+    Presence_Init();
+    Profiler_Init(0);
+}
+
+User *Harness_Connect(User users[], int user_count, int *peer)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return NULL;
+
+    User *u = Users_AllocSlot(users, user_count);
+    if (u == NULL || SetNonBlocking(sv[0]) != 0 || SetNonBlocking(sv[1]) != 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return NULL;
+    }
+
+    u->fd             = sv[0];
+    u->room_id        = -1;
+    u->connected      = time(NULL);
+    u->last_heartbeat = u->connected;
+    u->recv_len       = 0;
+    u->username[0]    = '\0';
+    *peer = sv[1];
+    return u;
+}
+
+int Harness_Drain(User *u, int peer)
+{
+    static char sink[64 * 1024];
+
+    while (u->sendq.count > 0) {
+        if (SendQ_Flush(&u->sendq, u->fd) != 0) return -1;
+        while (read(peer, sink, sizeof(sink)) > 0)
+            ;
+    }
+    return 0;
+}
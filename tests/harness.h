@@ -0,0 +1,35 @@
+/*
+ * harness.h – In-process lobby for tests and microbenchmarks.
+ *
+ * Runs the server code without the event loop: users are slots whose
+ * socket is one end of a socketpair, so handlers queue and flush
+ * replies exactly as they do on TCP while nothing leaves the machine.
+ * The caller drives Handler_ProcessMessage itself and drains every user
+ * between messages, as the server loop would flush.  Unix only.
+ */
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include "../server/user.h"
+#include "../server/room.h"
+
+/* Reset everything the handlers touch: JSON allocator, users, rooms,
+ * matchmaking, channels, presence and the profiler. */
+void Harness_Init(User users[], int user_count, Room rooms[], int room_count);
+
+/*
+ * Take a free user slot, connected (not yet logged in) through a
+ * non-blocking socketpair; *peer gets the other end.  Returns the user,
+ * or NULL if there is no slot or no socketpair.
+ */
+User *Harness_Connect(User users[], int user_count, int *peer);
+
+/*
+ * Flush `u`'s send queue into its socketpair and throw away what
+ * arrives at `peer`, until the queue is empty.  Returns 0, or -1 if a
+ * flush failed.
+ */
+int Harness_Drain(User *u, int peer);
+
+#endif /* HARNESS_H */
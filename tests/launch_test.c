@@ -0,0 +1,198 @@
+/*
+ * launch_test.c – Unit tests for the shared launch helpers
+ * (common/launch.h): the address one member uses for another, the
+ * per-member start delay, the war3hook.cfg text and the client's launch
+ * state machine.  The client using them is Win32-only; these run
+ * everywhere.
+ */
+
+#include "test.h"
+#include "../common/launch.h"
+
+#include <string.h>
+
+static LaunchEndpoint Endpoint(const char *ip, const char *local_ip,
+                               const char *udp_ip, int udp_port)
+{
+    LaunchEndpoint ep = { ip, local_ip, udp_ip, udp_port };
+    return ep;
+}
+
+/* ------------------------------------------------------------------ */
+
+static void TestPeerAddr(void)
+{
+    char addr[LAUNCH_ADDR_LEN];
+
+    LaunchEndpoint self  = Endpoint("1.2.3.4", "192.168.1.10",
+                                    "1.2.3.4", 40001);
+    LaunchEndpoint punch = Endpoint("5.6.7.8", "10.0.0.5",
+                                    "5.6.7.9", 50002);
+    LaunchEndpoint plain = Endpoint("5.6.7.8", "", "", 0);
+    LaunchEndpoint lan   = Endpoint("1.2.3.4", "192.168.1.20",
+                                    "1.2.3.4", 40002);
+
+    /* Behind the same NAT: the peer's LAN address, punched or not. */
+    CHECK_EQ(Launch_PeerAddr(&self, &lan, addr, sizeof(addr)),
+             LAUNCH_VIA_LAN);
+    CHECK(strcmp(addr, "192.168.1.20") == 0);
+
+    /* Both sides punched: the peer's reflector-seen endpoint. */
+    CHECK_EQ(Launch_PeerAddr(&self, &punch, addr, sizeof(addr)),
+             LAUNCH_VIA_PUNCH);
+    CHECK(strcmp(addr, "5.6.7.9:50002") == 0);
+
+    /* Only one side punched, or no endpoint: the public address. */
+    LaunchEndpoint unpunched = Endpoint("1.2.3.4", "192.168.1.10", "", 0);
+    CHECK_EQ(Launch_PeerAddr(&unpunched, &punch, addr, sizeof(addr)),
+             LAUNCH_VIA_PUBLIC);
+    CHECK(strcmp(addr, "5.6.7.8") == 0);
+    CHECK_EQ(Launch_PeerAddr(&self, &plain, addr, sizeof(addr)),
+             LAUNCH_VIA_PUBLIC);
+    CHECK(strcmp(addr, "5.6.7.8") == 0);
+
+    /* Same public IP but no LAN address reported: no LAN shortcut. */
+    LaunchEndpoint no_local = Endpoint("1.2.3.4", "", "1.2.3.4", 40003);
+    CHECK_EQ(Launch_PeerAddr(&self, &no_local, addr, sizeof(addr)),
+             LAUNCH_VIA_PUNCH);
+    CHECK(strcmp(addr, "1.2.3.4:40003") == 0);
+
+    /* A short buffer is cut, still terminated. */
+    char small[8];
+    Launch_PeerAddr(&self, &punch, small, sizeof(small));
+    CHECK(strcmp(small, "5.6.7.9") == 0);
+}
+
+static void TestDelayMs(void)
+{
+    /* Half the RTT earlier, so all members start together. */
+    CHECK_EQ(Launch_DelayMs(LAUNCH_LEAD_MS, 100), LAUNCH_LEAD_MS - 50);
+    CHECK_EQ(Launch_DelayMs(LAUNCH_LEAD_MS, 1), LAUNCH_LEAD_MS);
+    CHECK_EQ(Launch_DelayMs(LAUNCH_LEAD_MS, 0), LAUNCH_LEAD_MS);
+
+    /* Unknown RTT: the full lead. */
+    CHECK_EQ(Launch_DelayMs(LAUNCH_LEAD_MS, -1), LAUNCH_LEAD_MS);
+
+    /* A one-way trip as long as the lead: start at once, never wrap. */
+    CHECK_EQ(Launch_DelayMs(3000, 6000), 0);
+    CHECK_EQ(Launch_DelayMs(3000, 10000), 0);
+    CHECK_EQ(Launch_DelayMs(3000, 5998), 1);
+    CHECK_EQ(Launch_DelayMs(0, 100), 0);
+}
+
+static void TestFormatConfig(void)
+{
+    const char *addrs[] = { "192.168.1.20", "5.6.7.9:50002" };
+    char        buf[512];
+    int         len, plain;
+
+    /* No token: targets only. */
+    plain = Launch_FormatConfig(addrs, 2, "1.2.3.4:12000", 0,
+                                buf, sizeof(buf));
+    CHECK(plain > 0);
+    CHECK_EQ(plain, (int)strlen(buf));
+    CHECK(strstr(buf, "reflector=") == NULL);
+    CHECK(strstr(buf, "token=") == NULL);
+    CHECK(strstr(buf, "\n192.168.1.20\n5.6.7.9:50002\n") != NULL);
+
+    /* No reflector address: no reflector line either. */
+    len = Launch_FormatConfig(addrs, 2, "", 77, buf, sizeof(buf));
+    CHECK(len > 0);
+    CHECK(strstr(buf, "reflector=") == NULL);
+
+    /* Both: the reflector lines come first, then the targets. */
+    len = Launch_FormatConfig(addrs, 2, "1.2.3.4:12000", 77,
+                              buf, sizeof(buf));
+    CHECK(len > 0);
+    const char *refl = strstr(buf, "reflector=1.2.3.4:12000\n");
+    const char *tok  = strstr(buf, "token=77\n");
+    const char *tgt  = strstr(buf, "\n192.168.1.20\n");
+    CHECK(refl != NULL && tok != NULL && tgt != NULL);
+    CHECK(refl < tok && tok < tgt);
+
+    /* Too small at any point: -1, never a partial length. */
+    CHECK_EQ(Launch_FormatConfig(addrs, 2, "1.2.3.4:12000", 77, buf, 8), -1);
+    CHECK_EQ(Launch_FormatConfig(addrs, 2, NULL, 0, buf, (size_t)plain), -1);
+    CHECK_EQ(Launch_FormatConfig(addrs, 2, NULL, 0, buf, (size_t)plain + 1),
+             plain);
+    CHECK_EQ(Launch_FormatConfig(addrs, 2, "1.2.3.4:12000", 77,
+                                 buf, (size_t)len), -1);
+    CHECK_EQ(Launch_FormatConfig(addrs, 2, "1.2.3.4:12000", 77,
+                                 buf, (size_t)len + 1), len);
+}
+
+static void TestStateMachine(void)
+{
+    Launch l;
+    char   name[LAUNCH_NAME_LEN];
+
+    Launch_Init(&l);
+    CHECK_EQ(l.state, LAUNCH_IDLE);
+
+    /* Nothing staged: no peers, nothing remaining, nothing fires. */
+    CHECK_EQ(Launch_AddPeer(&l, "a", "1.1.1.1", LAUNCH_VIA_PUBLIC), -1);
+    CHECK_EQ(Launch_Remaining(&l, 1000), 0);
+    CHECK_EQ(Launch_Poll(&l, 1000000), 0);
+
+    CHECK_EQ(Launch_Stage(&l, 7, 3000, 1000), 0);
+    CHECK_EQ(l.state, LAUNCH_STAGED);
+
+    /* The peer set fills up to LAUNCH_MAX_PEERS. */
+    for (int i = 0; i < LAUNCH_MAX_PEERS; i++) {
+        snprintf(name, sizeof(name), "p%d", i);
+        CHECK_EQ(Launch_AddPeer(&l, name, "1.1.1.1", LAUNCH_VIA_PUNCH), 0);
+    }
+    CHECK_EQ(Launch_AddPeer(&l, "extra", "1.1.1.1", LAUNCH_VIA_PUBLIC), -1);
+    CHECK_EQ(l.count, LAUNCH_MAX_PEERS);
+    CHECK(strcmp(l.names[LAUNCH_MAX_PEERS - 1], "p15") == 0);
+    CHECK_EQ(l.via[0], LAUNCH_VIA_PUNCH);
+
+    /* A repeat of the staged id changes nothing. */
+    CHECK_EQ(Launch_Stage(&l, 7, 100, 2000), -1);
+    CHECK_EQ(l.count, LAUNCH_MAX_PEERS);
+    CHECK_EQ(l.fire_at_ms, 4000);
+
+    /* Counting down; fires once, at the due time. */
+    CHECK_EQ(Launch_Remaining(&l, 1000), 3000);
+    CHECK_EQ(Launch_Remaining(&l, 3999), 1);
+    CHECK_EQ(Launch_Poll(&l, 3999), 0);
+    CHECK_EQ(l.state, LAUNCH_STAGED);
+    CHECK_EQ(Launch_Remaining(&l, 4000), 0);
+    CHECK_EQ(Launch_Poll(&l, 4000), 1);
+    CHECK_EQ(l.state, LAUNCH_RUNNING);
+    CHECK_EQ(Launch_Poll(&l, 4001), 0);
+    CHECK_EQ(Launch_Poll(&l, 9000), 0);
+    CHECK_EQ(Launch_Remaining(&l, 2000), 0);
+    CHECK_EQ(Launch_AddPeer(&l, "late", "1.1.1.1", LAUNCH_VIA_PUBLIC), -1);
+
+    /* The same id again, even while running: still a repeat. */
+    CHECK_EQ(Launch_Stage(&l, 7, 100, 5000), -1);
+    CHECK_EQ(l.state, LAUNCH_RUNNING);
+
+    /* A new id restages with an empty peer set. */
+    CHECK_EQ(Launch_Stage(&l, 8, 0, 5000), 0);
+    CHECK_EQ(l.count, 0);
+    CHECK_EQ(Launch_Poll(&l, 5000), 1);
+
+    /* Reset: back to idle, and the id is forgotten. */
+    Launch_Reset(&l);
+    CHECK_EQ(l.state, LAUNCH_IDLE);
+    CHECK_EQ(l.count, 0);
+    CHECK_EQ(Launch_Poll(&l, 99999), 0);
+    CHECK_EQ(Launch_Stage(&l, 8, 10, 6000), 0);
+
+    /* Id 0 (no id from the server) is never a repeat. */
+    Launch_Reset(&l);
+    CHECK_EQ(Launch_Stage(&l, 0, 10, 6000), 0);
+    CHECK_EQ(Launch_Stage(&l, 0, 20, 6000), 0);
+    CHECK_EQ(Launch_Remaining(&l, 6000), 20);
+}
+
+int main(void)
+{
+    TestPeerAddr();
+    TestDelayMs();
+    TestFormatConfig();
+    TestStateMachine();
+    return TEST_RESULT();
+}
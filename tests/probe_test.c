@@ -0,0 +1,169 @@
+/*
+ * probe_test.c – Unit tests for the latency probe engine (common/probe.h).
+ */
+
+#include "test.h"
+#include "../common/probe.h"
+
+#include <string.h>
+
+#define MS 1000ull                   /* probe clocks are in microseconds */
+
+/* Answer a ping the way the remote end does: the same bytes, kind flipped. */
+static int Answer(ProbeTarget *t, const uint8_t *ping, uint64_t now_us)
+{
+    uint8_t pong[PROBE_TOKEN_PKT_SIZE];
+    memcpy(pong, ping, PROBE_PKT_SIZE);
+    Probe_MakePong(pong);
+    return Probe_HandlePong(t, pong, PROBE_PKT_SIZE, now_us);
+}
+
+/* ------------------------------------------------------------------ */
+
+static void TestPacket(void)
+{
+    ProbeTarget t;
+    uint8_t     buf[PROBE_TOKEN_PKT_SIZE];
+
+    Probe_Reset(&t);
+    CHECK_EQ(Probe_BuildPing(&t, 5 * MS, buf), PROBE_PKT_SIZE);
+    CHECK_EQ(Probe_Classify(buf, PROBE_PKT_SIZE), PROBE_KIND_PING);
+    CHECK_EQ(Probe_Classify(buf, PROBE_PKT_SIZE - 1), 0);
+    CHECK_EQ(Probe_Token(buf, PROBE_PKT_SIZE), 0);
+
+    Probe_MakePong(buf);
+    CHECK_EQ(Probe_Classify(buf, PROBE_PKT_SIZE), PROBE_KIND_PONG);
+
+    /* Server pings carry the udp_token, and the pong keeps it. */
+    Probe_BuildPing(&t, 6 * MS, buf);
+    CHECK_EQ(Probe_AddToken(buf, 0xA1B2C3D4u), PROBE_TOKEN_PKT_SIZE);
+    CHECK_EQ(Probe_Classify(buf, PROBE_TOKEN_PKT_SIZE), PROBE_KIND_PING);
+    CHECK_EQ(Probe_Token(buf, PROBE_TOKEN_PKT_SIZE), 0xA1B2C3D4u);
+    Probe_MakePong(buf);
+    CHECK_EQ(Probe_Token(buf, PROBE_TOKEN_PKT_SIZE), 0xA1B2C3D4u);
+
+    buf[0] = 'X';
+    CHECK_EQ(Probe_Classify(buf, PROBE_TOKEN_PKT_SIZE), 0);
+}
+
+static void TestSequenceMatching(void)
+{
+    ProbeTarget t;
+    uint8_t     ping[3][PROBE_PKT_SIZE];
+
+    Probe_Reset(&t);
+    for (int i = 0; i < 3; i++) {
+        Probe_BuildPing(&t, (uint64_t)(100 + i * 10) * MS, ping[i]);
+    }
+
+    /* Answers may arrive out of order; each matches its own ping. */
+    CHECK_EQ(Answer(&t, ping[2], 150 * MS), 30 * MS);
+    CHECK_EQ(Answer(&t, ping[0], 150 * MS), 50 * MS);
+
+    /* A duplicate of an answered ping is rejected. */
+    CHECK_EQ(Answer(&t, ping[0], 160 * MS), -1);
+
+    /* A forged timestamp does not match the slot. */
+    uint8_t forged[PROBE_PKT_SIZE];
+    memcpy(forged, ping[1], sizeof(forged));
+    forged[15] ^= 1;
+    CHECK_EQ(Answer(&t, forged, 160 * MS), -1);
+
+    /* A pong from before its ping was sent is rejected. */
+    CHECK_EQ(Answer(&t, ping[1], 105 * MS), -1);
+    CHECK_EQ(Answer(&t, ping[1], 160 * MS), 50 * MS);
+    CHECK_EQ(t.samples, 3);
+
+    /* Once seq + PROBE_WINDOW has reused the slot, a late answer to the
+     * old ping no longer matches. */
+    uint8_t old[PROBE_PKT_SIZE], cur[PROBE_PKT_SIZE];
+    Probe_Reset(&t);
+    Probe_BuildPing(&t, 1 * MS, old);
+    for (int i = 1; i < PROBE_WINDOW; i++) {
+        Probe_BuildPing(&t, (uint64_t)(1 + i) * MS, cur);
+    }
+    Probe_BuildPing(&t, 40 * MS, cur);          /* seq 32, slot 0 again */
+    CHECK_EQ(Answer(&t, old, 41 * MS), -1);
+    CHECK_EQ(Answer(&t, cur, 41 * MS), 1 * MS);
+}
+
+static void TestSmoothedRtt(void)
+{
+    ProbeTarget t;
+    uint8_t     ping[PROBE_PKT_SIZE];
+
+    Probe_Reset(&t);
+    CHECK_EQ(Probe_RttMs(&t), -1);
+
+    /* The first sample is taken as is. */
+    Probe_BuildPing(&t, 0, ping);
+    Answer(&t, ping, 100 * MS);
+    CHECK_EQ(t.srtt_us, 100000);
+    CHECK_EQ(Probe_RttMs(&t), 100);
+
+    /* Then 7/8 old + 1/8 new: 100000 + (200000 - 100000) / 8. */
+    Probe_BuildPing(&t, 1000 * MS, ping);
+    Answer(&t, ping, 1200 * MS);
+    CHECK_EQ(t.srtt_us, 112500);
+    CHECK_EQ(Probe_RttMs(&t), 113);             /* rounded */
+
+    /* A faster sample pulls it down: 112500 + (20000 - 112500) / 8. */
+    Probe_BuildPing(&t, 2000 * MS, ping);
+    Answer(&t, ping, 2020 * MS);
+    CHECK_EQ(t.srtt_us, 112500 + (20000 - 112500) / 8);
+    CHECK_EQ(t.min_rtt_us, 20000);
+    CHECK_EQ(t.samples, 3);
+}
+
+static void TestLossWindow(void)
+{
+    ProbeTarget t;
+    uint8_t     ping[PROBE_PKT_SIZE];
+    uint64_t    now = 0;
+
+    Probe_Reset(&t);
+    CHECK_EQ(Probe_LossPct(&t), 0);
+
+    /* 32 pings, every fourth one unanswered. */
+    for (int i = 0; i < PROBE_WINDOW; i++) {
+        now += 10 * MS;
+        Probe_BuildPing(&t, now, ping);
+        if (i % 4 != 3) Answer(&t, ping, now + 5 * MS);
+    }
+
+    /* Unanswered pings are pending, not lost, until the timeout. */
+    Probe_Expire(&t, now + 5 * MS);
+    CHECK_EQ(Probe_LossPct(&t), 0);
+    Probe_Expire(&t, now + PROBE_TIMEOUT_US + 1);
+    CHECK_EQ(Probe_LossPct(&t), 25);
+
+    /* The window holds only the last 32: answered pings push the lost
+     * ones out one slot at a time. */
+    now += PROBE_TIMEOUT_US + 1;
+    for (int i = 0; i < PROBE_WINDOW / 2; i++) {
+        now += 10 * MS;
+        Probe_BuildPing(&t, now, ping);
+        Answer(&t, ping, now + 5 * MS);
+    }
+    CHECK_EQ(Probe_LossPct(&t), 4 * 100 / PROBE_WINDOW);
+
+    for (int i = 0; i < PROBE_WINDOW / 2; i++) {
+        now += 10 * MS;
+        Probe_BuildPing(&t, now, ping);
+        Answer(&t, ping, now + 5 * MS);
+    }
+    CHECK_EQ(Probe_LossPct(&t), 0);
+
+    /* Pending pings do not count either way. */
+    Probe_BuildPing(&t, now + 10 * MS, ping);
+    CHECK_EQ(Probe_LossPct(&t), 0);
+}
+
+int main(void)
+{
+    TestPacket();
+    TestSequenceMatching();
+    TestSmoothedRtt();
+    TestLossWindow();
+    return TEST_RESULT();
+}
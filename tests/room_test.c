@@ -0,0 +1,328 @@
+/*
+ * room_test.c – Unit tests for the room (server/room.h): who the host
+ * is, the latency-ranked room list and quick_join choice, host
+ * recommendation from the RTT matrix and member removal.
+ */
+
+#include "test.h"
+#include "../server/room.h"
+
+#include <string.h>
+
+static User s_users[MAX_ROOM_PLAYERS];
+static Room s_rooms[1];
+
+/* A small lobby for the list and quick_join tests. */
+#define LOBBY_ROOMS 8
+#define LOBBY_USERS 32
+
+static User s_lobby_users[LOBBY_USERS];
+static Room s_lobby[LOBBY_ROOMS];
+static int  s_lobby_used;
+
+/* A fresh room with `n` members, nothing measured. */
+static Room *MakeRoom(int n)
+{
+    Users_Init(s_users, MAX_ROOM_PLAYERS);
+    Rooms_Init(s_rooms, 1);
+    Room *room = Rooms_Create(s_rooms, 1, "test", MAX_ROOM_PLAYERS, 3);
+    for (int i = 0; i < n; i++) {
+        s_users[i].fd = 3 + i;
+        Rooms_AddMember(room, &s_users[i]);
+    }
+    return room;
+}
+
+/* Both directions of a pair measured alike. */
+static void SetPair(Room *room, int a, int b, int rtt_ms)
+{
+    room->rtt_ms[a][b] = (int16_t)rtt_ms;
+    room->rtt_ms[b][a] = (int16_t)rtt_ms;
+}
+
+/* Mark `user` as hosting a War3 game last announced at `seen`. */
+static void SetGame(User *user, time_t seen)
+{
+    user->game_pkt_len = 1;
+    user->game_seen    = seen;
+}
+
+/* Empty the lobby. */
+static void ResetLobby(void)
+{
+    Users_Init(s_lobby_users, LOBBY_USERS);
+    Rooms_Init(s_lobby, LOBBY_ROOMS);
+    s_lobby_used = 0;
+}
+
+/* A room of `members` whose creator (its host) has lobby RTT `host_rtt`. */
+static Room *AddRoom(const char *name, int max_players, int host_rtt,
+                     int members)
+{
+    int   fd   = 3 + s_lobby_used;
+    Room *room = Rooms_Create(s_lobby, LOBBY_ROOMS, name, max_players, fd);
+    for (int i = 0; i < members; i++) {
+        User *u = &s_lobby_users[s_lobby_used++];
+        u->fd = 3 + (int)(u - s_lobby_users);
+        Rooms_AddMember(room, u);
+    }
+    room->members[0]->rtt_ms = host_rtt;
+    return room;
+}
+
+/* ------------------------------------------------------------------ */
+
+static void TestHost(void)
+{
+    const time_t now = 1000000;
+
+    Room *room = MakeRoom(0);
+    CHECK(Rooms_Host(room, now) == NULL);
+
+    /* Nobody hosting a game: the creator (fd 3), first to join. */
+    room = MakeRoom(3);
+    CHECK(Rooms_Host(room, now) == &s_users[0]);
+
+    /* A member hosting a live game is the host... */
+    SetGame(&s_users[2], now - 5);
+    CHECK(Rooms_Host(room, now) == &s_users[2]);
+    CHECK_EQ(Rooms_EstimateLatency(room, 30, now), -1);  /* unmeasured */
+    s_users[2].rtt_ms = 40;
+    CHECK_EQ(Rooms_EstimateLatency(room, 30, now), 70);
+
+    /* ...the creator first if several are, and an expired game does
+     * not count. */
+    SetGame(&s_users[0], now - USER_GAME_TTL - 1);
+    CHECK(Rooms_Host(room, now) == &s_users[2]);
+    SetGame(&s_users[0], now);
+    CHECK(Rooms_Host(room, now) == &s_users[0]);
+    s_users[0].game_pkt_len = 0;
+    s_users[2].game_pkt_len = 0;
+    CHECK(Rooms_Host(room, now) == &s_users[0]);
+
+    /* The creator gone: the member in the room longest. */
+    Rooms_RemoveMember(room, &s_users[0]);
+    CHECK(Rooms_Host(room, now) == &s_users[1]);
+    Rooms_AddMember(room, &s_users[0]);
+    s_users[0].fd = 9;                          /* rejoined, new socket */
+    CHECK(Rooms_Host(room, now) == &s_users[1]);
+}
+
+static void TestGetList(void)
+{
+    const time_t now = 1000000;
+    RoomInfo     list[LOBBY_ROOMS];
+
+    ResetLobby();
+    Room *a = AddRoom("a", 4, -1, 1);           /* host unmeasured */
+    Room *b = AddRoom("b", 4, 60, 1);
+    Room *c = AddRoom("c", 4, 10, 2);
+    Room *d = AddRoom("d", 4, -1, 1);
+    Room *e = AddRoom("e", 4, 60, 3);           /* ties with b */
+
+    /* Viewer at 20 ms: c (30), then b and e (80) in creation order,
+     * then the rooms without an estimate, also in creation order. */
+    CHECK_EQ(Rooms_GetList(s_lobby, LOBBY_ROOMS, list, LOBBY_ROOMS, 20, now),
+             5);
+    CHECK_EQ(list[0].id, c->id);
+    CHECK_EQ(list[0].latency_ms, 30);
+    CHECK_EQ(list[0].player_count, 2);
+    CHECK_EQ(list[1].id, b->id);
+    CHECK_EQ(list[1].latency_ms, 80);
+    CHECK_EQ(list[2].id, e->id);
+    CHECK_EQ(list[2].latency_ms, 80);
+    CHECK_EQ(list[3].id, a->id);
+    CHECK_EQ(list[3].latency_ms, -1);
+    CHECK_EQ(list[4].id, d->id);
+    CHECK(strcmp(list[4].name, "d") == 0);
+
+    /* An unmeasured viewer has no estimates: creation order. */
+    CHECK_EQ(Rooms_GetList(s_lobby, LOBBY_ROOMS, list, LOBBY_ROOMS, -1, now),
+             5);
+    CHECK(list[0].id == a->id && list[1].id == b->id && list[2].id == c->id &&
+          list[3].id == d->id && list[4].id == e->id);
+    CHECK_EQ(list[2].latency_ms, -1);
+
+    /* The estimate follows the host's RTT. */
+    a->members[0]->rtt_ms = 0;
+    Rooms_GetList(s_lobby, LOBBY_ROOMS, list, LOBBY_ROOMS, 20, now);
+    CHECK_EQ(list[0].id, a->id);
+    CHECK_EQ(list[0].latency_ms, 20);
+    CHECK_EQ(list[1].id, c->id);
+}
+
+static void TestPickQuickJoin(void)
+{
+    const time_t now = 1000000;
+
+    /* Viewer at 20 ms; bands are ROOM_LATENCY_BAND_MS (25 ms) wide. */
+    ResetLobby();
+    Room *p = AddRoom("dota p", 4, 10, 1);      /* 30 ms, band 1, 1/4 */
+    Room *q = AddRoom("dota q", 4, 14, 2);      /* 34 ms, band 1, 2/4 */
+    Room *r = AddRoom("dota r", 4, 4, 1);       /* 24 ms, band 0, 1/4 */
+    Room *u = AddRoom("dota u", 4, -1, 3);      /* no estimate,   3/4 */
+
+    /* The lowest band wins, even emptier. */
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, NULL, 20, now) == r);
+
+    /* Within one band the fuller room wins, even slower (q over p). */
+    r->members[0]->rtt_ms = 40;                 /* 60 ms, band 2 */
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, "", 20, now) == q);
+
+    /* Same band and fill: the older room. */
+    Room *q2 = AddRoom("dota q2", 4, 12, 2);    /* 32 ms, band 1, 2/4 */
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, NULL, 20, now) == q);
+    Rooms_RemoveMember(q, q->members[1]);
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, NULL, 20, now) == q2);
+    Rooms_RemoveMember(q2, q2->members[1]);
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, NULL, 20, now) == p);
+
+    /* Fill is compared as a ratio: 2/8 is emptier than 1/2. */
+    Room *big = AddRoom("dota big", 8, 10, 2);
+    Room *two = AddRoom("dota two", 2, 10, 1);
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, NULL, 20, now) == two);
+
+    /* Full rooms are skipped; the filter narrows by name. */
+    User *late = &s_lobby_users[s_lobby_used++];
+    late->fd = 3 + (int)(late - s_lobby_users);
+    Rooms_AddMember(two, late);
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, NULL, 20, now) == p);
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, "big", 20, now) == big);
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, "none", 20, now) == NULL);
+
+    /* No estimate ranks last, however full... */
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, "dota u", 20, now) == u);
+    r->members[0]->rtt_ms = 5000;
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, "r", 20, now) == r);
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, "dota", 20, now) != u);
+
+    /* ...and with an unmeasured viewer, fill decides alone. */
+    CHECK(Rooms_PickQuickJoin(s_lobby, LOBBY_ROOMS, NULL, -1, now) == u);
+}
+
+static void TestPickHost(void)
+{
+    int worst = 0, mean = 0;
+
+    /* Nothing to choose with fewer than two members. */
+    Room *room = MakeRoom(1);
+    CHECK_EQ(Rooms_PickHost(room, &worst, &mean), -1);
+
+    /*
+     *        0    1    2    3
+     *   0    -   40   90   60
+     *   1   40    -   50   30
+     *   2   90   50    -   70
+     *   3   60   30   70    -
+     *
+     * Worst link per candidate: 0 -> 90, 1 -> 50, 2 -> 90, 3 -> 70.
+     */
+    room = MakeRoom(4);
+    SetPair(room, 0, 1, 40);
+    SetPair(room, 0, 2, 90);
+    SetPair(room, 0, 3, 60);
+    SetPair(room, 1, 2, 50);
+    SetPair(room, 1, 3, 30);
+    SetPair(room, 2, 3, 70);
+    CHECK_EQ(Rooms_PickHost(room, &worst, &mean), 1);
+    CHECK_EQ(worst, 50);
+    CHECK_EQ(mean, (40 + 50 + 30) / 3);
+
+    /* Loss counts ROOM_LOSS_PENALTY_MS per percent: 10% on 1<->2 makes
+     * it 100 ms, and 3 (worst 70) wins. */
+    room->loss_pct[1][2] = 10;
+    CHECK_EQ(Rooms_PickHost(room, &worst, &mean), 3);
+    CHECK_EQ(worst, 70);
+    CHECK_EQ(mean, (60 + 30 + 70) / 3);
+    room->loss_pct[1][2] = 0;
+
+    /* One-sided and asymmetric reports: the average of both directions,
+     * or the one that exists. */
+    room->rtt_ms[1][2] = 30;                    /* 2 -> 1 still says 50 */
+    room->rtt_ms[1][3] = -1;                    /* 3 -> 1 still says 30 */
+    CHECK_EQ(Rooms_PickHost(room, &worst, &mean), 1);
+    CHECK_EQ(worst, 40);
+    CHECK_EQ(mean, (40 + 40 + 30) / 3);
+
+    /* Ties on the worst link go to the lower mean. */
+    room = MakeRoom(3);
+    SetPair(room, 0, 1, 50);
+    SetPair(room, 0, 2, 50);
+    SetPair(room, 1, 2, 10);
+    CHECK_EQ(Rooms_PickHost(room, &worst, &mean), 1);
+    CHECK_EQ(worst, 50);
+    CHECK_EQ(mean, 30);
+
+    /* An unmeasured pair falls back to the path via the server; with
+     * no server figure either, candidates needing it drop out. */
+    room = MakeRoom(3);
+    SetPair(room, 0, 1, 20);
+    SetPair(room, 0, 2, 20);
+    CHECK_EQ(Rooms_PickHost(room, &worst, &mean), 0);
+    room->rtt_ms[0][2] = room->rtt_ms[2][0] = -1;
+    CHECK_EQ(Rooms_PickHost(room, &worst, &mean), -1);
+    room->server_rtt_ms[0] = 15;
+    room->server_rtt_ms[2] = 25;
+    CHECK_EQ(Rooms_PickHost(room, &worst, &mean), 0);
+    CHECK_EQ(worst, 40);
+}
+
+static void TestRemoveMemberCompacts(void)
+{
+    const int n = 5;
+    Room *room = MakeRoom(n);
+
+    /* Every cell says where it came from: 10 * row + column. */
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            if (i == j) continue;
+            room->rtt_ms[i][j]   = (int16_t)(10 * i + j);
+            room->loss_pct[i][j] = (uint8_t)(10 * i + j);
+        }
+        room->server_rtt_ms[i] = (int16_t)(100 + i);
+    }
+    room->host_hint = &s_users[2];
+
+    Rooms_RemoveMember(room, &s_users[2]);
+    CHECK_EQ(room->member_count, n - 1);
+    CHECK_EQ(s_users[2].room_id, -1);
+    CHECK(room->host_hint == NULL);
+
+    /* Members keep join order; row and column 2 are gone. */
+    static const int was[] = { 0, 1, 3, 4 };
+    for (int i = 0; i < n - 1; i++) {
+        CHECK(room->members[i] == &s_users[was[i]]);
+        CHECK_EQ(room->server_rtt_ms[i], 100 + was[i]);
+        for (int j = 0; j < n - 1; j++) {
+            if (i == j) continue;
+            CHECK_EQ(room->rtt_ms[i][j], 10 * was[i] + was[j]);
+            CHECK_EQ(room->loss_pct[i][j], 10 * was[i] + was[j]);
+        }
+    }
+
+    /* Removing the first and the last member. */
+    Rooms_RemoveMember(room, &s_users[0]);
+    Rooms_RemoveMember(room, &s_users[4]);
+    CHECK_EQ(room->member_count, 2);
+    CHECK(room->members[0] == &s_users[1] && room->members[1] == &s_users[3]);
+    CHECK_EQ(room->rtt_ms[0][1], 13);
+    CHECK_EQ(room->rtt_ms[1][0], 31);
+    CHECK_EQ(room->server_rtt_ms[1], 103);
+
+    /* A newcomer takes the freed row and column, unmeasured. */
+    Rooms_AddMember(room, &s_users[0]);
+    CHECK_EQ(room->rtt_ms[2][0], -1);
+    CHECK_EQ(room->rtt_ms[0][2], -1);
+    CHECK_EQ(room->loss_pct[1][2], 0);
+    CHECK_EQ(room->server_rtt_ms[2], -1);
+}
+
+int main(void)
+{
+    TestHost();
+    TestGetList();
+    TestPickQuickJoin();
+    TestPickHost();
+    TestRemoveMemberCompacts();
+    return TEST_RESULT();
+}
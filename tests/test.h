@@ -0,0 +1,44 @@
+/*
+ * test.h – Minimal assertions for the unit tests under tests/.
+ *
+ * Every test is its own executable, registered with ctest in
+ * CMakeLists.txt.  CHECK reports a failed condition and carries on, so
+ * one run lists every failure; main() ends with `return TEST_RESULT();`.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+static int t_checks;
+static int t_failures;
+
+#define CHECK(cond)                                                      \
+    do {                                                                 \
+        t_checks++;                                                      \
+        if (!(cond)) {                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n",                 \
+                    __FILE__, __LINE__, #cond);                          \
+            t_failures++;                                                \
+        }                                                                \
+    } while (0)
+
+/* Integer comparison that prints both sides when it fails. */
+#define CHECK_EQ(a, b)                                                   \
+    do {                                                                 \
+        long long t_a = (long long)(a), t_b = (long long)(b);            \
+        t_checks++;                                                      \
+        if (t_a != t_b) {                                                \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: "           \
+                    "%lld != %lld\n", __FILE__, __LINE__, #a, #b,        \
+                    t_a, t_b);                                           \
+            t_failures++;                                                \
+        }                                                                \
+    } while (0)
+
+#define TEST_RESULT()                                                    \
+    (printf("%d checks, %d failed\n", t_checks, t_failures),             \
+     t_failures == 0 ? 0 : 1)
+
+#endif /* TEST_H */
@@ -0,0 +1,169 @@
+/*
+ * w3filter_test.c – Unit tests for the broadcast fanout filter
+ * (common/w3filter.h): which packets are relevant, repeats inside and
+ * outside W3FILTER_REPEAT_MS, and the per-target token buckets.
+ */
+
+#include "test.h"
+#include "../common/w3filter.h"
+#include "../common/w3gs.h"
+
+#include <string.h>
+
+#define PKT_LEN 24
+
+/* A W3GS packet of PKT_LEN bytes; `tag` tells copies apart. */
+static void MakePacket(uint8_t *pkt, int id, int tag)
+{
+    memset(pkt, 0, PKT_LEN);
+    pkt[0] = W3GS_HEADER;
+    pkt[1] = (uint8_t)id;
+    pkt[2] = PKT_LEN;
+    pkt[4] = (uint8_t)tag;
+}
+
+/* ------------------------------------------------------------------ */
+
+static void TestClassify(void)
+{
+    static const int relevant[] = {
+        W3GS_SEARCHGAME, W3GS_GAMEINFO, W3GS_CREATEGAME,
+        W3GS_REFRESHGAME, W3GS_DECREATEGAME
+    };
+    uint8_t pkt[PKT_LEN];
+
+    for (size_t i = 0; i < sizeof(relevant) / sizeof(relevant[0]); i++) {
+        MakePacket(pkt, relevant[i], 0);
+        CHECK_EQ(W3Filter_IsRelevant(pkt, PKT_LEN), 1);
+    }
+
+    /* In-game traffic and chat are not discovery packets. */
+    MakePacket(pkt, 0x1E, 0);                   /* REQJOIN */
+    CHECK_EQ(W3Filter_IsRelevant(pkt, PKT_LEN), 0);
+    MakePacket(pkt, 0x34, 0);
+    CHECK_EQ(W3Filter_IsRelevant(pkt, PKT_LEN), 0);
+
+    /* Neither is anything whose header does not hold up. */
+    MakePacket(pkt, W3GS_GAMEINFO, 0);
+    CHECK_EQ(W3Filter_IsRelevant(pkt, PKT_LEN - 1), 0);
+    CHECK_EQ(W3Filter_IsRelevant(pkt, 3), 0);
+    pkt[0] = 0xF6;
+    CHECK_EQ(W3Filter_IsRelevant(pkt, PKT_LEN), 0);
+
+    W3Filter f;
+    W3Filter_Init(&f);
+    CHECK_EQ(W3Filter_Check(&f, pkt, PKT_LEN, 1000), 0);
+    CHECK_EQ(f.ignored, 1);
+    CHECK_EQ(f.forwarded, 0);
+}
+
+static void TestRepeats(void)
+{
+    W3Filter f;
+    uint8_t  a[PKT_LEN], b[PKT_LEN];
+    uint32_t t0 = 100000;
+
+    W3Filter_Init(&f);
+    MakePacket(a, W3GS_REFRESHGAME, 1);
+    MakePacket(b, W3GS_REFRESHGAME, 2);
+
+    /* Inside the window only the first copy goes out. */
+    CHECK_EQ(W3Filter_Check(&f, a, PKT_LEN, t0), 1);
+    CHECK_EQ(W3Filter_Check(&f, a, PKT_LEN, t0 + 1000), 0);
+    CHECK_EQ(W3Filter_Check(&f, a, PKT_LEN, t0 + W3FILTER_REPEAT_MS - 1), 0);
+
+    /* A different packet is not a repeat. */
+    CHECK_EQ(W3Filter_Check(&f, b, PKT_LEN, t0 + 1000), 1);
+
+    /* Once the window has passed, one copy goes out and starts a new one. */
+    CHECK_EQ(W3Filter_Check(&f, a, PKT_LEN, t0 + W3FILTER_REPEAT_MS), 1);
+    CHECK_EQ(W3Filter_Check(&f, a, PKT_LEN, t0 + W3FILTER_REPEAT_MS + 1), 0);
+    CHECK_EQ(f.forwarded, 3);
+    CHECK_EQ(f.repeats, 3);
+
+    /* The window survives the 32-bit clock wrapping. */
+    W3Filter_Init(&f);
+    CHECK_EQ(W3Filter_Check(&f, a, PKT_LEN, 0xFFFFF000u), 1);
+    CHECK_EQ(W3Filter_Check(&f, a, PKT_LEN, 0x00000100u), 0);
+    CHECK_EQ(W3Filter_Check(&f, a, PKT_LEN,
+                            0xFFFFF000u + W3FILTER_REPEAT_MS), 1);
+
+    /* Only W3FILTER_RECENT packets are remembered: the oldest is
+     * forgotten and goes out again. */
+    W3Filter_Init(&f);
+    uint8_t pkts[W3FILTER_RECENT + 1][PKT_LEN];
+    for (int i = 0; i <= W3FILTER_RECENT; i++) {
+        MakePacket(pkts[i], W3GS_GAMEINFO, i);
+        CHECK_EQ(W3Filter_Check(&f, pkts[i], PKT_LEN, t0), 1);
+    }
+    CHECK_EQ(W3Filter_Check(&f, pkts[W3FILTER_RECENT], PKT_LEN, t0 + 1), 0);
+    CHECK_EQ(W3Filter_Check(&f, pkts[0], PKT_LEN, t0 + 1), 1);
+
+    /* W3Filter_ForgetRecent lets everything through once. */
+    W3Filter_ForgetRecent(&f);
+    CHECK_EQ(W3Filter_Check(&f, pkts[W3FILTER_RECENT], PKT_LEN, t0 + 2), 1);
+    CHECK_EQ(W3Filter_Check(&f, pkts[W3FILTER_RECENT], PKT_LEN, t0 + 3), 0);
+}
+
+static void TestTokenBucket(void)
+{
+    const uint32_t addr = 0x0100007Fu, port = 0xE017u;
+    const uint32_t per_token = 1000 / W3FILTER_RATE;    /* ms */
+    uint32_t now = 50000;
+    W3Filter f;
+
+    W3Filter_Init(&f);
+
+    /* A new target starts with a full burst, then runs dry. */
+    for (int i = 0; i < W3FILTER_BURST; i++) {
+        CHECK_EQ(W3Filter_Allow(&f, addr, (uint16_t)port, now), 1);
+    }
+    CHECK_EQ(W3Filter_Allow(&f, addr, (uint16_t)port, now), 0);
+    CHECK_EQ(f.limited, 1);
+
+    /* Other targets have buckets of their own. */
+    CHECK_EQ(W3Filter_Allow(&f, addr + 1, (uint16_t)port, now), 1);
+    CHECK_EQ(W3Filter_Allow(&f, addr, (uint16_t)(port + 1), now), 1);
+
+    /* One token per 1000 / W3FILTER_RATE ms, not before. */
+    CHECK_EQ(W3Filter_Allow(&f, addr, (uint16_t)port, now + per_token - 1), 0);
+    CHECK_EQ(W3Filter_Allow(&f, addr, (uint16_t)port, now + per_token), 1);
+    CHECK_EQ(W3Filter_Allow(&f, addr, (uint16_t)port, now + per_token), 0);
+    now += per_token;
+
+    /* Sustained traffic gets W3FILTER_RATE per second. */
+    int passed = 0;
+    for (uint32_t ms = 10; ms <= 10000; ms += 10) {
+        passed += W3Filter_Allow(&f, addr, (uint16_t)port, now + ms);
+    }
+    CHECK_EQ(passed, 10 * W3FILTER_RATE);
+    now += 10000;
+
+    /* A long silence refills no more than the burst. */
+    now += 60000;
+    passed = 0;
+    for (int i = 0; i < 2 * W3FILTER_BURST; i++) {
+        passed += W3Filter_Allow(&f, addr, (uint16_t)port, now);
+    }
+    CHECK_EQ(passed, W3FILTER_BURST);
+
+    /* With every bucket taken, a new target evicts the least recently
+     * used one, which then starts over with a full burst. */
+    W3Filter_Init(&f);
+    for (uint32_t t = 0; t < W3FILTER_MAX_TARGETS; t++) {
+        for (int i = 0; i < W3FILTER_BURST; i++) {
+            W3Filter_Allow(&f, addr + t, (uint16_t)port, now + t);
+        }
+    }
+    CHECK_EQ(W3Filter_Allow(&f, addr + 1, (uint16_t)port, now + 100), 0);
+    CHECK_EQ(W3Filter_Allow(&f, addr + 100, (uint16_t)port, now + 100), 1);
+    CHECK_EQ(W3Filter_Allow(&f, addr, (uint16_t)port, now + 100), 1);
+}
+
+int main(void)
+{
+    TestClassify();
+    TestRepeats();
+    TestTokenBucket();
+    return TEST_RESULT();
+}
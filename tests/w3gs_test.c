@@ -0,0 +1,315 @@
+/*
+ * w3gs_test.c – Tests for the W3GS announcement parser (common/w3gs.h)
+ * and the reflector's game cache built on it (server/reflector.c).
+ *
+ * The packets are read from tests/fixtures/w3gs (the directory is the
+ * first argument):
+ *
+ *   gameinfo.bin                  a TFT 1.26 DotA announcement
+ *   refreshgame.bin               its REFRESHGAME, 3 players, 12 slots
+ *   decreategame.bin              its DECREATEGAME
+ *   creategame.bin                CREATEGAME, never cached
+ *   gameinfo_truncated.bin        the announcement cut 9 bytes short
+ *   gameinfo_no_terminator.bin    cut inside the stat string, with the
+ *                                 header length fixed up to match
+ *   gameinfo_oversized_stat.bin   a stat string decoding past 512 bytes
+ *   refreshgame_short.bin         REFRESHGAME without the slot count
+ */
+
+#include "test.h"
+#include "../common/w3gs.h"
+#include "../common/reflect.h"
+#include "../server/reflector.h"
+#include "../server/clock.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#endif
+
+#define FIXTURE_MAX 1024
+
+static const char *s_dir = ".";
+
+/* Read fixture `name` into `buf`; returns its length, 0 if missing. */
+static int Load(const char *name, uint8_t *buf)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", s_dir, name);
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        t_failures++;
+        return 0;
+    }
+    int len = (int)fread(buf, 1, FIXTURE_MAX, f);
+    fclose(f);
+    return len;
+}
+
+/* Rewrite the header's length field, as a sender that cut the body would. */
+static void SetLength(uint8_t *pkt, int len)
+{
+    pkt[2] = (uint8_t)(len & 0xFF);
+    pkt[3] = (uint8_t)(len >> 8);
+}
+
+/* ------------------------------------------------------------------ */
+
+static void TestPacketId(void)
+{
+    uint8_t pkt[FIXTURE_MAX];
+    int     len;
+
+    len = Load("gameinfo.bin", pkt);
+    CHECK_EQ(W3GS_PacketId(pkt, len), W3GS_GAMEINFO);
+    CHECK_EQ(W3GS_PacketId(pkt, len - 1), -1);      /* length mismatch */
+    CHECK_EQ(W3GS_PacketId(pkt, 3), -1);
+    pkt[0] = 0xF6;
+    CHECK_EQ(W3GS_PacketId(pkt, len), -1);
+
+    len = Load("creategame.bin", pkt);
+    CHECK_EQ(W3GS_PacketId(pkt, len), W3GS_CREATEGAME);
+    len = Load("refreshgame.bin", pkt);
+    CHECK_EQ(W3GS_PacketId(pkt, len), W3GS_REFRESHGAME);
+    len = Load("decreategame.bin", pkt);
+    CHECK_EQ(W3GS_PacketId(pkt, len), W3GS_DECREATEGAME);
+}
+
+static void TestParseGameInfo(void)
+{
+    uint8_t       pkt[FIXTURE_MAX];
+    W3GS_GameInfo info;
+    int           len = Load("gameinfo.bin", pkt);
+
+    CHECK_EQ(W3GS_ParseGameInfo(pkt, len, &info), 0);
+    CHECK_EQ(info.version, 26);
+    CHECK_EQ(info.host_counter, 0x2A);
+    CHECK(strcmp(info.game_name, "dota -apem 5v5") == 0);
+    CHECK(strcmp(info.map_path, "Maps\\Download\\DotA v6.83d.w3x") == 0);
+    CHECK(strcmp(info.host_name, "Hoster") == 0);
+    CHECK_EQ(info.map_width, 116);
+    CHECK_EQ(info.map_height, 116);
+    CHECK_EQ(info.map_crc, 0x5B1A6E3C);
+    CHECK_EQ(info.slots_total, 12);
+    CHECK_EQ(info.slots_open, 10);
+    CHECK_EQ(info.players, -1);
+    CHECK_EQ(info.port, 6112);
+
+    /* Other packets are not announcements. */
+    len = Load("refreshgame.bin", pkt);
+    CHECK_EQ(W3GS_ParseGameInfo(pkt, len, &info), -1);
+}
+
+static void TestMalformed(void)
+{
+    uint8_t       pkt[FIXTURE_MAX];
+    W3GS_GameInfo info;
+    int           len;
+
+    len = Load("gameinfo_truncated.bin", pkt);
+    CHECK(len > 0);
+    CHECK_EQ(W3GS_ParseGameInfo(pkt, len, &info), -1);
+
+    len = Load("gameinfo_no_terminator.bin", pkt);
+    CHECK_EQ(W3GS_PacketId(pkt, len), W3GS_GAMEINFO);
+    CHECK_EQ(W3GS_ParseGameInfo(pkt, len, &info), -1);
+
+    len = Load("gameinfo_oversized_stat.bin", pkt);
+    CHECK_EQ(W3GS_PacketId(pkt, len), W3GS_GAMEINFO);
+    CHECK_EQ(W3GS_ParseGameInfo(pkt, len, &info), -1);
+
+    /* Every shorter cut of the good packet, header fixed up, fails. */
+    len = Load("gameinfo.bin", pkt);
+    int accepted = 0;
+    for (int cut = 4; cut < len; cut++) {
+        SetLength(pkt, cut);
+        if (W3GS_ParseGameInfo(pkt, cut, &info) == 0) accepted++;
+    }
+    CHECK_EQ(accepted, 0);
+}
+
+static void TestApplyRefresh(void)
+{
+    uint8_t       gi[FIXTURE_MAX], pkt[FIXTURE_MAX];
+    W3GS_GameInfo info;
+    int           len;
+
+    W3GS_ParseGameInfo(gi, Load("gameinfo.bin", gi), &info);
+
+    len = Load("refreshgame.bin", pkt);
+    info.slots_total = 10;
+    CHECK_EQ(W3GS_ApplyRefresh(pkt, len, &info), 0);
+    CHECK_EQ(info.players, 3);
+    CHECK_EQ(info.slots_total, 12);
+
+    /* A refresh for another game (host counter) leaves it alone. */
+    info.host_counter++;
+    info.players = 1;
+    CHECK_EQ(W3GS_ApplyRefresh(pkt, len, &info), -1);
+    CHECK_EQ(info.players, 1);
+    info.host_counter--;
+
+    len = Load("refreshgame_short.bin", pkt);
+    CHECK_EQ(W3GS_ApplyRefresh(pkt, len, &info), -1);
+    CHECK_EQ(info.players, 1);
+
+    len = Load("gameinfo.bin", pkt);
+    CHECK_EQ(W3GS_ApplyRefresh(pkt, len, &info), -1);
+}
+
+/* ------------------------------------------------------------------ */
+/*  The reflector's cache, over loopback                              */
+/* ------------------------------------------------------------------ */
+
+#ifndef _WIN32
+
+static uint64_t s_now_us = 1700000000ull * 1000000ull;
+
+static uint64_t TestClock(void *ctx)
+{
+    (void)ctx;
+    return s_now_us;
+}
+
+static User s_users[2];
+static Room s_rooms[1];
+static int  s_fd = -1;
+
+/* Send `w3gs` from s_users[0] through the reflector and process it. */
+static void Reflect(const uint8_t *w3gs, int len)
+{
+    uint8_t  dgram[REFLECT_HDR_SIZE + FIXTURE_MAX];
+    uint32_t token = s_users[0].udp_token;
+
+    dgram[0] = REFLECT_MAGIC0;
+    dgram[1] = REFLECT_MAGIC1;
+    dgram[2] = REFLECT_MAGIC2;
+    dgram[3] = REFLECT_MAGIC3;
+    dgram[4] = (uint8_t)(token >> 24);
+    dgram[5] = (uint8_t)(token >> 16);
+    dgram[6] = (uint8_t)(token >> 8);
+    dgram[7] = (uint8_t)token;
+    memcpy(dgram + REFLECT_HDR_SIZE, w3gs, (size_t)len);
+
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family      = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    to.sin_port        = htons((uint16_t)Reflector_Port());
+    sendto(s_fd, dgram, (size_t)(REFLECT_HDR_SIZE + len), 0,
+           (struct sockaddr *)&to, sizeof(to));
+
+    /* Loopback delivers at once, but give the stack a few tries. */
+    for (int i = 0; i < 100; i++) {
+        if (Reflector_Drain(s_rooms, 1, NULL, NULL) > 0) return;
+        usleep(1000);
+    }
+    fprintf(stderr, "reflector received nothing\n");
+    t_failures++;
+}
+
+static void TestReflectorCache(void)
+{
+    uint8_t pkt[FIXTURE_MAX];
+    int     len;
+    User   *host = &s_users[0];
+
+    Clock_SetSource(TestClock, NULL);
+    CHECK(Reflector_Open(0) >= 0);
+    s_fd = (int)socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(s_fd >= 0);
+
+    Users_Init(s_users, 2);
+    Rooms_Init(s_rooms, 1);
+    Room *room = Rooms_Create(s_rooms, 1, "test", 2, 3);
+    for (int i = 0; i < 2; i++) {
+        s_users[i].fd = 3 + i;
+        snprintf(s_users[i].username, sizeof(s_users[i].username),
+                 "user%d", i);
+        Rooms_AddMember(room, &s_users[i]);
+        Reflector_IssueToken(&s_users[i]);
+    }
+
+    /* Malformed announcements are forwarded but never cached. */
+    len = Load("gameinfo_no_terminator.bin", pkt);
+    Reflect(pkt, len);
+    CHECK_EQ(host->game_pkt_len, 0);
+    CHECK(Users_LiveGame(host, Clock_Wall()) == NULL);
+
+    len = Load("gameinfo.bin", pkt);
+    Reflect(pkt, len);
+    CHECK_EQ(host->game_pkt_len, REFLECT_HDR_SIZE + len);
+    const W3GS_GameInfo *game = Users_LiveGame(host, Clock_Wall());
+    CHECK(game != NULL);
+    if (game != NULL) {
+        CHECK(strcmp(game->game_name, "dota -apem 5v5") == 0);
+        CHECK_EQ(game->players, -1);
+    }
+
+    /* A refresh fills in the player count; a repeated GAMEINFO keeps it. */
+    len = Load("refreshgame.bin", pkt);
+    Reflect(pkt, len);
+    CHECK_EQ(host->game.players, 3);
+    len = Load("gameinfo.bin", pkt);
+    pkt[len - 6]++;                             /* one more second up */
+    Reflect(pkt, len);
+    CHECK_EQ(host->game.players, 3);
+
+    /* Without refreshes the game expires after USER_GAME_TTL. */
+    time_t seen = host->game_seen;
+    s_now_us += (uint64_t)USER_GAME_TTL * 1000000ull;
+    CHECK(Users_LiveGame(host, Clock_Wall()) != NULL);
+    s_now_us += 1000000ull;
+    CHECK(Users_LiveGame(host, Clock_Wall()) == NULL);
+
+    /* A refresh brings it back. */
+    len = Load("refreshgame.bin", pkt);
+    Reflect(pkt, len);
+    CHECK_EQ(host->game_seen, seen + USER_GAME_TTL + 1);
+    CHECK(Users_LiveGame(host, Clock_Wall()) != NULL);
+
+    /* A short refresh neither applies nor keeps the game alive. */
+    s_now_us += 10 * 1000000ull;
+    len = Load("refreshgame_short.bin", pkt);
+    Reflect(pkt, len);
+    CHECK_EQ(host->game_seen, seen + USER_GAME_TTL + 1);
+
+    /* CREATEGAME is forwarded only; DECREATEGAME withdraws the game. */
+    len = Load("creategame.bin", pkt);
+    Reflect(pkt, len);
+    CHECK(host->game_pkt_len > 0);
+    len = Load("decreategame.bin", pkt);
+    Reflect(pkt, len);
+    CHECK_EQ(host->game_pkt_len, 0);
+    CHECK(Users_LiveGame(host, Clock_Wall()) == NULL);
+
+    /* And a refresh cannot revive a withdrawn game. */
+    len = Load("refreshgame.bin", pkt);
+    Reflect(pkt, len);
+    CHECK(Users_LiveGame(host, Clock_Wall()) == NULL);
+
+    close(s_fd);
+    Reflector_Close();
+    Clock_SetSource(NULL, NULL);
+}
+
+#endif /* !_WIN32 */
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) s_dir = argv[1];
+
+    TestPacketId();
+    TestParseGameInfo();
+    TestMalformed();
+    TestApplyRefresh();
+#ifndef _WIN32
+    TestReflectorCache();
+#endif
+    return TEST_RESULT();
+}
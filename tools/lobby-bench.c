@@ -0,0 +1,881 @@
+/*
+ * lobby-bench.c – Load generator for war3-lobby-server.
+ *
+ * Simulates many lobby clients from one process and measures what they
+ * see.  Every client runs the same script with its own random timing:
+ *
+ *   connect, login, list rooms, then until the run ends
+ *     - heartbeat every -H seconds (the GUI client sends one every 15)
+ *     - outside a room: join one from the last list, create one if none
+ *       has space, or refresh the list; with -m, that share of these
+ *       actions queue for matchmaking instead (4 players, one of
+ *       BENCH_MATCH_TAGS tags)
+ *     - inside a room: a burst of chat lines, a list refresh, or leave
+ *   with an exponentially distributed pause (mean -t ms) between actions.
+ *
+ * Latency is end to end, from just before the request is written to the
+ * moment its reply is parsed:
+ *   login, room_list, room_create, room_join, room_leave – their reply
+ *   heartbeat – the heartbeat_ack echoing the request's "ts"
+ *   chat      – the client's own line coming back in the room broadcast
+ *   match_enqueue – time to match: the room_joined the server sends when
+ *               it forms the room
+ * A client keeps at most one request of the first group in flight;
+ * heartbeats and chats are pipelined.
+ *
+ * Clients connect at -r per second.  Measurement starts once all of
+ * them have connected and logged in (or failed to), and lasts -d
+ * seconds (logins are measured over the ramp-up instead); the report
+ * gives per-type throughput and latency percentiles, and -o writes the
+ * same as JSON for comparing builds.
+ *
+ * Usage:
+ *   lobby-bench [-c clients] [-d seconds] [-r connects/s] [-H hb_s]
+ *               [-t think_ms] [-m match_pct] [-o result.json]
+ *               <server> <port>
+ *
+ * Linux only (epoll).  The server accepts MAX_USERS connections; more
+ * clients than that show up as rejected.
+ */
+
+#define _GNU_SOURCE
+
+#include "../common/protocol.h"
+#include "../common/message.h"
+#include "../common/alloc.h"
+#include "../third_party/cJSON/cJSON.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RECV_INIT      8192
+#define BENCH_TIMEOUT_US     (10 * 1000000ull)   /* request given up */
+#define BENCH_LOGIN_WAIT_US  (10 * 1000000ull)   /* max wait before run */
+#define BENCH_MAX_ROOMS      64
+#define BENCH_EPOLL_BATCH    256
+#define BENCH_TICK_MS        2
+#define BENCH_MATCH_SIZE     4
+#define BENCH_MATCH_TAGS     4
+
+/* ------------------------------------------------------------------ */
+/*  Measured operations                                               */
+/* ------------------------------------------------------------------ */
+
+typedef enum {
+    OP_LOGIN,
+    OP_ROOM_LIST,
+    OP_ROOM_CREATE,
+    OP_ROOM_JOIN,
+    OP_ROOM_LEAVE,
+    OP_HEARTBEAT,
+    OP_CHAT,
+    OP_MATCH,
+    OP_COUNT,
+    OP_NONE = -1
+} Op;
+
+static const char *const s_op_names[OP_COUNT] = {
+    [OP_LOGIN]       = MSG_LOGIN,
+    [OP_ROOM_LIST]   = MSG_ROOM_LIST,
+    [OP_ROOM_CREATE] = MSG_ROOM_CREATE,
+    [OP_ROOM_JOIN]   = MSG_ROOM_JOIN,
+    [OP_ROOM_LEAVE]  = MSG_ROOM_LEAVE,
+    [OP_HEARTBEAT]   = MSG_HEARTBEAT,
+    [OP_CHAT]        = MSG_CHAT,
+    [OP_MATCH]       = MSG_MATCH_ENQUEUE,
+};
+
+typedef struct {
+    uint64_t  sent;
+    uint64_t  ok;
+    uint64_t  errors;                  /* error / login_fail replies */
+    uint64_t  timeouts;
+    uint32_t *lat_us;                  /* one sample per ok reply */
+    size_t    lat_count;
+    size_t    lat_cap;
+} OpStats;
+
+static OpStats s_ops[OP_COUNT];
+
+/* ------------------------------------------------------------------ */
+/*  Clients                                                           */
+/* ------------------------------------------------------------------ */
+
+typedef enum {
+    CS_IDLE,                           /* not connected yet */
+    CS_CONNECTING,
+    CS_LOGGING_IN,
+    CS_READY,
+    CS_CLOSED
+} ClientState;
+
+typedef struct {
+    int         fd;
+    ClientState state;
+    char        name[MAX_USERNAME];
+    int         room_id;               /* -1 = lobby */
+
+    Op          pending;               /* request in flight, or OP_NONE */
+    uint64_t    pending_us;
+
+    uint64_t    next_action_us;
+    uint64_t    next_hb_us;
+    uint64_t    chat_seq;
+
+    uint8_t    *rbuf;
+    uint32_t    rlen, rcap;
+    uint8_t    *wbuf;
+    uint32_t    wlen, woff, wcap;
+
+    uint64_t    rng;
+} Client;
+
+typedef struct {
+    int id;
+    int players, max;
+} KnownRoom;
+
+static Client   *s_clients;
+static int       s_nclients = 100;
+static int       s_duration_s = 30;
+static int       s_connect_rate = 200;
+static int       s_hb_s = 15;
+static int       s_think_ms = 2000;
+static int       s_match_pct = 0;
+static const char *s_outfile;
+static struct sockaddr_in s_addr;
+static int       s_ep;
+
+/* Shared view of the room list, refreshed by every room_list_result. */
+static KnownRoom s_rooms[BENCH_MAX_ROOMS];
+static int       s_room_count;
+
+/* Run window; samples outside it are not recorded. */
+static uint64_t  s_run_start_us, s_run_end_us;
+
+static uint64_t  s_msgs_in, s_bytes_in, s_msgs_out, s_bytes_out;
+static uint64_t  s_connect_failed, s_rejected, s_disconnected;
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void OnSignal(int sig)
+{
+    (void)sig;
+    s_stop = 1;
+}
+
+static uint64_t NowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/* xorshift64*: per-client, so runs do not depend on event order. */
+static uint64_t Rand(Client *c)
+{
+    c->rng ^= c->rng >> 12;
+    c->rng ^= c->rng << 25;
+    c->rng ^= c->rng >> 27;
+    return c->rng * 0x2545F4914F6CDD1Dull;
+}
+
+static double RandUnit(Client *c)
+{
+    return (double)(Rand(c) >> 11) / (double)(1ull << 53);
+}
+
+/* Exponential pause with the configured mean. */
+static uint64_t ThinkUs(Client *c)
+{
+    double u = RandUnit(c);
+    return (uint64_t)(-log(1.0 - u) * s_think_ms * 1000.0);
+}
+
+static int InRun(uint64_t sent_us)
+{
+    return s_run_start_us != 0 && sent_us >= s_run_start_us &&
+           sent_us < s_run_end_us;
+}
+
+/* Logins all happen during the ramp-up, so they count from the start. */
+static int Counted(Op op, uint64_t sent_us)
+{
+    return op == OP_LOGIN || InRun(sent_us);
+}
+
+static void RecordOk(Op op, uint64_t sent_us, uint64_t now_us)
+{
+    if (!Counted(op, sent_us)) return;
+    OpStats *st = &s_ops[op];
+    st->ok++;
+    if (st->lat_count == st->lat_cap) {
+        size_t cap = st->lat_cap ? st->lat_cap * 2 : 1024;
+        uint32_t *p = realloc(st->lat_us, cap * sizeof(uint32_t));
+        if (p == NULL) return;
+        st->lat_us  = p;
+        st->lat_cap = cap;
+    }
+    uint64_t d = now_us - sent_us;
+    st->lat_us[st->lat_count++] = d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Sending                                                           */
+/* ------------------------------------------------------------------ */
+
+static void CloseClient(Client *c)
+{
+    if (c->fd >= 0) {
+        epoll_ctl(s_ep, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+    }
+    c->fd    = -1;
+    c->state = CS_CLOSED;
+    free(c->rbuf);
+    free(c->wbuf);
+    c->rbuf = c->wbuf = NULL;
+    c->rlen = c->rcap = c->wlen = c->woff = c->wcap = 0;
+}
+
+static void WatchWrite(Client *c, int on)
+{
+    struct epoll_event ev = { .events = EPOLLIN | (on ? EPOLLOUT : 0),
+                              .data.ptr = c };
+    epoll_ctl(s_ep, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void Flush(Client *c)
+{
+    while (c->woff < c->wlen) {
+        ssize_t n = send(c->fd, c->wbuf + c->woff, c->wlen - c->woff,
+                         MSG_NOSIGNAL);
+        if (n > 0) {
+            c->woff      += (uint32_t)n;
+            s_bytes_out  += (uint64_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            WatchWrite(c, 1);
+            return;
+        }
+        s_disconnected++;
+        CloseClient(c);
+        return;
+    }
+    c->wlen = c->woff = 0;
+}
+
+/* Frame and queue one message, then try to write it. */
+static int Send(Client *c, cJSON *msg)
+{
+    char *s = cJSON_PrintUnformatted(msg);
+    cJSON_Delete(msg);
+    if (s == NULL) return -1;
+
+    uint32_t len;
+    uint8_t *frame = Protocol_Frame(s, &len);
+    free(s);
+    if (frame == NULL) return -1;
+
+    if (c->wlen + len > c->wcap) {
+        uint32_t cap = c->wcap ? c->wcap : 1024;
+        while (cap < c->wlen + len) cap *= 2;
+        uint8_t *p = realloc(c->wbuf, cap);
+        if (p == NULL) { Alloc_Free(frame); return -1; }
+        c->wbuf = p;
+        c->wcap = cap;
+    }
+    memcpy(c->wbuf + c->wlen, frame, len);
+    c->wlen += len;
+    Alloc_Free(frame);
+    s_msgs_out++;
+
+    if (c->woff == 0) Flush(c);
+    return c->state == CS_CLOSED ? -1 : 0;
+}
+
+static cJSON *NewMsg(const char *type)
+{
+    cJSON *m = cJSON_CreateObject();
+    cJSON_AddStringToObject(m, "type", type);
+    return m;
+}
+
+/* Send a request that expects exactly one reply. */
+static void Request(Client *c, Op op, cJSON *msg, uint64_t now)
+{
+    c->pending    = op;
+    c->pending_us = now;
+    if (Counted(op, now)) s_ops[op].sent++;
+    Send(c, msg);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Script                                                            */
+/* ------------------------------------------------------------------ */
+
+static void SendHeartbeat(Client *c, uint64_t now)
+{
+    cJSON *m = NewMsg(MSG_HEARTBEAT);
+    cJSON_AddNumberToObject(m, "ts", (double)now);
+    if (InRun(now)) s_ops[OP_HEARTBEAT].sent++;
+    Send(c, m);
+}
+
+static void SendChatBurst(Client *c, uint64_t now)
+{
+    static const char filler[] =
+        "gg wp anyone up for another round on lost temple? need one more";
+    int lines = 1 + (int)(Rand(c) % 5);
+
+    for (int i = 0; i < lines && c->state == CS_READY; i++) {
+        /* "<send time> <seq> <filler>": the send time comes back in
+         * the broadcast. */
+        char text[MAX_CHAT_MSG];
+        int  pad = (int)(Rand(c) % (sizeof(filler) - 1));
+        snprintf(text, sizeof(text), "%llu %llu %.*s",
+                 (unsigned long long)now,
+                 (unsigned long long)c->chat_seq++, pad, filler);
+
+        cJSON *m = NewMsg(MSG_CHAT);
+        cJSON_AddStringToObject(m, "message", text);
+        if (InRun(now)) s_ops[OP_CHAT].sent++;
+        Send(c, m);
+    }
+}
+
+static const KnownRoom *PickRoom(Client *c)
+{
+    int open[BENCH_MAX_ROOMS], n = 0;
+    for (int i = 0; i < s_room_count; i++) {
+        if (s_rooms[i].players < s_rooms[i].max) open[n++] = i;
+    }
+    return n ? &s_rooms[open[Rand(c) % (uint64_t)n]] : NULL;
+}
+
+static void NextAction(Client *c, uint64_t now)
+{
+    double u = RandUnit(c);
+
+    if (c->room_id == -1) {
+        if (s_match_pct > 0 && Rand(c) % 100 < (uint64_t)s_match_pct) {
+            char tag[16];
+            snprintf(tag, sizeof(tag), "bench%d",
+                     (int)(Rand(c) % BENCH_MATCH_TAGS));
+            cJSON *m = NewMsg(MSG_MATCH_ENQUEUE);
+            cJSON_AddNumberToObject(m, "size", BENCH_MATCH_SIZE);
+            cJSON_AddStringToObject(m, "tag", tag);
+            Request(c, OP_MATCH, m, now);
+            return;
+        }
+        if (u < 0.2) {
+            Request(c, OP_ROOM_LIST, NewMsg(MSG_ROOM_LIST), now);
+            return;
+        }
+        const KnownRoom *r = PickRoom(c);
+        if (r != NULL && u < 0.85) {
+            cJSON *m = NewMsg(MSG_ROOM_JOIN);
+            cJSON_AddNumberToObject(m, "room_id", r->id);
+            Request(c, OP_ROOM_JOIN, m, now);
+        } else {
+            cJSON *m = NewMsg(MSG_ROOM_CREATE);
+            cJSON_AddStringToObject(m, "name", c->name);
+            cJSON_AddNumberToObject(m, "max_players", 8);
+            Request(c, OP_ROOM_CREATE, m, now);
+        }
+    } else {
+        if (u < 0.6) {
+            SendChatBurst(c, now);
+        } else if (u < 0.75) {
+            Request(c, OP_ROOM_LIST, NewMsg(MSG_ROOM_LIST), now);
+        } else {
+            Request(c, OP_ROOM_LEAVE, NewMsg(MSG_ROOM_LEAVE), now);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Receiving                                                         */
+/* ------------------------------------------------------------------ */
+
+static int IntOf(const cJSON *obj, const char *key, int def)
+{
+    const cJSON *j = cJSON_GetObjectItem(obj, key);
+    return cJSON_IsNumber(j) ? j->valueint : def;
+}
+
+static void OnRoomList(const cJSON *msg)
+{
+    const cJSON *arr = cJSON_GetObjectItem(msg, "rooms");
+    const cJSON *it;
+    s_room_count = 0;
+    cJSON_ArrayForEach(it, arr) {
+        if (s_room_count == BENCH_MAX_ROOMS) break;
+        KnownRoom *r = &s_rooms[s_room_count++];
+        r->id      = IntOf(it, "id", 0);
+        r->players = IntOf(it, "players", 0);
+        r->max     = IntOf(it, "max", 0);
+    }
+}
+
+/* Reply to the request in flight: record it and clear it. */
+static void Complete(Client *c, Op op, int ok, uint64_t now)
+{
+    if (c->pending != op) return;
+    if (ok) {
+        RecordOk(op, c->pending_us, now);
+    } else if (Counted(op, c->pending_us)) {
+        s_ops[op].errors++;
+    }
+    c->pending = OP_NONE;
+}
+
+static void OnMessage(Client *c, const cJSON *msg, uint64_t now)
+{
+    const cJSON *j_type = cJSON_GetObjectItem(msg, "type");
+    if (!cJSON_IsString(j_type)) return;
+    const char *type = j_type->valuestring;
+
+    if (strcmp(type, MSG_HEARTBEAT_ACK) == 0) {
+        const cJSON *ts = cJSON_GetObjectItem(msg, "ts");
+        if (cJSON_IsNumber(ts))
+            RecordOk(OP_HEARTBEAT, (uint64_t)ts->valuedouble, now);
+    }
+    else if (strcmp(type, MSG_CHAT_MSG) == 0) {
+        const cJSON *from = cJSON_GetObjectItem(msg, "from");
+        const cJSON *text = cJSON_GetObjectItem(msg, "message");
+        if (cJSON_IsString(from) && strcmp(from->valuestring, c->name) == 0 &&
+            cJSON_IsString(text))
+            RecordOk(OP_CHAT, strtoull(text->valuestring, NULL, 10), now);
+    }
+    else if (strcmp(type, MSG_LOGIN_OK) == 0) {
+        Complete(c, OP_LOGIN, 1, now);
+        c->state = CS_READY;
+        Request(c, OP_ROOM_LIST, NewMsg(MSG_ROOM_LIST), now);
+    }
+    else if (strcmp(type, MSG_LOGIN_FAIL) == 0) {
+        Complete(c, OP_LOGIN, 0, now);
+        CloseClient(c);
+    }
+    else if (strcmp(type, MSG_ROOM_LIST_RES) == 0) {
+        OnRoomList(msg);
+        Complete(c, OP_ROOM_LIST, 1, now);
+    }
+    else if (strcmp(type, MSG_ROOM_CREATED) == 0) {
+        c->room_id = IntOf(msg, "room_id", -1);
+        Complete(c, OP_ROOM_CREATE, 1, now);
+    }
+    else if (strcmp(type, MSG_ROOM_JOINED) == 0) {
+        c->room_id = IntOf(msg, "room_id", -1);
+        if (cJSON_IsTrue(cJSON_GetObjectItem(msg, "match")))
+            Complete(c, OP_MATCH, 1, now);
+        else
+            Complete(c, OP_ROOM_JOIN, 1, now);
+    }
+    else if (strcmp(type, MSG_MATCH_TIMEOUT) == 0) {
+        Complete(c, OP_MATCH, 0, now);
+    }
+    else if (strcmp(type, MSG_ROOM_LEFT) == 0) {
+        c->room_id = -1;
+        Complete(c, OP_ROOM_LEAVE, 1, now);
+    }
+    else if (strcmp(type, MSG_ERROR) == 0) {
+        /* Errors carry no request type; blame the one in flight. */
+        if (c->pending != OP_NONE) Complete(c, c->pending, 0, now);
+    }
+}
+
+static void OnReadable(Client *c, uint64_t now)
+{
+    for (;;) {
+        if (c->rlen == c->rcap) {
+            uint32_t cap = c->rcap ? c->rcap * 2 : BENCH_RECV_INIT;
+            if (cap > FRAME_HEADER_SIZE + MAX_MSG_SIZE)
+                cap = FRAME_HEADER_SIZE + MAX_MSG_SIZE;
+            if (cap == c->rcap) { CloseClient(c); return; }
+            uint8_t *p = realloc(c->rbuf, cap);
+            if (p == NULL) { CloseClient(c); return; }
+            c->rbuf = p;
+            c->rcap = cap;
+        }
+
+        ssize_t n = recv(c->fd, c->rbuf + c->rlen, c->rcap - c->rlen, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            /* Closed before the login reply: no free slot. */
+            if (c->state == CS_LOGGING_IN) s_rejected++;
+            else                           s_disconnected++;
+            CloseClient(c);
+            return;
+        }
+        c->rlen    += (uint32_t)n;
+        s_bytes_in += (uint64_t)n;
+
+        uint32_t off = 0;
+        for (;;) {
+            const char *json;
+            uint32_t    json_len;
+            uint32_t    used = Protocol_Peek(c->rbuf + off, c->rlen - off,
+                                             &json, &json_len);
+            if (used == 0) break;
+            off += used;
+            s_msgs_in++;
+
+            cJSON *msg = cJSON_ParseWithLength(json, json_len);
+            if (msg) {
+                OnMessage(c, msg, now);
+                cJSON_Delete(msg);
+            }
+            if (c->state == CS_CLOSED) return;
+        }
+        if (off > 0) {
+            memmove(c->rbuf, c->rbuf + off, c->rlen - off);
+            c->rlen -= off;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Connections                                                       */
+/* ------------------------------------------------------------------ */
+
+static void StartConnect(Client *c, uint64_t now)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        s_connect_failed++;
+        c->state = CS_CLOSED;
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, (struct sockaddr *)&s_addr, sizeof(s_addr)) < 0 &&
+        errno != EINPROGRESS) {
+        close(fd);
+        s_connect_failed++;
+        c->state = CS_CLOSED;
+        return;
+    }
+
+    c->fd    = fd;
+    c->state = CS_CONNECTING;
+    c->pending_us = now;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = c };
+    epoll_ctl(s_ep, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void OnConnected(Client *c, uint64_t now)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+        s_connect_failed++;
+        CloseClient(c);
+        return;
+    }
+
+    WatchWrite(c, 0);
+    c->state       = CS_LOGGING_IN;
+    c->next_hb_us  = now + Rand(c) % ((uint64_t)s_hb_s * 1000000u);
+
+    cJSON *m = NewMsg(MSG_LOGIN);
+    cJSON_AddStringToObject(m, "username", c->name);
+    Request(c, OP_LOGIN, m, now);
+    c->next_action_us = now + ThinkUs(c);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Report                                                            */
+/* ------------------------------------------------------------------ */
+
+static int CmpU32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double Pct(const OpStats *st, double p)
+{
+    if (st->lat_count == 0) return 0;
+    size_t i = (size_t)(p * (double)(st->lat_count - 1) + 0.5);
+    return st->lat_us[i] / 1000.0;
+}
+
+static void Report(const char *host, int port, double secs,
+                   int connected, int logged_in)
+{
+    printf("\nlobby-bench: %d clients against %s:%d, %.1f s measured\n",
+           s_nclients, host, port, secs);
+    printf("  connected %d, logged in %d, connect failures %llu, "
+           "rejected %llu, disconnects %llu\n", connected, logged_in,
+           (unsigned long long)s_connect_failed,
+           (unsigned long long)s_rejected,
+           (unsigned long long)s_disconnected);
+    printf("  sent %llu msgs (%.0f/s), received %llu msgs (%.0f/s)\n\n",
+           (unsigned long long)s_msgs_out, s_msgs_out / secs,
+           (unsigned long long)s_msgs_in, s_msgs_in / secs);
+
+    printf("  %-14s %9s %9s %7s %7s %8s %8s %8s %8s %8s\n",
+           "type", "sent", "ok", "errors", "timeout", "ok/s",
+           "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (int op = 0; op < OP_COUNT; op++) {
+        OpStats *st = &s_ops[op];
+        qsort(st->lat_us, st->lat_count, sizeof(uint32_t), CmpU32);
+        printf("  %-14s %9llu %9llu %7llu %7llu %8.0f "
+               "%8.2f %8.2f %8.2f %8.2f\n", s_op_names[op],
+               (unsigned long long)st->sent, (unsigned long long)st->ok,
+               (unsigned long long)st->errors,
+               (unsigned long long)st->timeouts, st->ok / secs,
+               Pct(st, 0.50), Pct(st, 0.90), Pct(st, 0.99), Pct(st, 1.0));
+    }
+
+    if (s_outfile == NULL) return;
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "server", host);
+    cJSON_AddNumberToObject(root, "port", port);
+    cJSON_AddNumberToObject(root, "clients", s_nclients);
+    cJSON_AddNumberToObject(root, "connected", connected);
+    cJSON_AddNumberToObject(root, "logged_in", logged_in);
+    cJSON_AddNumberToObject(root, "connect_failures", (double)s_connect_failed);
+    cJSON_AddNumberToObject(root, "rejected", (double)s_rejected);
+    cJSON_AddNumberToObject(root, "disconnects", (double)s_disconnected);
+    cJSON_AddNumberToObject(root, "duration_s", secs);
+    cJSON_AddNumberToObject(root, "heartbeat_s", s_hb_s);
+    cJSON_AddNumberToObject(root, "think_ms", s_think_ms);
+    cJSON_AddNumberToObject(root, "match_pct", s_match_pct);
+    cJSON_AddNumberToObject(root, "msgs_sent", (double)s_msgs_out);
+    cJSON_AddNumberToObject(root, "msgs_received", (double)s_msgs_in);
+    cJSON_AddNumberToObject(root, "bytes_sent", (double)s_bytes_out);
+    cJSON_AddNumberToObject(root, "bytes_received", (double)s_bytes_in);
+
+    cJSON *types = cJSON_AddObjectToObject(root, "types");
+    for (int op = 0; op < OP_COUNT; op++) {
+        const OpStats *st = &s_ops[op];
+        cJSON *t = cJSON_AddObjectToObject(types, s_op_names[op]);
+        cJSON_AddNumberToObject(t, "sent", (double)st->sent);
+        cJSON_AddNumberToObject(t, "ok", (double)st->ok);
+        cJSON_AddNumberToObject(t, "errors", (double)st->errors);
+        cJSON_AddNumberToObject(t, "timeouts", (double)st->timeouts);
+        cJSON_AddNumberToObject(t, "ok_per_sec", st->ok / secs);
+        cJSON *lat = cJSON_AddObjectToObject(t, "latency_ms");
+        cJSON_AddNumberToObject(lat, "p50", Pct(st, 0.50));
+        cJSON_AddNumberToObject(lat, "p90", Pct(st, 0.90));
+        cJSON_AddNumberToObject(lat, "p99", Pct(st, 0.99));
+        cJSON_AddNumberToObject(lat, "p999", Pct(st, 0.999));
+        cJSON_AddNumberToObject(lat, "max", Pct(st, 1.0));
+    }
+
+    char *s = cJSON_Print(root);
+    cJSON_Delete(root);
+    FILE *f = s ? fopen(s_outfile, "w") : NULL;
+    if (f == NULL) {
+        fprintf(stderr, "lobby-bench: cannot write %s\n", s_outfile);
+    } else {
+        fprintf(f, "%s\n", s);
+        fclose(f);
+        printf("\n  results written to %s\n", s_outfile);
+    }
+    free(s);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Main                                                              */
+/* ------------------------------------------------------------------ */
+
+static void Usage(void)
+{
+    fprintf(stderr,
+            "usage: lobby-bench [-c clients] [-d seconds] [-r connects/s]\n"
+            "                   [-H heartbeat_s] [-t think_ms] "
+            "[-m match_pct]\n"
+            "                   [-o result.json] <server> <port>\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:r:H:t:m:o:")) != -1) {
+        switch (opt) {
+        case 'c': s_nclients     = atoi(optarg); break;
+        case 'd': s_duration_s   = atoi(optarg); break;
+        case 'r': s_connect_rate = atoi(optarg); break;
+        case 'H': s_hb_s         = atoi(optarg); break;
+        case 't': s_think_ms     = atoi(optarg); break;
+        case 'm': s_match_pct    = atoi(optarg); break;
+        case 'o': s_outfile      = optarg;       break;
+        default:  Usage(); return 2;
+        }
+    }
+    if (argc - optind != 2 || s_nclients <= 0 || s_duration_s <= 0 ||
+        s_connect_rate <= 0 || s_hb_s <= 0 || s_think_ms <= 0 ||
+        s_match_pct < 0 || s_match_pct > 100) {
+        Usage();
+        return 2;
+    }
+    const char *host = argv[optind];
+    int port = atoi(argv[optind + 1]);
+
+    struct addrinfo hints = { .ai_family   = AF_INET,
+                              .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+        fprintf(stderr, "lobby-bench: cannot resolve %s\n", host);
+        return 1;
+    }
+    s_addr = *(struct sockaddr_in *)res->ai_addr;
+    s_addr.sin_port = htons((uint16_t)port);
+    freeaddrinfo(res);
+
+    /* One descriptor per client, plus a few. */
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+        rl.rlim_cur < (rlim_t)s_nclients + 16) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    s_clients = calloc((size_t)s_nclients, sizeof(Client));
+    s_ep      = epoll_create1(0);
+    if (s_clients == NULL || s_ep < 0) {
+        fprintf(stderr, "lobby-bench: out of memory\n");
+        return 1;
+    }
+    uint64_t seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    for (int i = 0; i < s_nclients; i++) {
+        Client *c = &s_clients[i];
+        c->fd      = -1;
+        c->room_id = -1;
+        c->pending = OP_NONE;
+        c->rng     = seed + 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1);
+        snprintf(c->name, sizeof(c->name), "bench-%d-%d", (int)getpid(), i);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("lobby-bench: ramping up %d clients at %d/s ...\n",
+           s_nclients, s_connect_rate);
+    fflush(stdout);
+
+    uint64_t started = NowUs();
+    int      next_connect = 0;
+
+    while (!s_stop) {
+        uint64_t now = NowUs();
+
+        /* Ramp up. */
+        uint64_t due = (now - started) * (uint64_t)s_connect_rate / 1000000u
+                     + 1;
+        while (next_connect < s_nclients && (uint64_t)next_connect < due)
+            StartConnect(&s_clients[next_connect++], now);
+
+        /* The run starts once everyone is in (or has given up). */
+        if (s_run_start_us == 0 && next_connect == s_nclients) {
+            int waiting = 0;
+            for (int i = 0; i < s_nclients; i++) {
+                ClientState st = s_clients[i].state;
+                if (st == CS_CONNECTING || st == CS_LOGGING_IN) waiting++;
+            }
+            if (waiting == 0 || now - started > BENCH_LOGIN_WAIT_US +
+                (uint64_t)s_nclients * 1000000u / (uint64_t)s_connect_rate) {
+                s_run_start_us = now;
+                s_run_end_us   = now + (uint64_t)s_duration_s * 1000000u;
+                s_msgs_in = s_bytes_in = s_msgs_out = s_bytes_out = 0;
+                printf("lobby-bench: measuring for %d s ...\n", s_duration_s);
+                fflush(stdout);
+            }
+        }
+        if (s_run_start_us != 0 && now >= s_run_end_us) break;
+
+        struct epoll_event evs[BENCH_EPOLL_BATCH];
+        int n = epoll_wait(s_ep, evs, BENCH_EPOLL_BATCH, BENCH_TICK_MS);
+        now = NowUs();
+        for (int i = 0; i < n; i++) {
+            Client *c = evs[i].data.ptr;
+            if (c->state == CS_CLOSED) continue;
+            if (c->state == CS_CONNECTING) {
+                OnConnected(c, now);
+                continue;
+            }
+            if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                OnReadable(c, now);
+            if (c->state != CS_CLOSED && (evs[i].events & EPOLLOUT)) {
+                Flush(c);
+                if (c->state != CS_CLOSED && c->wlen == 0) WatchWrite(c, 0);
+            }
+        }
+
+        /* Timers. */
+        for (int i = 0; i < s_nclients; i++) {
+            Client *c = &s_clients[i];
+            if (c->state == CS_CONNECTING && now - c->pending_us >
+                BENCH_TIMEOUT_US) {
+                s_connect_failed++;
+                CloseClient(c);
+                continue;
+            }
+            if (c->state != CS_READY && c->state != CS_LOGGING_IN) continue;
+
+            if (c->pending != OP_NONE &&
+                now - c->pending_us > BENCH_TIMEOUT_US) {
+                if (Counted(c->pending, c->pending_us))
+                    s_ops[c->pending].timeouts++;
+                c->pending = OP_NONE;
+            }
+            if (now >= c->next_hb_us) {
+                SendHeartbeat(c, now);
+                c->next_hb_us = now + (uint64_t)s_hb_s * 1000000u;
+            }
+            if (c->state == CS_READY && c->pending == OP_NONE &&
+                now >= c->next_action_us) {
+                NextAction(c, now);
+                c->next_action_us = now + ThinkUs(c);
+            }
+        }
+    }
+
+    uint64_t end = NowUs();
+    if (s_run_start_us == 0) s_run_start_us = end;
+    if (s_run_end_us != 0 && end > s_run_end_us) end = s_run_end_us;
+    double secs = (double)(end - s_run_start_us) / 1e6;
+    if (secs <= 0) secs = 1e-6;
+
+    int connected = 0, logged_in = 0;
+    for (int i = 0; i < s_nclients; i++) {
+        if (s_clients[i].state == CS_READY) logged_in++;
+        if (s_clients[i].state == CS_READY ||
+            s_clients[i].state == CS_LOGGING_IN) connected++;
+    }
+
+    Report(host, port, secs, connected, logged_in);
+
+    for (int i = 0; i < s_nclients; i++) CloseClient(&s_clients[i]);
+    for (int op = 0; op < OP_COUNT; op++) free(s_ops[op].lat_us);
+    free(s_clients);
+    close(s_ep);
+    return 0;
+}
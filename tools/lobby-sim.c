@@ -0,0 +1,705 @@
+/*
+ * lobby-sim.c – Deterministic simulation of a loaded lobby.
+ *
+ * Runs the lobby server core in-process over the simulated network
+ * (server/sim.h): clients are state machines in this program, the
+ * network is in memory and time is virtual, so ten minutes of lobby
+ * with thousands of clients take seconds and the same seed always
+ * gives the same run.  The digest printed at the end covers every
+ * message every client received; two runs with the same options must
+ * print the same one.
+ *
+ * Each client connects at a random moment in the ramp-up, logs in,
+ * heartbeats every -H seconds and, with exponentially distributed
+ * pauses (mean -t ms), lists rooms, joins or creates one, chats in it
+ * and leaves again.  Scenarios add one disturbance:
+ *
+ *   steady   none
+ *   storm    at 1/3 of the run, -f percent of the clients hang: they
+ *            stop sending and reading without closing, until the
+ *            server times them out (heartbeat) or drops them (send
+ *            queue overflow); two minutes later they reconnect
+ *   wave     at 1/2 of the run every client drops its connection and
+ *            reconnects within -w seconds
+ *
+ * Every -i seconds of virtual time a timeline row shows users online,
+ * rooms, messages handled and the real CPU time the server core spent
+ * (Server_Poll), so a storm or wave shows up as it happens.
+ *
+ * Usage:
+ *   lobby-sim [-S steady|storm|wave] [-n clients] [-d seconds]
+ *             [-l latency_ms] [-H heartbeat_s] [-t think_ms]
+ *             [-f storm_pct] [-w wave_s] [-i interval_s] [-s seed] [-v]
+ *
+ * The server logs errors only; -v shows its INFO log as well.
+ *
+ * The simulator links a build of the server with MAX_USERS raised to
+ * LOBBY_SIM_MAX_USERS (CMake); clients beyond it are rejected and
+ * retry, as against a real full server.
+ */
+
+#include "../server/server.h"
+#include "../server/sim.h"
+#include "../server/clock.h"
+#include "../server/log.h"
+#include "../server/metrics.h"
+#include "../server/profiler.h"
+#include "../common/message.h"
+#include "../third_party/cJSON/cJSON.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIM_START_US       (1700000000ull * 1000000u)  /* fixed epoch */
+#define SIM_POLL_MS        1000        /* Server_Run's wait */
+#define SIM_RAMP_MAX_S     60          /* connects spread over this */
+#define SIM_RETRY_MIN_S    2           /* reconnect backoff */
+#define SIM_RETRY_MAX_S    10
+#define SIM_STORM_BACK_S   120         /* hung clients return after */
+#define SIM_KNOWN_ROOMS    8           /* joinable rooms remembered */
+#define SIM_MSG_MAX        256
+
+/* ------------------------------------------------------------------ */
+/*  Clients                                                           */
+/* ------------------------------------------------------------------ */
+
+typedef enum {
+    C_OFFLINE,
+    C_LOGIN,                           /* login sent */
+    C_LOBBY,
+    C_ROOM
+} ClientState;
+
+typedef struct {
+    int         sim;                   /* Sim client id, -1 if offline */
+    ClientState state;
+    int         pending;               /* control request in flight */
+    int         hung;                  /* storm: neither sends nor reads */
+    uint32_t    rng;
+    uint32_t    chats;
+    uint64_t    next_conn_us;          /* UINT64_MAX = not scheduled */
+    uint64_t    next_hb_us;
+    uint64_t    next_act_us;
+    uint64_t    armed_us;              /* due time in the timer heap */
+    int         rooms[SIM_KNOWN_ROOMS];
+    int         nrooms;
+} Client;
+
+typedef struct {
+    uint64_t at_us;
+    uint32_t client;
+} Timer;
+
+static Server   s_srv;
+static Client  *s_clients;
+static uint32_t *s_owner;              /* Sim client id -> client */
+static uint32_t s_owner_cap;
+static Timer   *s_heap;
+static uint32_t s_heap_len;
+static uint32_t s_heap_cap;
+
+/* Options */
+static const char *s_scenario = "steady";
+static int      s_nclients   = 1000;
+static int      s_duration_s = 600;
+static int      s_latency_ms = 20;
+static int      s_hb_s       = 15;
+static int      s_think_ms   = 5000;
+static int      s_storm_pct  = 50;
+static int      s_wave_s     = 1;
+static int      s_interval_s = 0;            /* 0 = duration / 20 */
+static uint32_t s_seed       = 1;
+static int      s_verbose;
+
+/* Results */
+static uint64_t s_digest = 14695981039346656037ull;   /* FNV-1a */
+static uint64_t s_logins;
+static uint64_t s_login_fails;
+static uint64_t s_rejected;                  /* closed before login_ok */
+static uint64_t s_dropped;                   /* closed by the server */
+static uint64_t s_chats_sent;
+static uint64_t s_msgs_recv;
+static uint64_t s_poll_calls;
+static uint64_t s_poll_ns;
+
+/* ------------------------------------------------------------------ */
+/*  Helpers                                                           */
+/* ------------------------------------------------------------------ */
+
+static uint32_t Rand(Client *c)
+{
+    /* xorshift32 */
+    c->rng ^= c->rng << 13;
+    c->rng ^= c->rng >> 17;
+    c->rng ^= c->rng << 5;
+    return c->rng;
+}
+
+static double RandUnit(Client *c)
+{
+    return (Rand(c) >> 8) / 16777216.0;
+}
+
+static uint64_t RandRange(Client *c, uint64_t lo_us, uint64_t hi_us)
+{
+    return lo_us + (uint64_t)(RandUnit(c) * (double)(hi_us - lo_us));
+}
+
+static uint64_t Think(Client *c)
+{
+    double u = RandUnit(c);
+    return (uint64_t)(-log(1.0 - u) * s_think_ms * 1000.0) + 1;
+}
+
+static void Digest(int client, const char *data, uint32_t len)
+{
+    uint64_t h = s_digest;
+    for (int i = 0; i < 4; i++) {
+        h ^= (uint8_t)(client >> (8 * i));
+        h *= 1099511628211ull;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= (uint8_t)data[i];
+        h *= 1099511628211ull;
+    }
+    s_digest = h;
+}
+
+static int OnlineUsers(void)
+{
+    int n = 0;
+    for (int i = 0; i < MAX_USERS; i++)
+        if (s_srv.users[i].fd != -1 && s_srv.users[i].username[0]) n++;
+    return n;
+}
+
+static int ActiveRooms(void)
+{
+    int n = 0;
+    for (int i = 0; i < MAX_ROOMS; i++)
+        if (s_srv.rooms[i].id != 0) n++;
+    return n;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Timer heap (one live entry per client; stale ones are skipped)    */
+/* ------------------------------------------------------------------ */
+
+static int TimerLess(const Timer *a, const Timer *b)
+{
+    return a->at_us < b->at_us ||
+           (a->at_us == b->at_us && a->client < b->client);
+}
+
+static void TimerPush(uint64_t at_us, uint32_t client)
+{
+    if (s_heap_len == s_heap_cap) {
+        s_heap_cap = s_heap_cap ? s_heap_cap * 2 : 1024;
+        s_heap = (Timer *)realloc(s_heap, s_heap_cap * sizeof(Timer));
+        if (s_heap == NULL) abort();
+    }
+    uint32_t i = s_heap_len++;
+    s_heap[i].at_us  = at_us;
+    s_heap[i].client = client;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!TimerLess(&s_heap[i], &s_heap[parent])) break;
+        Timer t = s_heap[i]; s_heap[i] = s_heap[parent]; s_heap[parent] = t;
+        i = parent;
+    }
+}
+
+static void TimerPop(void)
+{
+    s_heap[0] = s_heap[--s_heap_len];
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < s_heap_len && TimerLess(&s_heap[l], &s_heap[m])) m = l;
+        if (r < s_heap_len && TimerLess(&s_heap[r], &s_heap[m])) m = r;
+        if (m == i) break;
+        Timer t = s_heap[i]; s_heap[i] = s_heap[m]; s_heap[m] = t;
+        i = m;
+    }
+}
+
+/* Earliest live timer, dropping stale entries on the way. */
+static uint64_t TimerNext(void)
+{
+    while (s_heap_len > 0 &&
+           s_heap[0].at_us != s_clients[s_heap[0].client].armed_us)
+        TimerPop();
+    return s_heap_len > 0 ? s_heap[0].at_us : UINT64_MAX;
+}
+
+static void Rearm(uint32_t idx)
+{
+    Client  *c   = &s_clients[idx];
+    uint64_t due = c->next_conn_us;
+    if (c->state == C_LOBBY || c->state == C_ROOM) {
+        if (c->next_hb_us  < due) due = c->next_hb_us;
+        if (c->next_act_us < due) due = c->next_act_us;
+    }
+    if (due == c->armed_us) return;
+    c->armed_us = due;
+    if (due != UINT64_MAX) TimerPush(due, idx);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Client behaviour                                                  */
+/* ------------------------------------------------------------------ */
+
+static void Send(uint32_t idx, const char *json)
+{
+    Client *c = &s_clients[idx];
+    if (c->sim >= 0 && !c->hung) Sim_Send(c->sim, json);
+}
+
+static void Connect(uint32_t idx)
+{
+    Client *c = &s_clients[idx];
+    char ip[MAX_IP_STR], msg[SIM_MSG_MAX];
+
+    snprintf(ip, sizeof(ip), "10.%u.%u.%u", (idx >> 16) & 0xFF,
+             (idx >> 8) & 0xFF, idx & 0xFF);
+    c->sim          = Sim_Connect(ip);
+    if ((uint32_t)c->sim >= s_owner_cap) {
+        s_owner_cap = s_owner_cap ? s_owner_cap * 2 : 4096;
+        s_owner = (uint32_t *)realloc(s_owner, s_owner_cap * sizeof(uint32_t));
+        if (s_owner == NULL) abort();
+    }
+    s_owner[c->sim] = idx;
+    c->state        = C_LOGIN;
+    c->pending      = 0;
+    c->nrooms       = 0;
+    c->next_conn_us = UINT64_MAX;
+
+    snprintf(msg, sizeof(msg),
+             "{\"type\":\"login\",\"username\":\"sim%06u\"}", idx);
+    Send(idx, msg);
+}
+
+/* Connection gone: try again after a backoff (or at `at_us`). */
+static void GoOffline(uint32_t idx, uint64_t at_us)
+{
+    Client *c = &s_clients[idx];
+    if (c->sim >= 0) Sim_Close(c->sim);
+    c->sim          = -1;
+    c->state        = C_OFFLINE;
+    c->hung         = 0;
+    c->next_conn_us = at_us;
+    if (at_us == 0) {
+        uint64_t now = Sim_NowUs();
+        c->next_conn_us = RandRange(c, now + SIM_RETRY_MIN_S * 1000000ull,
+                                    now + SIM_RETRY_MAX_S * 1000000ull);
+    }
+    Rearm(idx);
+}
+
+static void Act(uint32_t idx)
+{
+    Client *c = &s_clients[idx];
+    char msg[SIM_MSG_MAX];
+
+    if (c->pending) return;
+
+    if (c->state == C_LOBBY) {
+        uint32_t r = Rand(c) % 100;
+        if (c->nrooms > 0 && r < 70) {
+            snprintf(msg, sizeof(msg), "{\"type\":\"room_join\","
+                     "\"room_id\":%d}", c->rooms[Rand(c) % c->nrooms]);
+        } else if (c->nrooms == 0 && r < 30) {
+            snprintf(msg, sizeof(msg), "{\"type\":\"room_create\","
+                     "\"name\":\"sim room %u\",\"max_players\":8}", idx);
+        } else {
+            snprintf(msg, sizeof(msg), "{\"type\":\"room_list\"}");
+        }
+        c->pending = 1;
+        Send(idx, msg);
+    } else if (c->state == C_ROOM) {
+        uint32_t r = Rand(c) % 100;
+        if (r < 80) {
+            snprintf(msg, sizeof(msg), "{\"type\":\"chat\","
+                     "\"message\":\"line %u from sim%06u\"}", ++c->chats, idx);
+            s_chats_sent++;
+        } else {
+            snprintf(msg, sizeof(msg), "{\"type\":\"room_leave\"}");
+            c->pending = 1;
+        }
+        Send(idx, msg);
+    }
+}
+
+static void OnTimer(uint32_t idx)
+{
+    Client  *c   = &s_clients[idx];
+    uint64_t now = Sim_NowUs();
+
+    if (c->state == C_OFFLINE) {
+        if (c->next_conn_us <= now) Connect(idx);
+        Rearm(idx);
+        return;
+    }
+    if (c->next_hb_us <= now) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "{\"type\":\"heartbeat\",\"ts\":%llu}",
+                 (unsigned long long)(now / 1000u));
+        Send(idx, msg);
+        c->next_hb_us = now + (uint64_t)s_hb_s * 1000000u;
+    }
+    if (c->next_act_us <= now) {
+        Act(idx);
+        c->next_act_us = now + Think(c);
+    }
+    Rearm(idx);
+}
+
+static void RememberRooms(Client *c, const cJSON *root)
+{
+    const cJSON *rooms = cJSON_GetObjectItem(root, "rooms");
+    const cJSON *room;
+
+    c->nrooms = 0;
+    cJSON_ArrayForEach(room, rooms) {
+        const cJSON *id  = cJSON_GetObjectItem(room, "id");
+        const cJSON *pl  = cJSON_GetObjectItem(room, "players");
+        const cJSON *max = cJSON_GetObjectItem(room, "max");
+        if (!cJSON_IsNumber(id) || !cJSON_IsNumber(pl) ||
+            !cJSON_IsNumber(max) || pl->valueint >= max->valueint)
+            continue;
+        if (c->nrooms < SIM_KNOWN_ROOMS) {
+            c->rooms[c->nrooms++] = id->valueint;
+        } else {
+            c->rooms[Rand(c) % SIM_KNOWN_ROOMS] = id->valueint;
+        }
+    }
+}
+
+static void OnMessage(uint32_t idx, const char *json, uint32_t len)
+{
+    Client  *c   = &s_clients[idx];
+    uint64_t now = Sim_NowUs();
+
+    s_msgs_recv++;
+    Digest((int)idx, json, len);
+
+    cJSON *root = cJSON_ParseWithLength(json, len);
+    const cJSON *type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(type)) {
+        cJSON_Delete(root);
+        return;
+    }
+    const char *t = type->valuestring;
+
+    if (strcmp(t, MSG_LOGIN_OK) == 0) {
+        s_logins++;
+        c->state       = C_LOBBY;
+        c->next_hb_us  = now + RandRange(c, 1, (uint64_t)s_hb_s * 1000000u);
+        c->next_act_us = now + Think(c);
+    } else if (strcmp(t, MSG_LOGIN_FAIL) == 0) {
+        s_login_fails++;
+        GoOffline(idx, 0);
+    } else if (strcmp(t, MSG_ROOM_LIST_RES) == 0) {
+        RememberRooms(c, root);
+        c->pending = 0;
+    } else if (strcmp(t, MSG_ROOM_CREATED) == 0 ||
+               strcmp(t, MSG_ROOM_JOINED) == 0) {
+        c->state   = C_ROOM;
+        c->pending = 0;
+    } else if (strcmp(t, MSG_ROOM_LEFT) == 0) {
+        c->state   = C_LOBBY;
+        c->nrooms  = 0;
+        c->pending = 0;
+    } else if (strcmp(t, MSG_ERROR) == 0) {
+        /* room full or gone: look again */
+        c->nrooms  = 0;
+        c->pending = 0;
+    }
+    cJSON_Delete(root);
+    Rearm(idx);
+}
+
+static void ReadAll(void)
+{
+    int sim;
+    while ((sim = Sim_NextReadable()) >= 0) {
+        uint32_t idx = s_owner[sim];
+        Client  *c   = &s_clients[idx];
+        if (c->sim != sim || c->hung) continue;
+
+        const char *json;
+        uint32_t    len;
+        int         rc;
+        while ((rc = Sim_Recv(sim, &json, &len)) > 0) {
+            OnMessage(idx, json, len);
+            if (c->sim != sim) break;       /* gave up on this one */
+        }
+        if (rc < 0 && c->sim == sim) {
+            if (c->state == C_LOGIN) s_rejected++;
+            else                     s_dropped++;
+            c->sim = -1;                    /* already closed */
+            GoOffline(idx, 0);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Scenarios                                                         */
+/* ------------------------------------------------------------------ */
+
+static uint64_t s_event_us = UINT64_MAX;    /* scenario disturbance */
+static int      s_event_done;
+static int      s_hung_left;                /* storm: still on server */
+static uint64_t s_recover_us;               /* event → back to normal */
+static int      s_online_before;
+static int      s_returned;                 /* storm: hung clients back */
+
+static void StartStorm(void)
+{
+    s_hung_left = 0;
+    for (int i = 0; i < s_nclients; i++) {
+        Client *c = &s_clients[i];
+        if (c->state != C_LOBBY && c->state != C_ROOM) continue;
+        if (Rand(c) % 100 >= (uint32_t)s_storm_pct) continue;
+        c->hung = 1;
+        s_hung_left++;
+    }
+    printf("  -- storm: %d clients hang\n", s_hung_left);
+}
+
+static void StartWave(void)
+{
+    uint64_t now = Sim_NowUs();
+    for (int i = 0; i < s_nclients; i++) {
+        Client *c = &s_clients[i];
+        GoOffline((uint32_t)i,
+                  RandRange(c, now, now + (uint64_t)s_wave_s * 1000000u) + 1);
+    }
+    printf("  -- wave: %d clients reconnect within %d s\n",
+           s_nclients, s_wave_s);
+}
+
+/* Once a virtual second: has the lobby recovered from the event? */
+static void CheckRecovery(void)
+{
+    if (!s_event_done || s_recover_us != 0 || s_returned) return;
+    uint64_t now = Sim_NowUs();
+
+    if (strcmp(s_scenario, "storm") == 0) {
+        /* Hung sessions still holding a slot on the server. */
+        int left = 0;
+        char name[MAX_USERNAME];
+        for (int i = 0; i < s_nclients; i++) {
+            if (!s_clients[i].hung) continue;
+            snprintf(name, sizeof(name), "sim%06d", i);
+            if (Users_FindByName(name)) left++;
+        }
+        s_hung_left = left;
+        if (left == 0) s_recover_us = now - s_event_us;
+    } else if (OnlineUsers() >= s_online_before) {
+        s_recover_us = now - s_event_us;
+    }
+}
+
+/* Storm: hung clients give up and reconnect. */
+static void ReturnHung(void)
+{
+    for (int i = 0; i < s_nclients; i++) {
+        if (s_clients[i].hung) GoOffline((uint32_t)i, 0);
+    }
+    s_returned = 1;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Main                                                              */
+/* ------------------------------------------------------------------ */
+
+static void Usage(void)
+{
+    fprintf(stderr,
+            "usage: lobby-sim [-S steady|storm|wave] [-n clients] "
+            "[-d seconds]\n"
+            "                 [-l latency_ms] [-H heartbeat_s] "
+            "[-t think_ms]\n"
+            "                 [-f storm_pct] [-w wave_s] [-i interval_s] "
+            "[-s seed] [-v]\n");
+}
+
+static void PrintRow(uint64_t t_s, uint64_t msgs, uint64_t poll_ns,
+                     uint64_t polls)
+{
+    printf("  %6llu %8d %6d %10llu %10.1f %9llu\n",
+           (unsigned long long)t_s, OnlineUsers(), ActiveRooms(),
+           (unsigned long long)msgs, (double)poll_ns / 1e6,
+           (unsigned long long)polls);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "S:n:d:l:H:t:f:w:i:s:v")) != -1) {
+        switch (opt) {
+        case 'S': s_scenario   = optarg;                  break;
+        case 'n': s_nclients   = atoi(optarg);            break;
+        case 'd': s_duration_s = atoi(optarg);            break;
+        case 'l': s_latency_ms = atoi(optarg);            break;
+        case 'H': s_hb_s       = atoi(optarg);            break;
+        case 't': s_think_ms   = atoi(optarg);            break;
+        case 'f': s_storm_pct  = atoi(optarg);            break;
+        case 'w': s_wave_s     = atoi(optarg);            break;
+        case 'i': s_interval_s = atoi(optarg);            break;
+        case 's': s_seed       = (uint32_t)strtoul(optarg, NULL, 10); break;
+        case 'v': s_verbose    = 1;                       break;
+        default:  Usage(); return 2;
+        }
+    }
+    int storm = strcmp(s_scenario, "storm") == 0;
+    int wave  = strcmp(s_scenario, "wave") == 0;
+    if (optind != argc || s_nclients <= 0 || s_duration_s <= 0 ||
+        s_latency_ms < 0 || s_hb_s <= 0 || s_think_ms <= 0 ||
+        s_storm_pct < 0 || s_storm_pct > 100 || s_wave_s <= 0 ||
+        s_interval_s < 0 ||
+        (!storm && !wave && strcmp(s_scenario, "steady") != 0)) {
+        Usage();
+        return 2;
+    }
+    if (s_interval_s == 0)
+        s_interval_s = s_duration_s >= 20 ? s_duration_s / 20 : 1;
+
+    /* Virtual clock first: log timestamps follow it. */
+    static Transport sim;
+    Sim_Init(&sim, SIM_START_US, (uint32_t)s_latency_ms * 1000u);
+    Log_Init(s_verbose ? LOG_LEVEL_INFO : LOG_LEVEL_ERROR);
+
+    Server_InitTransport(&s_srv, &sim);
+    /* Real-time stall reports say nothing about virtual time. */
+    Profiler_Init(60000);
+
+    s_clients = (Client *)calloc((size_t)s_nclients, sizeof(Client));
+    if (s_clients == NULL) return 1;
+
+    uint64_t start = Sim_NowUs();
+    uint64_t ramp  = (uint64_t)(s_duration_s / 4 < SIM_RAMP_MAX_S
+                                ? s_duration_s / 4 : SIM_RAMP_MAX_S);
+    for (int i = 0; i < s_nclients; i++) {
+        Client *c   = &s_clients[i];
+        c->sim      = -1;
+        c->rng      = (s_seed * 2654435761u) ^ ((uint32_t)i * 0x9E3779B9u);
+        if (c->rng == 0) c->rng = 1;
+        c->armed_us = UINT64_MAX;
+        GoOffline((uint32_t)i, start + RandRange(c, 0, ramp * 1000000u + 1));
+    }
+
+    uint64_t end_us = start + (uint64_t)s_duration_s * 1000000u;
+    if (storm) s_event_us = start + (uint64_t)s_duration_s * 1000000u / 3;
+    if (wave)  s_event_us = start + (uint64_t)s_duration_s * 1000000u / 2;
+    uint64_t return_us = storm ? s_event_us + SIM_STORM_BACK_S * 1000000ull
+                               : UINT64_MAX;
+
+    printf("lobby-sim: %s, %d clients, %d s, %d ms latency, "
+           "%d server slots, seed %u\n\n",
+           s_scenario, s_nclients, s_duration_s, s_latency_ms,
+           MAX_USERS, s_seed);
+    printf("  %6s %8s %6s %10s %10s %9s\n",
+           "t(s)", "online", "rooms", "msgs", "cpu(ms)", "polls");
+
+    uint64_t wall0     = Clock_NowNs();
+    uint64_t second_us = start + 1000000u;
+    uint64_t row_us    = start + (uint64_t)s_interval_s * 1000000u;
+    uint64_t row_msgs = 0, row_ns = 0, row_polls = 0;
+
+    while (Sim_NowUs() < end_us) {
+        uint64_t wake = TimerNext();
+        if (second_us < wake) wake = second_us;
+        if (row_us    < wake) wake = row_us;
+        if (return_us < wake) wake = return_us;
+        if (!s_event_done && s_event_us < wake) wake = s_event_us;
+        Sim_WakeAt(wake);
+
+        uint64_t t0 = Clock_NowNs();
+        Server_Poll(&s_srv, SIM_POLL_MS);
+        s_poll_ns += Clock_NowNs() - t0;
+        s_poll_calls++;
+
+        ReadAll();
+
+        uint64_t now = Sim_NowUs();
+        while (TimerNext() <= now) {
+            uint32_t idx = s_heap[0].client;
+            TimerPop();
+            s_clients[idx].armed_us = UINT64_MAX;
+            OnTimer(idx);
+        }
+
+        if (now >= s_event_us && !s_event_done) {
+            s_online_before = OnlineUsers();
+            if (storm) StartStorm();
+            else       StartWave();
+            s_event_done = 1;
+        }
+        if (now >= return_us) {
+            ReturnHung();
+            return_us = UINT64_MAX;
+        }
+        if (now >= second_us) {
+            CheckRecovery();
+            second_us += 1000000u;
+        }
+        if (now >= row_us) {
+            PrintRow((row_us - start) / 1000000u, s_srv.msgs_in - row_msgs,
+                     s_poll_ns - row_ns, s_poll_calls - row_polls);
+            row_msgs  = s_srv.msgs_in;
+            row_ns    = s_poll_ns;
+            row_polls = s_poll_calls;
+            row_us   += (uint64_t)s_interval_s * 1000000u;
+        }
+    }
+    double wall_s = (double)(Clock_NowNs() - wall0) / 1e9;
+
+    SimStats st;
+    Sim_GetStats(&st);
+
+    printf("\n  virtual %d s in %.2f s real (%.0fx)\n", s_duration_s, wall_s,
+           wall_s > 0 ? s_duration_s / wall_s : 0.0);
+    printf("  server core:  %llu polls, %.1f ms CPU, %llu messages "
+           "handled\n",
+           (unsigned long long)s_poll_calls, (double)s_poll_ns / 1e6,
+           (unsigned long long)s_srv.msgs_in);
+    printf("  clients:      %llu logins, %llu rejected, %llu login_fail, "
+           "%llu dropped, %llu chats sent, %llu messages received\n",
+           (unsigned long long)s_logins, (unsigned long long)s_rejected,
+           (unsigned long long)s_login_fails, (unsigned long long)s_dropped,
+           (unsigned long long)s_chats_sent, (unsigned long long)s_msgs_recv);
+    printf("  network:      %llu connects, %llu B up, %llu B down, "
+           "%llu window stalls\n",
+           (unsigned long long)st.connects, (unsigned long long)st.bytes_up,
+           (unsigned long long)st.bytes_down,
+           (unsigned long long)st.window_full);
+    if (s_event_done) {
+        if (s_recover_us != 0) {
+            char label[16];
+            snprintf(label, sizeof(label), "%s:", s_scenario);
+            printf("  %-14srecovered after %llu s\n", label,
+                   (unsigned long long)(s_recover_us / 1000000u));
+        } else if (storm) {
+            printf("  storm:        %d hung sessions still on the server\n",
+                   s_hung_left);
+        } else {
+            printf("  wave:         not recovered (%d of %d online)\n",
+                   OnlineUsers(), s_online_before);
+        }
+    }
+    printf("  digest:       %016llx\n", (unsigned long long)s_digest);
+
+    Server_Shutdown(&s_srv);
+    Log_Shutdown();
+    Sim_Shutdown();
+    free(s_clients);
+    free(s_heap);
+    free(s_owner);
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * lobby-top.c – Live view of a running lobby server.
+ *
+ * Maps the server's shared stats page (common/statpage.h) read-only and
+ * redraws it once a second.  Reading the page is a memory copy: the
+ * server is never asked for anything and cannot tell it is watched.
+ *
+ * Usage:
+ *   lobby-top [-1] [port]
+ *
+ * port defaults to DEFAULT_SERVER_PORT; -1 prints one snapshot and
+ * exits (for scripts and cron).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../common/statpage.h"
+#include "../common/protocol.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TOP_REFRESH_MS  1000
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void OnSignal(int sig)
+{
+    (void)sig;
+    s_stop = 1;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Formatting                                                        */
+/* ------------------------------------------------------------------ */
+
+/* Human-readable byte count: "512 B", "3.2 KiB", "1.0 MiB". */
+static const char *Bytes(char *buf, size_t len, uint64_t n)
+{
+    if (n < 1024)
+        snprintf(buf, len, "%llu B", (unsigned long long)n);
+    else if (n < 1024 * 1024)
+        snprintf(buf, len, "%.1f KiB", n / 1024.0);
+    else if (n < 1024ull * 1024 * 1024)
+        snprintf(buf, len, "%.1f MiB", n / (1024.0 * 1024));
+    else
+        snprintf(buf, len, "%.1f GiB", n / (1024.0 * 1024 * 1024));
+    return buf;
+}
+
+static double Us(uint64_t ns)
+{
+    return ns / 1000.0;
+}
+
+static void Print(const StatPage *p, int port)
+{
+    char a[32], b[32], c[32], d[32];
+    uint64_t now_ms = (uint64_t)time(NULL) * 1000u;
+    uint64_t up = p->updated_unix_ms / 1000u > p->started_unix
+                ? p->updated_unix_ms / 1000u - p->started_unix : 0;
+    uint64_t age_ms = now_ms > p->updated_unix_ms
+                    ? now_ms - p->updated_unix_ms : 0;
+
+    printf("war3-lobby-server :%d  pid %llu  up %lluh%02llum%02llus",
+           port, (unsigned long long)p->pid,
+           (unsigned long long)(up / 3600),
+           (unsigned long long)(up / 60 % 60),
+           (unsigned long long)(up % 60));
+    /* Whole seconds on our side, so only complain past a few. */
+    if (age_ms > 3000)
+        printf("  (stale: %llus)", (unsigned long long)(age_ms / 1000));
+    printf("\n\n");
+
+    printf("  connections %-6llu users %-6llu rooms %-6llu in rooms %llu\n",
+           (unsigned long long)p->connections,
+           (unsigned long long)p->users,
+           (unsigned long long)p->rooms,
+           (unsigned long long)p->room_members);
+    printf("\n");
+
+    printf("  traffic     %llu msg/s in, %s/s in, %s/s out\n",
+           (unsigned long long)p->msgs_in_per_sec,
+           Bytes(a, sizeof(a), p->bytes_in_per_sec),
+           Bytes(b, sizeof(b), p->bytes_out_per_sec));
+    printf("  totals      %llu msgs, %s in, %s out\n",
+           (unsigned long long)p->msgs_in_total,
+           Bytes(c, sizeof(c), p->bytes_in_total),
+           Bytes(d, sizeof(d), p->bytes_out_total));
+    printf("\n");
+
+    printf("  loop        %llu/s  p50 %.1f us  p90 %.1f us  "
+           "p99 %.1f us  max %.1f us\n",
+           (unsigned long long)p->loop_per_sec,
+           Us(p->loop_p50_ns), Us(p->loop_p90_ns),
+           Us(p->loop_p99_ns), Us(p->loop_max_ns));
+    printf("  stalls      %llu\n", (unsigned long long)p->loop_stalls_total);
+    printf("\n");
+
+    printf("  send queues %llu frames, %s  (deepest %llu frames, %s)\n",
+           (unsigned long long)p->sendq_frames,
+           Bytes(a, sizeof(a), p->sendq_bytes),
+           (unsigned long long)p->sendq_frames_max,
+           Bytes(b, sizeof(b), p->sendq_bytes_max));
+    printf("  log dropped %llu\n", (unsigned long long)p->log_dropped_total);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Main                                                              */
+/* ------------------------------------------------------------------ */
+
+int main(int argc, char *argv[])
+{
+    int port = DEFAULT_SERVER_PORT;
+    int once = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-1") == 0) {
+            once = 1;
+        } else {
+            port = atoi(argv[i]);
+            if (port <= 0 || port > 65535) {
+                fprintf(stderr, "usage: lobby-top [-1] [port]\n");
+                return 2;
+            }
+        }
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), STATPAGE_NAME_FMT, port);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "lobby-top: no stats page /dev/shm%s "
+                        "(is the server on port %d running?)\n", name, port);
+        return 1;
+    }
+    const StatPage *page = mmap(NULL, sizeof(StatPage), PROT_READ,
+                                MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        fprintf(stderr, "lobby-top: cannot map /dev/shm%s\n", name);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int rc = 0;
+    while (!s_stop) {
+        StatPage snap;
+        if (Statpage_Read(page, &snap) != 0) {
+            fprintf(stderr, "lobby-top: /dev/shm%s is not a version %d "
+                            "stats page\n", name, STATPAGE_VERSION);
+            rc = 1;
+            break;
+        }
+
+        if (!once) printf("\033[H\033[2J");
+        Print(&snap, port);
+        fflush(stdout);
+        if (once) break;
+
+        struct timespec ts = { TOP_REFRESH_MS / 1000,
+                               (TOP_REFRESH_MS % 1000) * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+
+    munmap((void *)page, sizeof(StatPage));
+    return rc;
+}